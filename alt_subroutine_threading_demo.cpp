@@ -4,6 +4,8 @@
 #include <map>
 #include <string>
 
+#include "tape.hpp"
+
 #define DEBUG 0
 #define break_if( E ) if ( E ) break
 #define return_if( E ) if ( E ) return
@@ -71,13 +73,13 @@ typedef unsigned char num;
 class Engine {
     std::map<char, OpCode> opcode_map;
     std::vector<Instruction> program;
-    std::vector<num> memory;
+    Tape memory;
     Instruction * program_data = nullptr;
     num * loc = nullptr;
 
 public:
-    Engine() : 
-        memory( 30000 )
+    Engine( const TapeOptions & tape = TapeOptions() ) : 
+        memory( tape.size, tape.max_size )
     {}
 
 public:
@@ -142,17 +144,15 @@ public:
         return pc;
     }
 
+    //  Stops the dispatch loop, so the engine can go on to another run.
     Instruction * HALT( Instruction * pc ) {
         if ( DEBUG ) std::cout << "DONE!";
-        exit( EXIT_SUCCESS );
-        return pc;
+        std::cout.flush();
+        return nullptr;
     }
 
-    void runFile( std::string_view filename, bool header_needed ) {
-        if ( header_needed ) {
-            std::cerr << "# Executing: " << filename << std::endl;
-        }
-
+    //  Plants a program, replacing any planted before.
+    void compile( std::string_view filename ) {
         opcode_map = {
             { '+', &Engine::INCR },
             { '-', &Engine::DECR },
@@ -165,27 +165,52 @@ public:
             { '\0', &Engine::HALT }
         };
         
+        program.clear();
         CodePlanter planter( filename, opcode_map, program );
         planter.plantProgram();
+    }
 
+    //  Runs the planted program from a clear tape.
+    void execute() {
+        memory.clear();
         std::noskipws( std::cin );
 
         this->program_data = program.data();
         Instruction * pc = &program_data[0];
         loc = &memory.data()[0];
         
-        for (;;) {
+        while ( pc != nullptr ) {
             OpCode s = pc++->opcode;
             pc = (this->*s)( pc );
         }
     }
+
+    void runFile( std::string_view filename, bool header_needed ) {
+        if ( header_needed ) {
+            std::cerr << "# Executing: " << filename << std::endl;
+        }
+        compile( filename );
+        execute();
+    }
 };
 
+//  The benchmarking harness includes this file and supplies its own main.
+#ifndef ALT_SUBROUTINE_THREADING_DEMO_NO_MAIN
+
 int main( int argc, char * argv[] ) {
     const std::vector<std::string_view> args(argv + 1, argv + argc);
+    std::vector<std::string_view> filenames;
+    TapeOptions tape;
     for (auto arg : args) {
-        Engine engine;
-        engine.runFile( arg, args.size() > 1 );
+        if ( not tape.tryParse( arg ) ) {
+            filenames.push_back( arg );
+        }
+    }
+    for (auto filename : filenames) {
+        Engine engine( tape );
+        engine.runFile( filename, filenames.size() > 1 );
     }
     exit( EXIT_SUCCESS );
 }
+
+#endif
@@ -0,0 +1,172 @@
+/*
+Running many independent jobs at once, for the batch modes of the engines.
+
+A Pool runs a numbered set of tasks across a fixed number of threads. The
+tasks are dealt out in contiguous blocks, one per worker, and each worker
+works through its own block from the front. A worker that runs out steals
+from the back of another's block, which is the work its owner would get
+to last. No tasks are added once a run has started, so a worker that
+finds every block empty is done.
+
+The tasks are told which worker they are running on, so they can keep
+per-worker state - an engine and its tape - in a table indexed by it,
+without any locking.
+
+A manifest lists the jobs of a batch, one per line:
+    program.bf [input-file]
+Blank lines and lines starting with # are ignored. A job without an input
+file reads an empty input.
+*/
+
+#ifndef BATCH_HPP
+#define BATCH_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <istream>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace batch {
+
+class Pool {
+    size_t workers;
+
+    //  The tasks a worker still has to do.
+    struct Queue {
+        std::mutex lock;
+        std::deque<size_t> tasks;
+    };
+
+public:
+    explicit Pool( size_t workers = std::thread::hardware_concurrency() ) :
+        workers( std::max<size_t>( workers, 1 ) )
+    {}
+
+public:
+    size_t size() const {
+        return workers;
+    }
+
+    //  Calls task( worker, index ) once for every index in [0, count) and
+    //  returns when all have finished. If a task throws, the remaining
+    //  tasks are abandoned and the first exception is rethrown here.
+    template <typename Task>
+    void run( size_t count, Task task ) const {
+        const size_t n = std::min( workers, count );
+        if ( n <= 1 ) {
+            for ( size_t i = 0; i < count; i++ ) {
+                task( 0, i );
+            }
+            return;
+        }
+
+        std::vector<Queue> queues( n );
+        for ( size_t w = 0; w < n; w++ ) {
+            for ( size_t i = w * count / n; i < ( w + 1 ) * count / n; i++ ) {
+                queues[ w ].tasks.push_back( i );
+            }
+        }
+
+        std::mutex failure_lock;
+        std::exception_ptr failure;
+        auto work = [&]( size_t w ) {
+            try {
+                while ( auto i = next( queues, w ) ) {
+                    task( w, *i );
+                }
+            } catch ( ... ) {
+                std::lock_guard<std::mutex> guard( failure_lock );
+                if ( not failure ) {
+                    failure = std::current_exception();
+                }
+                for ( auto & q : queues ) {
+                    std::lock_guard<std::mutex> abandon( q.lock );
+                    q.tasks.clear();
+                }
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for ( size_t w = 1; w < n; w++ ) {
+            threads.emplace_back( work, w );
+        }
+        work( 0 );
+        for ( auto & t : threads ) {
+            t.join();
+        }
+        if ( failure ) {
+            std::rethrow_exception( failure );
+        }
+    }
+
+private:
+    //  The next task for worker w: its own if it has any, else one stolen
+    //  from the others in turn.
+    static std::optional<size_t> next( std::vector<Queue> & queues, size_t w ) {
+        {
+            Queue & own = queues[ w ];
+            std::lock_guard<std::mutex> guard( own.lock );
+            if ( not own.tasks.empty() ) {
+                const size_t i = own.tasks.front();
+                own.tasks.pop_front();
+                return i;
+            }
+        }
+        for ( size_t k = 1; k < queues.size(); k++ ) {
+            Queue & victim = queues[ ( w + k ) % queues.size() ];
+            std::lock_guard<std::mutex> guard( victim.lock );
+            if ( not victim.tasks.empty() ) {
+                const size_t i = victim.tasks.back();
+                victim.tasks.pop_back();
+                return i;
+            }
+        }
+        return std::nullopt;
+    }
+};
+
+//  A single line of a manifest.
+struct Job {
+    std::string program;
+    std::string input;                  //  The name of the input file, or empty.
+};
+
+inline std::vector<Job> readManifest( std::istream & manifest ) {
+    std::vector<Job> jobs;
+    std::string line;
+    while ( std::getline( manifest, line ) ) {
+        std::istringstream fields( line );
+        Job job;
+        if ( not ( fields >> job.program ) || job.program[ 0 ] == '#' ) {
+            continue;
+        }
+        fields >> job.input;
+        std::string extra;
+        if ( fields >> extra ) {
+            throw std::runtime_error( "Unexpected text in manifest: " + line );
+        }
+        jobs.push_back( job );
+    }
+    return jobs;
+}
+
+inline std::vector<Job> readManifest( const std::string & filename ) {
+    std::ifstream manifest( filename );
+    if ( not manifest ) {
+        throw std::runtime_error( "Cannot open manifest: " + filename );
+    }
+    return readManifest( manifest );
+}
+
+} // namespace batch
+
+#endif
@@ -0,0 +1,397 @@
+/*
+Measures the two ways of getting rid of calls in Brainforth programs, and
+the cost of passing tokens between the tools as JSON.
+
+    Brainforth_Trace        the tracing tier of brainforth_runner.cpp, which
+                            records the hot loops and words of a program
+                            into traces with the calls inlined, on and off
+    Brainforth_Inline       brainforth_compiler.cpp inlining small words as
+                            it compiles, on and off, without tracing
+    Brainforth_Pipeline     compiling a large source with the tokens passed
+                            as JSON, as between the separate programs, or
+                            through the ring buffer of brainforth.cpp
+
+The tests also check the depths of the stacks that the compiler works out
+for the runner, the counts of its profiling instantiation and the runs of
+its snapshotting one.
+
+The tokeniser, the compiler and the runner are complete programs, so
+brainforth.cpp compiles each into its own namespace.
+*/
+
+#include <benchmark/benchmark.h>
+#include <gtest/gtest.h>
+
+#include "workloads.hpp"
+
+#define BRAINFORTH_NO_MAIN
+#include "../brainforth/brainforth.cpp"
+
+namespace brainforth {
+
+//  Compiles Brainforth source the way the separate programs do, with the
+//  tokens written out as JSON and parsed back.
+static std::map<std::string, nlohmann::json> compileViaJSON( std::istream & source, const brainforth_compiler::CompileFlags & flags ) {
+    std::noskipws( source );
+    brainforth_tokeniser::PeekableProgramInput input( source );
+    std::stringstream tokens;
+    while ( auto token = input.nextJToken() ) {
+        tokens << *token << std::endl;
+    }
+    const brainforth_compiler::InstructionSet instruction_set;
+    std::map<std::string, nlohmann::json> bindings;
+    brainforth_compiler::CodePlanter planter( flags, tokens, instruction_set, bindings );
+    planter.plantProgram();
+    for ( auto & [ name, code ] : bindings ) {
+        for ( auto & i : code ) {
+            i.erase( "DiscardBeforeSetZero" );
+        }
+    }
+    return bindings;
+}
+
+//  Tokenises and compiles a .bfth file into the JSON format, returning the
+//  name of the compiled file.
+static std::string compile( const std::string & source_file, const std::vector<std::string> & args = {} ) {
+    std::ifstream source( source_file );
+    const auto bindings = compileViaJSON( source, brainforth_compiler::CompileFlags( args ) );
+    const std::string stem = std::filesystem::path( source_file ).stem().string();
+    const std::string compiled = ( std::filesystem::temp_directory_path() / ( "brainforth_" + stem + ".json" ) ).string();
+    std::ofstream out( compiled );
+    out << nlohmann::json( bindings ).dump() << std::endl;
+    return compiled;
+}
+
+//  Compiles a program given as text, by way of a temporary .bfth file.
+static std::string compileText( const std::string & text, const std::vector<std::string> & args = {} ) {
+    const std::string source = ( std::filesystem::temp_directory_path() / "brainforth_text.bfth" ).string();
+    {
+        std::ofstream out( source );
+        out << text;
+    }
+    const std::string compiled = compile( source, args );
+    std::filesystem::remove( source );
+    return compiled;
+}
+
+//  Runs a compiled program with the given trace threshold, returning its
+//  output and, optionally, the number of traces recorded.
+static std::string run( const std::string & compiled, uint32_t threshold, size_t * traces = nullptr ) {
+    brainforth_runner::TraceOptions trace;
+    trace.threshold = threshold;
+    brainforth_runner::Engine engine( TapeOptions(), trace );
+    std::istringstream in;
+    std::ostringstream out;
+    engine.runFile( compiled, false, out, in );
+    if ( traces ) {
+        *traces = engine.traces();
+    }
+    return out.str();
+}
+
+//  The words are not inlined by the compiler, which leaves the calls for
+//  the tracing tier.
+static void Brainforth_Trace(benchmark::State& state, uint32_t threshold) {
+    const std::string compiled = compile( "../brainforth/loops.bfth", { "--no-inline" } );
+    for (auto _ : state) {
+        benchmark::DoNotOptimize( run( compiled, threshold ) );
+    }
+    std::filesystem::remove( compiled );
+}
+BENCHMARK_CAPTURE(Brainforth_Trace, Off, 0);
+BENCHMARK_CAPTURE(Brainforth_Trace, On, brainforth_runner::TraceOptions().threshold);
+
+static void Brainforth_Inline(benchmark::State& state, std::string option) {
+    const std::string compiled = compile( "../brainforth/loops.bfth", { option } );
+    for (auto _ : state) {
+        benchmark::DoNotOptimize( run( compiled, 0 ) );
+    }
+    std::filesystem::remove( compiled );
+}
+BENCHMARK_CAPTURE(Brainforth_Inline, Off, std::string("--no-inline"));
+BENCHMARK_CAPTURE(Brainforth_Inline, On, std::string("--inline"));
+
+//  A large source, with star3.bfth's words and then its main program many
+//  times over.
+static std::string largeSource() {
+    std::ifstream file( "../brainforth/star3.bfth" );
+    std::stringstream source;
+    source << file.rdbuf();
+    for ( int i = 0; i < 2000; i++ ) {
+        source << " 42 ! . . . 10 ! . $ >++++[<++++++++>-]< . # ";
+    }
+    return source.str();
+}
+
+static void Brainforth_Pipeline(benchmark::State& state, bool ring) {
+    const std::string text = largeSource();
+    const brainforth_compiler::CompileFlags flags( std::vector<std::string>{ "--no-cache" } );
+    for (auto _ : state) {
+        std::istringstream source( text );
+        benchmark::DoNotOptimize( ring ? compileStream( source, flags ) : compileViaJSON( source, flags ) );
+    }
+    state.SetBytesProcessed( state.iterations() * text.size() );
+}
+BENCHMARK_CAPTURE(Brainforth_Pipeline, JSON, false);
+BENCHMARK_CAPTURE(Brainforth_Pipeline, Ring, true);
+
+//  The row of the matrix in workloads.hpp, compiled as the compiler does by
+//  default and run with the default tracing. The runner loads the compiled
+//  program afresh for each run, so that is timed too.
+static const bool BRAINFORTH_ROW = matrix::addRow( "Brainforth", matrix::Language::BFTH, []( const matrix::Workload & workload ) -> matrix::Run {
+    const std::string compiled = compile( workload.program );
+    auto engine = std::make_shared<brainforth_runner::Engine>( TapeOptions(), brainforth_runner::TraceOptions() );
+    return [=]( const std::string & text ) {
+        std::istringstream in( text );
+        std::ostringstream out;
+        engine->runFile( compiled, false, out, in );
+        return out.str();
+    };
+} );
+
+//  Tracing must never change what a program does, however early it starts.
+//  A threshold of 1 traces every loop and word the first time round.
+TEST( Brainforth_Trace, NoChange ) {
+    for ( auto name : { "hello", "sierpinski", "star3", "loops" } ) {
+        const std::string compiled = compile( std::string( "../brainforth/" ) + name + ".bfth", { "--no-inline" } );
+        const std::string expected = run( compiled, 0 );
+        ASSERT_NE( expected.size(), 0 );
+        for ( uint32_t threshold : { 1, 2, 1000 } ) {
+            ASSERT_EQ( run( compiled, threshold ), expected ) << name << " traced after " << threshold;
+        }
+        std::filesystem::remove( compiled );
+    }
+}
+
+//  The hot loops and words of loops.bfth are traced, and nothing is traced
+//  when tracing is off.
+TEST( Brainforth_Trace, Recorded ) {
+    const std::string compiled = compile( "../brainforth/loops.bfth", { "--no-inline" } );
+    size_t traces = 0;
+    ASSERT_EQ( run( compiled, 1000, &traces ), std::string( 1, '\x80' ) );
+    ASSERT_GT( traces, 0 );
+    run( compiled, 0, &traces );
+    ASSERT_EQ( traces, 0 );
+    std::filesystem::remove( compiled );
+}
+
+static size_t countCalls( const std::string & compiled ) {
+    std::ifstream file( compiled );
+    nlohmann::json bindings;
+    file >> bindings;
+    size_t calls = 0;
+    for ( auto & [ name, code ] : bindings.items() ) {
+        for ( auto & i : code ) {
+            calls += i.contains( "OpCode" ) && i[ "OpCode" ] == "CALL";
+        }
+    }
+    return calls;
+}
+
+//  Inlining must never change what a program does, whatever the
+//  threshold, and a large enough threshold inlines every call in these
+//  programs, none of which are recursive.
+TEST( Brainforth_Inline, NoChange ) {
+    for ( auto name : { "hello", "star3", "loops" } ) {
+        const std::string source = std::string( "../brainforth/" ) + name + ".bfth";
+        const std::string compiled = compile( source, { "--no-inline" } );
+        const std::string expected = run( compiled, 0 );
+        ASSERT_GT( countCalls( compiled ), 0 );
+        for ( auto option : { "--inline-threshold=1", "--inline-threshold=4", "--inline", "--inline-threshold=1000" } ) {
+            const std::string inlined = compile( source, { option } );
+            ASSERT_EQ( run( inlined, 0 ), expected ) << name << " " << option;
+            ASSERT_LE( countCalls( inlined ), countCalls( compiled ) );
+        }
+        ASSERT_EQ( countCalls( compile( source, { "--inline-threshold=1000" } ) ), 0 );
+        std::filesystem::remove( compiled );
+    }
+}
+
+//  A word that calls itself, or that defines another word, stays a call.
+TEST( Brainforth_Inline, NotInlined ) {
+    const std::string compiled = compileText( ":down -[down] ; :outer :inner + ; inner ; +++ down outer .", { "--inline-threshold=1000" } );
+    ASSERT_EQ( countCalls( compiled ), 3 );
+    ASSERT_EQ( run( compiled, 0 ), std::string( 1, '\x01' ) );
+    std::filesystem::remove( compiled );
+    //  A call to a word that is defined twice runs only the first body, as
+    //  with --no-inline, whether or not it was inlined before the second.
+    const std::vector<std::pair<std::string, char>> redefinitions = {
+        { ":a +++ ; :a ++ ; a a .", 6 },
+        { ":a +++ ; a :a ++ ; a a .", 9 },
+    };
+    for ( auto & [ text, expected ] : redefinitions ) {
+        const std::string redefined = compileText( text );
+        ASSERT_EQ( run( redefined, 0 ), std::string( 1, expected ) ) << text;
+        ASSERT_EQ( countCalls( redefined ), 2 ) << text;
+        std::filesystem::remove( redefined );
+    }
+}
+
+//  The depths of the call and data stacks that the compiler plants at the
+//  start of main, as a pair.
+static std::pair<int32_t, int32_t> stackDepths( const std::string & compiled ) {
+    std::ifstream file( compiled );
+    nlohmann::json bindings;
+    file >> bindings;
+    const nlohmann::json & main = bindings[ "main" ];
+    EXPECT_EQ( main[ 0 ][ "OpCode" ], "STACKS" );
+    return { main[ 1 ][ "High" ], main[ 1 ][ "Low" ] };
+}
+
+//  The depths are exact for programs without recursion, and are only
+//  unbounded for the stack that recursion or an unbalanced loop affects.
+TEST( Brainforth_Stacks, Depths ) {
+    const std::string hello = compile( "../brainforth/hello.bfth", { "--no-inline" } );
+    ASSERT_EQ( stackDepths( hello ), std::make_pair( 2, 2 ) );
+    std::filesystem::remove( hello );
+    const std::string star3 = compile( "../brainforth/star3.bfth", { "--no-inline" } );
+    ASSERT_EQ( stackDepths( star3 ), std::make_pair( 3, 1 ) );
+    std::filesystem::remove( star3 );
+    const std::string balanced = compileText( ":twice ?? ; :drop ! ; twice drop drop $ twice # !! .", { "--no-inline" } );
+    ASSERT_EQ( stackDepths( balanced ), std::make_pair( 2, 2 ) );
+    std::filesystem::remove( balanced );
+    const std::string pushes = compileText( "+++[?-] !!! ." );
+    ASSERT_EQ( stackDepths( pushes ), std::make_pair( 0, -1 ) );
+    ASSERT_EQ( run( pushes, 0 ), std::string( 1, '\x03' ) );
+    std::filesystem::remove( pushes );
+    const std::string recursive = compileText( ":down -[down] ; - down ." );
+    ASSERT_EQ( stackDepths( recursive ), std::make_pair( -1, -1 ) );
+    ASSERT_EQ( run( recursive, 0 ), std::string( 1, '\0' ) );
+    std::filesystem::remove( recursive );
+}
+
+//  Popping an empty stack runs into the guard page below it.
+TEST( Brainforth_Stacks, UnderflowIsFatal ) {
+    const std::string compiled = compileText( "! ." );
+    EXPECT_DEATH( run( compiled, 0 ), "Data stack underflow" );
+    std::filesystem::remove( compiled );
+}
+
+//  Passing the tokens through the ring buffer must compile exactly what
+//  passing them as JSON does, whatever the flags.
+TEST( Brainforth_Pipeline, NoChange ) {
+    for ( auto name : { "hello", "sierpinski", "star3", "loops" } ) {
+        std::ifstream file( std::string( "../brainforth/" ) + name + ".bfth" );
+        std::stringstream text;
+        text << file.rdbuf();
+        for ( auto args : { std::vector<std::string>{}, { "--no-inline" }, { "--none" } } ) {
+            const brainforth_compiler::CompileFlags flags( args );
+            std::istringstream json_source( text.str() );
+            std::istringstream ring_source( text.str() );
+            ASSERT_EQ( compileStream( ring_source, flags ), compileViaJSON( json_source, flags ) ) << name;
+        }
+    }
+    std::istringstream json_source( largeSource() );
+    std::istringstream ring_source( largeSource() );
+    const brainforth_compiler::CompileFlags flags( std::vector<std::string>{} );
+    ASSERT_EQ( compileStream( ring_source, flags ), compileViaJSON( json_source, flags ) );
+}
+
+//  The program is run from memory, with the same output as from a file.
+TEST( Brainforth_Pipeline, RunJSON ) {
+    std::ifstream file( "../brainforth/hello.bfth" );
+    const nlohmann::json program( compileStream( file, brainforth_compiler::CompileFlags( std::vector<std::string>{} ) ) );
+    brainforth_runner::Engine engine;
+    std::istringstream in;
+    std::ostringstream out;
+    engine.runJSON( program, out, in );
+    const std::string compiled = compile( "../brainforth/hello.bfth" );
+    ASSERT_EQ( out.str(), run( compiled, 0 ) );
+    std::filesystem::remove( compiled );
+}
+
+//  The profiling instantiation leaves the output alone and counts every
+//  instruction, including the calls, against the words they are in.
+TEST( Brainforth_Profile, Counts ) {
+    const std::string compiled = compile( "../brainforth/star3.bfth", { "--no-inline" } );
+    const std::string report = ( std::filesystem::temp_directory_path() / "brainforth_profile.json" ).string();
+    profile::ProfileOptions profiling;
+    profiling.file = report;
+    brainforth_runner::Engine engine( TapeOptions(), brainforth_runner::TraceOptions(), profiling );
+    std::istringstream in;
+    std::ostringstream out;
+    engine.runFile( compiled, false, out, in );
+    ASSERT_EQ( out.str(), run( compiled, 0 ) );
+    ASSERT_EQ( engine.traces(), 0 );
+
+    const nlohmann::json counts = nlohmann::json::parse( std::ifstream( report ) );
+    ASSERT_FALSE( counts[ "Timed" ].get<bool>() );
+    std::map<std::string, uint64_t> by_opcode;
+    for ( auto & j : counts[ "OpCodes" ] ) {
+        by_opcode[ j[ "OpCode" ] ] = j[ "Count" ];
+    }
+    ASSERT_EQ( by_opcode[ "HALT" ], 1 );
+    ASSERT_GE( by_opcode[ "CALL" ], countCalls( compiled ) );
+    ASSERT_EQ( by_opcode[ "CALL" ], by_opcode[ "RETURN" ] );
+
+    std::ifstream folded( report + ".folded" );
+    std::string line;
+    ASSERT_TRUE( std::getline( folded, line ) );
+    ASSERT_NE( line.rfind( ' ' ), std::string::npos );
+    std::filesystem::remove( report );
+    std::filesystem::remove( report + ".folded" );
+    std::filesystem::remove( compiled );
+}
+
+//  Runs a compiled program with the snapshot options given on the input.
+static std::string runSnapshotted( const std::string & compiled, const std::string & input, const snapshot::SnapshotOptions & snapshots, bool * stopped = nullptr ) {
+    brainforth_runner::Engine engine( TapeOptions(), brainforth_runner::TraceOptions(), profile::ProfileOptions(), snapshots );
+    std::istringstream in( input );
+    std::ostringstream out;
+    engine.runFile( compiled, false, out, in );
+    if ( stopped ) {
+        *stopped = engine.stopped();
+    }
+    return out.str();
+}
+
+//  A run stopped at a safe point and resumed, twice over, has the output of
+//  an uninterrupted run, and so do warm started runs. The words are not inlined,
+//  so that the checkpoints are taken with frames on the call stack, both
+//  return addresses and saved locations, and items on the data stack.
+TEST( Brainforth_Snapshot, CheckpointAndWarmStart ) {
+    const std::string echo = ":spin $>$< >++++[>++++[>-<-]<-]< ## ; :echo ? spin ! + . ; ,[ echo [-] , ]";
+    const std::string first = ( std::filesystem::temp_directory_path() / "brainforth_checkpoint_1.snap" ).string();
+    const std::string second = ( std::filesystem::temp_directory_path() / "brainforth_checkpoint_2.snap" ).string();
+    for ( const std::string & compiled : { compile( "../brainforth/star3.bfth", { "--no-inline" } ), compileText( echo, { "--no-inline" } ) } ) {
+        const std::string input = "Brainforth";
+        const std::string expected = runSnapshotted( compiled, input, snapshot::SnapshotOptions() );
+        snapshot::SnapshotOptions snapshots;
+        bool stopped = false;
+        snapshots.checkpoint = first;
+        snapshot::requested = snapshot::STOP;
+        std::string output = runSnapshotted( compiled, input, snapshots, &stopped );
+        ASSERT_TRUE( stopped );
+        snapshots.resume = first;
+        snapshots.checkpoint = second;
+        snapshot::requested = snapshot::STOP;
+        output += runSnapshotted( compiled, input, snapshots, &stopped );
+        ASSERT_TRUE( stopped );
+        snapshots.resume = second;
+        output += runSnapshotted( compiled, input, snapshots, &stopped );
+        ASSERT_FALSE( stopped );
+        ASSERT_EQ( output, expected );
+
+        snapshot::SnapshotOptions warm;
+        warm.warm_start = first;
+        std::filesystem::remove( first );
+        ASSERT_EQ( runSnapshotted( compiled, input, warm ), expected );
+        ASSERT_EQ( runSnapshotted( compiled, input, warm ), expected );
+        std::filesystem::remove( compiled );
+    }
+    std::filesystem::remove( first );
+    std::filesystem::remove( second );
+}
+
+//  The single binary takes the runner's snapshot options, rather than
+//  passing them on to the compiler.
+TEST( Brainforth_Snapshot, Options ) {
+    const Options options( { "--checkpoint=a.snap", "--resume=b.snap", "--warm-start=c.snap", "--no-inline", "loops.bfth" } );
+    ASSERT_EQ( options.snapshots.checkpoint, "a.snap" );
+    ASSERT_EQ( options.snapshots.resume, "b.snap" );
+    ASSERT_EQ( options.snapshots.warm_start, "c.snap" );
+    ASSERT_EQ( options.compile, std::vector<std::string>{ "--no-inline" } );
+    ASSERT_EQ( options.filenames, std::vector<std::string>{ "loops.bfth" } );
+}
+
+} // namespace brainforth
@@ -0,0 +1,761 @@
+/*
+Compares the wide and compact instruction encodings of the CISC engine in 
+cisc_threading_demo.cpp, and the native code it generates with --native.
+The engine reads and writes the standard streams, so we temporarily
+redirect them for each run. The batch mode captures the output of each
+job itself.
+*/
+
+#define CISC_THREADING_DEMO_NO_MAIN
+#include "../cisc_threading_demo.cpp"
+
+#include <sstream>
+#include <filesystem>
+#include <atomic>
+
+#include <fcntl.h>
+
+#include <benchmark/benchmark.h>
+#include <gtest/gtest.h>
+
+#include "workloads.hpp"
+
+namespace cisc_encoding {
+
+//  Runs a Brainf*ck program on the given input, returning its output.
+class RedirectedRun {
+    std::istringstream input;
+    std::ostringstream output;
+    std::streambuf * saved_cin;
+    std::streambuf * saved_cout;
+public:
+    RedirectedRun( const std::string & text ) :
+        input( text ),
+        saved_cin( std::cin.rdbuf( input.rdbuf() ) ),
+        saved_cout( std::cout.rdbuf( output.rdbuf() ) )
+    {
+        std::cin.clear();
+    }
+
+    ~RedirectedRun() {
+        std::cin.rdbuf( saved_cin );
+        std::cout.rdbuf( saved_cout );
+        std::cin.clear();
+    }
+
+public:
+    template <typename Cell = uint8_t>
+    std::string run( std::string_view filename, bool compact, const compile_cache::Cache & cache = compile_cache::Cache::disabled(), bool cache_cell = false ) {
+        BasicEngine<Cell> engine( TapeOptions(), cache, profile::ProfileOptions(), cache_cell );
+        engine.runFile( filename, false, compact );
+        return output.str();
+    }
+
+    std::string runNative( std::string_view filename ) {
+        Engine engine{};
+        engine.runNativeFile( filename, false );
+        return output.str();
+    }
+};
+
+static std::string readFile( const std::string & filename ) {
+    std::ifstream file( filename );
+    std::stringstream text;
+    text << file.rdbuf();
+    return text.str();
+}
+
+//  bsort.bf sorts its input, so we give it its own source code to sort.
+static void CISC_Encoding(benchmark::State& state, std::string filename, bool compact) {
+    const std::string input = readFile( filename == "../bsort.bf" ? filename : "" );
+    for (auto _ : state) {
+        RedirectedRun redirected( input );
+        benchmark::DoNotOptimize( redirected.run( filename, compact ) );
+    }
+}
+BENCHMARK_CAPTURE(CISC_Encoding, WideBsort, std::string("../bsort.bf"), false);
+BENCHMARK_CAPTURE(CISC_Encoding, CompactBsort, std::string("../bsort.bf"), true);
+BENCHMARK_CAPTURE(CISC_Encoding, WideSierpinski, std::string("../sierpinski.bf"), false);
+BENCHMARK_CAPTURE(CISC_Encoding, CompactSierpinski, std::string("../sierpinski.bf"), true);
+BENCHMARK_CAPTURE(CISC_Encoding, WideSeek, std::string("../seek.bf"), false);
+BENCHMARK_CAPTURE(CISC_Encoding, CompactSeek, std::string("../seek.bf"), true);
+
+//  The native code against the interpreters above, and against
+//  Constexpr_Bsort which stands in for bsort.c.
+static void CISC_Native(benchmark::State& state, std::string filename) {
+    const std::string input = readFile( filename == "../bsort.bf" ? filename : "" );
+    for (auto _ : state) {
+        RedirectedRun redirected( input );
+        benchmark::DoNotOptimize( redirected.runNative( filename ) );
+    }
+}
+BENCHMARK_CAPTURE(CISC_Native, Bsort, std::string("../bsort.bf"));
+BENCHMARK_CAPTURE(CISC_Native, Sierpinski, std::string("../sierpinski.bf"));
+BENCHMARK_CAPTURE(CISC_Native, Seek, std::string("../seek.bf"));
+
+//  Output-heavy programs spend much of their time in iostreams. Both sides
+//  write to /dev/null so only the cost of the stream itself is measured.
+static void CISC_IO_IOStream(benchmark::State& state, std::string filename) {
+    std::ofstream out( "/dev/null" );
+    for (auto _ : state) {
+        Engine engine{};
+        engine.runFile( filename, false, false, out, std::cin );
+    }
+}
+BENCHMARK_CAPTURE(CISC_IO_IOStream, Sierpinski, std::string("../sierpinski.bf"));
+BENCHMARK_CAPTURE(CISC_IO_IOStream, Hello, std::string("../hello.bf"));
+
+static void CISC_IO_Buffered(benchmark::State& state, std::string filename) {
+    int fd = open( "/dev/null", O_WRONLY );
+    BufferedOutput out( fd );
+    for (auto _ : state) {
+        Engine engine{};
+        engine.runFile( filename, false, false, out, std::cin );
+    }
+    close( fd );
+}
+BENCHMARK_CAPTURE(CISC_IO_Buffered, Sierpinski, std::string("../sierpinski.bf"));
+BENCHMARK_CAPTURE(CISC_IO_Buffered, Hello, std::string("../hello.bf"));
+
+//  Opcodes that are distinct but are not labels, for planting programs
+//  that are never run.
+static InstructionSet fakeInstructionSet() {
+    static char labels[ 19 ];
+    InstructionSet s;
+    OpCode * fields[] = {
+        &s.SET_ZERO, &s.INCR, &s.DECR, &s.ADD, &s.ADD_OFFSET, &s.XFR_MULTIPLE,
+        &s.XFR_MULTI_N, &s.LEFT, &s.RIGHT, &s.SEEK_LEFT, &s.SEEK_RIGHT,
+        &s.SEEK_LEFT_N, &s.SEEK_RIGHT_N, &s.MOVE, &s.OPEN, &s.CLOSE, &s.GET,
+        &s.PUT, &s.HALT
+    };
+    static_assert( sizeof( fields ) / sizeof( fields[ 0 ] ) == sizeof( labels ) );
+    for ( size_t i = 0; i < sizeof( labels ); i++ ) {
+        *fields[ i ] = &labels[ i ];
+    }
+    return s;
+}
+
+//  Planting a large program from source, and relocating it from the compile
+//  cache.
+static void CISC_Plant(benchmark::State& state, bool cached) {
+    const InstructionSet instruction_set = fakeInstructionSet();
+    const auto dir = std::filesystem::temp_directory_path() / "cisc_plant_cache";
+    const compile_cache::Cache cache = cached ? compile_cache::Cache( dir ) : compile_cache::Cache::disabled();
+    for (auto _ : state) {
+        std::vector<Instruction> program;
+        CachingCodePlanter( "../dbf2c.bf", instruction_set, program, cache ).plantProgram();
+        benchmark::DoNotOptimize( program );
+    }
+    std::filesystem::remove_all( dir );
+}
+BENCHMARK_CAPTURE(CISC_Plant, Planted, false);
+BENCHMARK_CAPTURE(CISC_Plant, Cached, true);
+
+//  A multi-megabyte source, generated by concatenating the sample programs,
+//  comments and all, until it is large enough.
+static std::string largeSourceFile() {
+    const std::string file = ( std::filesystem::temp_directory_path() / "cisc_plant_large.bf" ).string();
+    std::ofstream out( file );
+    const std::string chunk = readFile( "../dbf2c.bf" ) + readFile( "../bsort.bf" ) + readFile( "../sierpinski.bf" ) + readFile( "../seek.bf" );
+    for ( size_t size = 0; size < ( size_t( 4 ) << 20 ); size += chunk.size() ) {
+        out << chunk;
+    }
+    return file;
+}
+
+//  Planting throughput, in source bytes per second.
+static void CISC_PlantThroughput(benchmark::State& state) {
+    const InstructionSet instruction_set = fakeInstructionSet();
+    const std::string file = largeSourceFile();
+    const size_t bytes = std::filesystem::file_size( file );
+    for (auto _ : state) {
+        std::vector<Instruction> program;
+        CodePlanter( file, instruction_set, program ).plantProgram();
+        benchmark::DoNotOptimize( program );
+    }
+    state.SetBytesProcessed( state.iterations() * bytes );
+    std::filesystem::remove( file );
+}
+BENCHMARK(CISC_PlantThroughput)->Unit(benchmark::kMillisecond);
+
+TEST( CISC_Encoding, NoChange ) {
+    const std::string input = readFile( "../bsort.bf" );
+    for ( auto filename : { "../sierpinski.bf", "../hello.bf", "../bsort.bf", "../seek.bf" } ) {
+        std::string output_wide;
+        std::string output_compact;
+        {
+            RedirectedRun redirected( input );
+            output_wide = redirected.run( filename, false );
+        }
+        {
+            RedirectedRun redirected( input );
+            output_compact = redirected.run( filename, true );
+        }
+        ASSERT_NE( output_wide.size(), 0 );
+        ASSERT_EQ( output_wide, output_compact );
+    }
+}
+
+//  The native code must behave exactly as the interpreter, on programs
+//  that between them use every instruction.
+TEST( CISC_Native, NoChange ) {
+    const std::string input = readFile( "../bsort.bf" );
+    for ( auto filename : { "../sierpinski.bf", "../hello.bf", "../bsort.bf", "../seek.bf", "../dbf2c.bf" } ) {
+        std::string expected;
+        {
+            RedirectedRun redirected( input );
+            expected = redirected.run( filename, false );
+        }
+        RedirectedRun redirected( input );
+        ASSERT_EQ( redirected.runNative( filename ), expected );
+    }
+}
+
+//  A copy-and-multiply loop with three targets becomes a single XFR_MULTI_N,
+//  whose table must survive both encodings.
+TEST( CISC_Encoding, TransferLoop ) {
+    const std::string filename = ( std::filesystem::temp_directory_path() / "cisc_transfer_loop.bf" ).string();
+    {
+        std::ofstream source( filename );
+        source << "++++++++[->++++>+++++++++>++++++++++++<<<]>>>+.<+.-<++.";
+    }
+    for ( bool compact : { false, true } ) {
+        RedirectedRun redirected( "" );
+        ASSERT_EQ( redirected.run( filename, compact ), "aI\"" );
+    }
+    std::filesystem::remove( filename );
+}
+
+//  The buffered streams must give the same result as iostreams, here on a
+//  program that reads all of its input before writing.
+TEST( CISC_IO, Buffered ) {
+    const std::string input = readFile( "../bsort.bf" );
+    std::string expected;
+    {
+        RedirectedRun redirected( input );
+        expected = redirected.run( "../bsort.bf", false );
+    }
+    const auto dir = std::filesystem::temp_directory_path();
+    const std::string output_file = ( dir / "cisc_io_output.txt" ).string();
+    {
+        int in_fd = open( "../bsort.bf", O_RDONLY );
+        int out_fd = open( output_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600 );
+        BufferedOutput out( out_fd, 7 );
+        BufferedInput in( in_fd, &out, 5 );
+        Engine engine{};
+        engine.runFile( "../bsort.bf", false, false, out, in );
+        close( in_fd );
+        close( out_fd );
+    }
+    ASSERT_EQ( readFile( output_file ), expected );
+    std::filesystem::remove( output_file );
+}
+
+//  A run that misses the compile cache stores the planted program, and the
+//  next run relocates it, with the same result as planting from source.
+TEST( CISC_Cache, SameAsPlanted ) {
+    const std::string input = readFile( "../bsort.bf" );
+    const auto dir = std::filesystem::temp_directory_path() / "cisc_cache_test";
+    std::filesystem::remove_all( dir );
+    const compile_cache::Cache cache( dir );
+    for ( auto filename : { "../sierpinski.bf", "../bsort.bf", "../seek.bf" } ) {
+        for ( bool compact : { false, true } ) {
+            std::string expected;
+            {
+                RedirectedRun redirected( input );
+                expected = redirected.run( filename, compact );
+            }
+            for ( int run = 0; run < 2; run++ ) {
+                RedirectedRun redirected( input );
+                ASSERT_EQ( redirected.run( filename, compact, cache ), expected );
+            }
+        }
+    }
+    //  One image per program, shared by both encodings.
+    ASSERT_EQ( std::distance( std::filesystem::directory_iterator( dir ), std::filesystem::directory_iterator() ), 3 );
+    std::filesystem::remove_all( dir );
+}
+
+//  A program compiled by one engine runs the same in another, and again in
+//  the first, as each run starts from a clear tape.
+TEST( CISC_Compiled, SharedBetweenEngines ) {
+    const std::string input = readFile( "../bsort.bf" );
+    std::string expected;
+    {
+        RedirectedRun redirected( input );
+        expected = redirected.run( "../bsort.bf", true );
+    }
+    Engine first{};
+    Engine second{};
+    const auto program = first.compile<CompactEncoding, CapturedOutput, StringInput>( "../bsort.bf" );
+    for ( Engine * engine : { &first, &second, &first } ) {
+        CapturedOutput out;
+        StringInput in( input );
+        engine->run( *program, out, in );
+        ASSERT_EQ( out.str(), expected );
+    }
+}
+
+//  The profiling instantiations, counting and timing, against the ordinary
+//  one, which should be untouched by their existence.
+static void CISC_Profile(benchmark::State& state, std::string mode) {
+    profile::ProfileOptions profiling;
+    if ( mode != "Off" ) {
+        profiling.file = ( std::filesystem::temp_directory_path() / "cisc_profile_benchmark.json" ).string();
+        profiling.cycles = mode == "Cycles";
+    }
+    for (auto _ : state) {
+        std::ofstream devnull( "/dev/null" );
+        Engine engine( TapeOptions(), compile_cache::Cache::disabled(), profiling );
+        engine.runFile( "../sierpinski.bf", false, false, devnull );
+    }
+}
+BENCHMARK_CAPTURE(CISC_Profile, Off, std::string("Off"));
+BENCHMARK_CAPTURE(CISC_Profile, Counts, std::string("Counts"));
+BENCHMARK_CAPTURE(CISC_Profile, Cycles, std::string("Cycles"));
+
+//  Profiling leaves the output alone, counts each instruction as often as
+//  it runs, and charges every instruction with the cycles it took.
+TEST( CISC_Profile, Counts ) {
+    const std::string input = readFile( "../bsort.bf" );
+    std::string expected;
+    {
+        RedirectedRun redirected( input );
+        expected = redirected.run( "../bsort.bf", false );
+    }
+    const std::string report = ( std::filesystem::temp_directory_path() / "cisc_profile.json" ).string();
+    profile::ProfileOptions profiling;
+    profiling.file = report;
+    profiling.cycles = true;
+    {
+        std::istringstream in( input );
+        std::ostringstream out;
+        Engine engine( TapeOptions(), compile_cache::Cache::disabled(), profiling );
+        engine.runFile( "../bsort.bf", false, true, out, in );
+        ASSERT_EQ( out.str(), expected );
+    }
+    const std::string counts = readFile( report );
+    ASSERT_NE( counts.find( "\"Timed\": true" ), std::string::npos );
+    ASSERT_NE( counts.find( "{ \"OpCode\": \"HALT\", \"Count\": 1, \"Cycles\": " ), std::string::npos );
+    ASSERT_NE( counts.find( "\"Frames\": \"main;loop@" ), std::string::npos );
+    ASSERT_NE( counts.find( "\"Hardware\": {" ), std::string::npos );
+    std::istringstream folded( readFile( report + ".folded" ) );
+    size_t stacks = 0;
+    for ( std::string line; std::getline( folded, line ); stacks++ ) {
+        ASSERT_EQ( line.rfind( "main", 0 ), 0 ) << line;
+    }
+    ASSERT_GT( stacks, 0 );
+    std::filesystem::remove( report );
+    std::filesystem::remove( report + ".folded" );
+}
+
+//  The wide encoding with the current cell kept in a register, against
+//  the same encoding loading and storing it in every handler.
+static void CISC_CachedCell(benchmark::State& state, std::string filename, bool cache_cell) {
+    const std::string input = readFile( filename == "../bsort.bf" ? filename : "" );
+    perf_counters::HardwareCounters hardware;
+    hardware.start();
+    for (auto _ : state) {
+        RedirectedRun redirected( input );
+        benchmark::DoNotOptimize( redirected.run( filename, false, compile_cache::Cache::disabled(), cache_cell ) );
+    }
+    hardware.stop();
+    matrix::reportHardware( state, hardware, matrix::instructionsOf( filename, input ) );
+}
+BENCHMARK_CAPTURE(CISC_CachedCell, UncachedBsort, std::string("../bsort.bf"), false);
+BENCHMARK_CAPTURE(CISC_CachedCell, CachedBsort, std::string("../bsort.bf"), true);
+BENCHMARK_CAPTURE(CISC_CachedCell, UncachedSierpinski, std::string("../sierpinski.bf"), false);
+BENCHMARK_CAPTURE(CISC_CachedCell, CachedSierpinski, std::string("../sierpinski.bf"), true);
+BENCHMARK_CAPTURE(CISC_CachedCell, UncachedSeek, std::string("../seek.bf"), false);
+BENCHMARK_CAPTURE(CISC_CachedCell, CachedSeek, std::string("../seek.bf"), true);
+
+//  Keeping the cell in a register changes nothing but the speed, whether
+//  the program is planted from source or relocated from the compile cache,
+//  which holds the usual opcodes.
+TEST( CISC_CachedCell, NoChange ) {
+    const std::string input = readFile( "../bsort.bf" );
+    const auto dir = std::filesystem::temp_directory_path() / "cisc_cached_cell_test";
+    std::filesystem::remove_all( dir );
+    const compile_cache::Cache cache( dir );
+    for ( auto filename : { "../sierpinski.bf", "../bsort.bf", "../seek.bf", "../hello.bf", "../head.bf", "../dbf2c.bf" } ) {
+        std::string expected;
+        {
+            RedirectedRun redirected( input );
+            expected = redirected.run( filename, false );
+        }
+        for ( int run = 0; run < 2; run++ ) {
+            RedirectedRun redirected( input );
+            ASSERT_EQ( redirected.run( filename, false, cache, true ), expected ) << filename;
+        }
+    }
+    std::filesystem::remove_all( dir );
+}
+
+//  Offset-addressed blocks must run as the moves they replace did, in
+//  every encoding and mode, including output, clearing and input at an
+//  offset, loops entered and left at one, moves left over at the end, and
+//  the reads of GET_BYTES, up to and past the end of the input.
+TEST( CISC_Offsets, SameAsReference ) {
+    const std::vector<std::string> sources = {
+        "++++++++[>++++++++<-]>+.>+++[<.>-]<<",
+        ">>+++++<<[-]>>[>++++<-]>.>,>>.[-]<<<<.",
+        "+++[>+++++<-]>[>+>+<<-]>>[-<<+>>]<.<.>>>>>>>",
+        ">>,[>>+>>,]<<[.<<]",
+        "+[>[-]>+++<<-]>>[<++>-]<.[>]",
+        ",>,>,>,<<<.>.>.>.>,>,.<.[-]>,>,>,<<[.>]",
+    };
+    const std::string input = "offsets";
+    const std::string filename = ( std::filesystem::temp_directory_path() / "cisc_offsets.bf" ).string();
+    for ( auto & source : sources ) {
+        std::ofstream( filename ) << source;
+        const std::string expected = matrix::referenceOf( source, input ).output;
+        for ( bool compact : { false, true } ) {
+            RedirectedRun redirected( input );
+            ASSERT_EQ( redirected.run( filename, compact ), expected ) << source;
+        }
+        {
+            RedirectedRun redirected( input );
+            ASSERT_EQ( redirected.run( filename, false, compile_cache::Cache::disabled(), true ), expected ) << source;
+        }
+        {
+            RedirectedRun redirected( input );
+            ASSERT_EQ( redirected.runNative( filename ), expected ) << source;
+        }
+    }
+    std::filesystem::remove( filename );
+}
+
+//  Wider cells cost more of the tape, and so of the cache, for each cell
+//  that a program touches.
+template <typename Cell>
+static void runCellWidth(benchmark::State& state, const std::string & filename, const std::string & input) {
+    for (auto _ : state) {
+        RedirectedRun redirected( input );
+        benchmark::DoNotOptimize( redirected.run<Cell>( filename, false ) );
+    }
+    state.counters[ "TapeBytes" ] = static_cast<double>( TapeOptions().size * sizeof( Cell ) );
+}
+
+static void CISC_CellWidth(benchmark::State& state, std::string filename, int bits) {
+    const std::string input = readFile( filename == "../bsort.bf" ? filename : "" );
+    if ( bits == 16 ) {
+        runCellWidth<uint16_t>( state, filename, input );
+    } else if ( bits == 32 ) {
+        runCellWidth<uint32_t>( state, filename, input );
+    } else {
+        runCellWidth<uint8_t>( state, filename, input );
+    }
+}
+BENCHMARK_CAPTURE(CISC_CellWidth, Bsort8, std::string("../bsort.bf"), 8);
+BENCHMARK_CAPTURE(CISC_CellWidth, Bsort16, std::string("../bsort.bf"), 16);
+BENCHMARK_CAPTURE(CISC_CellWidth, Bsort32, std::string("../bsort.bf"), 32);
+BENCHMARK_CAPTURE(CISC_CellWidth, Sierpinski8, std::string("../sierpinski.bf"), 8);
+BENCHMARK_CAPTURE(CISC_CellWidth, Sierpinski16, std::string("../sierpinski.bf"), 16);
+BENCHMARK_CAPTURE(CISC_CellWidth, Sierpinski32, std::string("../sierpinski.bf"), 32);
+
+//  Cells wrap at their own width, whatever the encoding or mode, and only
+//  the low byte is output. 256 is zero in 8 bits and 65536 in 16.
+TEST( CISC_CellWidth, Wraparound ) {
+    const std::string put_1 = std::string( 49, '+' ) + ".[-]";
+    const std::vector<std::pair<std::string, std::vector<std::string>>> sources = {
+        { "++++++++[>++++++++<-]>[<++++>-]<[" + put_1 + "]", { "", "1", "1" } },
+        { "++++++++++++++++[>++++++++++++++++<-]>[>" + std::string( 256, '+' ) + "<-]>[" + put_1 + "]", { "", "", "1" } },
+        { "-.[>+++<-]>.", { "\xff\xfd", "\xff\xfd", "\xff\xfd" } },
+    };
+    const std::string filename = ( std::filesystem::temp_directory_path() / "cisc_cell_width.bf" ).string();
+    for ( auto & [ source, expected ] : sources ) {
+        std::ofstream( filename ) << source;
+        for ( bool compact : { false, true } ) {
+            for ( bool cache_cell : { false, true } ) {
+                const compile_cache::Cache cache = compile_cache::Cache::disabled();
+                {
+                    RedirectedRun redirected( "" );
+                    ASSERT_EQ( redirected.run<uint8_t>( filename, compact, cache, cache_cell ), expected[ 0 ] ) << source;
+                }
+                {
+                    RedirectedRun redirected( "" );
+                    ASSERT_EQ( redirected.run<uint16_t>( filename, compact, cache, cache_cell ), expected[ 1 ] ) << source;
+                }
+                {
+                    RedirectedRun redirected( "" );
+                    ASSERT_EQ( redirected.run<uint32_t>( filename, compact, cache, cache_cell ), expected[ 2 ] ) << source;
+                }
+            }
+        }
+    }
+    std::filesystem::remove( filename );
+}
+
+//  An input that, like a pipe, cannot say where it is.
+class PipedInput : public std::stringbuf {
+public:
+    explicit PipedInput( const std::string & text ) :
+        std::stringbuf( text, std::ios_base::in )
+    {}
+
+protected:
+    pos_type seekoff( off_type, std::ios_base::seekdir, std::ios_base::openmode ) override {
+        return pos_type( off_type( -1 ) );
+    }
+
+    pos_type seekpos( pos_type, std::ios_base::openmode ) override {
+        return pos_type( off_type( -1 ) );
+    }
+};
+
+//  Runs a program with the snapshot options given, reading the input as
+//  though it came down a pipe.
+static std::string runSnapshotted( const std::string & filename, bool compact, const std::string & input, const snapshot::SnapshotOptions & snapshots, bool * stopped = nullptr ) {
+    Engine engine( TapeOptions(), compile_cache::Cache::disabled(), profile::ProfileOptions(), false, snapshots );
+    PipedInput piped( input );
+    std::istream in( &piped );
+    std::ostringstream out;
+    engine.runFile( filename, false, compact, out, in );
+    if ( stopped ) {
+        *stopped = engine.stopped();
+    }
+    return out.str();
+}
+
+//  An ordinary run, against one in the snapshotting instantiation that
+//  never takes a snapshot, and one warm started from a snapshot taken by
+//  an earlier run.
+static void CISC_Snapshot(benchmark::State& state, std::string mode) {
+    const std::string input = readFile( "../bsort.bf" );
+    const std::string file = ( std::filesystem::temp_directory_path() / "cisc_snapshot_benchmark.snap" ).string();
+    snapshot::SnapshotOptions snapshots;
+    if ( mode == "Checkpointed" ) {
+        snapshots.checkpoint = file;
+    } else if ( mode == "WarmStart" ) {
+        snapshots.warm_start = file;
+        std::filesystem::remove( file );
+        runSnapshotted( "../bsort.bf", false, input, snapshots );
+    }
+    for (auto _ : state) {
+        benchmark::DoNotOptimize( runSnapshotted( "../bsort.bf", false, input, snapshots ) );
+    }
+    std::filesystem::remove( file );
+}
+BENCHMARK_CAPTURE(CISC_Snapshot, Off, std::string("Off"));
+BENCHMARK_CAPTURE(CISC_Snapshot, Checkpointed, std::string("Checkpointed"));
+BENCHMARK_CAPTURE(CISC_Snapshot, WarmStart, std::string("WarmStart"));
+
+//  The first run writes the snapshot and the later ones start from it,
+//  with the same output, in either encoding and at any width of cell.
+TEST( CISC_Snapshot, WarmStart ) {
+    const std::string input = readFile( "../bsort.bf" );
+    const std::string file = ( std::filesystem::temp_directory_path() / "cisc_warm_start.snap" ).string();
+    snapshot::SnapshotOptions snapshots;
+    snapshots.warm_start = file;
+    for ( auto filename : { "../sierpinski.bf", "../bsort.bf" } ) {
+        for ( bool compact : { false, true } ) {
+            const std::string expected = runSnapshotted( filename, compact, input, snapshot::SnapshotOptions() );
+            std::filesystem::remove( file );
+            ASSERT_EQ( runSnapshotted( filename, compact, input, snapshots ), expected ) << filename;
+            ASSERT_TRUE( snapshot::isSnapshotOf( file, snapshot::fingerprintOf( filename, compact ? "compact" : "wide" ) ) );
+            ASSERT_EQ( runSnapshotted( filename, compact, input, snapshots ), expected ) << filename;
+        }
+    }
+    std::filesystem::remove( file );
+}
+
+//  A run stopped at its first safe point and resumed, twice over, has the
+//  output of an uninterrupted run. The checkpoint is requested up front,
+//  as a signal would.
+TEST( CISC_Snapshot, Checkpoint ) {
+    const std::string input = readFile( "../bsort.bf" );
+    const std::string first = ( std::filesystem::temp_directory_path() / "cisc_checkpoint_1.snap" ).string();
+    const std::string second = ( std::filesystem::temp_directory_path() / "cisc_checkpoint_2.snap" ).string();
+    for ( bool compact : { false, true } ) {
+        const std::string expected = runSnapshotted( "../bsort.bf", compact, input, snapshot::SnapshotOptions() );
+        snapshot::SnapshotOptions snapshots;
+        bool stopped = false;
+        snapshots.checkpoint = first;
+        snapshot::requested = snapshot::STOP;
+        std::string output = runSnapshotted( "../bsort.bf", compact, input, snapshots, &stopped );
+        ASSERT_TRUE( stopped );
+        snapshots.resume = first;
+        snapshots.checkpoint = second;
+        snapshot::requested = snapshot::STOP;
+        output += runSnapshotted( "../bsort.bf", compact, input, snapshots, &stopped );
+        ASSERT_TRUE( stopped );
+        snapshots.resume = second;
+        output += runSnapshotted( "../bsort.bf", compact, input, snapshots, &stopped );
+        ASSERT_FALSE( stopped );
+        ASSERT_EQ( output, expected );
+        //  A snapshot is only ever resumed by the program it was taken of.
+        snapshots.resume = first;
+        ASSERT_THROW( runSnapshotted( "../sierpinski.bf", compact, input, snapshots ), std::runtime_error );
+        ASSERT_THROW( runSnapshotted( "../bsort.bf", not compact, input, snapshots ), std::runtime_error );
+    }
+    std::filesystem::remove( first );
+    std::filesystem::remove( second );
+}
+
+//  A program without loops stops at its input, its output or its halt, and
+//  carries on from there.
+TEST( CISC_Snapshot, StraightLine ) {
+    const std::string filename = ( std::filesystem::temp_directory_path() / "cisc_straight_line.bf" ).string();
+    const std::string file = ( std::filesystem::temp_directory_path() / "cisc_straight_line.snap" ).string();
+    for ( auto program : { ",.,.", ",>,<.>.", "+++" } ) {
+        {
+            std::ofstream source( filename );
+            source << program;
+        }
+        for ( bool compact : { false, true } ) {
+            const std::string expected = runSnapshotted( filename, compact, "ab", snapshot::SnapshotOptions() );
+            snapshot::SnapshotOptions snapshots;
+            bool stopped = false;
+            snapshots.checkpoint = file;
+            snapshot::requested = snapshot::STOP;
+            std::string output = runSnapshotted( filename, compact, "ab", snapshots, &stopped );
+            ASSERT_TRUE( stopped ) << program;
+            snapshots.checkpoint.clear();
+            snapshots.resume = file;
+            output += runSnapshotted( filename, compact, "ab", snapshots, &stopped );
+            ASSERT_FALSE( stopped ) << program;
+            ASSERT_EQ( output, expected ) << program;
+        }
+    }
+    std::filesystem::remove( filename );
+    std::filesystem::remove( file );
+}
+
+//  The same 16 sorts, one per job, across an increasing number of threads.
+static void CISC_Batch(benchmark::State& state) {
+    const std::vector<batch::Job> jobs( 16, batch::Job{ "../bsort.bf", "../bsort.bf" } );
+    const batch::Pool pool( static_cast<size_t>( state.range( 0 ) ) );
+    std::ostringstream out;
+    std::ostringstream err;
+    for (auto _ : state) {
+        out.str( "" );
+        benchmark::DoNotOptimize( runBatch<CompactEncoding>( jobs, pool, TapeOptions(), compile_cache::Cache::disabled(), out, err ) );
+    }
+    state.SetItemsProcessed( state.iterations() * static_cast<int64_t>( jobs.size() ) );
+}
+BENCHMARK(CISC_Batch)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+//  The rows of the matrix in workloads.hpp, in the wide encoding.
+static matrix::Prepare preparedFor( bool cache_cell ) {
+    return [=]( const matrix::Workload & workload ) -> matrix::Run {
+        auto engine = std::make_shared<Engine>( TapeOptions(), compile_cache::Cache::disabled(), profile::ProfileOptions(), cache_cell );
+        auto program = engine->compile<WideEncoding, std::ostream, std::istream>( workload.program );
+        return [=]( const std::string & text ) {
+            std::istringstream input( text );
+            std::ostringstream output;
+            engine->run<WideEncoding, std::ostream, std::istream>( *program, output, input );
+            return output.str();
+        };
+    };
+}
+static const bool CISC_ROW = matrix::addRow( "CISC", matrix::Language::BF, preparedFor( false ) );
+static const bool CISC_CACHED_CELL_ROW = matrix::addRow( "CISCCachedCell", matrix::Language::BF, preparedFor( true ) );
+
+//  Every task runs exactly once, however the work is stolen.
+TEST( Batch_Pool, EveryTaskOnce ) {
+    const size_t N = 1000;
+    std::vector<std::atomic<int>> runs( N );
+    const batch::Pool pool( 4 );
+    pool.run( N, [&]( size_t worker, size_t i ) {
+        ASSERT_LT( worker, pool.size() );
+        //  Uneven tasks, so that the workers finishing early steal.
+        if ( i < N / 4 ) {
+            std::this_thread::sleep_for( std::chrono::microseconds( 50 ) );
+        }
+        runs[ i ] += 1;
+    } );
+    for ( size_t i = 0; i < N; i++ ) {
+        ASSERT_EQ( runs[ i ], 1 ) << "task " << i;
+    }
+}
+
+TEST( Batch_Pool, RethrowsFailure ) {
+    const batch::Pool pool( 3 );
+    ASSERT_THROW(
+        pool.run( 100, []( size_t, size_t i ) {
+            if ( i == 42 ) throw std::runtime_error( "task failed" );
+        } ),
+        std::runtime_error
+    );
+}
+
+TEST( Batch_Manifest, Parsed ) {
+    std::istringstream manifest( "# A comment\n\n  a.bf\nb.bf input.txt\n" );
+    const std::vector<batch::Job> jobs = batch::readManifest( manifest );
+    ASSERT_EQ( jobs.size(), 2 );
+    ASSERT_EQ( jobs[ 0 ].program, "a.bf" );
+    ASSERT_EQ( jobs[ 0 ].input, "" );
+    ASSERT_EQ( jobs[ 1 ].program, "b.bf" );
+    ASSERT_EQ( jobs[ 1 ].input, "input.txt" );
+    std::istringstream bad( "a.bf b.bf c.bf\n" );
+    ASSERT_THROW( batch::readManifest( bad ), std::runtime_error );
+}
+
+//  A batch writes the same output, in the same order, as running each job
+//  in turn, with a failed job reported but not stopping the others.
+TEST( CISC_Batch, SameAsSequential ) {
+    const std::vector<batch::Job> jobs = {
+        { "../sierpinski.bf", "" },
+        { "../bsort.bf", "../bsort.bf" },
+        { "../hello.bf", "" },
+        { "../no_such_program.bf", "" },
+        { "../bsort.bf", "../hello.bf" },
+        { "../seek.bf", "" },
+    };
+    std::string expected;
+    for ( auto & job : jobs ) {
+        if ( std::filesystem::exists( job.program ) ) {
+            RedirectedRun redirected( job.input.empty() ? "" : readFile( job.input ) );
+            expected += redirected.run( job.program, true );
+        }
+    }
+    for ( bool compact : { false, true } ) {
+        std::ostringstream out;
+        std::ostringstream err;
+        const batch::Pool pool( 4 );
+        const size_t failures = compact ?
+            runBatch<CompactEncoding>( jobs, pool, TapeOptions(), compile_cache::Cache::disabled(), out, err ) :
+            runBatch<WideEncoding>( jobs, pool, TapeOptions(), compile_cache::Cache::disabled(), out, err );
+        ASSERT_EQ( out.str(), expected );
+        ASSERT_EQ( failures, 1 );
+        ASSERT_NE( err.str().find( "# Failed: Cannot open ../no_such_program.bf" ), std::string::npos );
+    }
+}
+
+//  The threads of a batch that plant the same source under different names
+//  store the same image at once, each through a temporary file of its own,
+//  leaving a single complete image behind.
+TEST( CISC_Batch, ConcurrentStores ) {
+    const auto dir = std::filesystem::temp_directory_path() / "cisc_batch_cache_test";
+    std::filesystem::remove_all( dir );
+    const compile_cache::Cache cache( dir );
+    std::vector<batch::Job> jobs;
+    for ( int i = 0; i < 16; i++ ) {
+        jobs.push_back( { i % 2 == 0 ? "../bsort.bf" : "./../bsort.bf", "../hello.bf" } );
+    }
+    std::string expected;
+    {
+        RedirectedRun redirected( readFile( "../hello.bf" ) );
+        expected = redirected.run( "../bsort.bf", true );
+    }
+    std::ostringstream out;
+    std::ostringstream err;
+    const batch::Pool pool( 4 );
+    ASSERT_EQ( runBatch<CompactEncoding>( jobs, pool, TapeOptions(), cache, out, err ), 0 );
+    std::string sequential;
+    for ( size_t i = 0; i < jobs.size(); i++ ) {
+        sequential += expected;
+    }
+    ASSERT_EQ( out.str(), sequential );
+    std::vector<std::filesystem::path> files;
+    for ( auto & entry : std::filesystem::recursive_directory_iterator( dir ) ) {
+        if ( entry.is_regular_file() ) {
+            files.push_back( entry.path() );
+        }
+    }
+    ASSERT_EQ( files.size(), 1 );
+    ASSERT_TRUE( image::Mapped::isImage( files[ 0 ].string() ) );
+    std::filesystem::remove_all( dir );
+}
+
+} // namespace cisc_encoding
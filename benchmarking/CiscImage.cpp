@@ -0,0 +1,321 @@
+/*
+Compares how long cisc_runner_demo takes to load a program from the JSON
+debug format and from the binary image format. Both are produced by
+cisc_compiler_demo from the same, deliberately large, Brainf*ck program.
+Also compares output a byte at a time with PUT_BYTES of the data segment.
+
+The compiler and runner are both complete programs, so each is compiled
+into its own namespace. Their shared headers are included first so that
+they stay in the global namespace.
+*/
+
+#include <algorithm>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+#include <filesystem>
+
+#include "json.hpp"
+#include "../seek.hpp"
+#include "../tape.hpp"
+#include "../buffered_io.hpp"
+#include "../image.hpp"
+#include "../profile.hpp"
+#include "workloads.hpp"
+
+#include <benchmark/benchmark.h>
+#include <gtest/gtest.h>
+
+namespace cisc_compiler {
+#define CISC_COMPILER_DEMO_NO_MAIN
+#include "../compiler_and_runner/cisc_compiler_demo.cpp"
+}
+
+#undef DEBUG
+#undef DUMP
+#undef break_if
+#undef break_unless
+#undef return_if
+#undef return_unless
+
+namespace cisc_runner {
+#define CISC_RUNNER_DEMO_NO_MAIN
+#include "../compiler_and_runner/cisc_runner_demo.cpp"
+}
+
+namespace cisc_image {
+
+//  Compiles a large program, many copies of dbf2c.bf, in both formats.
+class CompiledFiles {
+public:
+    const std::string json_file;
+    const std::string image_file;
+
+    CompiledFiles() :
+        json_file( ( std::filesystem::temp_directory_path() / "cisc_image_startup.json" ).string() ),
+        image_file( ( std::filesystem::temp_directory_path() / "cisc_image_startup.img" ).string() )
+    {
+        std::ifstream source_file( "../dbf2c.bf" );
+        std::stringstream one;
+        one << source_file.rdbuf();
+        std::stringstream source;
+        for ( int i = 0; i < 200; i++ ) {
+            source << one.str();
+        }
+        cisc_compiler::CompileFlags flags( std::vector<std::string>{} );
+        const cisc_compiler::InstructionSet instruction_set;
+        nlohmann::json program;
+        cisc_compiler::CodePlanter planter( flags, source, instruction_set, program );
+        planter.plantProgram();
+        std::ofstream json_out( json_file );
+        json_out << program.dump( 4 ) << std::endl;
+        std::ofstream image_out( image_file, std::ios::binary );
+        cisc_compiler::writeImage( program, flags.cellBits, image_out );
+    }
+
+    ~CompiledFiles() {
+        std::filesystem::remove( json_file );
+        std::filesystem::remove( image_file );
+    }
+};
+
+static const CompiledFiles & compiledFiles() {
+    static CompiledFiles files;
+    return files;
+}
+
+static std::vector<cisc_runner::Instruction> load( const std::string & filename, std::vector<std::string> & listing ) {
+    //  The labels are irrelevant here, we only measure the loading.
+    const cisc_runner::InstructionSet instruction_set{};
+    std::vector<cisc_runner::Instruction> program;
+    cisc_runner::CodePlanter planter( filename, instruction_set, program, listing );
+    planter.plantProgram();
+    return program;
+}
+
+static void CISC_Startup(benchmark::State& state, bool binary) {
+    const CompiledFiles & files = compiledFiles();
+    const std::string & filename = binary ? files.image_file : files.json_file;
+    for (auto _ : state) {
+        std::vector<std::string> listing;
+        benchmark::DoNotOptimize( load( filename, listing ) );
+    }
+}
+BENCHMARK_CAPTURE(CISC_Startup, JSON, false);
+BENCHMARK_CAPTURE(CISC_Startup, Image, true);
+
+//  Both formats must load into the same program.
+TEST( CISC_Image, SameAsJSON ) {
+    const CompiledFiles & files = compiledFiles();
+    std::vector<std::string> json_listing;
+    std::vector<std::string> image_listing;
+    auto from_json = load( files.json_file, json_listing );
+    auto from_image = load( files.image_file, image_listing );
+    ASSERT_EQ( json_listing, image_listing );
+    ASSERT_EQ( from_json.size(), from_image.size() );
+    for ( size_t i = 0; i < from_json.size(); i++ ) {
+        if ( json_listing[ i ].empty() ) {
+            //  Jump targets are pointers into each program, so compare them
+            //  as offsets.
+            bool jump = (
+                from_json[ i ].target >= from_json.data() &&
+                from_json[ i ].target < from_json.data() + from_json.size()
+            );
+            if ( jump ) {
+                ASSERT_EQ( from_json[ i ].target - from_json.data(), from_image[ i ].target - from_image.data() );
+            } else {
+                ASSERT_EQ( from_json[ i ].dyad.operand1, from_image[ i ].dyad.operand1 );
+            }
+        }
+    }
+}
+
+//  Compiles the source of a program to JSON, or an image if the flags say
+//  --binary, fusing superinstructions as cisc_compiler_demo does.
+static void compileTo( std::istream & source, const std::vector<std::string> & args, const std::string & json_file ) {
+    cisc_compiler::CompileFlags flags( args );
+    const cisc_compiler::InstructionSet instruction_set;
+    nlohmann::json program;
+    cisc_compiler::CodePlanter planter( flags, source, instruction_set, program );
+    planter.plantProgram();
+    if ( not flags.superinstructions.empty() ) {
+        std::ifstream input( flags.superinstructions );
+        nlohmann::json profile;
+        input >> profile;
+        program = cisc_compiler::SuperinstructionFuser( instruction_set, profile ).fuse( program );
+    }
+    if ( flags.binary ) {
+        std::ofstream image_out( json_file, std::ios::binary );
+        cisc_compiler::writeImage( program, flags.cellBits, image_out );
+    } else {
+        std::ofstream json_out( json_file );
+        cisc_compiler::writeJSON( program, flags.cellBits, json_out );
+    }
+}
+
+static void compileTo( const std::string & program_file, const std::vector<std::string> & args, const std::string & json_file ) {
+    std::ifstream source( program_file );
+    compileTo( source, args, json_file );
+}
+
+static std::string runJSON( const std::string & json_file, const std::string & input ) {
+    std::stringstream in( input );
+    std::stringstream out;
+    cisc_runner::Engine engine;
+    engine.runFile( json_file, false, profile::ProfileOptions(), out, in );
+    return out.str();
+}
+
+//  Offset-addressed blocks must shorten the program without changing what
+//  it does.
+TEST( CISC_Image, OffsetsSameOutput ) {
+    const std::string with_file = ( std::filesystem::temp_directory_path() / "cisc_offsets.json" ).string();
+    const std::string without_file = ( std::filesystem::temp_directory_path() / "cisc_no_offsets.json" ).string();
+    compileTo( "../bsort.bf", {}, with_file );
+    compileTo( "../bsort.bf", { "--no-offsets" }, without_file );
+    std::vector<std::string> with_listing;
+    std::vector<std::string> without_listing;
+    ASSERT_LT( load( with_file, with_listing ).size(), load( without_file, without_listing ).size() );
+    const std::string input = "the quick brown fox jumps over the lazy dog";
+    ASSERT_EQ( runJSON( with_file, input ), runJSON( without_file, input ) );
+    std::filesystem::remove( with_file );
+    std::filesystem::remove( without_file );
+}
+
+//  The superinstructions fused from a profile of bsort.bf shorten it and
+//  must not change what it does, whatever the width of its cells. With
+//  offsets MOVE+OPEN is planted anyway, and without them it is fused.
+TEST( CISC_Image, SuperinstructionsSameOutput ) {
+    const std::string profile_file = ( std::filesystem::temp_directory_path() / "cisc_superinstructions_profile.json" ).string();
+    const std::string fused_file = ( std::filesystem::temp_directory_path() / "cisc_fused.json" ).string();
+    const std::string unfused_file = ( std::filesystem::temp_directory_path() / "cisc_unfused.json" ).string();
+    const std::string input = "the quick brown fox jumps over the lazy dog";
+    const std::vector<std::pair<std::vector<std::string>, std::vector<std::string>>> variants = {
+        { {}, { "MOVE+XFR_MULTIPLE", "RIGHT+SEEK_LEFT" } },
+        { { "--no-offsets" }, { "MOVE+OPEN", "MOVE+XFR_MULTIPLE", "RIGHT+SEEK_LEFT" } }
+    };
+    for ( auto & [ args, names ] : variants ) {
+        compileTo( "../bsort.bf", args, unfused_file );
+        {
+            profile::ProfileOptions profiling;
+            profiling.file = profile_file;
+            std::stringstream in( input );
+            std::stringstream out;
+            cisc_runner::Engine engine;
+            engine.runFile( unfused_file, false, profiling, out, in );
+        }
+        for ( std::string bits : { "8", "16" } ) {
+            std::vector<std::string> unfused_args = args;
+            unfused_args.push_back( "--cell-bits=" + bits );
+            std::vector<std::string> fused_args = unfused_args;
+            fused_args.push_back( "--superinstructions=" + profile_file );
+            compileTo( "../bsort.bf", unfused_args, unfused_file );
+            compileTo( "../bsort.bf", fused_args, fused_file );
+            std::vector<std::string> fused_listing;
+            std::vector<std::string> unfused_listing;
+            ASSERT_LT( load( fused_file, fused_listing ).size(), load( unfused_file, unfused_listing ).size() ) << bits;
+            for ( auto & name : names ) {
+                ASSERT_GT(
+                    std::count( fused_listing.begin(), fused_listing.end(), name ),
+                    std::count( unfused_listing.begin(), unfused_listing.end(), name )
+                ) << name << " " << bits;
+            }
+            ASSERT_EQ( runJSON( fused_file, input ), runJSON( unfused_file, input ) ) << bits;
+        }
+    }
+    std::filesystem::remove( profile_file );
+    std::filesystem::remove( fused_file );
+    std::filesystem::remove( unfused_file );
+}
+
+//  sierpinski.bf reads no input, so with --constants it is a single
+//  PUT_BYTES of the data segment rather than a PUT per byte.
+static void CISC_BulkOutput(benchmark::State& state, bool constants) {
+    const std::string image_file = ( std::filesystem::temp_directory_path() / "cisc_bulk_output.img" ).string();
+    compileTo( "../sierpinski.bf", { "--binary", constants ? "--constants" : "--no-constants" }, image_file );
+    for (auto _ : state) {
+        CapturedOutput out;
+        StringInput in;
+        cisc_runner::Engine engine;
+        engine.runFile( image_file, false, profile::ProfileOptions(), out, in );
+        benchmark::DoNotOptimize( out.str() );
+    }
+    std::filesystem::remove( image_file );
+}
+BENCHMARK_CAPTURE(CISC_BulkOutput, PutBytes, true);
+BENCHMARK_CAPTURE(CISC_BulkOutput, Put, false);
+
+//  A program that reads no input compiles to a single PUT_BYTES of its
+//  output, and what is known of the cells must not change what any program
+//  does, nor must reading several cells at once.
+TEST( CISC_Image, ConstantsSameOutput ) {
+    const std::string json_file = ( std::filesystem::temp_directory_path() / "cisc_constants.json" ).string();
+    const std::string image_file = ( std::filesystem::temp_directory_path() / "cisc_constants.img" ).string();
+    compileTo( "../hello.bf", {}, json_file );
+    std::vector<std::string> listing;
+    load( json_file, listing );
+    std::vector<std::string> run;
+    for ( auto & name : listing ) {
+        if ( name == "HALT" ) break;
+        if ( not name.empty() ) run.push_back( name );
+    }
+    ASSERT_EQ( run, std::vector<std::string>{ "PUT_BYTES" } );
+    compileTo( "../sierpinski.bf", {}, json_file );
+    compileTo( "../sierpinski.bf", { "--binary" }, image_file );
+    ASSERT_EQ( runJSON( image_file, "" ), runJSON( json_file, "" ) );
+
+    const std::vector<std::string> sources = {
+        "++++++++[>++++++++<-]>+.,.>+++.<<",
+        ">+++++[<++++++>-],>.<[>+>+<<-]>[-]>.<<.",
+        "+++>,<[->>+<<]>>.>++[>+++<-]>.[-]+++.[>]<.",
+        ">>,[>>+>>,]<<[.<<]+++.",
+        ">,[.>,]",
+        ",>,>,>,<<<.>.>.>.>,>,.<.++[->+>+<<]>>.",
+    };
+    const std::string input = "constant";
+    for ( auto & source : sources ) {
+        std::string outputs[ 2 ];
+        for ( int constants = 0; constants < 2; constants++ ) {
+            std::stringstream in( source );
+            compileTo( in, { constants ? "--constants" : "--no-constants" }, json_file );
+            outputs[ constants ] = runJSON( json_file, input );
+        }
+        ASSERT_EQ( outputs[ 0 ], matrix::referenceOf( source, input ).output ) << source;
+        ASSERT_EQ( outputs[ 1 ], outputs[ 0 ] ) << source;
+    }
+    std::filesystem::remove( json_file );
+    std::filesystem::remove( image_file );
+}
+
+//  The width of the cells goes with the program, in either format, so the
+//  runner wraps as the compiler did when it folded the constant prefix.
+TEST( CISC_Image, CellBitsRecorded ) {
+    const std::string json_file = ( std::filesystem::temp_directory_path() / "cisc_cell_bits.json" ).string();
+    const std::string image_file = ( std::filesystem::temp_directory_path() / "cisc_cell_bits.img" ).string();
+    //  Prints 1 unless 256 wraps to zero, and reads so that not all of it
+    //  is folded.
+    const std::string source = "++++++++[>++++++++<-]>[<++++>-]<[" + std::string( 49, '+' ) + ".[-]],[>+<-]>.";
+    const std::map<std::string, std::string> expected = { { "8", "A" }, { "16", "1A" }, { "32", "1A" } };
+    for ( auto & [ bits, output ] : expected ) {
+        for ( const char * constants : { "--constants", "--no-constants" } ) {
+            std::stringstream json_source( source );
+            compileTo( json_source, { "--cell-bits=" + bits, constants }, json_file );
+            ASSERT_EQ( runJSON( json_file, "A" ), output ) << bits << constants;
+            std::stringstream image_source( source );
+            compileTo( image_source, { "--cell-bits=" + bits, constants, "--binary" }, image_file );
+            ASSERT_EQ( runJSON( image_file, "A" ), output ) << bits << constants;
+        }
+    }
+    std::filesystem::remove( json_file );
+    std::filesystem::remove( image_file );
+}
+
+} // namespace cisc_image
@@ -17,6 +17,7 @@ method (Engine::runFile) fit on a single screen.
 #include <fstream>
 #include <map>
 #include <sstream>
+#include <algorithm>
 #include "unreachable.hpp"
 
 namespace computed_gotos {
@@ -102,9 +103,22 @@ public:
 
 typedef unsigned char num;
 
+//  The engine has several dispatch loops, so a program is prepared for one
+//  of them.
+enum struct Dispatch {
+    LABELS,
+    MACROS,
+    UNREACHABLE
+};
+
+//  A program planted once, ahead of any number of executions.
+struct PreparedProgram {
+    Dispatch dispatch;
+    std::vector<Instruction> code;
+};
+
 class Engine {
-    std::map<char, OpCode> opcode_map;
-    std::vector<Instruction> program;
+    std::map<Dispatch, std::map<char, OpCode>> opcode_maps;
     std::vector<num> memory;
 public:
     Engine() : 
@@ -112,31 +126,89 @@ public:
     {}
 
 public:
+    PreparedProgram compile( std::string_view filename, Dispatch dispatch = Dispatch::LABELS ) {
+        const std::map<char, OpCode> & opcode_map = opcode_maps[ dispatch ];
+        if ( opcode_map.empty() ) {
+            //  A dispatch loop records its opcodes when called without a 
+            //  program, as labels can only be taken inside their function.
+            run( dispatch, nullptr, std::cin, std::cout );
+        }
+        PreparedProgram prepared{ dispatch, {} };
+        CodePlanter planter( filename, opcode_map, prepared.code );
+        planter.plantProgram();
+        return prepared;
+    }
+
+    //  Runs a prepared program from a cleared tape.
+    void execute( const PreparedProgram & prepared, std::istream & in = std::cin, std::ostream & out = std::cout ) {
+        reset();
+        run( prepared.dispatch, &prepared.code, in, out );
+    }
+
+    void reset() {
+        std::fill( memory.begin(), memory.end(), 0 );
+    }
+
+    //  Compiles and executes in one go.
     template<typename StreamType = std::ostream>
-    inline void runFile( std::string_view filename, bool header_needed, StreamType& outStream = std::cout ) {
+    void runFile( std::string_view filename, bool header_needed, StreamType& outStream = std::cout ) {
         if ( header_needed ) {
             std::cerr << "# Executing: " << filename << std::endl;
         }
+        execute( compile( filename, Dispatch::LABELS ), std::cin, outStream );
+    }
 
-        opcode_map = {
-            { '+', &&INCR },
-            { '-', &&DECR },
-            { '<', &&LEFT },
-            { '>', &&RIGHT },
-            { '[', &&OPEN },
-            { ']', &&CLOSE },
-            { '.', &&PUT },
-            { ',', &&GET },
-            { '\0', &&HALT }
-        };
-        
-        CodePlanter planter( filename, opcode_map, program );
-        planter.plantProgram();
+    template<typename StreamType = std::ostream>
+    void runMacros( std::string_view filename, bool header_needed, StreamType& outStream = std::cout ) {
+        if ( header_needed ) {
+            outStream << "# Executing: " << filename << "\n";
+        }
+        execute( compile( filename, Dispatch::MACROS ), std::cin, outStream );
+    }
 
-        std::noskipws( std::cin );
+    template<typename StreamType = std::ostream>
+    void runUnreachable( std::string_view filename, bool header_needed, StreamType& outStream = std::cout ) {
+        if ( header_needed ) {
+            outStream << "# Executing: " << filename << "\n";
+        }
+        execute( compile( filename, Dispatch::UNREACHABLE ), std::cin, outStream );
+    }
+
+private:
+    void run( Dispatch dispatch, const std::vector<Instruction> * program, std::istream & in, std::ostream & out ) {
+        switch ( dispatch ) {
+            case Dispatch::LABELS:
+                dispatchLabels( program, in, out );
+                break;
+            case Dispatch::MACROS:
+                dispatchMacros( program, in, out );
+                break;
+            case Dispatch::UNREACHABLE:
+                dispatchUnreachable( program, in, out );
+                break;
+        }
+    }
+
+    void dispatchLabels( const std::vector<Instruction> * program, std::istream & in, std::ostream & outStream ) {
+        if ( program == nullptr ) {
+            opcode_maps[ Dispatch::LABELS ] = {
+                { '+', &&INCR },
+                { '-', &&DECR },
+                { '<', &&LEFT },
+                { '>', &&RIGHT },
+                { '[', &&OPEN },
+                { ']', &&CLOSE },
+                { '.', &&PUT },
+                { ',', &&GET },
+                { '\0', &&HALT }
+            };
+            return;
+        }
 
-        auto program_data = program.data();
-        Instruction * pc = &program_data[0];
+        std::noskipws( in );
+
+        auto program_data = program->data();
+        const Instruction * pc = &program_data[0];
         num * loc = &memory.data()[0];
         goto *(pc++->opcode);
 
@@ -172,8 +244,8 @@ public:
         if ( DEBUG ) std::cout << "GET" << std::endl;
         {
             char ch;
-            std::cin.get( ch );
-            if (std::cin.good()) {
+            in.get( ch );
+            if (in.good()) {
                 *loc = ch;
             }
         }
@@ -201,31 +273,26 @@ public:
         return;
     } // End function
 
-    template<typename StreamType = std::ostream>
-    inline void runMacros( std::string_view filename, bool header_needed, StreamType& outStream = std::cout ) {
-        if ( header_needed ) {
-            outStream << "# Executing: " << filename << "\n";
+    void dispatchMacros( const std::vector<Instruction> * program, std::istream & in, std::ostream & outStream ) {
+        if ( program == nullptr ) {
+            opcode_maps[ Dispatch::MACROS ] = {
+                { '+', &&INCR },
+                { '-', &&DECR },
+                { '<', &&LEFT },
+                { '>', &&RIGHT },
+                { '[', &&OPEN },
+                { ']', &&CLOSE },
+                { '.', &&PUT },
+                { ',', &&GET },
+                { '\0', &&HALT }
+            };
+            return;
         }
 
-        opcode_map = {
-            { '+', &&INCR },
-            { '-', &&DECR },
-            { '<', &&LEFT },
-            { '>', &&RIGHT },
-            { '[', &&OPEN },
-            { ']', &&CLOSE },
-            { '.', &&PUT },
-            { ',', &&GET },
-            { '\0', &&HALT }
-        };
-        
-        CodePlanter planter( filename, opcode_map, program );
-        planter.plantProgram();
-
-        std::noskipws( std::cin );
+        std::noskipws( in );
 
-        auto program_data = program.data();
-        Instruction * pc = &program_data[0];
+        auto program_data = program->data();
+        const Instruction * pc = &program_data[0];
         num * loc = &memory.data()[0];
         goto *(pc++->opcode);
 
@@ -244,8 +311,8 @@ public:
         );
     ON_LABEL_DO(GET,
             char ch;
-            std::cin.get( ch );
-            if (std::cin.good()) {
+            in.get( ch );
+            if (in.good()) {
                 *loc = ch;
             }
         );
@@ -266,31 +333,26 @@ public:
     } // End function
 
     # undef ON_LABEL_DO
-    template<typename StreamType = std::ostream>
-    inline void runUnreachable( std::string_view filename, bool header_needed, StreamType& outStream = std::cout ) {
-        if ( header_needed ) {
-            outStream << "# Executing: " << filename << "\n";
+    void dispatchUnreachable( const std::vector<Instruction> * program, std::istream & in, std::ostream & outStream ) {
+        if ( program == nullptr ) {
+            opcode_maps[ Dispatch::UNREACHABLE ] = {
+                { '+', &&INCR },
+                { '-', &&DECR },
+                { '<', &&LEFT },
+                { '>', &&RIGHT },
+                { '[', &&OPEN },
+                { ']', &&CLOSE },
+                { '.', &&PUT },
+                { ',', &&GET },
+                { '\0', &&HALT }
+            };
+            return;
         }
 
-        opcode_map = {
-            { '+', &&INCR },
-            { '-', &&DECR },
-            { '<', &&LEFT },
-            { '>', &&RIGHT },
-            { '[', &&OPEN },
-            { ']', &&CLOSE },
-            { '.', &&PUT },
-            { ',', &&GET },
-            { '\0', &&HALT }
-        };
-        
-        CodePlanter planter( filename, opcode_map, program );
-        planter.plantProgram();
-
-        std::noskipws( std::cin );
+        std::noskipws( in );
 
-        auto program_data = program.data();
-        Instruction * pc = &program_data[0];
+        auto program_data = program->data();
+        const Instruction * pc = &program_data[0];
         num * loc = &memory.data()[0];
         goto *(pc++->opcode);
 
@@ -311,8 +373,8 @@ public:
             );
         ON_LABEL_DO(GET,
                 char ch;
-                std::cin.get( ch );
-                if (std::cin.good()) {
+                in.get( ch );
+                if (in.good()) {
                     *loc = ch;
                 }
             );
@@ -343,54 +405,98 @@ threaded coded and executed.
 
 #include <benchmark/benchmark.h>
 #include <gtest/gtest.h>
+#include "workloads.hpp"
 
 namespace computed_gotos {
+//  Planting alone, whereas the benchmarks below measure only the dispatch
+//  loop running an already prepared program.
+static void CG_Compile(benchmark::State& state, Dispatch dispatch) {
+    Engine engine{};
+    for (auto _ : state) {
+        benchmark::DoNotOptimize( engine.compile( "../sierpinski.bf", dispatch ) );
+    }
+}
+BENCHMARK_CAPTURE(CG_Compile, CG_Labels, Dispatch::LABELS);
+BENCHMARK_CAPTURE(CG_Compile, CG_LabelsMacros, Dispatch::MACROS);
+BENCHMARK_CAPTURE(CG_Compile, CG_LabelsUnreachable, Dispatch::UNREACHABLE);
+
 static void CG_Labels(benchmark::State& state) {
     Engine engine{};
+    const PreparedProgram program = engine.compile( "../sierpinski.bf", Dispatch::LABELS );
+    std::istringstream input{};
     std::ostringstream output{};
+    perf_counters::HardwareCounters hardware;
+    hardware.start();
     for (auto _ : state) {
-        engine.runFile( "../sierpinski.bf", false, output );
+        engine.execute( program, input, output );
     }
+    hardware.stop();
+    matrix::reportHardware( state, hardware, matrix::instructionsOf( "../sierpinski.bf" ) );
 }
 BENCHMARK(CG_Labels);
 
 static void CG_LabelsMacros(benchmark::State& state) {
     Engine engine{};
+    const PreparedProgram program = engine.compile( "../sierpinski.bf", Dispatch::MACROS );
+    std::istringstream input{};
     std::ostringstream output{};
+    perf_counters::HardwareCounters hardware;
+    hardware.start();
     for (auto _ : state) {
-        engine.runMacros( "../sierpinski.bf", false, output);
+        engine.execute( program, input, output );
     }
+    hardware.stop();
+    matrix::reportHardware( state, hardware, matrix::instructionsOf( "../sierpinski.bf" ) );
 }
 BENCHMARK(CG_LabelsMacros);
 
 static void CG_LabelsUnreachable(benchmark::State& state) {
     Engine engine{};
+    const PreparedProgram program = engine.compile( "../sierpinski.bf", Dispatch::UNREACHABLE );
+    std::istringstream input{};
     std::ostringstream output{};
+    perf_counters::HardwareCounters hardware;
+    hardware.start();
     for (auto _ : state) {
-        engine.runUnreachable( "../sierpinski.bf", false, output );
+        engine.execute( program, input, output );
     }
+    hardware.stop();
+    matrix::reportHardware( state, hardware, matrix::instructionsOf( "../sierpinski.bf" ) );
 }
 BENCHMARK(CG_LabelsUnreachable);
 
+//  The rows of the matrix in workloads.hpp.
+static const bool LABELS_ROW = matrix::addRow( "Labels", matrix::Language::BF, []( const matrix::Workload & workload ) -> matrix::Run {
+    auto engine = std::make_shared<Engine>();
+    auto program = std::make_shared<const PreparedProgram>( engine->compile( workload.program, Dispatch::LABELS ) );
+    return [=]( const std::string & text ) {
+        std::istringstream input( text );
+        std::ostringstream output;
+        engine->execute( *program, input, output );
+        return output.str();
+    };
+} );
+static const bool LABELSUNREACHABLE_ROW = matrix::addRow( "LabelsUnreachable", matrix::Language::BF, []( const matrix::Workload & workload ) -> matrix::Run {
+    auto engine = std::make_shared<Engine>();
+    auto program = std::make_shared<const PreparedProgram>( engine->compile( workload.program, Dispatch::UNREACHABLE ) );
+    return [=]( const std::string & text ) {
+        std::istringstream input( text );
+        std::ostringstream output;
+        engine->execute( *program, input, output );
+        return output.str();
+    };
+} );
+
 TEST( CG_DirectThreadedCode, NoChange ) {
     std::stringstream output_expected{};
     std::stringstream output_macros{};
-    {
-        // std::cout << "Running without lambdas" << std::endl;
-        Engine engine{};
-        engine.runFile( "../sierpinski.bf", false, output_expected );
-        engine.runFile( "../hello.bf", false, output_expected );
-        engine.runFile( "../head.bf", false, output_expected );
-
-        // std::cout << "Ran without lambdas" << std::endl;
-    }
-    {
-        // std::cout << "Running with lambdas" << std::endl;
+    for ( auto filename : { "../sierpinski.bf", "../hello.bf", "../head.bf" } ) {
+        //  head.bf reads its input, so give it some.
         Engine engine{};
-        engine.runMacros( "../sierpinski.bf", false, output_macros );
-        engine.runMacros( "../hello.bf", false, output_macros );
-        engine.runMacros( "../head.bf", false, output_macros );
-        // std::cout << "Ran with lambdas" << std::endl;
+        std::istringstream input_expected( "one\ntwo\n" );
+        std::istringstream input_macros( "one\ntwo\n" );
+        engine.execute( engine.compile( filename, Dispatch::LABELS ), input_expected, output_expected );
+        engine.execute( engine.compile( filename, Dispatch::MACROS ), input_macros, output_macros );
     }
     ASSERT_TRUE( output_expected.good()     );
     ASSERT_TRUE( output_macros  .good()     );
@@ -401,6 +507,24 @@ TEST( CG_DirectThreadedCode, NoChange ) {
     ASSERT_EQ( output_expected.str(), output_macros.str() );
 }
 
+//  A prepared program can be executed repeatedly, each time from a cleared
+//  tape, with the same result as compiling and executing it afresh.
+TEST( CG_DirectThreadedCode, Reexecute ) {
+    std::ostringstream expected{};
+    {
+        Engine engine{};
+        engine.runFile( "../sierpinski.bf", false, expected );
+    }
+    Engine engine{};
+    const PreparedProgram program = engine.compile( "../sierpinski.bf", Dispatch::UNREACHABLE );
+    for ( int i = 0; i < 3; i++ ) {
+        std::istringstream input{};
+        std::ostringstream output{};
+        engine.execute( program, input, output );
+        ASSERT_EQ( output.str(), expected.str() );
+    }
+}
+
 } // namespace two
 
 int main(int argc, char** argv) {   
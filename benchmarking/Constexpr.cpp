@@ -0,0 +1,129 @@
+/*
+Compares the ahead-of-time engine of constexpr_engine.hpp, which compiles a
+Brainf*ck program into straight-line C++, against the interpreters. The
+programs are embedded as string literals, which CMake generates from the
+.bf files in the parent folder.
+
+    Constexpr_Sierpinski    against CG_Labels and Switch
+    Constexpr_Bsort         against CISC_Encoding/WideBsort, on the same input
+*/
+
+#include "constexpr_engine.hpp"
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <gtest/gtest.h>
+
+namespace constexpr_ {
+
+static constexpr char SIERPINSKI[] =
+#include "programs/sierpinski.bf.inc"
+;
+
+static constexpr char BSORT[] =
+#include "programs/bsort.bf.inc"
+;
+
+static constexpr auto SIERPINSKI_PROGRAM = constexpr_engine::parse( SIERPINSKI );
+static constexpr auto BSORT_PROGRAM = constexpr_engine::parse( BSORT );
+
+static std::string readFile( const std::string & filename ) {
+    std::ifstream file( filename );
+    std::stringstream text;
+    text << file.rdbuf();
+    return text.str();
+}
+
+static void Constexpr_Sierpinski(benchmark::State& state) {
+    std::istringstream input;
+    std::ostringstream output{};
+    for (auto _ : state) {
+        constexpr_engine::run<SIERPINSKI_PROGRAM>( input, output );
+    }
+}
+BENCHMARK(Constexpr_Sierpinski);
+
+//  bsort.bf sorts its input, so we give it its own source code to sort.
+static void Constexpr_Bsort(benchmark::State& state) {
+    const std::string text = readFile( "../bsort.bf" );
+    for (auto _ : state) {
+        std::istringstream input( text );
+        std::ostringstream output;
+        constexpr_engine::run<BSORT_PROGRAM>( input, output );
+        benchmark::DoNotOptimize( output.str() );
+    }
+}
+BENCHMARK(Constexpr_Bsort);
+
+//  The simplest possible interpreter, one character at a time, as the
+//  reference for the ahead-of-time engine.
+static std::string interpret( const std::string & source, const std::string & text ) {
+    std::vector<unsigned char> tape( 30000 );
+    std::vector<size_t> match( source.size() );
+    std::vector<size_t> opens;
+    for ( size_t i = 0; i < source.size(); i++ ) {
+        if ( source[ i ] == '[' ) {
+            opens.push_back( i );
+        } else if ( source[ i ] == ']' ) {
+            match[ i ] = opens.back();
+            match[ opens.back() ] = i;
+            opens.pop_back();
+        }
+    }
+    std::string output;
+    size_t in = 0;
+    unsigned char * loc = tape.data();
+    for ( size_t pc = 0; pc < source.size(); pc++ ) {
+        switch ( source[ pc ] ) {
+            case '+': ++*loc; break;
+            case '-': --*loc; break;
+            case '>': ++loc; break;
+            case '<': --loc; break;
+            case '.': output += static_cast<char>( *loc ); break;
+            case ',': if ( in < text.size() ) *loc = static_cast<unsigned char>( text[ in++ ] ); break;
+            case '[': if ( *loc == 0 ) pc = match[ pc ]; break;
+            case ']': if ( *loc != 0 ) pc = match[ pc ]; break;
+        }
+    }
+    return output;
+}
+
+//  The embedded copies must be the programs on disk, and must run the same
+//  as they do under the reference interpreter.
+TEST( Constexpr, SameAsInterpreter ) {
+    ASSERT_EQ( std::string( SIERPINSKI ), readFile( "../sierpinski.bf" ) );
+    ASSERT_EQ( std::string( BSORT ), readFile( "../bsort.bf" ) );
+    const std::string text = readFile( "../bsort.bf" );
+    {
+        std::istringstream input;
+        std::ostringstream output;
+        constexpr_engine::run<SIERPINSKI_PROGRAM>( input, output );
+        ASSERT_NE( output.str().size(), 0 );
+        ASSERT_EQ( output.str(), interpret( SIERPINSKI, "" ) );
+    }
+    {
+        std::istringstream input( text );
+        std::ostringstream output;
+        constexpr_engine::run<BSORT_PROGRAM>( input, output );
+        ASSERT_EQ( output.str(), interpret( BSORT, text ) );
+    }
+}
+
+//  Runs are folded and [-] becomes SET_ZERO.
+TEST( Constexpr, Folding ) {
+    static constexpr char SOURCE[] = "+++>>-<[-]";
+    constexpr auto program = constexpr_engine::parse( SOURCE );
+    static_assert( program.size == 5 );
+    static_assert( program.code[ 0 ].opcode == constexpr_engine::OpCode::ADD && program.code[ 0 ].operand == 3 );
+    static_assert( program.code[ 1 ].opcode == constexpr_engine::OpCode::MOVE && program.code[ 1 ].operand == 2 );
+    static_assert( program.code[ 2 ].opcode == constexpr_engine::OpCode::ADD && program.code[ 2 ].operand == -1 );
+    static_assert( program.code[ 3 ].opcode == constexpr_engine::OpCode::MOVE && program.code[ 3 ].operand == -1 );
+    static_assert( program.code[ 4 ].opcode == constexpr_engine::OpCode::SET_ZERO );
+    SUCCEED();
+}
+
+} // namespace constexpr_
@@ -0,0 +1,121 @@
+/*
+The baseline row of the dispatch-strategy matrix in workloads.hpp, and the
+check that every row gets the same answers as the plain interpreter there,
+and of the hardware counters that the rows report.
+
+    Baseline        bsort.c, the translation of bsort.bf into C by dbf2c.bf,
+                    which CMakeLists.txt builds as its own program
+
+The baseline is a separate process, so its times include starting it and
+passing its input and output through pipes. It only runs bsort.bf.
+*/
+
+#include <cerrno>
+#include <stdexcept>
+#include <string>
+
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <benchmark/benchmark.h>
+#include <gtest/gtest.h>
+
+#include "workloads.hpp"
+
+extern char ** environ;
+
+namespace matrix {
+
+//  Runs a program with the text as its standard input, returning its
+//  standard output. The text must fit in a pipe.
+static std::string runProcess( const std::string & path, const std::string & text ) {
+    int in[ 2 ];
+    int out[ 2 ];
+    if ( pipe( in ) != 0 || pipe( out ) != 0 ) {
+        throw std::runtime_error( "Cannot create pipes" );
+    }
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init( &actions );
+    posix_spawn_file_actions_adddup2( &actions, in[ 0 ], STDIN_FILENO );
+    posix_spawn_file_actions_adddup2( &actions, out[ 1 ], STDOUT_FILENO );
+    for ( int fd : { in[ 0 ], in[ 1 ], out[ 0 ], out[ 1 ] } ) {
+        posix_spawn_file_actions_addclose( &actions, fd );
+    }
+    char * argv[] = { const_cast<char *>( path.c_str() ), nullptr };
+    pid_t pid;
+    const int error = posix_spawn( &pid, path.c_str(), &actions, nullptr, argv, environ );
+    posix_spawn_file_actions_destroy( &actions );
+    close( in[ 0 ] );
+    close( out[ 1 ] );
+    if ( error != 0 ) {
+        close( in[ 1 ] );
+        close( out[ 0 ] );
+        throw std::runtime_error( "Cannot run " + path );
+    }
+
+    const bool written = write( in[ 1 ], text.data(), text.size() ) == static_cast<ssize_t>( text.size() );
+    close( in[ 1 ] );
+    std::string output;
+    char buffer[ 4096 ];
+    for (;;) {
+        const ssize_t n = read( out[ 0 ], buffer, sizeof( buffer ) );
+        if ( n > 0 ) {
+            output.append( buffer, static_cast<size_t>( n ) );
+        } else if ( n == 0 || errno != EINTR ) {
+            break;
+        }
+    }
+    close( out[ 0 ] );
+    int status = 0;
+    waitpid( pid, &status, 0 );
+    if ( not written || not WIFEXITED( status ) || WEXITSTATUS( status ) != 0 ) {
+        throw std::runtime_error( "Failed to run " + path );
+    }
+    return output;
+}
+
+#ifdef BSORT_BASELINE
+static const bool BASELINE_ROW = addRow( "Baseline", Language::BF, []( const Workload & ) -> Run {
+    return []( const std::string & text ) {
+        return runProcess( BSORT_BASELINE, text );
+    };
+}, "../bsort.bf" );
+#endif
+
+//  Every strategy must agree with the plain interpreter on every workload,
+//  or there is no point comparing their times.
+TEST( Matrix, SameOutput ) {
+    ASSERT_FALSE( rows().empty() );
+    for ( const Row & row : rows() ) {
+        for ( const Workload & workload : workloads() ) {
+            if ( workload.language != Language::BF || not runs( row, workload ) ) continue;
+            const matrix::Run run = row.prepare( workload );
+            ASSERT_EQ( run( inputOf( workload ) ), referenceOf( workload ).output ) << row.strategy << " on " << workload.name;
+        }
+    }
+}
+
+//  Counting more work must give more instructions, on a host that counts
+//  them at all.
+TEST( PerfCounters, Instructions ) {
+    perf_counters::HardwareCounters hardware;
+    if ( not hardware.available() ) {
+        GTEST_SKIP() << "No hardware counters on this host";
+    }
+    auto instructionsFor = [&]( int n ) {
+        hardware.start();
+        volatile int sum = 0;
+        for ( int i = 0; i < n; i++ ) {
+            sum = sum + i;
+        }
+        hardware.stop();
+        for ( auto & [ name, count ] : hardware.read() ) {
+            if ( name == "instructions" ) return count;
+        }
+        return 0.0;
+    };
+    ASSERT_LT( instructionsFor( 1000 ), instructionsFor( 1000000 ) );
+}
+
+} // namespace matrix
@@ -0,0 +1,120 @@
+/*
+Compares the vectorised seek kernels in seek.hpp against the one cell at a
+time loop they replace. The tape is a long run of non-zero cells with a
+zero at either end, which is the worst case for the scalar loop.
+*/
+
+#include "../seek.hpp"
+
+#include <random>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <gtest/gtest.h>
+
+namespace seek_ {
+
+typedef seek::cell cell;
+
+constexpr size_t TAPE = 30000;
+
+static std::vector<cell> runTape() {
+    std::vector<cell> tape( TAPE, 1 );
+    tape.front() = 0;
+    tape.back() = 0;
+    return tape;
+}
+
+static void Seek_ScalarRight(benchmark::State& state) {
+    std::vector<cell> tape = runTape();
+    const size_t stride = static_cast<size_t>( state.range( 0 ) );
+    for (auto _ : state) {
+        cell * loc = tape.data() + 1;
+        while ( *loc ) {
+            loc += stride;
+        }
+        benchmark::DoNotOptimize( loc );
+    }
+}
+BENCHMARK(Seek_ScalarRight)->Arg(1)->Arg(3);
+
+static void Seek_VectorRight(benchmark::State& state) {
+    std::vector<cell> tape = runTape();
+    const size_t stride = static_cast<size_t>( state.range( 0 ) );
+    for (auto _ : state) {
+        benchmark::DoNotOptimize( seek::right( tape.data() + 1, tape.data() + tape.size(), stride ) );
+    }
+}
+BENCHMARK(Seek_VectorRight)->Arg(1)->Arg(3);
+
+static void Seek_ScalarLeft(benchmark::State& state) {
+    std::vector<cell> tape = runTape();
+    const size_t stride = static_cast<size_t>( state.range( 0 ) );
+    for (auto _ : state) {
+        cell * loc = tape.data() + tape.size() - 2;
+        while ( *loc ) {
+            loc -= stride;
+        }
+        benchmark::DoNotOptimize( loc );
+    }
+}
+BENCHMARK(Seek_ScalarLeft)->Arg(1)->Arg(3);
+
+static void Seek_VectorLeft(benchmark::State& state) {
+    std::vector<cell> tape = runTape();
+    const size_t stride = static_cast<size_t>( state.range( 0 ) );
+    for (auto _ : state) {
+        benchmark::DoNotOptimize( seek::left( tape.data() + tape.size() - 2, tape.data(), stride ) );
+    }
+}
+BENCHMARK(Seek_VectorLeft)->Arg(1)->Arg(3);
+
+//  A short tape with a sprinkling of zeros. Every starting point and
+//  stride must land on the same cell as the scalar loop, including those
+//  within a vector's width of either end. The wider cells are multiples of
+//  256, so that a cell that is zero only in its low byte is not taken for
+//  a zero.
+template <typename T>
+static void sameAsScalar() {
+    std::mt19937 random( 42 );
+    std::vector<T> tape( 300 );
+    for ( auto & c : tape ) {
+        c = static_cast<T>( ( random() % 24 ) << ( sizeof( T ) > 1 ? 8 : 0 ) );
+    }
+    tape.front() = 0;
+    tape.back() = 0;
+    const ptrdiff_t size = static_cast<ptrdiff_t>( tape.size() );
+    for ( size_t stride = 1; stride <= 40; stride++ ) {
+        const ptrdiff_t s = static_cast<ptrdiff_t>( stride );
+        for ( ptrdiff_t start = 0; start < size; start++ ) {
+            ptrdiff_t i = start;
+            while ( i < size && tape[ static_cast<size_t>( i ) ] ) {
+                i += s;
+            }
+            if ( i < size ) {
+                ASSERT_EQ( seek::right( tape.data() + start, tape.data() + size, stride ), tape.data() + i );
+            }
+            ptrdiff_t j = start;
+            while ( j >= 0 && tape[ static_cast<size_t>( j ) ] ) {
+                j -= s;
+            }
+            if ( j >= 0 ) {
+                ASSERT_EQ( seek::left( tape.data() + start, tape.data(), stride ), tape.data() + j );
+            }
+        }
+    }
+}
+
+TEST( Seek, SameAsScalar ) {
+    sameAsScalar<cell>();
+}
+
+TEST( Seek, SameAsScalar16 ) {
+    sameAsScalar<uint16_t>();
+}
+
+TEST( Seek, SameAsScalar32 ) {
+    sameAsScalar<uint32_t>();
+}
+
+} // namespace seek_
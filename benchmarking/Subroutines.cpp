@@ -0,0 +1,117 @@
+/*
+The three subroutine-threaded engines, as rows of the dispatch-strategy
+matrix in workloads.hpp:
+
+    Subroutine      subroutine_threading_demo.cpp, in which each handler
+                    is a member function that advances the pc it is given
+    AltSubroutine   alt_subroutine_threading_demo.cpp, in which each
+                    handler returns the next pc
+    Alt2Subroutine  alt2_subroutine_threading_demo.cpp, in which the pc is
+                    a member of the engine
+
+The demos read std::cin and write std::cout, so the rows redirect them.
+Each demo is a complete program, so each is compiled into its own
+namespace.
+*/
+
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../tape.hpp"
+
+#include <benchmark/benchmark.h>
+#include <gtest/gtest.h>
+
+#include "workloads.hpp"
+
+namespace subroutine {
+#define SUBROUTINE_THREADING_DEMO_NO_MAIN
+#include "../subroutine_threading_demo.cpp"
+}
+
+#undef DEBUG
+#undef break_if
+#undef break_unless
+#undef return_if
+
+namespace alt_subroutine {
+#define ALT_SUBROUTINE_THREADING_DEMO_NO_MAIN
+#include "../alt_subroutine_threading_demo.cpp"
+}
+
+#undef DEBUG
+#undef break_if
+#undef break_unless
+#undef return_if
+
+namespace alt2_subroutine {
+#define ALT2_SUBROUTINE_THREADING_DEMO_NO_MAIN
+#include "../alt2_subroutine_threading_demo.cpp"
+}
+
+namespace subroutines {
+
+//  Runs f with std::cin reading the text and std::cout captured, returning
+//  the output.
+template <typename F>
+static std::string redirected( const std::string & text, F f ) {
+    std::istringstream input( text );
+    std::ostringstream output;
+    std::streambuf * cin_buf = std::cin.rdbuf( input.rdbuf() );
+    std::streambuf * cout_buf = std::cout.rdbuf( output.rdbuf() );
+    std::cin.clear();
+    f();
+    std::cin.rdbuf( cin_buf );
+    std::cout.rdbuf( cout_buf );
+    std::cin.clear();
+    return output.str();
+}
+
+static const bool SUBROUTINE_ROW = matrix::addRow( "Subroutine", matrix::Language::BF, []( const matrix::Workload & workload ) -> matrix::Run {
+    auto engine = std::make_shared<subroutine::Engine>();
+    auto program = std::make_shared<const subroutine::CompiledProgram>( workload.program );
+    return [=]( const std::string & text ) {
+        return redirected( text, [&]() { engine->run( *program ); } );
+    };
+} );
+
+static const bool ALT_SUBROUTINE_ROW = matrix::addRow( "AltSubroutine", matrix::Language::BF, []( const matrix::Workload & workload ) -> matrix::Run {
+    auto engine = std::make_shared<alt_subroutine::Engine>();
+    engine->compile( workload.program );
+    return [=]( const std::string & text ) {
+        return redirected( text, [&]() { engine->execute(); } );
+    };
+} );
+
+static const bool ALT2_SUBROUTINE_ROW = matrix::addRow( "Alt2Subroutine", matrix::Language::BF, []( const matrix::Workload & workload ) -> matrix::Run {
+    auto engine = std::make_shared<alt2_subroutine::Engine>();
+    engine->compile( workload.program );
+    return [=]( const std::string & text ) {
+        return redirected( text, [&]() { engine->execute(); } );
+    };
+} );
+
+//  The alternative engines used to exit at HALT. Now they return, so a
+//  planted program can be run again from a clear tape.
+TEST( Subroutine_Engines, Rerun ) {
+    const std::string expected = redirected( "", []() {
+        subroutine::Engine engine;
+        engine.run( subroutine::CompiledProgram( "../sierpinski.bf" ) );
+    } );
+    ASSERT_FALSE( expected.empty() );
+    alt_subroutine::Engine alt;
+    alt2_subroutine::Engine alt2;
+    alt.compile( "../sierpinski.bf" );
+    alt2.compile( "../sierpinski.bf" );
+    for ( int i = 0; i < 2; i++ ) {
+        ASSERT_EQ( redirected( "", [&]() { alt.execute(); } ), expected );
+        ASSERT_EQ( redirected( "", [&]() { alt2.execute(); } ), expected );
+    }
+}
+
+} // namespace subroutines
@@ -4,6 +4,7 @@
 #include <fstream>
 #include <map>
 #include <sstream>
+#include <algorithm>
 #include "unreachable.hpp"
 
 namespace switch_ {
@@ -98,9 +99,23 @@ public:
 
 typedef unsigned char num;
 
+//  The engine has several dispatch loops, so a program is prepared for one
+//  of them.
+enum struct Dispatch {
+    MACROS,
+    UNREACHABLE,
+    REPLICATED,
+    REPLICATED_LABELS
+};
+
+//  A program planted once, ahead of any number of executions.
+struct PreparedProgram {
+    Dispatch dispatch;
+    std::vector<Instruction> code;
+};
+
 class Engine {
-    std::map<char, OpCode> opcode_map;
-    std::vector<Instruction> program;
+    std::map<Dispatch, std::map<char, OpCode>> opcode_maps;
     std::vector<num> memory;
 public:
     Engine() : 
@@ -108,32 +123,98 @@ public:
     {}
 
 public:
+    PreparedProgram compile( std::string_view filename, Dispatch dispatch = Dispatch::MACROS ) {
+        const std::map<char, OpCode> & opcode_map = opcode_maps[ dispatch ];
+        if ( opcode_map.empty() ) {
+            //  A dispatch loop records its opcodes when called without a 
+            //  program, as labels can only be taken inside their function.
+            run( dispatch, nullptr, std::cin, std::cout );
+        }
+        PreparedProgram prepared{ dispatch, {} };
+        CodePlanter planter( filename, opcode_map, prepared.code );
+        planter.plantProgram();
+        return prepared;
+    }
+
+    //  Runs a prepared program from a cleared tape.
+    void execute( const PreparedProgram & prepared, std::istream & in = std::cin, std::ostream & out = std::cout ) {
+        reset();
+        run( prepared.dispatch, &prepared.code, in, out );
+    }
+
+    void reset() {
+        std::fill( memory.begin(), memory.end(), 0 );
+    }
+
+    //  Compiles and executes in one go.
     template<typename StreamType = std::ostream>
-    inline void runMacros( std::string_view filename, bool header_needed, StreamType& outStream = std::cout ) {
+    void runMacros( std::string_view filename, bool header_needed, StreamType& outStream = std::cout ) {
         if ( header_needed ) {
             outStream << "# Executing: " << filename << "\n";
         }
-        
-
-        opcode_map = {
-            { '+',  OpCode::INCR },
-            { '-',  OpCode::DECR },
-            { '<',  OpCode::LEFT },
-            { '>',  OpCode::RIGHT },
-            { '[',  OpCode::OPEN },
-            { ']',  OpCode::CLOSE },
-            { '.',  OpCode::PUT },
-            { ',',  OpCode::GET },
-            { '\0', OpCode::HALT }
-        };
-        
-        CodePlanter planter( filename, opcode_map, program );
-        planter.plantProgram();
+        execute( compile( filename, Dispatch::MACROS ), std::cin, outStream );
+    }
 
-        std::noskipws( std::cin );
+    template<typename StreamType = std::ostream>
+    void runUnreachable( std::string_view filename, bool header_needed, StreamType& outStream = std::cout ) {
+        if ( header_needed ) {
+            outStream << "# Executing: " << filename << "\n";
+        }
+        execute( compile( filename, Dispatch::UNREACHABLE ), std::cin, outStream );
+    }
+
+    //  With labels as values if the compiler has them, else with the
+    //  portable switches.
+    template<typename StreamType = std::ostream>
+    void runReplicated( std::string_view filename, bool header_needed, StreamType& outStream = std::cout ) {
+        if ( header_needed ) {
+            outStream << "# Executing: " << filename << "\n";
+        }
+        execute( compile( filename, Dispatch::REPLICATED_LABELS ), std::cin, outStream );
+    }
+
+private:
+    void run( Dispatch dispatch, const std::vector<Instruction> * program, std::istream & in, std::ostream & out ) {
+        switch ( dispatch ) {
+            case Dispatch::MACROS:
+                dispatchMacros( program, in, out );
+                break;
+            case Dispatch::UNREACHABLE:
+                dispatchUnreachable( program, in, out );
+                break;
+            case Dispatch::REPLICATED:
+                dispatchReplicated( Dispatch::REPLICATED, program, in, out );
+                break;
+            case Dispatch::REPLICATED_LABELS:
+#ifdef NM_LabelsAsValues
+                dispatchReplicatedLabels( program, in, out );
+#else
+                dispatchReplicated( Dispatch::REPLICATED_LABELS, program, in, out );
+#endif
+                break;
+        }
+    }
+
+    void dispatchMacros( const std::vector<Instruction> * program, std::istream & in, std::ostream & outStream ) {
+        if ( program == nullptr ) {
+            opcode_maps[ Dispatch::MACROS ] = {
+                { '+',  OpCode::INCR },
+                { '-',  OpCode::DECR },
+                { '<',  OpCode::LEFT },
+                { '>',  OpCode::RIGHT },
+                { '[',  OpCode::OPEN },
+                { ']',  OpCode::CLOSE },
+                { '.',  OpCode::PUT },
+                { ',',  OpCode::GET },
+                { '\0', OpCode::HALT }
+            };
+            return;
+        }
+
+        std::noskipws( in );
 
-        auto program_data = program.data();
-        Instruction * pc = &program_data[0];
+        auto program_data = program->data();
+        const Instruction * pc = &program_data[0];
         num * loc = &memory.data()[0];
 
         ////////////////////////////////////////////////////////////////////////
@@ -153,8 +234,8 @@ public:
         );
     ON_LABEL_DO(GET, {
             char ch;
-            std::cin.get( ch );
-            if (std::cin.good()) {
+            in.get( ch );
+            if (in.good()) {
                 *loc = ch;
             }
         }
@@ -178,32 +259,26 @@ public:
     } // End inf loop 
     } // End function
 
-    template<typename StreamType = std::ostream>
-    inline void runUnreachable( std::string_view filename, bool header_needed, StreamType& outStream = std::cout ) {
-        if ( header_needed ) {
-            outStream << "# Executing: " << filename << "\n";
+    void dispatchUnreachable( const std::vector<Instruction> * program, std::istream & in, std::ostream & outStream ) {
+        if ( program == nullptr ) {
+            opcode_maps[ Dispatch::UNREACHABLE ] = {
+                { '+',  OpCode::INCR },
+                { '-',  OpCode::DECR },
+                { '<',  OpCode::LEFT },
+                { '>',  OpCode::RIGHT },
+                { '[',  OpCode::OPEN },
+                { ']',  OpCode::CLOSE },
+                { '.',  OpCode::PUT },
+                { ',',  OpCode::GET },
+                { '\0', OpCode::HALT }
+            };
+            return;
         }
-        
-
-        opcode_map = {
-            { '+',  OpCode::INCR },
-            { '-',  OpCode::DECR },
-            { '<',  OpCode::LEFT },
-            { '>',  OpCode::RIGHT },
-            { '[',  OpCode::OPEN },
-            { ']',  OpCode::CLOSE },
-            { '.',  OpCode::PUT },
-            { ',',  OpCode::GET },
-            { '\0', OpCode::HALT }
-        };
-        
-        CodePlanter planter( filename, opcode_map, program );
-        planter.plantProgram();
 
-        std::noskipws( std::cin );
+        std::noskipws( in );
 
-        auto program_data = program.data();
-        Instruction * pc = &program_data[0];
+        auto program_data = program->data();
+        const Instruction * pc = &program_data[0];
         num * loc = &memory.data()[0];
 
         ////////////////////////////////////////////////////////////////////////
@@ -222,8 +297,8 @@ public:
         );
     ON_LABEL_DO(GET, {
             char ch;
-            std::cin.get( ch );
-            if (std::cin.good()) {
+            in.get( ch );
+            if (in.good()) {
                 *loc = ch;
             }
         }
@@ -248,6 +323,172 @@ public:
     } // End inf loop 
     } // End function
 
+    #undef ON_LABEL_DO
+
+    //  The two loops above have a single switch, so every dispatch goes
+    //  through the one indirect branch of its jump table, and the predictor
+    //  has only the one branch history to go on. This gives each handler a
+    //  switch of its own, which costs nothing but code, so that the branch
+    //  at the end of each handler learns what tends to follow that handler.
+    //
+    //  It is standard C++: the cases just goto ordinary labels. The macro
+    //  keeps the switches identical, and each ends unreachable so that no
+    //  range check is needed. Were jump tables turned off (-fno-jump-tables)
+    //  each switch would become a tree of compares of its own instead,
+    //  which is still replicated.
+    void dispatchReplicated( Dispatch dispatch, const std::vector<Instruction> * program, std::istream & in, std::ostream & outStream ) {
+        if ( program == nullptr ) {
+            opcode_maps[ dispatch ] = {
+                { '+',  OpCode::INCR },
+                { '-',  OpCode::DECR },
+                { '<',  OpCode::LEFT },
+                { '>',  OpCode::RIGHT },
+                { '[',  OpCode::OPEN },
+                { ']',  OpCode::CLOSE },
+                { '.',  OpCode::PUT },
+                { ',',  OpCode::GET },
+                { '\0', OpCode::HALT }
+            };
+            return;
+        }
+
+        std::noskipws( in );
+
+        auto program_data = program->data();
+        const Instruction * pc = &program_data[0];
+        num * loc = &memory.data()[0];
+
+    #define NEXT switch ( (*pc++).opcode ) { \
+        case OpCode::INCR: goto INCR; \
+        case OpCode::DECR: goto DECR; \
+        case OpCode::LEFT: goto LEFT; \
+        case OpCode::RIGHT: goto RIGHT; \
+        case OpCode::OPEN: goto OPEN; \
+        case OpCode::CLOSE: goto CLOSE; \
+        case OpCode::PUT: goto PUT; \
+        case OpCode::GET: goto GET; \
+        case OpCode::HALT: goto HALT; \
+        } NM_Unreachable
+    #define ON_LABEL_DO( LABEL , code ) LABEL : if constexpr (DEBUG) {outStream << #LABEL << "\n"; } code NEXT;
+        NEXT;
+
+        ////////////////////////////////////////////////////////////////////////
+        //  Control flow does not reach this position! 
+        //  Instructions are listed below.
+        ////////////////////////////////////////////////////////////////////////
+    ON_LABEL_DO(INCR, *loc += 1; );
+    ON_LABEL_DO(DECR, *loc -= 1; );
+    ON_LABEL_DO(RIGHT, loc += 1; );
+    ON_LABEL_DO(LEFT, loc -= 1; );
+    ON_LABEL_DO(PUT, {
+            num i = *loc;
+            outStream << i;
+        }
+        );
+    ON_LABEL_DO(GET, {
+            char ch;
+            in.get( ch );
+            if (in.good()) {
+                *loc = ch;
+            }
+        }
+        );
+    ON_LABEL_DO(OPEN, {
+            int n = pc++->operand;
+            if ( *loc == 0 ) {
+                pc = &program_data[n];
+            }
+        }
+    );
+    ON_LABEL_DO(CLOSE, {
+            int n = pc++->operand;
+            if ( *loc != 0 ) {
+                pc = &program_data[n];
+            }
+        }
+    );
+    HALT:
+        return;
+    #undef ON_LABEL_DO
+    #undef NEXT
+    } // End function
+
+#ifdef NM_LabelsAsValues
+    //  The same replicated dispatch as runMacros in ComputedGotos.cpp, for
+    //  the same program of opcodes: each handler jumps through a table of
+    //  the addresses of the labels, indexed by the next opcode. Only for
+    //  compilers with labels as values, so on any other the portable
+    //  switches above stand in for it.
+    void dispatchReplicatedLabels( const std::vector<Instruction> * program, std::istream & in, std::ostream & outStream ) {
+        //  In the order of OpCode.
+        static const void * const TARGETS[] = { &&INCR, &&DECR, &&LEFT, &&RIGHT, &&OPEN, &&CLOSE, &&PUT, &&GET, &&HALT };
+        if ( program == nullptr ) {
+            opcode_maps[ Dispatch::REPLICATED_LABELS ] = {
+                { '+',  OpCode::INCR },
+                { '-',  OpCode::DECR },
+                { '<',  OpCode::LEFT },
+                { '>',  OpCode::RIGHT },
+                { '[',  OpCode::OPEN },
+                { ']',  OpCode::CLOSE },
+                { '.',  OpCode::PUT },
+                { ',',  OpCode::GET },
+                { '\0', OpCode::HALT }
+            };
+            return;
+        }
+
+        std::noskipws( in );
+
+        auto program_data = program->data();
+        const Instruction * pc = &program_data[0];
+        num * loc = &memory.data()[0];
+
+    #define NEXT goto *TARGETS[ static_cast<int>( (*pc++).opcode ) ]
+    #define ON_LABEL_DO( LABEL , code ) LABEL : if constexpr (DEBUG) {outStream << #LABEL << "\n"; } code NEXT;
+        NEXT;
+
+        ////////////////////////////////////////////////////////////////////////
+        //  Control flow does not reach this position! 
+        //  Instructions are listed below.
+        ////////////////////////////////////////////////////////////////////////
+    ON_LABEL_DO(INCR, *loc += 1; );
+    ON_LABEL_DO(DECR, *loc -= 1; );
+    ON_LABEL_DO(RIGHT, loc += 1; );
+    ON_LABEL_DO(LEFT, loc -= 1; );
+    ON_LABEL_DO(PUT, {
+            num i = *loc;
+            outStream << i;
+        }
+        );
+    ON_LABEL_DO(GET, {
+            char ch;
+            in.get( ch );
+            if (in.good()) {
+                *loc = ch;
+            }
+        }
+        );
+    ON_LABEL_DO(OPEN, {
+            int n = pc++->operand;
+            if ( *loc == 0 ) {
+                pc = &program_data[n];
+            }
+        }
+    );
+    ON_LABEL_DO(CLOSE, {
+            int n = pc++->operand;
+            if ( *loc != 0 ) {
+                pc = &program_data[n];
+            }
+        }
+    );
+    HALT:
+        return;
+    #undef ON_LABEL_DO
+    #undef NEXT
+    } // End function
+#endif
+
 };
 
 } // End namespace
@@ -255,23 +496,115 @@ public:
 
 #include <benchmark/benchmark.h>
 #include <gtest/gtest.h>
+#include "workloads.hpp"
 
 namespace switch_ {
+//  Planting alone, whereas the benchmarks below measure only the dispatch
+//  loop running an already prepared program.
+static void Switch_Compile(benchmark::State& state, Dispatch dispatch) {
+    Engine engine{};
+    for (auto _ : state) {
+        benchmark::DoNotOptimize( engine.compile( "../sierpinski.bf", dispatch ) );
+    }
+}
+BENCHMARK_CAPTURE(Switch_Compile, Switch, Dispatch::MACROS);
+BENCHMARK_CAPTURE(Switch_Compile, SwitchUnreachable, Dispatch::UNREACHABLE);
+BENCHMARK_CAPTURE(Switch_Compile, SwitchReplicated, Dispatch::REPLICATED);
+BENCHMARK_CAPTURE(Switch_Compile, SwitchReplicatedLabels, Dispatch::REPLICATED_LABELS);
+
 static void Switch(benchmark::State& state) {
     Engine engine{};
+    const PreparedProgram program = engine.compile( "../sierpinski.bf", Dispatch::MACROS );
+    std::istringstream input{};
     std::ostringstream output{};
+    perf_counters::HardwareCounters hardware;
+    hardware.start();
     for (auto _ : state) {
-        engine.runMacros( "../sierpinski.bf", false, output);
+        engine.execute( program, input, output );
     }
+    hardware.stop();
+    matrix::reportHardware( state, hardware, matrix::instructionsOf( "../sierpinski.bf" ) );
 }
 BENCHMARK(Switch);
 
 static void SwitchUnreachable(benchmark::State& state) {
     Engine engine{};
+    const PreparedProgram program = engine.compile( "../sierpinski.bf", Dispatch::UNREACHABLE );
+    std::istringstream input{};
     std::ostringstream output{};
+    perf_counters::HardwareCounters hardware;
+    hardware.start();
     for (auto _ : state) {
-        engine.runUnreachable( "../sierpinski.bf", false, output );
+        engine.execute( program, input, output );
     }
+    hardware.stop();
+    matrix::reportHardware( state, hardware, matrix::instructionsOf( "../sierpinski.bf" ) );
 }
 BENCHMARK(SwitchUnreachable);
+
+static void SwitchReplicated(benchmark::State& state) {
+    Engine engine{};
+    const PreparedProgram program = engine.compile( "../sierpinski.bf", Dispatch::REPLICATED );
+    std::istringstream input{};
+    std::ostringstream output{};
+    perf_counters::HardwareCounters hardware;
+    hardware.start();
+    for (auto _ : state) {
+        engine.execute( program, input, output );
+    }
+    hardware.stop();
+    matrix::reportHardware( state, hardware, matrix::instructionsOf( "../sierpinski.bf" ) );
+}
+BENCHMARK(SwitchReplicated);
+
+static void SwitchReplicatedLabels(benchmark::State& state) {
+    Engine engine{};
+    const PreparedProgram program = engine.compile( "../sierpinski.bf", Dispatch::REPLICATED_LABELS );
+    std::istringstream input{};
+    std::ostringstream output{};
+    perf_counters::HardwareCounters hardware;
+    hardware.start();
+    for (auto _ : state) {
+        engine.execute( program, input, output );
+    }
+    hardware.stop();
+    matrix::reportHardware( state, hardware, matrix::instructionsOf( "../sierpinski.bf" ) );
+}
+BENCHMARK(SwitchReplicatedLabels);
+
+//  The rows of the matrix in workloads.hpp.
+static matrix::Prepare preparedFor( Dispatch dispatch ) {
+    return [=]( const matrix::Workload & workload ) -> matrix::Run {
+        auto engine = std::make_shared<Engine>();
+        auto program = std::make_shared<const PreparedProgram>( engine->compile( workload.program, dispatch ) );
+        return [=]( const std::string & text ) {
+            std::istringstream input( text );
+            std::ostringstream output;
+            engine->execute( *program, input, output );
+            return output.str();
+        };
+    };
+}
+static const bool SWITCH_ROW = matrix::addRow( "Switch", matrix::Language::BF, preparedFor( Dispatch::MACROS ) );
+static const bool SWITCH_REPLICATED_ROW = matrix::addRow( "SwitchReplicated", matrix::Language::BF, preparedFor( Dispatch::REPLICATED ) );
+static const bool SWITCH_REPLICATED_LABELS_ROW = matrix::addRow( "SwitchReplicatedLabels", matrix::Language::BF, preparedFor( Dispatch::REPLICATED_LABELS ) );
+
+//  Replicating the dispatch must not change what a program does.
+TEST( Switch_Replicated, NoChange ) {
+    for ( auto filename : { "../sierpinski.bf", "../hello.bf", "../head.bf", "../bsort.bf" } ) {
+        std::string expected;
+        for ( Dispatch dispatch : { Dispatch::MACROS, Dispatch::REPLICATED, Dispatch::REPLICATED_LABELS } ) {
+            Engine engine{};
+            std::istringstream input( "one\ntwo\nthree\n" );
+            std::ostringstream output;
+            engine.execute( engine.compile( filename, dispatch ), input, output );
+            if ( dispatch == Dispatch::MACROS ) {
+                expected = output.str();
+                ASSERT_FALSE( expected.empty() ) << filename;
+            } else {
+                ASSERT_EQ( output.str(), expected ) << filename;
+            }
+        }
+    }
+}
 }
\ No newline at end of file
@@ -0,0 +1,89 @@
+/*
+Benchmarks tail_call_threading_demo.cpp, in which each instruction is a
+free function that tail-calls the next, against the engines that dispatch
+with computed gotos and a switch.
+
+    TailCall_Sierpinski     against CG_Labels and Switch
+    TailCall_Bsort          against Constexpr_Bsort, on the same input
+
+The demo reads std::cin and writes std::cout, so the benchmarks redirect
+them. The handlers only run in constant stack if their calls compile to
+jumps, which CMakeLists.txt arranges for this file.
+*/
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../tape.hpp"
+
+#include <benchmark/benchmark.h>
+#include <gtest/gtest.h>
+
+namespace tail_calls {
+#define TAIL_CALL_THREADING_DEMO_NO_MAIN
+#include "../tail_call_threading_demo.cpp"
+
+#undef DEBUG
+#undef break_if
+#undef break_unless
+#undef return_if
+
+static std::string readFile( const std::string & filename ) {
+    std::ifstream file( filename );
+    std::stringstream text;
+    text << file.rdbuf();
+    return text.str();
+}
+
+//  Runs a program with std::cin and std::cout redirected, returning the
+//  output.
+static std::string run( const std::string & filename, const std::string & text ) {
+    std::istringstream input( text );
+    std::ostringstream output;
+    std::streambuf * cin_buf = std::cin.rdbuf( input.rdbuf() );
+    std::streambuf * cout_buf = std::cout.rdbuf( output.rdbuf() );
+    std::cin.clear();
+    Engine engine;
+    engine.runFile( filename, false );
+    std::cin.rdbuf( cin_buf );
+    std::cout.rdbuf( cout_buf );
+    std::cin.clear();
+    return output.str();
+}
+
+static void TailCall_Sierpinski(benchmark::State& state) {
+    for (auto _ : state) {
+        benchmark::DoNotOptimize( run( "../sierpinski.bf", "" ) );
+    }
+}
+BENCHMARK(TailCall_Sierpinski);
+
+//  bsort.bf sorts its input, so we give it its own source code to sort.
+static void TailCall_Bsort(benchmark::State& state) {
+    const std::string text = readFile( "../bsort.bf" );
+    for (auto _ : state) {
+        benchmark::DoNotOptimize( run( "../bsort.bf", text ) );
+    }
+}
+BENCHMARK(TailCall_Bsort);
+
+//  bsort.bf executes millions of instructions, which would overflow the
+//  stack if any handler called the next rather than jumping to it.
+TEST( TailCall, Bsort ) {
+    const std::string text = readFile( "../bsort.bf" );
+    std::string sorted = text;
+    std::sort( sorted.begin(), sorted.end() );
+    ASSERT_EQ( run( "../bsort.bf", text ), sorted );
+}
+
+TEST( TailCall, Sierpinski ) {
+    const std::string output = run( "../sierpinski.bf", "" );
+    ASSERT_EQ( output.substr( 0, 33 ), std::string( 31, ' ' ) + "*\n" );
+}
+
+} // namespace tail_calls
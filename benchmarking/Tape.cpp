@@ -0,0 +1,65 @@
+/*
+Checks that the guard-paged tape in tape.hpp grows when a program walks
+off the end of it, and that walking off either end of the reservation is
+still fatal. The stacks of stack.hpp are guarded in the same way.
+*/
+
+#include "../tape.hpp"
+#include "../stack.hpp"
+
+#include <gtest/gtest.h>
+
+namespace tape_ {
+
+TEST( Tape, GrowsOnDemand ) {
+    Tape tape( 10, 1 << 20 );
+    const size_t initial = tape.size();
+    ASSERT_GE( initial, 10 );
+    volatile unsigned char * cells = tape.data();
+    cells[ 500000 ] = 42;
+    ASSERT_GT( tape.size(), 500000 );
+    ASSERT_EQ( cells[ 500000 ], 42 );
+    ASSERT_EQ( cells[ initial ], 0 );
+}
+
+TEST( Tape, UnderflowIsFatal ) {
+    Tape tape( 10, 1 << 20 );
+    volatile unsigned char * cells = tape.data();
+    EXPECT_DEATH( cells[ -1 ] = 1, "Tape underflow" );
+}
+
+TEST( Tape, OverflowIsFatal ) {
+    Tape tape( 10, 1 << 20 );
+    volatile unsigned char * cells = tape.data();
+    EXPECT_DEATH( cells[ 1 << 20 ] = 1, "Tape overflow" );
+}
+
+static const GuardMessages STACK_MESSAGES = {
+    "Stack underflow\n",
+    "Stack overflow\n",
+    "Stack exhausted\n"
+};
+
+TEST( Stack, GrowsOnDemand ) {
+    GuardedStack<int64_t> stack( STACK_MESSAGES, 1, 1 << 20 );
+    volatile int64_t * top = stack.data();
+    for ( int64_t i = 0; i < 100000; i++ ) {
+        *top++ = i;
+    }
+    ASSERT_GE( stack.size(), 100000 );
+    ASSERT_EQ( *--top, 99999 );
+}
+
+//  A stack of a known depth is committed up front and overflowing it is
+//  reported with its own message.
+TEST( Stack, ExactlySized ) {
+    GuardedStack<int64_t> stack( STACK_MESSAGES, 3, 3 );
+    const size_t size = stack.size();
+    ASSERT_GE( size, 3 );
+    volatile int64_t * top = stack.data();
+    top[ size - 1 ] = 1;
+    EXPECT_DEATH( top[ size ] = 1, "Stack overflow" );
+    EXPECT_DEATH( top[ -1 ] = 1, "Stack underflow" );
+}
+
+} // namespace tape_
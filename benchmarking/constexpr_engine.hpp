@@ -0,0 +1,182 @@
+/*
+An ahead-of-time engine. The Brainf*ck program is a string literal that is
+parsed at compile time into a constexpr array of instructions, and each
+instruction is then instantiated as a template. The compiler sees the
+whole program as ordinary nested C++ - runs of + - < > become single
+additions, [-] becomes a store and [ ... ] becomes a while loop - so the
+generated code is straight-line with no dispatch at all. This is the
+limit that the interpreters are approaching, measured inside the same
+harness.
+
+Usage:
+    static constexpr char SOURCE[] = "++++++++[>++++++++<-]>+.";
+    static constexpr auto PROGRAM = constexpr_engine::parse( SOURCE );
+    constexpr_engine::run<PROGRAM>( std::cin, std::cout );
+*/
+
+#ifndef CONSTEXPR_ENGINE_HPP
+#define CONSTEXPR_ENGINE_HPP
+
+#include <array>
+#include <cstddef>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <utility>
+
+#include "../tape.hpp"
+
+namespace constexpr_engine {
+
+enum struct OpCode {
+    ADD,
+    MOVE,
+    SET_ZERO,
+    OPEN,
+    CLOSE,
+    PUT,
+    GET
+};
+
+struct Instruction {
+    OpCode opcode = OpCode::ADD;
+    int operand = 0;                    //  The amount of an ADD or MOVE.
+    size_t match = 0;                   //  The CLOSE of an OPEN, and vice versa.
+    size_t block = 0;                   //  The first instruction of the enclosing block.
+};
+
+//  A program of at most N instructions, of which size are used.
+template <size_t N>
+struct Program {
+    std::array<Instruction, N> code{};
+    size_t size = 0;
+};
+
+constexpr bool isCommand( char ch ) {
+    return ch == '+' || ch == '-' || ch == '<' || ch == '>' || ch == '[' || ch == ']' || ch == '.' || ch == ',';
+}
+
+//  Parses the source, folding runs of + - and < > into single instructions
+//  and [-] into SET_ZERO. A program can never have more instructions than
+//  characters, which sizes the array. Unbalanced brackets are a compile
+//  time error, because throwing is not a constant expression.
+template <size_t Length>
+constexpr Program<Length> parse( const char ( & source )[ Length ] ) {
+    Program<Length> program;
+    std::array<size_t, Length> opens{};
+    size_t depth = 0;
+    size_t block = 0;
+    for ( size_t i = 0; i < Length; i++ ) {
+        const char ch = source[ i ];
+        if ( not isCommand( ch ) ) {
+            continue;
+        }
+        Instruction & last = program.code[ program.size > 0 ? program.size - 1 : 0 ];
+        const bool extends = program.size > 0 && last.block == block;
+        if ( ch == '+' || ch == '-' ) {
+            const int by = ch == '+' ? 1 : -1;
+            if ( extends && last.opcode == OpCode::ADD ) {
+                last.operand += by;
+                continue;
+            }
+            program.code[ program.size++ ] = { OpCode::ADD, by, 0, block };
+        } else if ( ch == '<' || ch == '>' ) {
+            const int by = ch == '>' ? 1 : -1;
+            if ( extends && last.opcode == OpCode::MOVE ) {
+                last.operand += by;
+                continue;
+            }
+            program.code[ program.size++ ] = { OpCode::MOVE, by, 0, block };
+        } else if ( ch == '[' ) {
+            opens[ depth++ ] = program.size;
+            program.code[ program.size++ ] = { OpCode::OPEN, 0, 0, block };
+            block = program.size;
+        } else if ( ch == ']' ) {
+            if ( depth == 0 ) {
+                throw std::logic_error( "Unmatched ]" );
+            }
+            const size_t open = opens[ --depth ];
+            const bool clear = (
+                program.size == open + 2 &&
+                program.code[ open + 1 ].opcode == OpCode::ADD &&
+                ( program.code[ open + 1 ].operand == 1 || program.code[ open + 1 ].operand == -1 )
+            );
+            block = program.code[ open ].block;
+            if ( clear ) {
+                program.size = open;
+                program.code[ program.size++ ] = { OpCode::SET_ZERO, 0, 0, block };
+            } else {
+                program.code[ open ].match = program.size;
+                program.code[ program.size++ ] = { OpCode::CLOSE, 0, open, open + 1 };
+            }
+        } else if ( ch == '.' ) {
+            program.code[ program.size++ ] = { OpCode::PUT, 0, 0, block };
+        } else {
+            program.code[ program.size++ ] = { OpCode::GET, 0, 0, block };
+        }
+    }
+    if ( depth != 0 ) {
+        throw std::logic_error( "Unmatched [" );
+    }
+    return program;
+}
+
+struct Machine {
+    unsigned char * loc;
+    std::istream & in;
+    std::ostream & out;
+};
+
+template <const auto & P, size_t PC>
+inline void step( Machine & m );
+
+//  Runs the instructions of the block starting at BEGIN. Every instruction
+//  up to the end of the block is considered but only those belonging to
+//  the block itself, rather than to a nested loop, are instantiated.
+template <const auto & P, size_t BEGIN, size_t PC>
+inline void member( Machine & m ) {
+    if constexpr ( P.code[ PC ].block == BEGIN && P.code[ PC ].opcode != OpCode::CLOSE ) {
+        step<P, PC>( m );
+    }
+}
+
+template <const auto & P, size_t BEGIN, size_t ... I>
+inline void block( Machine & m, std::index_sequence<I...> ) {
+    ( member<P, BEGIN, BEGIN + I>( m ), ... );
+}
+
+template <const auto & P, size_t PC>
+inline void step( Machine & m ) {
+    constexpr Instruction i = P.code[ PC ];
+    if constexpr ( i.opcode == OpCode::ADD ) {
+        *m.loc += static_cast<unsigned char>( i.operand );
+    } else if constexpr ( i.opcode == OpCode::MOVE ) {
+        m.loc += i.operand;
+    } else if constexpr ( i.opcode == OpCode::SET_ZERO ) {
+        *m.loc = 0;
+    } else if constexpr ( i.opcode == OpCode::OPEN ) {
+        while ( *m.loc ) {
+            block<P, PC + 1>( m, std::make_index_sequence<i.match - PC - 1>() );
+        }
+    } else if constexpr ( i.opcode == OpCode::PUT ) {
+        m.out.put( static_cast<char>( *m.loc ) );
+    } else if constexpr ( i.opcode == OpCode::GET ) {
+        char ch;
+        if ( m.in.get( ch ) ) {
+            *m.loc = static_cast<unsigned char>( ch );
+        }
+    }
+}
+
+//  Runs the program on a fresh tape.
+template <const auto & P>
+void run( std::istream & in, std::ostream & out, const TapeOptions & options = TapeOptions() ) {
+    Tape tape( options.size, options.max_size );
+    Machine m{ tape.data(), in, out };
+    block<P, 0>( m, std::make_index_sequence<P.size>() );
+    out.flush();
+}
+
+} // namespace constexpr_engine
+
+#endif
@@ -17,6 +17,7 @@ method (Engine::runFile) fit on a single screen.
 #include <fstream>
 #include <map>
 #include <sstream>
+#include <algorithm>
 #include "unreachable.hpp"
 
 namespace two {
@@ -102,9 +103,23 @@ public:
 
 typedef unsigned char num;
 
+//  The engine has several dispatch loops, so a program is prepared for one
+//  of them.
+enum struct Dispatch {
+    LABELS,
+    UNREACHABLE,
+    LAMBDAS,
+    LAMBDAS_AND_UNREACHABLE
+};
+
+//  A program planted once, ahead of any number of executions.
+struct PreparedProgram {
+    Dispatch dispatch;
+    std::vector<Instruction> code;
+};
+
 class Engine {
-    std::map<char, OpCode> opcode_map;
-    std::vector<Instruction> program;
+    std::map<Dispatch, std::map<char, OpCode>> opcode_maps;
     std::vector<num> memory;
 public:
     Engine() : 
@@ -112,31 +127,100 @@ public:
     {}
 
 public:
+    PreparedProgram compile( std::string_view filename, Dispatch dispatch = Dispatch::LABELS ) {
+        const std::map<char, OpCode> & opcode_map = opcode_maps[ dispatch ];
+        if ( opcode_map.empty() ) {
+            //  A dispatch loop records its opcodes when called without a 
+            //  program, as labels can only be taken inside their function.
+            run( dispatch, nullptr, std::cin, std::cout );
+        }
+        PreparedProgram prepared{ dispatch, {} };
+        CodePlanter planter( filename, opcode_map, prepared.code );
+        planter.plantProgram();
+        return prepared;
+    }
+
+    //  Runs a prepared program from a cleared tape.
+    void execute( const PreparedProgram & prepared, std::istream & in = std::cin, std::ostream & out = std::cout ) {
+        reset();
+        run( prepared.dispatch, &prepared.code, in, out );
+    }
+
+    void reset() {
+        std::fill( memory.begin(), memory.end(), 0 );
+    }
+
+    //  Compiles and executes in one go.
     template<typename StreamType = std::ostream>
     void runFile( std::string_view filename, bool header_needed, StreamType& outStream = std::cout ) {
         if ( header_needed ) {
             std::cerr << "# Executing: " << filename << std::endl;
         }
+        execute( compile( filename, Dispatch::LABELS ), std::cin, outStream );
+    }
 
-        opcode_map = {
-            { '+', &&INCR },
-            { '-', &&DECR },
-            { '<', &&LEFT },
-            { '>', &&RIGHT },
-            { '[', &&OPEN },
-            { ']', &&CLOSE },
-            { '.', &&PUT },
-            { ',', &&GET },
-            { '\0', &&HALT }
-        };
-        
-        CodePlanter planter( filename, opcode_map, program );
-        planter.plantProgram();
+    template<typename StreamType = std::ostream>
+    void runFileWithUnreachable( std::string_view filename, bool header_needed, StreamType& outStream = std::cout ) {
+        if ( header_needed ) {
+            std::cerr << "# Executing: " << filename << std::endl;
+        }
+        execute( compile( filename, Dispatch::UNREACHABLE ), std::cin, outStream );
+    }
+
+    template<typename StreamType = std::ostream>
+    void runFileLambdas( std::string_view filename, bool header_needed, StreamType& outStream = std::cout ) {
+        if ( header_needed ) {
+            std::cerr << "# Executing: " << filename << std::endl;
+        }
+        execute( compile( filename, Dispatch::LAMBDAS ), std::cin, outStream );
+    }
+
+    template<typename StreamType = std::ostream>
+    void runFileLambdasAndUnreachable( std::string_view filename, bool header_needed, StreamType& outStream = std::cout ) {
+        if ( header_needed ) {
+            std::cerr << "# Executing: " << filename << std::endl;
+        }
+        execute( compile( filename, Dispatch::LAMBDAS_AND_UNREACHABLE ), std::cin, outStream );
+    }
 
-        std::noskipws( std::cin );
+private:
+    void run( Dispatch dispatch, const std::vector<Instruction> * program, std::istream & in, std::ostream & out ) {
+        switch ( dispatch ) {
+            case Dispatch::LABELS:
+                dispatchLabels( program, in, out );
+                break;
+            case Dispatch::UNREACHABLE:
+                dispatchUnreachable( program, in, out );
+                break;
+            case Dispatch::LAMBDAS:
+                dispatchLambdas( program, in, out );
+                break;
+            case Dispatch::LAMBDAS_AND_UNREACHABLE:
+                dispatchLambdasAndUnreachable( program, in, out );
+                break;
+        }
+    }
 
-        auto program_data = program.data();
-        Instruction * pc = &program_data[0];
+    void dispatchLabels( const std::vector<Instruction> * program, std::istream & in, std::ostream & outStream ) {
+        if ( program == nullptr ) {
+            opcode_maps[ Dispatch::LABELS ] = {
+                { '+', &&INCR },
+                { '-', &&DECR },
+                { '<', &&LEFT },
+                { '>', &&RIGHT },
+                { '[', &&OPEN },
+                { ']', &&CLOSE },
+                { '.', &&PUT },
+                { ',', &&GET },
+                { '\0', &&HALT }
+            };
+            return;
+        }
+
+        std::noskipws( in );
+
+        auto program_data = program->data();
+        const Instruction * pc = &program_data[0];
         num * loc = &memory.data()[0];
         goto *(pc++->opcode);
 
@@ -172,8 +256,8 @@ public:
         if ( DEBUG ) std::cout << "GET" << std::endl;
         {
             char ch;
-            std::cin.get( ch );
-            if (std::cin.good()) {
+            in.get( ch );
+            if (in.good()) {
                 *loc = ch;
             }
         }
@@ -201,31 +285,26 @@ public:
         return;
     }
 
-    template<typename StreamType = std::ostream>
-    void runFileWithUnreachable( std::string_view filename, bool header_needed, StreamType& outStream = std::cout ) {
-        if ( header_needed ) {
-            std::cerr << "# Executing: " << filename << std::endl;
+    void dispatchUnreachable( const std::vector<Instruction> * program, std::istream & in, std::ostream & outStream ) {
+        if ( program == nullptr ) {
+            opcode_maps[ Dispatch::UNREACHABLE ] = {
+                { '+', &&INCR },
+                { '-', &&DECR },
+                { '<', &&LEFT },
+                { '>', &&RIGHT },
+                { '[', &&OPEN },
+                { ']', &&CLOSE },
+                { '.', &&PUT },
+                { ',', &&GET },
+                { '\0', &&HALT }
+            };
+            return;
         }
 
-        opcode_map = {
-            { '+', &&INCR },
-            { '-', &&DECR },
-            { '<', &&LEFT },
-            { '>', &&RIGHT },
-            { '[', &&OPEN },
-            { ']', &&CLOSE },
-            { '.', &&PUT },
-            { ',', &&GET },
-            { '\0', &&HALT }
-        };
-        
-        CodePlanter planter( filename, opcode_map, program );
-        planter.plantProgram();
-
-        std::noskipws( std::cin );
+        std::noskipws( in );
 
-        auto program_data = program.data();
-        Instruction * pc = &program_data[0];
+        auto program_data = program->data();
+        const Instruction * pc = &program_data[0];
         num * loc = &memory.data()[0];
         goto *(pc++->opcode);
 
@@ -262,8 +341,8 @@ public:
         if ( DEBUG ) std::cout << "GET" << std::endl;
         {
             char ch;
-            std::cin.get( ch );
-            if (std::cin.good()) {
+            in.get( ch );
+            if (in.good()) {
                 *loc = ch;
             }
         }
@@ -291,31 +370,26 @@ public:
         return;
     }
 
-    template<typename StreamType = std::ostream>
-    void runFileLambdas( ::std::string_view filename, bool header_needed, StreamType& outStream = std::cout ) {
-        if ( header_needed ) {
-            std::cerr << "# Executing: " << filename << std::endl;
+    void dispatchLambdas( const std::vector<Instruction> * program, std::istream & in, std::ostream & outStream ) {
+        if ( program == nullptr ) {
+            opcode_maps[ Dispatch::LAMBDAS ] = {
+                { '+', &&INCR },
+                { '-', &&DECR },
+                { '<', &&LEFT },
+                { '>', &&RIGHT },
+                { '[', &&OPEN },
+                { ']', &&CLOSE },
+                { '.', &&PUT },
+                { ',', &&GET },
+                { '\0', &&HALT }
+            };
+            return;
         }
 
-        opcode_map = {
-            { '+', &&INCR },
-            { '-', &&DECR },
-            { '<', &&LEFT },
-            { '>', &&RIGHT },
-            { '[', &&OPEN },
-            { ']', &&CLOSE },
-            { '.', &&PUT },
-            { ',', &&GET },
-            { '\0', &&HALT }
-        };
-        
-        CodePlanter planter( filename, opcode_map, program );
-        planter.plantProgram();
-
-        std::noskipws( std::cin );
+        std::noskipws( in );
 
-        auto program_data = program.data();
-        Instruction * pc = &program_data[0];
+        auto program_data = program->data();
+        const Instruction * pc = &program_data[0];
         num * loc = memory.data();
         goto *(pc++->opcode);
 
@@ -369,8 +443,8 @@ public:
         if ( DEBUG ) { std::cout << "GET" << std::endl; }
         {
             char ch;
-            std::cin.get( ch );
-            if (std::cin.good()) {
+            in.get( ch );
+            if (in.good()) {
                 *loc = ch;
             }
         }
@@ -408,31 +482,26 @@ public:
 
     }
 
-    template<typename StreamType = std::ostream>
-    void runFileLambdasAndUnreachable( ::std::string_view filename, bool header_needed, StreamType& outStream = std::cout ) {
-    if ( header_needed ) {
-            std::cerr << "# Executing: " << filename << std::endl;
+    void dispatchLambdasAndUnreachable( const std::vector<Instruction> * program, std::istream & in, std::ostream & outStream ) {
+        if ( program == nullptr ) {
+            opcode_maps[ Dispatch::LAMBDAS_AND_UNREACHABLE ] = {
+                { '+', &&INCR },
+                { '-', &&DECR },
+                { '<', &&LEFT },
+                { '>', &&RIGHT },
+                { '[', &&OPEN },
+                { ']', &&CLOSE },
+                { '.', &&PUT },
+                { ',', &&GET },
+                { '\0', &&HALT }
+            };
+            return;
         }
 
-        opcode_map = {
-            { '+', &&INCR },
-            { '-', &&DECR },
-            { '<', &&LEFT },
-            { '>', &&RIGHT },
-            { '[', &&OPEN },
-            { ']', &&CLOSE },
-            { '.', &&PUT },
-            { ',', &&GET },
-            { '\0', &&HALT }
-        };
-        
-        CodePlanter planter( filename, opcode_map, program );
-        planter.plantProgram();
+        std::noskipws( in );
 
-        std::noskipws( std::cin );
-
-        auto program_data = program.data();
-        Instruction * pc = &program_data[0];
+        auto program_data = program->data();
+        const Instruction * pc = &program_data[0];
         num * loc = &memory.data()[0];
         goto *(pc++->opcode);
 
@@ -487,8 +556,8 @@ public:
         if ( DEBUG ) std::cout << "GET" << std::endl;
         {
             char ch;
-            std::cin.get( ch );
-            if (std::cin.good()) {
+            in.get( ch );
+            if (in.good()) {
                 *loc = ch;
             }
         }
@@ -586,41 +655,79 @@ threaded coded and executed.
 
 #include <benchmark/benchmark.h>
 #include <gtest/gtest.h>
+#include "workloads.hpp"
 
 namespace two {
+//  Planting alone, whereas the benchmarks below measure only the dispatch
+//  loop running an already prepared program.
+static void Labels_Compile(benchmark::State& state, Dispatch dispatch) {
+    Engine engine{};
+    for (auto _ : state) {
+        benchmark::DoNotOptimize( engine.compile( "../sierpinski.bf", dispatch ) );
+    }
+}
+BENCHMARK_CAPTURE(Labels_Compile, Labels, Dispatch::LABELS);
+BENCHMARK_CAPTURE(Labels_Compile, LabelsLambdas, Dispatch::LAMBDAS);
+BENCHMARK_CAPTURE(Labels_Compile, LablesWithUnreachable, Dispatch::UNREACHABLE);
+BENCHMARK_CAPTURE(Labels_Compile, LablesWithLambdasAndUnreachable, Dispatch::LAMBDAS_AND_UNREACHABLE);
+
 static void Labels(benchmark::State& state) {
     Engine engine{};
+    const PreparedProgram program = engine.compile( "../sierpinski.bf", Dispatch::LABELS );
+    std::istringstream input{};
     std::ostringstream output{};
+    perf_counters::HardwareCounters hardware;
+    hardware.start();
     for (auto _ : state) {
-        engine.runFile( "../sierpinski.bf", false, output );
+        engine.execute( program, input, output );
     }
+    hardware.stop();
+    matrix::reportHardware( state, hardware, matrix::instructionsOf( "../sierpinski.bf" ) );
 }
 BENCHMARK(Labels);
 
 static void LabelsLambdas(benchmark::State& state) {
     Engine engine{};
+    const PreparedProgram program = engine.compile( "../sierpinski.bf", Dispatch::LAMBDAS );
+    std::istringstream input{};
     std::ostringstream output{};
+    perf_counters::HardwareCounters hardware;
+    hardware.start();
     for (auto _ : state) {
-        engine.runFileLambdas( "../sierpinski.bf", false, output);
+        engine.execute( program, input, output );
     }
+    hardware.stop();
+    matrix::reportHardware( state, hardware, matrix::instructionsOf( "../sierpinski.bf" ) );
 }
 BENCHMARK(LabelsLambdas);
 
 static void LablesWithUnreachable(benchmark::State& state) {
     Engine engine{};
+    const PreparedProgram program = engine.compile( "../sierpinski.bf", Dispatch::UNREACHABLE );
+    std::istringstream input{};
     std::ostringstream output{};
+    perf_counters::HardwareCounters hardware;
+    hardware.start();
     for (auto _ : state) {
-        engine.runFileWithUnreachable( "../sierpinski.bf", false, output );
+        engine.execute( program, input, output );
     }
+    hardware.stop();
+    matrix::reportHardware( state, hardware, matrix::instructionsOf( "../sierpinski.bf" ) );
 }
 BENCHMARK(LablesWithUnreachable);
 
 static void LablesWithLambdasAndUnreachable(benchmark::State& state) {
     Engine engine{};
+    const PreparedProgram program = engine.compile( "../sierpinski.bf", Dispatch::LAMBDAS_AND_UNREACHABLE );
+    std::istringstream input{};
     std::ostringstream output{};
+    perf_counters::HardwareCounters hardware;
+    hardware.start();
     for (auto _ : state) {
-        engine.runFileLambdasAndUnreachable( "../sierpinski.bf", false, output );
+        engine.execute( program, input, output );
     }
+    hardware.stop();
+    matrix::reportHardware( state, hardware, matrix::instructionsOf( "../sierpinski.bf" ) );
 }
 BENCHMARK(LablesWithLambdasAndUnreachable);
 
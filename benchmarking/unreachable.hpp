@@ -4,3 +4,9 @@
 #else // GCC, Clang
 #   define NM_Unreachable __builtin_unreachable();
 #endif
+
+//  Whether the compiler has the GNU extension of labels as values, which
+//  computed gotos need. MSVC does not.
+#if defined(__GNUC__) || defined(__clang__)
+#   define NM_LabelsAsValues 1
+#endif
@@ -0,0 +1,230 @@
+/*
+The dispatch-strategy matrix: every strategy of the harness running the
+same realistic workloads, so that they can be compared directly.
+
+Each file that benchmarks a strategy registers a row of the matrix with
+addRow, giving a function that prepares a program for that strategy.
+Preparing is not timed, only running the prepared program on its input.
+The benchmarks are named
+
+    Matrix/<Workload>/<Strategy>
+
+so that --benchmark_filter=Matrix/Bsort512/ picks out one column. The
+Brainf*ck workloads also report BFInstructions, the rate at which the
+commands of the source are executed. That is counted once, by the plain
+interpreter here, so it is the same for every strategy however many
+commands each of them fuses into a single instruction. The times are
+wall-clock, as the baseline runs in a process of its own.
+
+Where the host has hardware counters (see perf_counters.hpp), they are
+reported too, per iteration and per Brainf*ck command, so that the
+strategies can be compared on their branch-misses per command rather than
+only on time. reportHardware does the same for the other benchmarks.
+*/
+
+#ifndef WORKLOADS_HPP
+#define WORKLOADS_HPP
+
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "../perf_counters.hpp"
+
+namespace matrix {
+
+enum struct Language {
+    BF,
+    BFTH
+};
+
+struct Workload {
+    std::string name;
+    Language language;
+    std::string program;
+    std::string input_file;             //  Empty for a generated input, or none.
+    size_t input_size;                  //  The size of the generated input.
+};
+
+//  bsort.bf is quadratic in its input, so it is run on several sizes. The
+//  other programs read their own kind of input: dbf2c.bf translates
+//  Brainf*ck and head.bf copies the first lines of a text.
+inline const std::vector<Workload> & workloads() {
+    static const std::vector<Workload> WORKLOADS = {
+        { "Bsort32", Language::BF, "../bsort.bf", "", 32 },
+        { "Bsort128", Language::BF, "../bsort.bf", "", 128 },
+        { "Bsort512", Language::BF, "../bsort.bf", "", 512 },
+        { "Dbf2c", Language::BF, "../dbf2c.bf", "../bsort.bf", 0 },
+        { "Head", Language::BF, "../head.bf", "../README.md", 0 },
+        { "Sierpinski", Language::BF, "../sierpinski.bf", "", 0 },
+        { "HelloBfth", Language::BFTH, "../brainforth/hello.bfth", "", 0 },
+        { "SierpinskiBfth", Language::BFTH, "../brainforth/sierpinski.bfth", "", 0 },
+        { "Star3Bfth", Language::BFTH, "../brainforth/star3.bfth", "", 0 },
+        { "LoopsBfth", Language::BFTH, "../brainforth/loops.bfth", "", 0 },
+    };
+    return WORKLOADS;
+}
+
+inline std::string readFile( const std::string & filename ) {
+    std::ifstream file( filename );
+    if ( not file ) {
+        throw std::runtime_error( "Cannot open " + filename );
+    }
+    std::stringstream text;
+    text << file.rdbuf();
+    return text.str();
+}
+
+//  Lines of lower-case words, the same on every run.
+inline std::string generatedText( size_t size ) {
+    std::string text;
+    uint32_t seed = 12345;
+    while ( text.size() < size ) {
+        seed = seed * 1103515245 + 12345;
+        const uint32_t r = ( seed >> 16 ) % 32;
+        text += r < 26 ? static_cast<char>( 'a' + r ) : r < 31 ? ' ' : '\n';
+    }
+    return text;
+}
+
+inline std::string inputOf( const Workload & workload ) {
+    if ( not workload.input_file.empty() ) {
+        return readFile( workload.input_file );
+    }
+    return generatedText( workload.input_size );
+}
+
+//  What the plain interpreter finds when it runs a Brainf*ck workload.
+struct Reference {
+    std::string output;
+    uint64_t instructions = 0;          //  The commands executed.
+};
+
+inline Reference referenceOf( const std::string & source, const std::string & input ) {
+    std::string code;
+    for ( char ch : source ) {
+        if ( std::string_view( "><+-.,[]" ).find( ch ) != std::string_view::npos ) {
+            code += ch;
+        }
+    }
+    std::vector<size_t> jumps( code.size() );
+    std::vector<size_t> opens;
+    for ( size_t i = 0; i < code.size(); i++ ) {
+        if ( code[ i ] == '[' ) {
+            opens.push_back( i );
+        } else if ( code[ i ] == ']' ) {
+            jumps[ i ] = opens.back();
+            jumps[ opens.back() ] = i;
+            opens.pop_back();
+        }
+    }
+
+    Reference reference;
+    std::vector<unsigned char> tape( 65536 );
+    size_t loc = 0;
+    size_t next = 0;
+    for ( size_t pc = 0; pc < code.size(); pc++ ) {
+        reference.instructions += 1;
+        switch ( code[ pc ] ) {
+            case '>': loc += 1; break;
+            case '<': loc -= 1; break;
+            case '+': tape[ loc ] += 1; break;
+            case '-': tape[ loc ] -= 1; break;
+            case '.': reference.output += static_cast<char>( tape[ loc ] ); break;
+            case ',': if ( next < input.size() ) tape[ loc ] = static_cast<unsigned char>( input[ next++ ] ); break;
+            case '[': if ( tape[ loc ] == 0 ) pc = jumps[ pc ]; break;
+            case ']': if ( tape[ loc ] != 0 ) pc = jumps[ pc ]; break;
+        }
+    }
+    return reference;
+}
+
+//  Worked out once for each workload.
+inline const Reference & referenceOf( const Workload & workload ) {
+    static std::map<std::string, Reference> references;
+    auto it = references.find( workload.name );
+    if ( it == references.end() ) {
+        it = references.emplace( workload.name, referenceOf( readFile( workload.program ), inputOf( workload ) ) ).first;
+    }
+    return it->second;
+}
+
+//  The number of Brainf*ck commands that a program executes on the input.
+inline uint64_t instructionsOf( const std::string & program, const std::string & input = "" ) {
+    return referenceOf( readFile( program ), input ).instructions;
+}
+
+//  Adds the counts of a run of the benchmark to its results, averaged over
+//  the iterations and, unless the number of commands executed by each
+//  iteration is unknown, divided by that too.
+inline void reportHardware( benchmark::State & state, const perf_counters::HardwareCounters & hardware, uint64_t instructions = 0 ) {
+    for ( auto & [ name, count ] : hardware.read() ) {
+        state.counters[ name ] = benchmark::Counter( count, benchmark::Counter::kAvgIterations );
+        if ( instructions != 0 ) {
+            state.counters[ name + "/BF" ] = benchmark::Counter( count / static_cast<double>( instructions ), benchmark::Counter::kAvgIterations );
+        }
+    }
+}
+
+//  Runs a prepared program on an input, returning its output.
+using Run = std::function<std::string( const std::string & input )>;
+
+//  Prepares the program of a workload for one strategy.
+using Prepare = std::function<Run( const Workload & workload )>;
+
+struct Row {
+    std::string strategy;
+    Language language;
+    Prepare prepare;
+    std::string only;                   //  The only program the strategy can run, if it is specific to one.
+};
+
+inline std::vector<Row> & rows() {
+    static std::vector<Row> ROWS;
+    return ROWS;
+}
+
+inline bool runs( const Row & row, const Workload & workload ) {
+    return row.language == workload.language && ( row.only.empty() || row.only == workload.program );
+}
+
+//  Registers a benchmark for every workload the strategy runs. Returns a
+//  value so that it can be called when a file's statics are initialised.
+inline bool addRow( const std::string & strategy, Language language, Prepare prepare, const std::string & only = "" ) {
+    rows().push_back( { strategy, language, prepare, only } );
+    const Row & row = rows().back();
+    for ( const Workload & workload : workloads() ) {
+        if ( not runs( row, workload ) ) continue;
+        benchmark::RegisterBenchmark( ( "Matrix/" + workload.name + "/" + strategy ).c_str(), [=]( benchmark::State & state ) {
+            const std::string input = inputOf( workload );
+            const Run run = prepare( workload );
+            perf_counters::HardwareCounters hardware;
+            hardware.start();
+            for ( auto _ : state ) {
+                benchmark::DoNotOptimize( run( input ) );
+            }
+            hardware.stop();
+            if ( workload.language == Language::BF ) {
+                const uint64_t instructions = referenceOf( workload ).instructions;
+                const double executed = static_cast<double>( instructions * state.iterations() );
+                state.counters[ "BFInstructions" ] = benchmark::Counter( executed, benchmark::Counter::kIsRate );
+                reportHardware( state, hardware, instructions );
+            } else {
+                reportHardware( state, hardware );
+            }
+        } )->UseRealTime()->Unit( benchmark::kMillisecond );
+    }
+    return true;
+}
+
+} // namespace matrix
+
+#endif
@@ -0,0 +1,285 @@
+/*
+The whole Brainforth toolchain in a single process. The tokeniser, the
+compiler and the runner are the same code as the three programs, but the
+tokens are streamed from the tokeniser to the compiler through a ring
+buffer, and the compiled program is handed to the runner in memory. So
+neither the tokens nor the program are ever written out and parsed back
+as JSON, which is where the separate programs spend most of their time on
+large sources.
+
+The JSON interchange formats are still available for debugging:
+    --emit=tokens   writes the tokens, as brainforth_tokeniser does
+    --emit=json     writes the compiled program, as brainforth_compiler does
+
+Each of the three programs is compiled into its own namespace, with their
+shared headers included first so that they stay in the global namespace.
+*/
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+#include "json.hpp"
+#include "../seek.hpp"
+#include "../tape.hpp"
+#include "../stack.hpp"
+#include "../buffered_io.hpp"
+#include "../image.hpp"
+#include "../compile_cache.hpp"
+#include "../profile.hpp"
+#include "../snapshot.hpp"
+#include "../source_view.hpp"
+
+namespace brainforth_tokeniser {
+#define BRAINFORTH_TOKENISER_NO_MAIN
+#include "brainforth_tokeniser.cpp"
+}
+
+#undef DUMP
+#undef break_if
+#undef break_unless
+#undef continue_if
+#undef continue_unless
+#undef return_if
+#undef return_unless
+
+namespace brainforth_compiler {
+#define BRAINFORTH_COMPILER_NO_MAIN
+#include "brainforth_compiler.cpp"
+}
+
+#undef DUMP
+#undef MAIN_PROGRAM
+#undef break_if
+#undef break_unless
+#undef return_if
+#undef return_unless
+
+namespace brainforth_runner {
+#define BRAINFORTH_RUNNER_NO_MAIN
+#include "brainforth_runner.cpp"
+}
+
+namespace brainforth {
+
+//  A fixed-capacity ring buffer. N must be a power of two, so that the
+//  indexes can run on freely and be masked.
+template <typename T, size_t N>
+class Ring {
+    static_assert( ( N & ( N - 1 ) ) == 0, "The capacity must be a power of two" );
+    T items[ N ];
+    size_t head = 0;                    //  The next item to be popped.
+    size_t tail = 0;                    //  Where the next item is pushed.
+
+public:
+    bool empty() const { return head == tail; }
+    bool full() const { return tail - head == N; }
+
+    void push( T && item ) {
+        items[ tail++ & ( N - 1 ) ] = std::move( item );
+    }
+
+    T pop() {
+        return std::move( items[ head++ & ( N - 1 ) ] );
+    }
+};
+
+//  This class is responsible for feeding the tokens of the source to the
+//  compiler. Whenever the compiler has drained the ring, the tokeniser
+//  refills it, so the two alternate in batches rather than token by token.
+class TokenPipe : public brainforth_compiler::TokenSource {
+    static constexpr size_t CAPACITY = 256;
+    brainforth_tokeniser::PeekableProgramInput tokeniser;
+    Ring< brainforth_compiler::Token, CAPACITY > ring;
+
+public:
+    TokenPipe( std::istream & source ) :
+        tokeniser( source )
+    {}
+
+private:
+    void refill() {
+        while ( not ring.full() ) {
+            auto text = tokeniser.nextToken();
+            if ( not text ) break;
+            if ( isalnum( text->front() ) ) {
+                ring.push( brainforth_compiler::Token::ofName( std::string( *text ) ) );
+            } else {
+                ring.push( brainforth_compiler::Token::ofSymbol( text->front() ) );
+            }
+        }
+    }
+
+public:
+    brainforth_compiler::Token nextToken() override {
+        if ( ring.empty() ) {
+            refill();
+            if ( ring.empty() ) {
+                return brainforth_compiler::Token();
+            }
+        }
+        return ring.pop();
+    }
+};
+
+//  Compiles Brainforth source into the bindings of its words, as
+//  brainforth_compiler does but without going through JSON tokens.
+inline std::map<std::string, nlohmann::json> compileStream( std::istream & source, const brainforth_compiler::CompileFlags & flags ) {
+    std::noskipws( source );
+    TokenPipe pipe( source );
+    const brainforth_compiler::InstructionSet instruction_set;
+    std::map<std::string, nlohmann::json> bindings;
+    brainforth_compiler::CodePlanter planter( flags, pipe, instruction_set, bindings );
+    planter.plantProgram();
+    for ( auto & [ name, code ] : bindings ) {
+        for ( auto & i : code ) {
+            i.erase( "DiscardBeforeSetZero" );
+        }
+    }
+    return bindings;
+}
+
+//  The options of the single binary: the runner's and --emit=, with every
+//  other option passed on to the compiler.
+struct Options {
+    TapeOptions tape;
+    brainforth_runner::TraceOptions trace;
+    profile::ProfileOptions profiling;
+    snapshot::SnapshotOptions snapshots;
+    bool buffered = true;
+    std::string emit;                   //  Empty to run the program, or "tokens" or "json".
+    std::vector<std::string> compile;
+    std::vector<std::string> filenames;
+
+public:
+    Options( const std::vector<std::string> & args ) {
+        const std::string EMIT = "--emit=";
+        for ( auto & arg : args ) {
+            if ( arg == "--unbuffered" ) {
+                buffered = false;
+            } else if ( arg.rfind( EMIT, 0 ) == 0 ) {
+                emit = arg.substr( EMIT.size() );
+                if ( emit != "tokens" && emit != "json" ) {
+                    throw std::runtime_error( "Unrecognised option: " + arg );
+                }
+            } else if ( tape.tryParse( arg ) || trace.tryParse( arg ) || profiling.tryParse( arg ) || snapshots.tryParse( arg ) ) {
+                //  Already parsed.
+            } else if ( arg.rfind( "--", 0 ) == 0 ) {
+                compile.push_back( arg );
+            } else {
+                filenames.push_back( arg );
+            }
+        }
+    }
+};
+
+//  Tokenises, compiles and runs one source. The planted program is kept
+//  in the compile cache as brainforth_compiler does, but keyed on the
+//  source itself, so a hit skips the tokeniser as well. The snapshots of
+//  the run identify the program by its source and flags likewise, as it
+//  is run from the image on a hit and from the JSON otherwise. Returns
+//  true if the run stopped at a checkpoint.
+inline bool runSource( const std::string & text, const Options & options, bool header_needed, const std::string & filename ) {
+    const brainforth_compiler::CompileFlags flags( options.compile );
+    if ( options.emit == "tokens" ) {
+        std::istringstream source( text );
+        std::noskipws( source );
+        brainforth_tokeniser::PeekableProgramInput input( source );
+        while ( auto token = input.nextJToken() ) {
+            std::cout << *token << std::endl;
+        }
+        return false;
+    }
+
+    const char * ENGINE = "brainforth";
+    const compile_cache::Cache cache = flags.cache && options.emit.empty() ? compile_cache::Cache() : compile_cache::Cache::disabled();
+    const compile_cache::Key key = compile_cache::Cache::key( ENGINE, flags.key(), text );
+
+    brainforth_runner::Engine engine( options.tape, options.trace, options.profiling, options.snapshots );
+    engine.identify( snapshot::fingerprint( text, snapshot::fingerprint( flags.key() ) ) );
+    auto run = [&]( auto & out, auto & in ) {
+        if ( header_needed ) {
+            std::cerr << "# Executing: " << filename << std::endl;
+        }
+        if ( auto file = cache.lookup( ENGINE, key ) ) {
+            engine.runFile( *file, false, out, in );
+            return;
+        }
+        std::istringstream source( text );
+        const auto bindings = compileStream( source, flags );
+        cache.store( ENGINE, key, brainforth_compiler::imageOf( bindings ) );
+        engine.runJSON( nlohmann::json( bindings ), out, in );
+    };
+
+    if ( options.emit == "json" ) {
+        std::istringstream source( text );
+        std::cout << nlohmann::json( compileStream( source, flags ) ).dump( 4 ) << std::endl;
+    } else if ( options.buffered ) {
+        BufferedOutput out;
+        BufferedInput in( STDIN_FILENO, &out );
+        run( out, in );
+    } else {
+        run( std::cout, std::cin );
+    }
+    return engine.stopped();
+}
+
+} // namespace brainforth
+
+//  The benchmarking harness includes this file for the pipeline and
+//  supplies its own main.
+#ifndef BRAINFORTH_NO_MAIN
+
+/*
+Each argument is the name of a Brainforth source file to be tokenised,
+compiled and run; with no file the source is read from the standard
+input. The options are those of brainforth_compiler and brainforth_runner,
+plus --emit=tokens or --emit=json to stop at that stage and write out its
+JSON instead. A run stopped at a checkpoint exits with a failing status.
+*/
+int main( int argc, char * argv[] ) {
+    const brainforth::Options options( std::vector<std::string>( argv + 1, argv + argc ) );
+    if ( not options.snapshots.checkpoint.empty() ) {
+        snapshot::installHandlers();
+    }
+    auto stop = [&]() {
+        std::cerr << "# Stopped at a checkpoint: " << options.snapshots.checkpoint << std::endl;
+        exit( EXIT_FAILURE );
+    };
+    if ( options.filenames.empty() ) {
+        std::stringstream source;
+        source << std::cin.rdbuf();
+        if ( brainforth::runSource( source.str(), options, false, "-" ) ) {
+            stop();
+        }
+    }
+    for ( auto & filename : options.filenames ) {
+        std::ifstream file( filename );
+        if ( not file ) {
+            throw std::runtime_error( "Cannot open " + filename );
+        }
+        std::stringstream source;
+        source << file.rdbuf();
+        if ( brainforth::runSource( source.str(), options, options.filenames.size() > 1, filename ) ) {
+            stop();
+        }
+    }
+    exit( EXIT_SUCCESS );
+}
+
+#endif
@@ -12,8 +12,14 @@ code from its execution. We introduce an intermediate JSON format.
 #include <deque>
 #include <cstdlib>
 #include <memory>
+#include <sstream>
+#include <set>
+#include <limits>
+#include <algorithm>
 
 #include "json.hpp"
+#include "../image.hpp"
+#include "../compile_cache.hpp"
 
 using namespace nlohmann;
 
@@ -77,35 +83,158 @@ public:
     bool isName() const {
         return this->token_type == NAME;
     }
+
+    static Token ofSymbol( char ch ) {
+        Token t;
+        t.token_type = SYMBOL;
+        t.symbol = ch;
+        return t;
+    }
+
+    static Token ofName( const std::string & name ) {
+        Token t;
+        t.token_type = NAME;
+        t.symbol = 'A';
+        t.name = name;
+        return t;
+    }
 } Token;
 
-class PeekableProgramInput {
-    std::istream& input;                //  The source code to be read in.
-    std::deque< Token > tbuffer;
+//  Where the compiler gets its tokens from. By default that is the JSON
+//  written by brainforth_tokeniser, one object per token, but the
+//  in-process pipeline of brainforth.cpp hands them over directly.
+class TokenSource {
 public:
-    PeekableProgramInput( std::istream& input ) :
+    virtual ~TokenSource() = default;
+
+    //  Returns the end-of-input token once the tokens are exhausted.
+    virtual Token nextToken() = 0;
+};
+
+class JSONTokenSource : public TokenSource {
+    std::istream& input;
+
+public:
+    JSONTokenSource( std::istream& input ) :
         input( input )
     {}
-private:
-    Token fetchToken() {
+
+public:
+    Token nextToken() override {
         if ( input.eof() ) {
             return Token();
         } else {
             json jobj;
             input >> jobj >> std::ws;
             if ( jobj.contains( "symbol" ) ) {
-                Token t;
-                t.token_type = Token::SYMBOL;
-                t.symbol = jobj[ "symbol" ].get<std::string>()[ 0 ];
-                return t;
+                return Token::ofSymbol( jobj[ "symbol" ].get<std::string>()[ 0 ] );
+            } else {
+                return Token::ofName( jobj[ "name" ].get<std::string>() );
+            }
+        }
+    }
+};
+
+//  A word whose definition is still being read.
+struct Definition {
+    std::string name;
+    std::vector< Token > body;
+    bool nested = false;                //  True if it contains another definition.
+};
+
+//  Responsible for reading the tokens and for inlining small words. Calls
+//  to a word are replaced by its body as the tokens are read, so every
+//  pass of the CodePlanter sees straight through the former call. Only
+//  words that have already been defined are inlined, so inlining always
+//  terminates. A word that is defined again is never inlined, as the
+//  planter appends the new body to the old and a call runs from the first.
+class PeekableProgramInput {
+    std::unique_ptr< TokenSource > owned;
+    TokenSource & source;               //  The tokens to be read in.
+    std::deque< Token > tbuffer;
+    size_t inline_threshold;            //  The largest body, in tokens, that is inlined.
+    std::map< std::string, std::vector< Token > > inlinable;
+    std::set< std::string > defined;    //  Every word defined so far.
+    std::set< std::string > redefined;  //  Those defined more than once.
+    std::vector< Definition > definitions;
+    std::deque< Token > expansion;      //  The rest of the body being inlined.
+    bool after_colon = false;
+public:
+    PeekableProgramInput( TokenSource & source, size_t inline_threshold = 0 ) :
+        source( source ),
+        inline_threshold( inline_threshold )
+    {}
+
+    PeekableProgramInput( std::istream& input, size_t inline_threshold = 0 ) :
+        owned( std::make_unique< JSONTokenSource >( input ) ),
+        source( *owned ),
+        inline_threshold( inline_threshold )
+    {}
+private:
+    //  A word can be inlined if it is small, does not call itself, does
+    //  not define other words and saves and restores locations in pairs.
+    bool isInlinable( const Definition & d ) const {
+        return_if( d.nested || d.body.size() > inline_threshold )( false );
+        int saved = 0;
+        for ( auto & t : d.body ) {
+            return_if( t.isName() && t.name == d.name )( false );
+            if ( t.isSymbol( '$' ) ) {
+                saved += 1;
+            } else if ( t.isSymbol( '#' ) ) {
+                saved -= 1;
+                return_if( saved < 0 )( false );
+            }
+        }
+        return saved == 0;
+    }
+
+    //  Keeps track of the definitions that the token belongs to.
+    void define( const Token & t ) {
+        if ( after_colon ) {
+            after_colon = false;
+            if ( t.isName() ) {
+                if ( not defined.insert( t.name ).second ) {
+                    redefined.insert( t.name );
+                    inlinable.erase( t.name );
+                }
+                definitions.push_back( { t.name } );
+                return;
+            }
+        }
+        if ( t.isSymbol( ':' ) ) {
+            after_colon = true;
+            if ( not definitions.empty() ) {
+                definitions.back().nested = true;
+            }
+        } else if ( t.isSymbol( ';' ) && not definitions.empty() ) {
+            if ( isInlinable( definitions.back() ) && redefined.count( definitions.back().name ) == 0 ) {
+                inlinable[ definitions.back().name ] = definitions.back().body;
+            }
+            definitions.pop_back();
+        } else if ( not definitions.empty() ) {
+            definitions.back().body.push_back( t );
+        }
+    }
+
+    Token fetchToken() {
+        for (;;) {
+            Token t;
+            if ( not expansion.empty() ) {
+                t = expansion.front();
+                expansion.pop_front();
             } else {
-                Token t;
-                t.token_type = Token::NAME;
-                t.symbol = 'A';
-                t.name = jobj[ "name" ].get<std::string>();
-                return t;
+                t = source.nextToken();
+                if ( t.isName() && not after_colon ) {
+                    auto it = inlinable.find( t.name );
+                    if ( it != inlinable.end() ) {
+                        expansion.assign( it->second.begin(), it->second.end() );
+                        continue;
+                    }
+                }
             }
-        }      
+            define( t );
+            return t;
+        }
     }
 
 public:
@@ -219,6 +348,7 @@ typedef struct InstructionSet {
     OpCode RESTORE = { "RESTORE", false, false };
     OpCode RETURN = { "RETURN", false, false };
     OpCode HALT = { "HALT", false, false };
+    OpCode STACKS = { "STACKS", false, false };
 } InstructionSet; 
 
 //  TODO: These should be moved to a shared header file.
@@ -234,6 +364,10 @@ typedef struct CompileFlags {
     bool locIsZero = true;
     bool xfrMultiple = true;
     bool unplantSuperfluousCode = true;
+    bool binary = false;                //  Emit a binary image rather than JSON.
+    bool cache = true;                  //  Use the compile cache.
+    static constexpr size_t DEFAULT_INLINE_THRESHOLD = 16;
+    size_t inlineThreshold = DEFAULT_INLINE_THRESHOLD;    //  Inline words of at most this many tokens, 0 for none.
 
     void setDeadCode( bool enabled ) {
         this->deadCodeRemoval = enabled;
@@ -277,6 +411,14 @@ typedef struct CompileFlags {
             setXfrMultiple( enable );
         } else if ( arg == "--superfluous" ) {
             setUnplantSuperfluousCode( enable );
+        } else if ( arg == "--binary" ) {
+            this->binary = enable;
+        } else if ( arg == "--cache" ) {
+            this->cache = enable;
+        } else if ( startsWith( arg, "--inline-threshold=" ) ) {
+            this->inlineThreshold = std::stoul( arg.substr( std::string( "--inline-threshold=" ).size() ) );
+        } else if ( arg == "--inline" ) {
+            this->inlineThreshold = enable ? DEFAULT_INLINE_THRESHOLD : 0;
         } else {
             std::string prefix( "--no-" );
             if ( startsWith( arg, prefix ) ) {    //  is it a prefix?
@@ -293,8 +435,117 @@ typedef struct CompileFlags {
             setArg( arg, true );
         }
     }
+
+    //  The flags that affect what is planted, as part of the cache key.
+    std::string key() const {
+        std::string k;
+        for ( bool flag : { deadCodeRemoval, seekZero, locIsZero, xfrMultiple, unplantSuperfluousCode } ) {
+            k += flag ? '1' : '0';
+        }
+        k += ":" + std::to_string( inlineThreshold );
+        return k;
+    }
 } CompileFlags;
 
+//  This class is responsible for working out how deep the call stack and
+//  the data stack of a program can get, so that the runner can size them
+//  exactly. A CALL or a SAVE takes a slot of the call stack and a PUSH an
+//  item of the data stack. A word's effect on a stack is the net change
+//  it makes and the peak it reaches above where it started. Recursion
+//  leaves the depth of both stacks unbounded, and so does a loop that does
+//  not leave a stack as it found it, for that stack.
+class StackAnalysis {
+    struct Usage {
+        bool bounded = true;
+        int64_t net = 0;
+        int64_t peak = 0;
+
+    public:
+        void push( int64_t n ) {
+            net += n;
+            peak = std::max( peak, net );
+        }
+
+        //  A call takes frame slots of its own on top of the callee's.
+        void call( const Usage & callee, int64_t frame ) {
+            peak = std::max( peak, net + frame + callee.peak );
+            net += callee.net;
+            bounded = bounded && callee.bounded;
+        }
+    };
+
+    struct Effect {
+        Usage calls;
+        Usage data;
+    };
+
+    const std::map<std::string, json> & bindings;
+    std::map<std::string, Effect> effects;
+    std::set<std::string> active;       //  The words being analysed, to spot recursion.
+
+public:
+    StackAnalysis( const std::map<std::string, json> & bindings ) :
+        bindings( bindings )
+    {}
+
+private:
+    Effect effectOf( const std::string & name ) {
+        auto cached = effects.find( name );
+        return_if( cached != effects.end() )( cached->second );
+        Effect effect;
+        if ( active.count( name ) ) {
+            effect.calls.bounded = false;
+            effect.data.bounded = false;
+            return effect;
+        }
+        auto binding = bindings.find( name );
+        return_if( binding == bindings.end() )( effect );
+        active.insert( name );
+        const json & code = binding->second;
+        std::vector< Effect > opens;
+        for ( size_t k = 0; k < code.size(); k++ ) {
+            if ( not code[ k ].contains( OPCODE ) ) continue;
+            const std::string opcode = code[ k ][ OPCODE ];
+            if ( opcode == "PUSH" ) {
+                effect.data.push( 1 );
+            } else if ( opcode == "POP" ) {
+                effect.data.push( -1 );
+            } else if ( opcode == "SAVE" ) {
+                effect.calls.push( 1 );
+            } else if ( opcode == "RESTORE" ) {
+                effect.calls.push( -1 );
+            } else if ( opcode == "CALL" ) {
+                const Effect callee = effectOf( code[ k + 1 ][ REF ] );
+                effect.calls.call( callee.calls, 1 );
+                effect.data.call( callee.data, 0 );
+            } else if ( opcode == "OPEN" ) {
+                opens.push_back( effect );
+            } else if ( opcode == "CLOSE" ) {
+                const Effect & before = opens.back();
+                effect.calls.bounded = effect.calls.bounded && effect.calls.net == before.calls.net;
+                effect.data.bounded = effect.data.bounded && effect.data.net == before.data.net;
+                opens.pop_back();
+            }
+        }
+        active.erase( name );
+        effects[ name ] = effect;
+        return effect;
+    }
+
+    static int32_t depthOf( const Usage & usage ) {
+        const bool fits = usage.bounded && usage.peak <= std::numeric_limits<int32_t>::max();
+        return fits ? static_cast<int32_t>( usage.peak ) : -1;
+    }
+
+public:
+    //  The greatest depths of the call stack and the data stack, or -1 if
+    //  they are unbounded.
+    std::pair<int32_t, int32_t> depths() {
+        const Effect effect = effectOf( MAIN_PROGRAM );
+        return { depthOf( effect.calls ), depthOf( effect.data ) };
+    }
+};
+
 //  This class is responsible for translating the stream of source code
 //  into a vector<Instruction>. It is passed a mapping from characters
 //  to the addresses-of-labels, so it can plant (aka append) the exact
@@ -310,14 +561,16 @@ class CodePlanter {
     std::vector<std::tuple<std::shared_ptr<std::vector<int>>, json *>> dump;
     
 public:
+    //  The tokens are either a std::istream of JSON tokens or a TokenSource.
+    template <typename Source>
     CodePlanter( 
         CompileFlags flags,
-        std::istream& input_stream,
+        Source & source,
         const InstructionSet & instruction_set,
         std::map<std::string, json> & bindings 
     ) :
         flags( flags ),
-        input( input_stream ),
+        input( source, flags.inlineThreshold ),
         instruction_set( instruction_set ), 
         bindings( bindings ),
         program( &bindings[MAIN_PROGRAM] ),
@@ -660,21 +913,122 @@ public:
     void plantProgram() {
         while ( plantExpr() ) {}
         plantOpCode( instruction_set.HALT );
+        plantSTACKS();
+    }
+
+private:
+    //  Once the program is complete, main is prefixed with the depths of
+    //  the stacks. Jumps are relative, so nothing needs to be patched.
+    void plantSTACKS() {
+        const auto [ calls, data ] = StackAnalysis( bindings ).depths();
+        json & main = bindings[ MAIN_PROGRAM ];
+        main.insert( main.begin(), json( { { HIGH, calls }, { LOW, data } } ) );
+        main.insert( main.begin(), json( {{ OPCODE, instruction_set.STACKS.name }} ) );
     }
 };
 
+//  Translates the bindings into the binary image format, one binding after
+//  another. The relative jumps of OPEN and CLOSE become absolute indexes.
+image::Writer imageOf( const std::map<std::string, json> & bindings ) {
+    image::Writer writer;
+    for ( auto & [ name, code ] : bindings ) {
+        writer.binding( name );
+        bool jump = false;
+        for ( auto & i : code ) {
+            if ( i.contains( OPCODE ) ) {
+                const std::string opcode = i[ OPCODE ];
+                writer.opcode( opcode );
+                jump = opcode == "OPEN" || opcode == "CLOSE";
+            } else if ( i.contains( OPERAND ) ) {
+                int64_t n = i[ OPERAND ];
+                if ( jump ) {
+                    writer.jump( writer.size() + 1 + n );
+                } else {
+                    writer.operand( n );
+                }
+            } else if ( i.contains( HIGH ) ) {
+                writer.dyad( i[ HIGH ], i[ LOW ] );
+            } else if ( i.contains( REF ) ) {
+                writer.reference( i[ REF ] );
+            }
+        }
+    }
+    return writer;
+}
+
+//  The inverse of imageOf, for when the cached image is wanted as JSON.
+json jsonOf( const image::Mapped & mapped ) {
+    json bindings = json::object();
+    const auto & names = mapped.bindingNames();
+    for ( size_t b = 0; b < names.size(); b++ ) {
+        const int64_t start = mapped.bindingStarts()[ b ];
+        const int64_t end = b + 1 < names.size() ? mapped.bindingStarts()[ b + 1 ] : static_cast<int64_t>( mapped.size() );
+        json code = json::array();
+        for ( int64_t k = start; k < end; k++ ) {
+            const image::Slot slot = mapped.slots()[ k ];
+            switch ( mapped.tags()[ k ] ) {
+                case image::OPCODE:
+                    code.push_back( {{ OPCODE, mapped.opcodeNames()[ slot.opcode ] }} );
+                    break;
+                case image::OPERAND:
+                    code.push_back( {{ OPERAND, slot.operand }} );
+                    break;
+                case image::JUMP:
+                    code.push_back( {{ OPERAND, slot.operand - ( k + 1 ) }} );
+                    break;
+                case image::DYAD:
+                    code.push_back( { { HIGH, slot.dyad.high }, { LOW, slot.dyad.low } } );
+                    break;
+                case image::REFERENCE:
+                    code.push_back( {{ REF, names[ slot.operand ] }} );
+                    break;
+            }
+        }
+        bindings[ std::string( names[ b ] ) ] = code;
+    }
+    return bindings;
+}
+
+//  The benchmarking harness compiles this file into its own executable and
+//  supplies its own main.
+#ifndef BRAINFORTH_COMPILER_NO_MAIN
+
 /*
 Compiles Brainforth code on the standard input into a JSON array of 
-CISC instructions.
+CISC instructions, or a binary image with --binary. The planted program
+is kept in the compile cache (see compile_cache.hpp), keyed on the tokens
+and the compile flags, unless --no-cache is given. Words of at most 16
+tokens are inlined into their callers; --inline-threshold=N changes the
+limit and --no-inline turns it off.
 */
 int main( int argc, char * argv[] ) {
     std::vector<std::string> args(argv + 1, argv + argc);
     CompileFlags flags( args );
 
+    std::stringstream source;
+    source << std::cin.rdbuf();
+
+    const char * ENGINE = "brainforth_compiler";
+    const compile_cache::Cache cache = flags.cache ? compile_cache::Cache() : compile_cache::Cache::disabled();
+    const compile_cache::Key key = compile_cache::Cache::key( ENGINE, flags.key(), source.str() );
+    if ( auto file = cache.lookup( ENGINE, key ) ) {
+        try {
+            if ( flags.binary ) {
+                std::ifstream cached( *file, std::ios::binary );
+                std::cout << cached.rdbuf();
+            } else {
+                std::cout << jsonOf( image::Mapped( *file ) ).dump(4) << std::endl;
+            }
+            return( EXIT_SUCCESS );
+        } catch ( const std::exception & ) {
+            //  An unusable image is treated as a miss.
+        }
+    }
+
     std::map<std::string, json> bindings;
     const InstructionSet instruction_set;
 
-    CodePlanter planter( flags, std::cin, instruction_set, bindings );
+    CodePlanter planter( flags, source, instruction_set, bindings );
     planter.plantProgram();
 
     for ( auto & [ name, code ] : bindings ) {
@@ -683,8 +1037,14 @@ int main( int argc, char * argv[] ) {
         }
     }
 
-    json main = bindings;
-
-    std::cout << main.dump(4) << std::endl;
+    if ( flags.binary ) {
+        imageOf( bindings ).write( std::cout );
+    } else {
+        json main = bindings;
+        std::cout << main.dump(4) << std::endl;
+    }
+    cache.store( ENGINE, key, imageOf( bindings ) );
     return( EXIT_SUCCESS );
 }
+
+#endif
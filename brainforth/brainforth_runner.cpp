@@ -1,8 +1,22 @@
 /*
 We extend the CISC Brainf*ck machine with new instructions:
     ?   Push the item at the current location onto the stack
-    !   Pop the top item of the stack into the current location (or pop 0
-        if the stack is empty)
+    !   Pop the top item of the stack into the current location (popping
+        an empty stack is reported as a stack underflow)
+
+Hot loops and words are handed to a tracing tier, see Tracer below. With
+--profile=FILE the program is instead run in the profiling instantiation
+of the engine, with tracing off so that the counts are of the program as
+compiled (see BindingProfile below and profile.hpp).
+
+The data stack and the call stack are guarded regions that never move (see
+stack.hpp), with their tops kept in local pointers. The compiler plants a
+STACKS instruction at the start of main giving the greatest depth of each,
+when it can work it out, and those stacks are sized exactly.
+
+A run can be checkpointed, warm started and resumed (see snapshot.hpp) in
+the snapshotting instantiation of the engine, with tracing off so that
+every instruction is in a binding and can be numbered (see BindingSlots).
 */
 
 
@@ -14,6 +28,16 @@ We extend the CISC Brainf*ck machine with new instructions:
 #include <stdexcept>
 #include <deque>
 #include <cstdlib>
+#include <algorithm>
+#include <functional>
+
+#include "../seek.hpp"
+#include "../tape.hpp"
+#include "../stack.hpp"
+#include "../buffered_io.hpp"
+#include "../image.hpp"
+#include "../profile.hpp"
+#include "../snapshot.hpp"
 
 
 #include "json.hpp"
@@ -49,11 +73,12 @@ typedef struct Dyad {
 //  The instruction stream is mainly OpCodes but there are some
 //  integer arguments interspersed. Strictly speaking this makes this
 //  interpreter a hybrid between direct/indirect threading.
-typedef union {
+typedef union Instruction {
     OpCode opcode;
     int64_t operand;
     Dyad dyad;
     void * reference;
+    union Instruction * target;         //  Jump target of OPEN and CLOSE.
 } Instruction;
 
 //  Horrible hack to more-or-less switch on string-literals.
@@ -87,7 +112,20 @@ typedef struct InstructionSet {
     OpCode CALL;
     OpCode RETURN;
     OpCode HALT;
+    OpCode LOOP;                        //  A CLOSE in a trace, which is not counted.
+    OpCode EXIT;                        //  Leaves a trace for the threaded code.
+    OpCode STACKS;                      //  The depths of the stacks, only ever at the start of main.
 public:
+    //  True if the opcode is followed by a single operand slot.
+    bool hasOperand( OpCode opcode ) const {
+        return
+            opcode == ADD || opcode == MOVE || opcode == ADD_OFFSET || opcode == XFR_MULTIPLE ||
+            opcode == OPEN || opcode == CLOSE || opcode == LOOP || opcode == EXIT || opcode == CALL ||
+            opcode == STACKS;
+    }
+
+    //  LOOP and EXIT are only ever planted by the Tracer, so they have no
+    //  names.
     OpCode byName( const std::string & name ) const {
         switch ( hash( name.c_str() ) ) {
             case hash( "PUSH" ): return PUSH;
@@ -112,9 +150,23 @@ public:
             case hash( "RESTORE" ): return RESTORE;
             case hash( "RETURN" ): return RETURN;
             case hash( "HALT" ): return HALT;
+            case hash( "STACKS" ): return STACKS;
         };
         throw std::runtime_error( "Unrecognised opcode: " + name );
     }
+
+    //  The names of the opcodes, for profiling.
+    std::map<OpCode, std::string> names() const {
+        std::map<OpCode, std::string> names = { { LOOP, "LOOP" }, { EXIT, "EXIT" } };
+        for ( auto name : {
+            "PUSH", "POP", "SET_ZERO", "INCR", "DECR", "ADD", "ADD_OFFSET", "XFR_MULTIPLE",
+            "LEFT", "RIGHT", "SEEK_LEFT", "SEEK_RIGHT", "MOVE", "OPEN", "CLOSE", "GET", "PUT",
+            "CALL", "SAVE", "RESTORE", "RETURN", "HALT", "STACKS"
+        } ) {
+            names[ byName( name ) ] = name;
+        }
+        return names;
+    }
 } InstructionSet;
 
 //  This class is responsible for translating the stream of source code
@@ -123,17 +175,21 @@ public:
 //  pointer to the implementing code. 
 class CodePlanter {
     const std::string filename;  
+    const json * jprogram;              //  Already in memory, rather than in the file.
     const InstructionSet & instruction_set;
     std::map<std::string, std::vector<Instruction>> & bindings; 
     std::vector< std::tuple< std::string, size_t, std::string > > backfill;
+    std::vector< std::tuple< std::string, size_t > > jumps;
 
 public:
     CodePlanter( 
         const std::string filename,
         const InstructionSet & instruction_set,
-        std::map<std::string, std::vector<Instruction>> & bindings 
+        std::map<std::string, std::vector<Instruction>> & bindings,
+        const json * jprogram = nullptr
     ) :
         filename( filename ),
+        jprogram( jprogram ),
         instruction_set( instruction_set ), 
         bindings( bindings )
     {}
@@ -158,17 +214,64 @@ private:
         backfill.push_back( { enclosing, program.size() - 1, name } );
     }
 
-    void plantOpCode( const json & jopcode, std::vector< Instruction > & program ) {
+    void plantOpCode( const json & jopcode, std::vector< Instruction > & program, const std::string & enclosing ) {
         const std::string name = jopcode[ "OpCode" ];
         OpCode opcode( instruction_set.byName( name ) );
         program.push_back( { opcode } );
+        if ( opcode == instruction_set.OPEN || opcode == instruction_set.CLOSE ) {
+            jumps.push_back( { enclosing, program.size() } );
+        }
     }
 
-public:
-    void plantProgram() {
-        std::ifstream input( filename.c_str(), std::ios::in );
-        json jprogram;
-        input >> jprogram;
+    //  Relocates a binary image, written by brainforth_compiler --binary,
+    //  in one pass. Every binding is sized up front so that references
+    //  between them can be filled in as we go.
+    void plantImage() {
+        image::Mapped mapped( filename );
+        std::vector<OpCode> relocations;
+        for ( auto name : mapped.opcodeNames() ) {
+            relocations.push_back( instruction_set.byName( std::string( name ) ) );
+        }
+        const auto & names = mapped.bindingNames();
+        const int64_t * starts = mapped.bindingStarts();
+        std::vector<Instruction *> bases;
+        for ( size_t b = 0; b < names.size(); b++ ) {
+            const int64_t end = b + 1 < names.size() ? starts[ b + 1 ] : static_cast<int64_t>( mapped.size() );
+            std::vector<Instruction> & program = this->bindings[ std::string( names[ b ] ) ];
+            program.resize( end - starts[ b ] );
+            bases.push_back( program.data() );
+        }
+        const image::Tag * tags = mapped.tags();
+        const image::Slot * slots = mapped.slots();
+        for ( size_t b = 0; b < names.size(); b++ ) {
+            Instruction * program_data = bases[ b ];
+            const int64_t start = starts[ b ];
+            const int64_t end = b + 1 < names.size() ? starts[ b + 1 ] : static_cast<int64_t>( mapped.size() );
+            for ( int64_t k = start; k < end; k++ ) {
+                const image::Slot slot = slots[ k ];
+                Instruction & i = program_data[ k - start ];
+                switch ( tags[ k ] ) {
+                    case image::OPCODE:
+                        i.opcode = relocations.at( slot.opcode );
+                        break;
+                    case image::OPERAND:
+                        i.operand = slot.operand;
+                        break;
+                    case image::DYAD:
+                        i.dyad = { .operand1=slot.dyad.high, .operand2=slot.dyad.low };
+                        break;
+                    case image::JUMP:
+                        i.target = &program_data[ slot.operand - start ];
+                        break;
+                    case image::REFERENCE:
+                        i.reference = bases.at( slot.operand );
+                        break;
+                }
+            }
+        }
+    }
+
+    void plantJSON( const json & jprogram ) {
         //  Ensure the bindings map is filled up - we don't want anything moving.
         for ( auto & [name, jcode] : jprogram.items() ) {
             this->bindings[ name ] = std::vector<Instruction>();
@@ -179,7 +282,7 @@ public:
             for ( auto & i : jcode ) {
                 // std::cerr << "Code: " << i << std::endl;
                 if ( i.contains( "OpCode" ) ) {
-                    plantOpCode( i, program );
+                    plantOpCode( i, program, name );
                 } else if ( i.contains( "Operand" ) ) {
                     plantOperand( i, program );
                 } else if ( i.contains( "High" ) ) {
@@ -193,6 +296,27 @@ public:
         for ( auto & [ enclosing, index, refname ] : backfill ) {
             this->bindings[ enclosing ][ index ].reference = this->bindings[ refname ].data();
         }
+        //  And resolve the relative jumps of OPEN and CLOSE into direct 
+        //  pointers. The displacement is from the slot after the operand.
+        for ( auto & [ enclosing, index ] : jumps ) {
+            Instruction & slot = this->bindings[ enclosing ][ index ];
+            slot.target = &slot + 1 + slot.operand;
+        }
+    }
+
+public:
+    //  The program may be either a binary image or the JSON debug format.
+    void plantProgram() {
+        if ( jprogram ) {
+            plantJSON( *jprogram );
+        } else if ( image::Mapped::isImage( filename ) ) {
+            plantImage();
+        } else {
+            std::ifstream input( filename.c_str(), std::ios::in );
+            json j;
+            input >> j;
+            plantJSON( j );
+        }
     }
 };
 
@@ -200,9 +324,11 @@ typedef unsigned char num;
 
 typedef union CallStackSlot {
     Instruction * return_address;
+    //  The location comes first, where a return address would be, so that
+    //  a snapshot can tell the two apart (see Engine::save).
     struct SavedLocation {
-        num saved;
         num * location;
+        num saved;
 
     public:
         void restore() {
@@ -211,21 +337,535 @@ typedef union CallStackSlot {
     } saved_location;
 } CallStackSlot;
 
+typedef GuardedStack< num > DataStack;
+typedef GuardedStack< CallStackSlot > CallStack;
+
+const GuardMessages DATA_STACK_MESSAGES = {
+    "Data stack underflow: popped an empty stack\n",
+    "Data stack overflow: pushed too many items\n",
+    "Data stack overflow: cannot grow the stack\n"
+};
+
+const GuardMessages CALL_STACK_MESSAGES = {
+    "Call stack underflow: returned from main\n",
+    "Call stack overflow: calls nested too deeply\n",
+    "Call stack overflow: cannot grow the stack\n"
+};
+
+//  The command-line option that controls the tracing tier,
+//  --trace-threshold=N, where 0 turns it off.
+struct TraceOptions {
+    uint32_t threshold = 1000;
+
+public:
+    //  Returns true if the argument was a trace option.
+    bool tryParse( std::string_view arg ) {
+        const std::string_view option = "--trace-threshold=";
+        if ( arg.substr( 0, option.size() ) != option ) {
+            return false;
+        }
+        threshold = static_cast<uint32_t>( std::stoul( std::string( arg.substr( option.size() ) ) ) );
+        return true;
+    }
+};
+
+//  This class is responsible for the tracing tier. The interpreter counts
+//  the taken back-edges of every loop and the calls made from every site,
+//  in a small table hashed on the site so that counting costs no more than
+//  an increment. When a site gets hot we record a trace:
+//
+//      A hot loop is copied into a trace buffer, with the words that it
+//      calls inlined, ending in a LOOP back to its start and an EXIT to
+//      the code after the original loop. The back-edge of the original is
+//      patched to enter the trace.
+//
+//      A hot word is copied, with its own calls inlined, into a new word
+//      and the calling site is patched to call that instead.
+//
+//  Inlining lets runs of arithmetic and moves be fused across what were
+//  word boundaries, and gets rid of the pushes and pops of the call stack.
+//  A trace is made of ordinary instructions, so a call that cannot be
+//  inlined (a word calling itself, say, or a trace that grows too large)
+//  is simply left as a CALL that returns into the trace.
+class Tracer {
+    static constexpr size_t COUNTERS = 4096;
+    static constexpr size_t MAX_TRACE = 4096;       //  In slots.
+    static constexpr int MAX_DEPTH = 16;
+
+    //  This class is responsible for copying code into a single trace.
+    class Recording {
+        const InstructionSet & instruction_set;
+        const std::map<const Instruction *, const Instruction *> & words;
+        OpCode pending = nullptr;       //  An ADD or MOVE that is still being fused.
+        int64_t amount = 0;
+
+    public:
+        std::vector<Instruction> code;
+        std::vector<size_t> jumps;      //  Slots holding the index of their target.
+
+    public:
+        Recording(
+            const InstructionSet & instruction_set,
+            const std::map<const Instruction *, const Instruction *> & words
+        ) :
+            instruction_set( instruction_set ),
+            words( words )
+        {}
+
+    private:
+        void fuse( OpCode kind, int64_t by ) {
+            if ( pending != kind ) {
+                flush();
+                pending = kind;
+            }
+            amount += by;
+        }
+
+    public:
+        void flush() {
+            if ( pending == instruction_set.ADD && ( amount & 0xff ) != 0 ) {
+                if ( ( amount & 0xff ) == 1 ) {
+                    code.push_back( { instruction_set.INCR } );
+                } else if ( ( amount & 0xff ) == 0xff ) {
+                    code.push_back( { instruction_set.DECR } );
+                } else {
+                    code.push_back( { instruction_set.ADD } );
+                    code.push_back( { .operand=amount } );
+                }
+            } else if ( pending == instruction_set.MOVE && amount != 0 ) {
+                if ( amount == 1 ) {
+                    code.push_back( { instruction_set.RIGHT } );
+                } else if ( amount == -1 ) {
+                    code.push_back( { instruction_set.LEFT } );
+                } else {
+                    code.push_back( { instruction_set.MOVE } );
+                    code.push_back( { .operand=amount } );
+                }
+            }
+            pending = nullptr;
+            amount = 0;
+        }
+
+        void plantJump( OpCode opcode, size_t target ) {
+            flush();
+            code.push_back( { opcode } );
+            jumps.push_back( code.size() );
+            code.push_back( { .operand=static_cast<int64_t>( target ) } );
+        }
+
+        //  Copies the code in [begin, end), which must not jump outside
+        //  itself. Every jump target immediately follows a jump, which
+        //  flushes, so fusing never swallows a target.
+        bool record( const Instruction * begin, const Instruction * end, int depth ) {
+            std::map<const Instruction *, size_t> positions;
+            std::vector<std::pair<size_t, const Instruction *>> targets;
+            for ( const Instruction * pc = begin; pc < end; ) {
+                positions[ pc ] = code.size();
+                const OpCode opcode = pc++->opcode;
+                if ( opcode == instruction_set.INCR ) {
+                    fuse( instruction_set.ADD, 1 );
+                } else if ( opcode == instruction_set.DECR ) {
+                    fuse( instruction_set.ADD, -1 );
+                } else if ( opcode == instruction_set.ADD ) {
+                    fuse( instruction_set.ADD, pc++->operand );
+                } else if ( opcode == instruction_set.RIGHT ) {
+                    fuse( instruction_set.MOVE, 1 );
+                } else if ( opcode == instruction_set.LEFT ) {
+                    fuse( instruction_set.MOVE, -1 );
+                } else if ( opcode == instruction_set.MOVE ) {
+                    fuse( instruction_set.MOVE, pc++->operand );
+                } else if ( opcode == instruction_set.OPEN || opcode == instruction_set.CLOSE || opcode == instruction_set.LOOP ) {
+                    plantJump( opcode == instruction_set.OPEN ? opcode : instruction_set.LOOP, 0 );
+                    targets.push_back( { code.size() - 1, pc++->target } );
+                } else if ( opcode == instruction_set.CALL && inline_( static_cast<const Instruction *>( pc->reference ), depth ) ) {
+                    pc++;
+                } else {
+                    flush();
+                    code.push_back( { opcode } );
+                    if ( instruction_set.hasOperand( opcode ) ) {
+                        code.push_back( *pc++ );
+                    }
+                }
+            }
+            positions[ end ] = code.size();
+            for ( auto & [ slot, target ] : targets ) {
+                auto it = positions.find( target );
+                return_unless( it != positions.end() )( false );
+                code[ slot ].operand = static_cast<int64_t>( it->second );
+            }
+            return true;
+        }
+
+    private:
+        //  Inlines the body of a word, up to but excluding its RETURN,
+        //  unless that would make the trace too deep or too large.
+        bool inline_( const Instruction * word, int depth ) {
+            auto it = words.find( word );
+            return_unless( it != words.end() && depth < MAX_DEPTH )( false );
+            const size_t mark = code.size();
+            const size_t jumps_mark = jumps.size();
+            const OpCode saved_pending = pending;
+            const int64_t saved_amount = amount;
+            if ( record( word, it->second, depth + 1 ) && code.size() <= MAX_TRACE ) {
+                return true;
+            }
+            code.resize( mark );
+            jumps.resize( jumps_mark );
+            pending = saved_pending;
+            amount = saved_amount;
+            return false;
+        }
+    };
+
+    const InstructionSet & instruction_set;
+    const uint32_t threshold;
+    std::vector<uint32_t> counters;
+    std::map<const Instruction *, const Instruction *> words;   //  The words that can be inlined, and their RETURNs.
+    std::deque<std::vector<Instruction>> traces;
+
+public:
+    Tracer(
+        const InstructionSet & instruction_set,
+        const std::map<std::string, std::vector<Instruction>> & bindings,
+        uint32_t threshold
+    ) :
+        instruction_set( instruction_set ),
+        threshold( threshold ),
+        counters( COUNTERS )
+    {
+        for ( auto & [ name, program ] : bindings ) {
+            addWord( program );
+        }
+    }
+
+private:
+    //  A word can be inlined if its only RETURN is its last instruction.
+    void addWord( const std::vector<Instruction> & program ) {
+        const Instruction * pc = program.data();
+        const Instruction * end = pc + program.size();
+        while ( pc < end ) {
+            const Instruction * at = pc;
+            const OpCode opcode = pc++->opcode;
+            if ( instruction_set.hasOperand( opcode ) ) {
+                pc++;
+            }
+            if ( opcode == instruction_set.RETURN ) {
+                if ( pc == end ) {
+                    words[ program.data() ] = at;
+                }
+                return;
+            }
+        }
+    }
+
+    //  Moves the recording into its own buffer and resolves its jumps into
+    //  pointers.
+    Instruction * finish( Recording & recording ) {
+        std::vector<Instruction> & trace = traces.emplace_back( std::move( recording.code ) );
+        for ( size_t j : recording.jumps ) {
+            trace[ j ].target = &trace[ trace[ j ].operand ];
+        }
+        return trace.data();
+    }
+
+public:
+    bool isHot( const Instruction * site ) {
+        return threshold != 0 && ++counters[ ( reinterpret_cast<uintptr_t>( site ) >> 3 ) & ( COUNTERS - 1 ) ] == threshold;
+    }
+
+    //  Traces the loop whose CLOSE has the operand slot given, returning
+    //  where the back-edge now goes.
+    Instruction * traceLoop( Instruction * slot ) {
+        const Instruction * close = slot - 1;
+        Recording recording( instruction_set, words );
+        if ( recording.record( slot->target, close, 0 ) && recording.code.size() <= MAX_TRACE ) {
+            recording.plantJump( instruction_set.LOOP, 0 );
+            recording.code.push_back( { instruction_set.EXIT } );
+            recording.code.push_back( { .target=slot + 1 } );
+            slot->target = finish( recording );
+        }
+        return slot->target;
+    }
+
+    //  Traces the word called from the operand slot given, returning the
+    //  word that is now called.
+    Instruction * traceCall( Instruction * slot ) {
+        const Instruction * word = static_cast<const Instruction *>( slot->reference );
+        auto it = words.find( word );
+        if ( it != words.end() ) {
+            Recording recording( instruction_set, words );
+            if ( recording.record( word, it->second, 0 ) ) {
+                recording.flush();
+                recording.code.push_back( { instruction_set.RETURN } );
+                Instruction * trace = finish( recording );
+                words[ trace ] = &traces.back().back();
+                slot->reference = trace;
+            }
+        }
+        return static_cast<Instruction *>( slot->reference );
+    }
+
+    //  The number of traces recorded so far.
+    size_t size() const {
+        return traces.size();
+    }
+};
+
+//  Counts how often each instruction of every binding is dispatched (see
+//  profile.hpp). To number the slots, the bindings are taken to be laid end
+//  to end in the order of their names, and the loops are named after their
+//  positions in that.
+class BindingProfile {
+    std::vector< std::pair< const Instruction *, size_t > > starts;     //  Ordered by address.
+    std::vector< profile::Site > sites;
+    profile::Counters counters;
+
+public:
+    BindingProfile(
+        const std::map<std::string, std::vector<Instruction>> & bindings,
+        const InstructionSet & instruction_set,
+        bool timed
+    ) :
+        counters( slotsOf( bindings ), timed )
+    {
+        const std::map<OpCode, std::string> names = instruction_set.names();
+        for ( auto & [ name, program ] : bindings ) {
+            starts.push_back( { program.data(), sites.size() } );
+            std::vector<std::string> listing;
+            for ( size_t i = 0; i < program.size(); i++ ) {
+                const OpCode opcode = program[ i ].opcode;
+                listing.push_back( names.at( opcode ) );
+                if ( instruction_set.hasOperand( opcode ) ) {
+                    listing.push_back( "" );
+                    i += 1;
+                }
+            }
+            const std::vector<profile::Site> word = profile::sitesOf( listing, name, sites.size() );
+            sites.insert( sites.end(), word.begin(), word.end() );
+        }
+        std::sort( starts.begin(), starts.end(), []( auto & a, auto & b ) {
+            return std::less<const Instruction *>()( a.first, b.first );
+        } );
+    }
+
+private:
+    static size_t slotsOf( const std::map<std::string, std::vector<Instruction>> & bindings ) {
+        size_t n = 0;
+        for ( auto & [ name, program ] : bindings ) {
+            n += program.size();
+        }
+        return n;
+    }
+
+public:
+    void count( const Instruction * pc ) {
+        auto it = std::upper_bound( starts.begin(), starts.end(), pc, []( const Instruction * p, auto & start ) {
+            return std::less<const Instruction *>()( p, start.first );
+        } );
+        --it;
+        counters.count( it->second + static_cast<size_t>( pc - it->first ) );
+    }
+
+    void stop() {
+        counters.stop();
+    }
+
+    void write( const std::string & filename ) const {
+        profile::write( filename, counters, sites );
+    }
+};
+
+//  Numbers the slots of the bindings as BindingProfile does, laid end to
+//  end in the order of their names, so that a snapshot can say where the
+//  program counter and the return addresses are.
+class BindingSlots {
+    std::vector< std::pair< Instruction *, uint64_t > > by_slot;
+    std::vector< std::pair< Instruction *, uint64_t > > by_address;
+
+public:
+    explicit BindingSlots( std::map<std::string, std::vector<Instruction>> & bindings ) {
+        uint64_t n = 0;
+        for ( auto & [ name, program ] : bindings ) {
+            if ( not program.empty() ) {
+                by_slot.push_back( { program.data(), n } );
+            }
+            n += program.size();
+        }
+        by_address = by_slot;
+        std::sort( by_address.begin(), by_address.end(), []( auto & a, auto & b ) {
+            return std::less<const Instruction *>()( a.first, b.first );
+        } );
+    }
+
+public:
+    uint64_t slotOf( const Instruction * pc ) const {
+        auto it = std::upper_bound( by_address.begin(), by_address.end(), pc, []( const Instruction * p, auto & start ) {
+            return std::less<const Instruction *>()( p, start.first );
+        } );
+        --it;
+        return it->second + static_cast<uint64_t>( pc - it->first );
+    }
+
+    Instruction * at( uint64_t slot ) const {
+        auto it = std::upper_bound( by_slot.begin(), by_slot.end(), slot, []( uint64_t n, auto & start ) {
+            return n < start.second;
+        } );
+        --it;
+        return it->first + ( slot - it->second );
+    }
+};
+
+//  Dispatches to the next instruction. The profiling instantiation of the
+//  engine counts the instruction first; otherwise this compiles away.
+#define NEXT { if ( PROFILE ) profile->count( pc ); goto *(pc++->opcode); }
+
 class Engine {
-    std::map<char, OpCode> opcode_map;
-    std::map<std::string, OpCode> extra_opcodes_map;
     std::map<std::string, std::vector<Instruction>> bindings;
-    std::vector<num> memory;
+    Tape memory;
+    TraceOptions trace;
+    profile::ProfileOptions profiling;
+    snapshot::SnapshotOptions snapshots;
+    size_t trace_count = 0;
+    uint64_t identity = 0;              //  The fingerprint of the programs, if it is given.
+    uint64_t input_read = 0;            //  The bytes of input the run has read.
+    bool stopped_at_checkpoint = false;
 public:
-    Engine() : 
-        memory( 30000 )
+    Engine(
+        const TapeOptions & tape = TapeOptions(),
+        const TraceOptions & trace = TraceOptions(),
+        const profile::ProfileOptions & profiling = profile::ProfileOptions(),
+        const snapshot::SnapshotOptions & snapshots = snapshot::SnapshotOptions()
+    ) : 
+        memory( tape.size, tape.max_size ),
+        trace( trace ),
+        profiling( profiling ),
+        snapshots( snapshots )
     {}
 
+    //  The number of traces recorded by the last run.
+    size_t traces() const {
+        return trace_count;
+    }
+
+    //  True if the last run stopped at a checkpoint rather than halting.
+    bool stopped() const {
+        return stopped_at_checkpoint;
+    }
+
+    //  Identifies the program in snapshots by the fingerprint given rather
+    //  than by its file or JSON, for a caller that may run the same program
+    //  from either.
+    void identify( uint64_t fingerprint ) {
+        identity = fingerprint;
+    }
+
 public:
-    void runFile( const std::string filename, bool header_needed ) {
+    //  The streams may be the standard iostreams or the BufferedOutput and
+    //  BufferedInput of buffered_io.hpp.
+    template <typename OutStream = std::ostream, typename InStream = std::istream>
+    void runFile( const std::string filename, bool header_needed, OutStream & out = std::cout, InStream & in = std::cin ) {
         if ( header_needed ) {
             std::cerr << "# Executing: " << filename << std::endl;
         }
+        if ( profiling.enabled() ) {
+            run<true>( filename, nullptr, out, in );
+        } else if ( snapshots.enabled() ) {
+            const snapshot::Listening listening;
+            run<false, true>( filename, nullptr, out, in );
+        } else {
+            run<false>( filename, nullptr, out, in );
+        }
+    }
+
+    //  Runs a program that has been compiled in-process, in the JSON
+    //  format that brainforth_compiler writes.
+    template <typename OutStream = std::ostream, typename InStream = std::istream>
+    void runJSON( const json & jprogram, OutStream & out = std::cout, InStream & in = std::cin ) {
+        if ( profiling.enabled() ) {
+            run<true>( "", &jprogram, out, in );
+        } else if ( snapshots.enabled() ) {
+            const snapshot::Listening listening;
+            run<false, true>( "", &jprogram, out, in );
+        } else {
+            run<false>( "", &jprogram, out, in );
+        }
+    }
+
+private:
+    //  A snapshot of the run. The program counter and return addresses are
+    //  slots and the call stack is a pair of words for each frame: a return
+    //  address and -1, or the cell and value of a saved location, which are
+    //  told apart by whether the first word points into the tape.
+    void save(
+        const std::string & file, uint64_t program, const BindingSlots & slots,
+        const Instruction * pc, const num * loc,
+        const DataStack & data_stack, const num * stack,
+        const CallStack & call_stack, const CallStackSlot * frame,
+        uint64_t input
+    ) const {
+        const num * tape = memory.data();
+        size_t used = memory.size();
+        while ( used > 0 && tape[ used - 1 ] == 0 ) {
+            used -= 1;
+        }
+        std::vector<int64_t> frames;
+        for ( const CallStackSlot * f = call_stack.data(); f < frame; f++ ) {
+            const num * location = f->saved_location.location;
+            if ( location >= tape && location < tape + memory.size() ) {
+                frames.push_back( location - tape );
+                frames.push_back( f->saved_location.saved );
+            } else {
+                frames.push_back( static_cast<int64_t>( slots.slotOf( f->return_address ) ) );
+                frames.push_back( -1 );
+            }
+        }
+        snapshot::State state;
+        state.program = program;
+        state.pc = slots.slotOf( pc );
+        state.loc = static_cast<uint64_t>( loc - tape );
+        state.input = input;
+        state.tape = std::string_view( reinterpret_cast<const char *>( tape ), used );
+        state.data_stack = std::string_view( reinterpret_cast<const char *>( data_stack.data() ), stack - data_stack.data() );
+        state.call_stack = std::string_view( reinterpret_cast<const char *>( frames.data() ), frames.size() * sizeof( int64_t ) );
+        snapshot::write( file, state );
+    }
+
+    //  Puts back the tape, stacks and input of a snapshot, returning the
+    //  instruction to carry on from.
+    template <typename InStream>
+    Instruction * restore(
+        const std::string & file, uint64_t program, const BindingSlots & slots,
+        num * & loc,
+        DataStack & data_stack, num * & stack,
+        CallStack & call_stack, CallStackSlot * & frame,
+        InStream & in
+    ) {
+        const snapshot::Mapped mapped( file );
+        mapped.check( program, 8, file );
+        const snapshot::State & state = mapped.state();
+        std::memcpy( memory.data(), state.tape.data(), state.tape.size() );
+        loc = memory.data() + state.loc;
+        std::memcpy( data_stack.data(), state.data_stack.data(), state.data_stack.size() );
+        stack = data_stack.data() + state.data_stack.size();
+        const int64_t * frames = reinterpret_cast<const int64_t *>( state.call_stack.data() );
+        frame = call_stack.data();
+        for ( size_t k = 0; k + 1 < state.call_stack.size() / sizeof( int64_t ); k += 2 ) {
+            if ( frames[ k + 1 ] < 0 ) {
+                ( frame++ )->return_address = slots.at( static_cast<uint64_t>( frames[ k ] ) );
+            } else {
+                ( frame++ )->saved_location = { .location = memory.data() + frames[ k ], .saved = static_cast<num>( frames[ k + 1 ] ) };
+            }
+        }
+        snapshot::skip( in, state.input );
+        input_read = state.input;
+        return slots.at( state.pc );
+    }
+
+    //  Only the snapshotting instantiation has safe points, at the jumps
+    //  back of CLOSE, at PUT and GET and at HALT, and it runs without tracing, as a trace is not a
+    //  binding and its instructions have no slots.
+    template <bool PROFILE, bool SNAPSHOT = false, typename OutStream, typename InStream>
+    void run( const std::string filename, const json * jprogram, OutStream & out, InStream & in ) {
 
         InstructionSet instruction_set;
         instruction_set.PUSH = &&PUSH;
@@ -250,19 +890,61 @@ public:
         instruction_set.SAVE = &&SAVE;
         instruction_set.RESTORE = &&RESTORE;
         instruction_set.HALT = &&HALT;
+        instruction_set.LOOP = &&LOOP;
+        instruction_set.EXIT = &&EXIT;
+        instruction_set.STACKS = &&STACKS;
         
-        CodePlanter planter( filename, instruction_set, bindings );
+        CodePlanter planter( filename, instruction_set, bindings, jprogram );
         planter.plantProgram();
 
+        Tracer tracer( instruction_set, bindings, PROFILE || SNAPSHOT ? 0 : trace.threshold );
+        std::unique_ptr<BindingProfile> profile;
+        if ( PROFILE ) {
+            profile = std::make_unique<BindingProfile>( bindings, instruction_set, profiling.cycles );
+        }
+
         std::noskipws( std::cin );
 
         auto program_data = bindings["main"].data();
         Instruction * pc = &program_data[0];
         num * loc = &memory.data()[0];
-        std::vector< num > data_stack( 30000 );
-        num * stack = &data_stack.data()[ 0 ];
-        std::vector< CallStackSlot > call_stack;
-        goto *(pc++->opcode);
+        //  A depth of -1 means the compiler could not bound that stack, so
+        //  it grows on demand.
+        const Dyad depths = pc->opcode == instruction_set.STACKS ? pc[ 1 ].dyad : Dyad{ -1, -1 };
+        CallStack call_stack(
+            CALL_STACK_MESSAGES,
+            depths.operand1 >= 0 ? size_t( depths.operand1 ) : CallStack::DEFAULT_SIZE,
+            depths.operand1 >= 0 ? size_t( depths.operand1 ) : CallStack::DEFAULT_MAX_SIZE
+        );
+        DataStack data_stack(
+            DATA_STACK_MESSAGES,
+            depths.operand2 >= 0 ? size_t( depths.operand2 ) : DataStack::DEFAULT_SIZE,
+            depths.operand2 >= 0 ? size_t( depths.operand2 ) : DataStack::DEFAULT_MAX_SIZE
+        );
+        num * stack = data_stack.data();
+        CallStackSlot * frame = call_stack.data();
+
+        std::unique_ptr<BindingSlots> slots;
+        uint64_t fingerprint = 0;
+        bool warm_start_pending = false;
+        stopped_at_checkpoint = false;
+        input_read = 0;
+        if constexpr ( SNAPSHOT ) {
+            slots = std::make_unique<BindingSlots>( bindings );
+            fingerprint =
+                identity != 0 ? identity :
+                jprogram ? snapshot::fingerprint( jprogram->dump() ) :
+                snapshot::fingerprintOf( filename, "brainforth" );
+            std::string resume = snapshots.resume;
+            if ( resume.empty() && not snapshots.warm_start.empty() && snapshot::isSnapshotOf( snapshots.warm_start, fingerprint ) ) {
+                resume = snapshots.warm_start;
+            }
+            warm_start_pending = resume.empty() && not snapshots.warm_start.empty();
+            if ( not resume.empty() ) {
+                pc = restore( resume, fingerprint, *slots, loc, data_stack, stack, call_stack, frame, in );
+            }
+        }
+        NEXT;
 
         ////////////////////////////////////////////////////////////////////////
         //  Control flow does not reach this position! 
@@ -271,25 +953,25 @@ public:
 
     PUSH:
         *stack++ = *loc;
-        goto *(pc++->opcode);
+        NEXT;
     POP:
         *loc = *(--stack);
-        goto *(pc++->opcode);
+        NEXT;
     INCR:
         if ( DEBUG ) std::cout << "INCR" << std::endl;
         *loc += 1;
-        goto *(pc++->opcode);
+        NEXT;
     DECR:
         if ( DEBUG ) std::cout << "DECR" << std::endl;
         *loc -= 1;
-        goto *(pc++->opcode);
+        NEXT;
     ADD:
         if ( DEBUG ) std::cout << "ADD" << std::endl;
         {
             int n = pc++->operand;
             *loc += n;
         }
-        goto *(pc++->opcode);
+        NEXT;
     ADD_OFFSET:
         if ( DEBUG ) std::cout << "ADD_OFFSET" << std::endl;
         {
@@ -298,61 +980,115 @@ public:
             int32_t by = d.operand2;
             *( loc + offset ) += by;
         }
-        goto *(pc++->opcode);
+        NEXT;
     RIGHT:
         if ( DEBUG ) std::cout << "RIGHT" << std::endl;
         loc += 1;
-        goto *(pc++->opcode);
+        NEXT;
     LEFT:
         if ( DEBUG ) std::cout << "LEFT" << std::endl;
         loc -= 1;
-        goto *(pc++->opcode);
+        NEXT;
     MOVE:
         if ( DEBUG ) std::cout << "MOVE" << std::endl;
         {
             int n = pc++->operand;
             loc += n;
         }
-        goto *(pc++->opcode);
+        NEXT;
     PUT:
         if ( DEBUG ) std::cout << "PUT" << std::endl;
+        if ( SNAPSHOT && warm_start_pending ) goto WARM_START;
+        if ( SNAPSHOT && snapshot::pending() ) goto CHECKPOINT_BEFORE;
         {
             num i = *loc;
-            std::cout << i;
+            out << i;
         }
-        goto *(pc++->opcode);
+        NEXT;
     GET:
         if ( DEBUG ) std::cout << "GET" << std::endl;
+        if ( SNAPSHOT && warm_start_pending ) goto WARM_START;
+        if ( SNAPSHOT && snapshot::pending() ) goto CHECKPOINT_BEFORE;
         {
             char ch;
-            std::cin.get( ch );
-            if (std::cin.good()) {
+            in.get( ch );
+            if (in.good()) {
                 *loc = ch;
+                if ( SNAPSHOT ) input_read += 1;
+            } else if ( SNAPSHOT && snapshot::stopping() ) {
+                goto CHECKPOINT_BEFORE;
             }
         }
-        goto *(pc++->opcode);
+        NEXT;
     OPEN:
         if ( DEBUG ) std::cout << "OPEN" << std::endl;
         {
-            int n = pc++->operand;
+            Instruction * target = pc++->target;
             if ( *loc == 0 ) {
-                pc += n;
+                pc = target;
             }
-            goto *(pc++->opcode);
+            NEXT;
         }
     CLOSE:
         if ( DEBUG ) std::cout << "CLOSE" << std::endl;
         {
-            int n = pc++->operand;
+            Instruction * target = pc++->target;
             if ( *loc != 0 ) {
-                pc += n;
+                if ( tracer.isHot( pc - 1 ) ) {
+                    target = tracer.traceLoop( pc - 1 );
+                }
+                pc = target;
+                if ( SNAPSHOT && snapshot::pending() ) goto CHECKPOINT;
             }
-            goto *(pc++->opcode);
+            NEXT;
         }
+    LOOP:
+        if ( DEBUG ) std::cout << "LOOP" << std::endl;
+        {
+            Instruction * target = pc++->target;
+            if ( *loc != 0 ) {
+                pc = target;
+            }
+            NEXT;
+        }
+    EXIT:
+        if ( DEBUG ) std::cout << "EXIT" << std::endl;
+        pc = pc->target;
+        NEXT;
+    CHECKPOINT_BEFORE:
+        //  The instruction dispatched is run again, once the checkpoint is
+        //  taken or when the run is resumed.
+        if constexpr ( SNAPSHOT ) {
+            pc -= 1;
+        }
+    CHECKPOINT:
+        //  Between dispatches, with pc at the start of the loop or at the
+        //  instruction to run again.
+        if constexpr ( SNAPSHOT ) {
+            const snapshot::Request request = snapshot::take();
+            if ( not snapshots.checkpoint.empty() ) {
+                out.flush();
+                save( snapshots.checkpoint, fingerprint, *slots, pc, loc, data_stack, stack, call_stack, frame, input_read );
+                if ( request == snapshot::STOP ) {
+                    stopped_at_checkpoint = true;
+                    return;
+                }
+            }
+        }
+        NEXT;
+    WARM_START:
+        //  The first input or output, which is run again from the snapshot,
+        //  before anything has been read.
+        if constexpr ( SNAPSHOT ) {
+            warm_start_pending = false;
+            pc -= 1;
+            save( snapshots.warm_start, fingerprint, *slots, pc, loc, data_stack, stack, call_stack, frame, 0 );
+        }
+        NEXT;
     SET_ZERO:
         if ( DEBUG ) std::cout << "SET_ZERO" << std::endl;
         *loc = 0;
-        goto *(pc++->opcode);
+        NEXT;
     XFR_MULTIPLE:
         if ( DEBUG ) std::cout << "XFR_MULTIPLE" << std::endl;
         {
@@ -364,55 +1100,97 @@ public:
             *( loc + offset ) += n * by;
             *loc = 0;
         }
-        goto *(pc++->opcode);
+        NEXT;
     SEEK_LEFT:
         if ( DEBUG ) std::cout << "SEEK_LEFT" << std::endl;
-        {
-            while ( *loc ) {
-                loc -= 1;
-            }
-        }
-        goto *(pc++->opcode);
+        loc = seek::left( loc, memory.data() );
+        NEXT;
     SEEK_RIGHT:
         if ( DEBUG ) std::cout << "SEEK_RIGHT" << std::endl;
-        {
-            while ( *loc ) {
-                loc += 1;
-            }
-        }
-        goto *(pc++->opcode);
+        loc = seek::right( loc, memory.data() + memory.size() );
+        NEXT;
     CALL:
-        Instruction * nextpc = static_cast< Instruction * >( (pc++)->reference );
-        call_stack.push_back( { .return_address = pc } );
+        Instruction * nextpc = static_cast< Instruction * >( pc->reference );
+        if ( tracer.isHot( pc ) ) {
+            nextpc = tracer.traceCall( pc );
+        }
+        pc++;
+        ( frame++ )->return_address = pc;
         pc = nextpc;
-        goto *(pc++->opcode);
+        NEXT;
     RETURN:
-        pc = call_stack.back().return_address;
-        call_stack.pop_back();
-        goto *(pc++->opcode);
+        pc = ( --frame )->return_address;
+        NEXT;
     SAVE:
-        call_stack.push_back( { .saved_location = { .saved = *loc, .location = loc } } );
+        ( frame++ )->saved_location = { .location = loc, .saved = *loc };
         *loc = 0;
-        goto *(pc++->opcode);
+        NEXT;
     RESTORE:
-        call_stack.back().saved_location.restore();
-        call_stack.pop_back();
-        goto *(pc++->opcode);
+        ( --frame )->saved_location.restore();
+        NEXT;
+    STACKS:
+        pc++;
+        NEXT;
     HALT:
         if ( DEBUG ) std::cout << "DONE!" << std::endl;
+        if ( SNAPSHOT && snapshot::pending() ) goto CHECKPOINT_BEFORE;
+        out.flush();
+        trace_count = tracer.size();
+        if ( PROFILE ) {
+            profile->stop();
+            profile->write( profiling.file );
+        }
         return;
     }
 };
 
+//  The benchmarking harness compiles this file into its own executable and
+//  supplies its own main.
+#ifndef BRAINFORTH_RUNNER_NO_MAIN
+
 /*
 Each argument is the name of a Brainf*ck source file to be compiled into
-threaded coded and executed.
+threaded coded and executed. Loops and words are traced once they have
+run --trace-threshold=N times, and never if N is 0. The option
+--profile=FILE runs the programs in the profiling instantiation of the
+engine and writes the counts to FILE, and --profile-cycles times each
+handler too. The options --checkpoint=FILE, --warm-start=FILE and
+--resume=FILE are as for cisc_threading_demo (see snapshot.hpp), and a run
+stopped at a checkpoint exits with a failing status.
 */
 int main( int argc, char * argv[] ) {
     const std::vector<std::string> args(argv + 1, argv + argc);
+    std::vector<std::string> filenames;
+    TapeOptions tape;
+    TraceOptions trace;
+    profile::ProfileOptions profiling;
+    snapshot::SnapshotOptions snapshots;
+    bool buffered = true;
     for (auto arg : args) {
-        Engine engine;
-        engine.runFile( arg, args.size() > 1 );
+        if ( arg == "--unbuffered" ) {
+            buffered = false;
+        } else if ( not tape.tryParse( arg ) && not trace.tryParse( arg ) && not profiling.tryParse( arg ) && not snapshots.tryParse( arg ) ) {
+            filenames.push_back( arg );
+        }
+    }
+    if ( not snapshots.checkpoint.empty() ) {
+        snapshot::installHandlers();
+    }
+    for (auto filename : filenames) {
+        Engine engine( tape, trace, profiling, snapshots );
+        if ( buffered ) {
+            BufferedOutput out;
+            BufferedInput in( STDIN_FILENO, &out );
+            engine.runFile( filename, filenames.size() > 1, out, in );
+        } else {
+            engine.runFile( filename, filenames.size() > 1 );
+        }
+        if ( engine.stopped() ) {
+            std::cerr << "# Stopped at a checkpoint: " << snapshots.checkpoint << std::endl;
+            exit( EXIT_FAILURE );
+        }
     }
     exit( EXIT_SUCCESS );
 }
+
+#endif
@@ -9,11 +9,13 @@ code from its execution. We introduce an intermediate JSON format.
 #include <map>
 #include <optional>
 #include <stdexcept>
-#include <deque>
 #include <cstdlib>
 #include <cctype>
+#include <string>
+#include <string_view>
 
 #include "json.hpp"
+#include "../source_view.hpp"
 
 using namespace nlohmann;
 
@@ -40,120 +42,97 @@ bool startsWith( std::string_view haystack, std::string_view needle ) {
     return haystack.rfind( needle, 0 ) == 0;
 }
 
-class PeekableProgramInput {
-    std::istream& input;                //  The source code to be read in.
-    std::deque< char > buffer;          //  Queue of characters that have been peeked.
-    std::string token;
-public:
-    PeekableProgramInput( std::istream& input ) :
-        input( input )
-    {}
-private:
-    std::optional<char> getChar() {
-        int comment_nesting = 0;
-        for (;;) {
-            char ch = input.get();
-            if ( input.good() ) {
-                if ( comment_nesting > 0 ) {
-                    switch ( ch ) {
-                        case '(':
-                            comment_nesting += 1;
-                            break;
-                        case ')':
-                            comment_nesting -= 1;
-                            break;
-                    }
-                } else { 
-                    switch ( ch ) {
-                        case '?':
-                        case '!':
-                        case '>':
-                        case '<':
-                        case '+':
-                        case '-':
-                        case '.':
-                        case ',':
-                        case '[':
-                        case ']':
-                        case ':':
-                        case ';':
-                        case '#':
-                        case '$':
-                            return std::optional<char>( ch );
-                        case '(':
-                            comment_nesting += 1;
-                            break;
-                        default:
-                            return std::optional<char>( isalnum( ch ) ? ch : ' ' );
-                    }
-                }
-            } else {
-                return std::nullopt;
-            }
+//  The characters of the source that make up its tokens, in order: the
+//  symbols, letters and digits, with the comments, which nest, dropped and
+//  each run of anything else as a single space between names.
+inline std::string charactersOf( std::string_view text ) {
+    std::string characters;
+    characters.reserve( text.size() );
+    int comment_nesting = 0;
+    for ( char ch : text ) {
+        if ( comment_nesting > 0 ) {
+            comment_nesting += ( ch == '(' ) - ( ch == ')' );
+            continue;
         }
-    }
-public:
-    std::optional<char> peek() {
-        if ( this->buffer.empty() ) {
-            auto ch = getChar();
-            if ( ch ) {
-                this->buffer.push_back( *ch );
-            }
-            return ch;
-        } else {
-            return this->buffer.front();
+        switch ( ch ) {
+            case '?':
+            case '!':
+            case '>':
+            case '<':
+            case '+':
+            case '-':
+            case '.':
+            case ',':
+            case '[':
+            case ']':
+            case ':':
+            case ';':
+            case '#':
+            case '$':
+                characters.push_back( ch );
+                break;
+            case '(':
+                comment_nesting += 1;
+                break;
+            default:
+                if ( isalnum( static_cast<unsigned char>( ch ) ) ) {
+                    characters.push_back( ch );
+                } else if ( characters.empty() || characters.back() != ' ' ) {
+                    characters.push_back( ' ' );
+                }
         }
     }
+    return characters;
+}
 
+//  The source is read in whole and reduced to its characters in one pass,
+//  and a Cursor walks along them (see source_view.hpp), so a name is a
+//  view of the buffer rather than being copied a character at a time.
+class PeekableProgramInput {
+    source_view::Cursor input;          //  The source code to be read in, stripped of comments.
+    char symbol = '\0';                 //  The last symbol token.
 public:
-    std::optional<char> pop() {
-        if ( this->buffer.empty() ) {
-            return getChar();
-        } else {
-            char ch = this->buffer.front();
-            this->buffer.pop_front();
-            return ch;
-        }
-    }
+    PeekableProgramInput( std::istream& input ) :
+        input( charactersOf( source_view::Source( input ).text() ) )
+    {}
 
 private:
-    void drop() {
-        if ( this->buffer.empty() ) {
-            input.get();
-        } else {
-            this->buffer.pop_front();
-        }
+    static bool isNameChar( char ch ) {
+        return isalnum( static_cast<unsigned char>( ch ) ) != 0;
     }
 
-private:
-    void scanName() {
-        for (;;) {
-            auto ch = peek();
-            break_unless( ch && isalnum( *ch ) );
-            this->token.push_back( *ch );
-            this->drop();
+public:
+    //  The text of the next token, which is a name if it starts with a
+    //  letter or digit and a single symbol otherwise. It is valid until
+    //  the next call. The in-process pipeline of brainforth.cpp uses this
+    //  to skip the JSON.
+    std::optional<std::string_view> nextToken() {
+        input.tryPop( ' ' );
+        return_if( input.atEnd() )( std::nullopt );
+        if ( isNameChar( input.peek() ) ) {
+            return std::optional<std::string_view>( input.popWhile( isNameChar ) );
         }
+        this->symbol = input.pop();
+        return std::optional<std::string_view>( std::string_view( &this->symbol, 1 ) );
     }
 
 public:
     std::optional<json> nextJToken() {
-        this->token.clear();
-        for (;;) {
-            auto ch = pop();
-            return_unless( ch )( std::nullopt );
-            continue_if( *ch == ' ' );
-            this->token.push_back( *ch );
-            if ( isalnum( *ch ) ) {
-                this->scanName();
-                return std::optional<json>( json( {{ "name", this->token }} ) );
-            } else {
-                return std::optional<json>( json( {{ "symbol", std::string( 1, *ch ) }} ) );
-            }
+        auto t = nextToken();
+        return_unless( t )( std::nullopt );
+        if ( isalnum( t->front() ) ) {
+            return std::optional<json>( json( {{ "name", *t }} ) );
+        } else {
+            return std::optional<json>( json( {{ "symbol", std::string( *t ) }} ) );
         }
     }
 };
 
 
+//  The benchmarking harness compiles this file into its own executable and
+//  supplies its own main.
+#ifndef BRAINFORTH_TOKENISER_NO_MAIN
+
 /*
 Splits Brainforth code on the standard input into a stream of tokens.
 */
@@ -168,3 +147,5 @@ int main( int argc, char * argv[] ) {
     }
     exit( EXIT_SUCCESS );
 }
+
+#endif
@@ -0,0 +1,211 @@
+/*
+A minimal buffered I/O layer for the engines' PUT and GET, which otherwise
+spend most of their time in iostreams on output-heavy programs.
+
+Output is collected in a large buffer and written with a single write(2)
+when the buffer fills, when the program halts, or before we block waiting
+for input - so interactive programs still show their prompts. Input is
+refilled in bulk with read(2).
+
+The classes mimic the tiny part of the iostream interface the engines use
+(<< for PUT, write for PUT_BYTES, get/good for GET and flush at HALT), so the engines can be
+instantiated with either. CapturedOutput and StringInput do the same in
+memory, for the batch modes, where many programs run at once and their
+output is written out afterwards. The inputs can also skip what a run
+had read, for the snapshots of snapshot.hpp.
+*/
+
+#ifndef BUFFERED_IO_HPP
+#define BUFFERED_IO_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+class BufferedOutput {
+    int fd;
+    std::vector<char> buffer;
+    size_t used = 0;
+
+public:
+    explicit BufferedOutput( int fd = STDOUT_FILENO, size_t capacity = 1 << 16 ) :
+        fd( fd ),
+        buffer( capacity )
+    {}
+
+    ~BufferedOutput() {
+        flush();
+    }
+
+    BufferedOutput( const BufferedOutput & ) = delete;
+    BufferedOutput & operator=( const BufferedOutput & ) = delete;
+
+public:
+    BufferedOutput & operator<<( unsigned char ch ) {
+        if ( used == buffer.size() ) {
+            flush();
+        }
+        buffer[ used++ ] = static_cast<char>( ch );
+        return *this;
+    }
+
+    //  A run of bytes is copied into the buffer a bufferful at a time.
+    BufferedOutput & write( const char * s, size_t n ) {
+        while ( n > 0 ) {
+            if ( used == buffer.size() ) {
+                flush();
+            }
+            const size_t k = std::min( n, buffer.size() - used );
+            memcpy( buffer.data() + used, s, k );
+            used += k;
+            s += k;
+            n -= k;
+        }
+        return *this;
+    }
+
+    BufferedOutput & flush() {
+        const char * p = buffer.data();
+        while ( used > 0 ) {
+            ssize_t n = ::write( fd, p, used );
+            if ( n < 0 ) {
+                if ( errno == EINTR ) {
+                    continue;
+                }
+                throw std::runtime_error( "Cannot write output: errno " + std::to_string( errno ) );
+            }
+            p += n;
+            used -= static_cast<size_t>( n );
+        }
+        return *this;
+    }
+};
+
+class BufferedInput {
+    int fd;
+    BufferedOutput * tie;               //  Flushed before we block on a read.
+    std::vector<char> buffer;
+    size_t next = 0;
+    size_t end = 0;
+    bool ok = true;
+
+public:
+    explicit BufferedInput( int fd = STDIN_FILENO, BufferedOutput * tie = nullptr, size_t capacity = 1 << 16 ) :
+        fd( fd ),
+        tie( tie ),
+        buffer( capacity )
+    {}
+
+    BufferedInput( const BufferedInput & ) = delete;
+    BufferedInput & operator=( const BufferedInput & ) = delete;
+
+private:
+    bool refill() {
+        if ( tie != nullptr ) {
+            tie->flush();
+        }
+        //  A read that a signal interrupts rather than restarts ends the
+        //  input, as it does an iostream's, so that an engine waiting on it
+        //  can stop at a safe point (see snapshot.hpp).
+        ssize_t n = read( fd, buffer.data(), buffer.size() );
+        if ( n <= 0 ) {
+            return false;
+        }
+        next = 0;
+        end = static_cast<size_t>( n );
+        return true;
+    }
+
+public:
+    //  Like std::istream::get, at end of input the character is left
+    //  untouched and good() becomes false.
+    BufferedInput & get( char & ch ) {
+        if ( next == end && not refill() ) {
+            ok = false;
+        } else {
+            ch = buffer[ next++ ];
+        }
+        return *this;
+    }
+
+    bool good() const {
+        return ok;
+    }
+
+    //  Seeks past the bytes if the input is a file, and reads them
+    //  otherwise.
+    void skip( uint64_t n ) {
+        if ( next == end && lseek( fd, static_cast<off_t>( n ), SEEK_CUR ) >= 0 ) {
+            return;
+        }
+        char ch;
+        for ( uint64_t k = 0; k < n && ok; k++ ) {
+            get( ch );
+        }
+    }
+};
+
+//  Output collected into a string rather than written.
+class CapturedOutput {
+    std::string text;
+
+public:
+    CapturedOutput & operator<<( unsigned char ch ) {
+        text.push_back( static_cast<char>( ch ) );
+        return *this;
+    }
+
+    CapturedOutput & write( const char * s, size_t n ) {
+        text.append( s, n );
+        return *this;
+    }
+
+    CapturedOutput & flush() {
+        return *this;
+    }
+
+    const std::string & str() const {
+        return text;
+    }
+};
+
+//  Input read from a string, with the end of input behaving as it does
+//  for BufferedInput.
+class StringInput {
+    std::string text;
+    size_t next = 0;
+    bool ok = true;
+
+public:
+    explicit StringInput( std::string text = std::string() ) :
+        text( std::move( text ) )
+    {}
+
+public:
+    StringInput & get( char & ch ) {
+        if ( next == text.size() ) {
+            ok = false;
+        } else {
+            ch = text[ next++ ];
+        }
+        return *this;
+    }
+
+    bool good() const {
+        return ok;
+    }
+
+    void skip( uint64_t n ) {
+        next = static_cast<size_t>( std::min<uint64_t>( text.size(), next + n ) );
+    }
+};
+
+#endif
@@ -20,6 +20,19 @@ method (Engine::runFile) fit on a single screen.
 #include <stdexcept>
 #include <deque>
 #include <cstdlib>
+#include <memory>
+#include <type_traits>
+
+#include "seek.hpp"
+#include "tape.hpp"
+#include "buffered_io.hpp"
+#include "image.hpp"
+#include "source_view.hpp"
+#include "compile_cache.hpp"
+#include "native_code.hpp"
+#include "batch.hpp"
+#include "profile.hpp"
+#include "snapshot.hpp"
 
 //  Use this to turn on or off some debug-level tracing.
 #define DEBUG 0
@@ -35,10 +48,6 @@ method (Engine::runFile) fit on a single screen.
 #define return_if( E ) if (E) return
 #define return_unless( E ) if (!(E)) return
 
-template <typename T> int sgn(T val) {
-    return (T(0) < val) - (val < T(0));
-};
-
 //  We use the address of a label to play the role of an operation-code.
 typedef void * OpCode;
 
@@ -50,100 +59,30 @@ typedef struct Dyad {
 //  The instruction stream is mainly OpCodes but there are some
 //  integer arguments interspersed. Strictly speaking this makes this
 //  interpreter a hybrid between direct/indirect threading.
-typedef union {
+typedef union Instruction {
     OpCode opcode;
     int operand;
     Dyad dyad;
+    union Instruction * target;         //  Jump target of OPEN and CLOSE.
 } Instruction;
 
-class PeekableProgramInput {
-    std::ifstream input;                //  The source code to be read in.
-    std::deque< char > buffer;
-public:
-    PeekableProgramInput( std::string_view filename ) :
-        input( filename.data(), std::ios::in )
-    {}
-private:
-    std::optional<char> nextChar() {
-        for (;;) {
-            char ch = input.get();
-            if ( input.good() ) {
-                switch ( ch ) {
-                    case '>':
-                    case '<':
-                    case '+':
-                    case '-':
-                    case '.':
-                    case ',':
-                    case '[':
-                    case ']':
-                        return std::optional<char>( ch );
-                }
-            } else {
-                return std::nullopt;
-            }
-        }
-    }
-public:
-    std::optional<char> peekN( size_t n ) {
-        while ( this->buffer.size() <= n ) {
-            auto ch = nextChar();
-            return_unless( ch )( std::nullopt );
-            this->buffer.push_back( *ch );
-        }
-        return this->buffer[ n ];
-    }    
-public:
-    std::optional<char> peek() {
-        if ( this->buffer.empty() ) {
-            auto ch = nextChar();
-            if ( ch ) {
-                this->buffer.push_back( *ch );
-            }
-            return ch;
-        } else {
-            return this->buffer.front();
-        }
-    }
-public:
-    std::optional<char> pop() {
-        if ( this->buffer.empty() ) {
-            return nextChar();
-        } else {
-            char ch = this->buffer.front();
-            this->buffer.pop_front();
-            return ch;
-        }
-    }
-private:
-    void drop() {
-        if ( this->buffer.empty() ) {
-            input.get();
-        } else {
-            this->buffer.pop_front();
-        }
-    }
-public:
-    bool tryPop( char ch ) {
-        if ( this->peek() == ch ) {
-            this->drop();
-            return true;
-        } else {
-            return false;
-        }
-    }
-public:
-    bool tryPopString( std::string str ) {
-        int n = 0;
-        for ( auto ch : str ) {
-            auto actual = this->peekN( n );
-            return_if( actual != ch )( false );
-            n += 1;
-        }
-        this->buffer.erase( this->buffer.begin(), this->buffer.begin() + n );
-        return true;
-    }
-};
+typedef struct CompactDyad {
+    int16_t operand1;
+    int16_t operand2;
+} CompactDyad;
+
+//  The compact instruction stream packs an opcode and its operands into a 
+//  single fixed-width record. Rather than the address of a label we store 
+//  its offset from a base label, which comfortably fits into 32 bits. This
+//  halves the size of most instructions and keeps the program in L1 for 
+//  longer.
+typedef struct CompactInstruction {
+    int32_t opcode;
+    union {
+        int32_t operand;
+        CompactDyad dyad;
+    };
+} CompactInstruction;
 
 struct MoveAddMove {
     int lhs;
@@ -159,10 +98,6 @@ public:
     bool matches( int L, int N, int R ) {
         return L == this->lhs && N == this->by && R == this->rhs;
     }
-public:
-    bool isNonZeroBalanced() {
-        return ( this->lhs != 0 ) && ( ( this->lhs + this->rhs ) == 0 );
-    }
 };
 
 typedef struct InstructionSet {
@@ -172,27 +107,103 @@ typedef struct InstructionSet {
     OpCode ADD;
     OpCode ADD_OFFSET;
     OpCode XFR_MULTIPLE;
+    OpCode XFR_MULTI_N;
     OpCode LEFT;
     OpCode RIGHT;
     OpCode SEEK_LEFT;
     OpCode SEEK_RIGHT;
+    OpCode SEEK_LEFT_N;
+    OpCode SEEK_RIGHT_N;
     OpCode MOVE;
     OpCode OPEN;
     OpCode CLOSE;
     OpCode GET;
     OpCode PUT;
+    //  The offset-addressed instructions, which work on the cell at an
+    //  offset from loc (see CodePlanter). ADD_OFFSET is the one for adding.
+    OpCode SET_AT;
+    OpCode PUT_AT;
+    OpCode OPEN_AT;
+    OpCode CLOSE_AT;
+    //  Reads into as many consecutive cells as its operand, for ,>,>,
+    //  and leaves loc on the first of them.
+    OpCode GET_BYTES;
     OpCode HALT;
+public:
+    //  True if the opcode is followed by a single operand slot.
+    bool hasOperand( OpCode opcode ) const {
+        return 
+            opcode == ADD || opcode == MOVE || opcode == OPEN || opcode == CLOSE ||
+            opcode == SEEK_LEFT_N || opcode == SEEK_RIGHT_N || opcode == SET_AT || opcode == PUT_AT ||
+            opcode == GET_BYTES;
+    }
+
+    //  True if the opcode is followed by a jump slot and then an operand
+    //  slot holding the offset to move by before the test.
+    bool hasOffsetJump( OpCode opcode ) const {
+        return opcode == OPEN_AT || opcode == CLOSE_AT;
+    }
+
+    //  True if the opcode is followed by a single Dyad slot.
+    bool hasDyad( OpCode opcode ) const {
+        return opcode == ADD_OFFSET || opcode == XFR_MULTIPLE;
+    }
+
+    //  True if the opcode is followed by a count and then that many Dyad 
+    //  slots.
+    bool hasTable( OpCode opcode ) const {
+        return opcode == XFR_MULTI_N;
+    }
+
+    //  The opcodes by name, which is how they are stored in an image.
+    std::map<std::string, OpCode> byName() const {
+        return {
+            { "SET_ZERO", SET_ZERO },
+            { "INCR", INCR },
+            { "DECR", DECR },
+            { "ADD", ADD },
+            { "ADD_OFFSET", ADD_OFFSET },
+            { "XFR_MULTIPLE", XFR_MULTIPLE },
+            { "XFR_MULTI_N", XFR_MULTI_N },
+            { "LEFT", LEFT },
+            { "RIGHT", RIGHT },
+            { "SEEK_LEFT", SEEK_LEFT },
+            { "SEEK_RIGHT", SEEK_RIGHT },
+            { "SEEK_LEFT_N", SEEK_LEFT_N },
+            { "SEEK_RIGHT_N", SEEK_RIGHT_N },
+            { "MOVE", MOVE },
+            { "OPEN", OPEN },
+            { "CLOSE", CLOSE },
+            { "GET", GET },
+            { "PUT", PUT },
+            { "SET_AT", SET_AT },
+            { "PUT_AT", PUT_AT },
+            { "OPEN_AT", OPEN_AT },
+            { "CLOSE_AT", CLOSE_AT },
+            { "GET_BYTES", GET_BYTES },
+            { "HALT", HALT }
+        };
+    }
 } InstructionSet;
 
 //  This class is responsible for translating the stream of source code
 //  into a vector<Instruction>. It is passed a mapping from characters
 //  to the addresses-of-labels, so it can plant (aka append) the exact
 //  pointer to the implementing code. 
+//
+//  The moves of a basic block are not planted as they are read. Instead the
+//  planter keeps track of how far the current cell is from loc and plants
+//  the offset-addressed instructions - ADD_OFFSET, SET_AT and PUT_AT - for
+//  the cells in between. The net move is only planted at the end of the
+//  block, where OPEN_AT and CLOSE_AT combine it with the test, or ahead of
+//  an instruction that needs loc to be the current cell, such as a seek.
 class CodePlanter {
-    PeekableProgramInput input;         //  The source code to be read in, stripped of comment characters.
+    source_view::Cursor input;          //  The source code to be read in, stripped of comment characters.
     const InstructionSet & instruction_set;
     std::vector<Instruction> & program; 
     std::vector<int> indexes;           //  Responsible for managing [ ... ] loops.
+    std::vector<int> jumps;             //  The operand slots of every OPEN and CLOSE.
+    int pending = 0;                    //  The moves not yet planted: the current cell is loc + pending.
 
 public:
     CodePlanter( 
@@ -200,55 +211,108 @@ public:
         const InstructionSet & instruction_set,
         std::vector<Instruction> & program 
     ) :
-        input( filename.data() ),
+        input( source_view::commandsOf( source_view::Source( std::string( filename ) ).text() ) ),
         instruction_set( instruction_set ), 
         program( program )
     {}
 
 private:
+    //  Plants the moves of the block so far, making loc the current cell.
+    void plantPending() {
+        plantMOVE( pending );
+        pending = 0;
+    }
+
+    //  The loop is entered, and left, with the offset planted, so that its
+    //  body starts from loc. The offset follows the jump so that the jump
+    //  is in the same place as for OPEN.
     void plantOPEN() {
-        program.push_back( { instruction_set.OPEN } );
-        if ( DUMP ) std::cerr << "OPEN" << std::endl;
+        const bool at = pending != 0;
+        if ( DUMP ) std::cerr << ( at ? "OPEN_AT offset=" + std::to_string( pending ) : "OPEN" ) << std::endl;
+        program.push_back( { at ? instruction_set.OPEN_AT : instruction_set.OPEN } );
         //  If we are dealing with loops, we plant the absolute index of the
-        //  operation in the program we want to jump to. This can be improved
-        //  fairly easily.
+        //  operation in the program we want to jump to. Once the program is
+        //  complete these are resolved into pointers (see resolveJumps).
         indexes.push_back( program.size() );
+        jumps.push_back( program.size() );
         program.push_back( {nullptr} );         //  Dummy value, will be overwritten.
+        if ( at ) {
+            program.push_back( { .operand=pending } );
+            pending = 0;
+        }
     }
 
     void plantCLOSE() {
-        if ( DUMP ) std::cerr << "CLOSE" << std::endl;
-        program.push_back( { instruction_set.CLOSE } );
+        const bool at = pending != 0;
+        if ( DUMP ) std::cerr << ( at ? "CLOSE_AT offset=" + std::to_string( pending ) : "CLOSE" ) << std::endl;
+        program.push_back( { at ? instruction_set.CLOSE_AT : instruction_set.CLOSE } );
         //  If we are dealing with loops, we plant the absolute index of the
-        //  operation in the program we want to jump to. This can be improved
-        //  fairly easily.
+        //  operation in the program we want to jump to. Once the program is
+        //  complete these are resolved into pointers (see resolveJumps).
         int end = program.size();
         int start = indexes.back();
         indexes.pop_back();
-        program[ start ].operand = end + 1;     //  Overwrite the dummy value.
-        program.push_back( { .operand=( start + 1 ) } );
+        const int body = start + ( instruction_set.hasOffsetJump( program[ start - 1 ].opcode ) ? 2 : 1 );
+        program[ start ].operand = end + ( at ? 2 : 1 );    //  Overwrite the dummy value.
+        jumps.push_back( program.size() );
+        program.push_back( { .operand=body } );
+        if ( at ) {
+            program.push_back( { .operand=pending } );
+            pending = 0;
+        }
     }
 
     void plantPUT() {
-        if ( DUMP ) std::cerr << "PUT" << std::endl;
-        program.push_back( { instruction_set.PUT } );
+        if ( pending != 0 ) {
+            if ( DUMP ) std::cerr << "PUT_AT offset=" << pending << std::endl;
+            program.push_back( { instruction_set.PUT_AT } );
+            program.push_back( { .operand=pending } );
+        } else {
+            if ( DUMP ) std::cerr << "PUT" << std::endl;
+            program.push_back( { instruction_set.PUT } );
+        }
     }
 
+    //  A run of reads into consecutive cells, such as ,>,>, is a single
+    //  GET_BYTES, after which the current cell is the last of them.
     void plantGET() {
-        if ( DUMP ) std::cerr << "GET" << std::endl;
-        program.push_back( { instruction_set.GET } );
+        plantPending();
+        int n = 1;
+        while ( input.tryPopString( ">," ) ) {
+            n += 1;
+        }
+        if ( n > 1 ) {
+            if ( DUMP ) std::cerr << "GET_BYTES n=" << n << std::endl;
+            program.push_back( { instruction_set.GET_BYTES } );
+            program.push_back( { .operand=n } );
+            pending = n - 1;
+        } else {
+            if ( DUMP ) std::cerr << "GET" << std::endl;
+            program.push_back( { instruction_set.GET } );
+        }
     }
 
     void plantSEEK_LEFT() {
+        plantPending();
         if ( DUMP ) std::cerr << "SEEK_LEFT" << std::endl;
         program.push_back( { instruction_set.SEEK_LEFT } );
     }
 
     void plantSEEK_RIGHT() {
+        plantPending();
         if ( DUMP ) std::cerr << "SEEK_RIGHT" << std::endl;
         program.push_back( { instruction_set.SEEK_RIGHT } );
     }
 
+    //  A seek with a stride, such as [>>>], planted with the stride as a
+    //  positive operand.
+    void plantSEEK_N( int n ) {
+        plantPending();
+        if ( DUMP ) std::cerr << ( n > 0 ? "SEEK_RIGHT_N " : "SEEK_LEFT_N " ) << abs( n ) << std::endl;
+        program.push_back( { n > 0 ? instruction_set.SEEK_RIGHT_N : instruction_set.SEEK_LEFT_N } );
+        program.push_back( { .operand=abs( n ) } );
+    }
+
     void plantMOVE( int n ) {
         if ( n == 1 ) {
             if ( DUMP ) std::cerr << "RIGHT" << std::endl;
@@ -264,7 +328,9 @@ private:
     }
 
     void plantADD( int n ) {
-        if ( n == 1 ) {
+        if ( pending != 0 ) {
+            if ( n != 0 ) plantADD_OFFSET( pending, n );
+        } else if ( n == 1 ) {
             if ( DUMP ) std::cerr << "INCR" << std::endl;
             program.push_back( { instruction_set.INCR } );
         } else if ( n == -1 ) {
@@ -311,50 +377,44 @@ private:
     }
 
     void plantXFR_MULTIPLE( int32_t offset, int32_t by ) {
+        plantPending();
         if ( DUMP ) std::cerr << "XFR_MULTIPLE offset=" << offset << " by=" << by << std::endl;
         program.push_back( { instruction_set.XFR_MULTIPLE } );
         struct Dyad d = { .operand1=offset, .operand2=by };
         program.push_back( { .dyad=d } );
     }
 
-    void plantMoveAddMove( const MoveAddMove & mim ) {
-        if ( mim.by == 0 ) {
-            if ( mim.rhs == 0 ) {
-                plantMOVE( mim.lhs );
-            } else if ( mim.lhs == 0 ) {
-                const MoveAddMove nextmam = scanMoveAddMove( mim.rhs );
-                plantMoveAddMove( nextmam );
-            } else {
-                const MoveAddMove nextmam = scanMoveAddMove( mim.lhs + mim.rhs );
-                plantMoveAddMove( nextmam );
-            }
-        } else if (
-            ( mim.lhs != 0 && mim.rhs != 0 ) &&     
-            ( sgn( mim.lhs ) != sgn( mim.rhs ) ) //  And they have opposite signs
-        ) {
-            int abs_lhs = abs( mim.lhs ); 
-            int abs_rhs = abs( mim.rhs );
-            if ( abs_lhs == abs_rhs ) {
-                plantADD_OFFSET( mim.lhs, mim.by );
-            } else if ( abs_lhs > abs_rhs ) {
-                plantMOVE( sgn( mim.lhs ) * ( abs_lhs - abs_rhs ) );
-                plantADD_OFFSET( sgn( mim.lhs ) * abs_rhs, mim.by );
-            } else /* if ( abs_lhs < abs_rhs ) */ {
-                plantADD_OFFSET( mim.lhs, mim.by );
-                const MoveAddMove nextmam = scanMoveAddMove( sgn( mim.rhs ) * ( abs_rhs - abs_lhs ) );
-                plantMoveAddMove( nextmam );
-           }
-        } else {
-            plantMOVE( mim.lhs );
-            plantADD( mim.by );
-            const MoveAddMove nextmam = scanMoveAddMove( mim.rhs );
-            plantMoveAddMove( nextmam );
+    //  Transfers the current cell to several others, each scaled by its own
+    //  factor. The table is planted as a count followed by (offset, factor)
+    //  pairs.
+    void plantXFR_MULTI_N( const std::vector<Dyad> & targets ) {
+        plantPending();
+        if ( DUMP ) std::cerr << "XFR_MULTI_N n=" << targets.size() << std::endl;
+        program.push_back( { instruction_set.XFR_MULTI_N } );
+        program.push_back( { .operand=static_cast<int>( targets.size() ) } );
+        for ( auto & d : targets ) {
+            if ( DUMP ) std::cerr << "    offset=" << d.operand1 << " by=" << d.operand2 << std::endl;
+            program.push_back( { .dyad=d } );
         }
     }
 
+    //  The moves only change the offset, so the add is planted at the cell
+    //  it applies to.
+    void plantMoveAddMove( const MoveAddMove & mim ) {
+        pending += mim.lhs;
+        plantADD( mim.by );
+        pending += mim.rhs;
+    }
+
     void plantSetZero() {
-        if ( DUMP ) std::cerr << "SET_ZERO" << std::endl;
-        program.push_back( { instruction_set.SET_ZERO } );
+        if ( pending != 0 ) {
+            if ( DUMP ) std::cerr << "SET_AT offset=" << pending << std::endl;
+            program.push_back( { instruction_set.SET_AT } );
+            program.push_back( { .operand=pending } );
+        } else {
+            if ( DUMP ) std::cerr << "SET_ZERO" << std::endl;
+            program.push_back( { instruction_set.SET_ZERO } );
+        }
     }
 
     MoveAddMove scanMoveAddMove( int initial ) {
@@ -364,11 +424,64 @@ private:
         return MoveAddMove( move_lhs, n, move_rhs );
     }
 
+    //  Looks ahead, without consuming anything, for the body of a transfer
+    //  loop following a '['. That is a loop that only moves and adds, ends
+    //  where it started and decrements the control cell by exactly one - so
+    //  it runs *loc times and adds *loc * factor to each target cell. 
+    //  Returns the length of the body including the ']', or zero if this 
+    //  is not a transfer loop.
+    size_t scanTransferLoop( std::vector<Dyad> & targets ) {
+        std::map<int, int> deltas;
+        int offset = 0;
+        for ( size_t n = 0; ; n++ ) {
+            const char ch = input.peekN( n );
+            switch ( ch ) {
+                case '>':
+                    offset += 1;
+                    break;
+                case '<':
+                    offset -= 1;
+                    break;
+                case '+':
+                    deltas[ offset ] += 1;
+                    break;
+                case '-':
+                    deltas[ offset ] -= 1;
+                    break;
+                case ']':
+                    return_unless( offset == 0 && deltas[ 0 ] == -1 )( 0 );
+                    for ( auto & [ at, by ] : deltas ) {
+                        if ( at != 0 && by != 0 ) {
+                            targets.push_back( { .operand1=at, .operand2=by } );
+                        }
+                    }
+                    return n + 1;
+                default:
+                    //  A nested loop or I/O.
+                    return 0;
+            }
+        }
+    }
+
+    bool plantTransferLoop() {
+        std::vector<Dyad> targets;
+        size_t n = scanTransferLoop( targets );
+        //  [-] is better handled as SET_ZERO.
+        return_if( n == 0 || targets.empty() )( false );
+        input.dropN( n );
+        if ( targets.size() == 1 ) {
+            plantXFR_MULTIPLE( targets[ 0 ].operand1, targets[ 0 ].operand2 );
+        } else {
+            plantXFR_MULTI_N( targets );
+        }
+        return true;
+    }
+
     bool plantExpr() {
-        auto ch = input.pop();
-        return_unless( ch )( false );
+        char ch = input.pop();
+        return_if( ch == '\0' )( false );
 
-        switch ( *ch ) {
+        switch ( ch ) {
             case '+':
                 plantADD( scanAdd( 1 ) );
                 break;
@@ -383,7 +496,7 @@ private:
                 }
                 break;
             case '[':
-                {
+                if ( not plantTransferLoop() ) {
                     MoveAddMove mim = scanMoveAddMove( 0 );
                     bool bump = mim.matches( 0, 1, 0 ) || mim.matches( 0, -1, 0 );
                     if ( bump && input.tryPop( ']' ) ) {
@@ -392,8 +505,8 @@ private:
                         plantSEEK_RIGHT();
                     } else if ( mim.matches( -1, 0, 0 ) && input.tryPop( ']') ) {
                         plantSEEK_LEFT();
-                    } else if ( mim.isNonZeroBalanced() && input.tryPopString( "-]" ) ) {
-                        plantXFR_MULTIPLE( mim.lhs, mim.by );
+                    } else if ( mim.lhs != 0 && mim.matches( mim.lhs, 0, 0 ) && input.tryPop( ']') ) {
+                        plantSEEK_N( mim.lhs );
                     } else {
                         plantOPEN();
                         plantMoveAddMove( mim );
@@ -413,58 +526,914 @@ private:
         return true;
     }
 
+    //  Rewrites the absolute indexes planted by OPEN and CLOSE into direct
+    //  pointers, so a taken branch is a single load. This can only be done
+    //  when the program is complete as the vector may reallocate while
+    //  planting.
+    void resolveJumps() {
+        Instruction * program_data = program.data();
+        for ( int j : jumps ) {
+            program[ j ].target = &program_data[ program[ j ].operand ];
+        }
+    }
+
 public:
     void plantProgram() {
+        //  No command plants more than two slots, once the moves that an
+        //  offset-addressed instruction absorbs are counted with it, so the
+        //  program never has to grow and be copied. The pages that are not
+        //  used are never touched.
+        program.reserve( program.size() + 2 * input.remaining() + 1 );
         while ( plantExpr() ) {}
+        //  The moves after the last block are never planted, as nothing can
+        //  observe them.
         program.push_back( { instruction_set.HALT } );
+        resolveJumps();
+    }
+};
+
+//  This class is responsible for planting a program via the compile cache
+//  (see compile_cache.hpp). On a hit the planted program is relocated
+//  straight out of the cached image, skipping the source_view::Cursor and
+//  the CodePlanter; on a miss we plant as usual and store the result.
+class CachingCodePlanter {
+    static constexpr const char * ENGINE = "cisc_threading_demo";
+    std::string_view filename;
+    const InstructionSet & instruction_set;
+    std::vector<Instruction> & program;
+    const compile_cache::Cache & cache;
+
+public:
+    CachingCodePlanter(
+        std::string_view filename,
+        const InstructionSet & instruction_set,
+        std::vector<Instruction> & program,
+        const compile_cache::Cache & cache
+    ) :
+        filename( filename ),
+        instruction_set( instruction_set ),
+        program( program ),
+        cache( cache )
+    {}
+
+private:
+    //  Opcodes are stored by name and jumps as absolute indexes.
+    image::Writer imageOf() const {
+        std::map<OpCode, std::string> names;
+        for ( auto & [ name, opcode ] : instruction_set.byName() ) {
+            names[ opcode ] = name;
+        }
+        image::Writer writer;
+        for ( size_t i = 0; i < program.size(); ) {
+            OpCode opcode = program[ i++ ].opcode;
+            writer.opcode( names.at( opcode ) );
+            if ( opcode == instruction_set.OPEN || opcode == instruction_set.CLOSE ) {
+                writer.jump( program[ i++ ].target - program.data() );
+            } else if ( instruction_set.hasOffsetJump( opcode ) ) {
+                writer.jump( program[ i++ ].target - program.data() );
+                writer.operand( program[ i++ ].operand );
+            } else if ( instruction_set.hasOperand( opcode ) ) {
+                writer.operand( program[ i++ ].operand );
+            } else if ( instruction_set.hasDyad( opcode ) ) {
+                Dyad d = program[ i++ ].dyad;
+                writer.dyad( d.operand1, d.operand2 );
+            } else if ( instruction_set.hasTable( opcode ) ) {
+                int count = program[ i++ ].operand;
+                writer.operand( count );
+                for ( int k = 0; k < count; k++ ) {
+                    Dyad d = program[ i++ ].dyad;
+                    writer.dyad( d.operand1, d.operand2 );
+                }
+            }
+        }
+        return writer;
+    }
+
+    void plantImage( const std::string & file ) {
+        image::Mapped mapped( file );
+        const std::map<std::string, OpCode> by_name = instruction_set.byName();
+        std::vector<OpCode> relocations;
+        for ( auto name : mapped.opcodeNames() ) {
+            relocations.push_back( by_name.at( std::string( name ) ) );
+        }
+        const size_t n = mapped.size();
+        const image::Tag * tags = mapped.tags();
+        const image::Slot * slots = mapped.slots();
+        program.resize( n );
+        Instruction * program_data = program.data();
+        for ( size_t i = 0; i < n; i++ ) {
+            const image::Slot slot = slots[ i ];
+            switch ( tags[ i ] ) {
+                case image::OPCODE:
+                    program_data[ i ].opcode = relocations.at( slot.opcode );
+                    break;
+                case image::OPERAND:
+                    program_data[ i ].operand = static_cast<int>( slot.operand );
+                    break;
+                case image::DYAD:
+                    program_data[ i ].dyad = { .operand1=slot.dyad.high, .operand2=slot.dyad.low };
+                    break;
+                case image::JUMP:
+                    program_data[ i ].target = &program_data[ slot.operand ];
+                    break;
+                case image::REFERENCE:
+                    throw std::runtime_error( "Unexpected reference in image: " + file );
+            }
+        }
+    }
+
+public:
+    void plantProgram() {
+        if ( not cache.enabled() ) {
+            CodePlanter( filename, instruction_set, program ).plantProgram();
+            return;
+        }
+        const source_view::Source source{ std::string( filename ) };
+        const compile_cache::Key key = compile_cache::Cache::key( ENGINE, "", source.text() );
+        if ( auto file = cache.lookup( ENGINE, key ) ) {
+            try {
+                plantImage( *file );
+                return;
+            } catch ( const std::exception & ) {
+                //  An unusable image is treated as a miss.
+                program.clear();
+            }
+        }
+        CodePlanter( filename, instruction_set, program ).plantProgram();
+        cache.store( ENGINE, key, imageOf() );
+    }
+};
+
+//  This class is responsible for rewriting a wide program for the cached-
+//  cell mode of the Engine, in which the value of the current cell is kept
+//  in a local variable - and so in a register - rather than being loaded
+//  and stored by every handler. Each opcode comes in two variants, one for
+//  when the cell is cached and one for when it is not, and the variant
+//  planted depends on what comes before it. The moves write the cell back
+//  and leave it uncached, the offset-addressed instructions never touch the
+//  current cell, and everything else leaves it cached. The loop tests
+//  always leave it cached, so each jump target is reached in the same state
+//  whichever way it is reached. The opcodes are rewritten in place, so the jumps stay valid.
+class CellCacher {
+    const InstructionSet & instruction_set;
+    std::map<OpCode, std::pair<OpCode, OpCode>> variants;   //  When uncached, when cached.
+
+public:
+    CellCacher( const InstructionSet & instruction_set, const InstructionSet & uncached, const InstructionSet & cached ) :
+        instruction_set( instruction_set )
+    {
+        const std::map<std::string, OpCode> by_name = instruction_set.byName();
+        const std::map<std::string, OpCode> uncached_by_name = uncached.byName();
+        const std::map<std::string, OpCode> cached_by_name = cached.byName();
+        for ( auto & [ name, opcode ] : by_name ) {
+            variants[ opcode ] = { uncached_by_name.at( name ), cached_by_name.at( name ) };
+        }
+    }
+
+private:
+    //  The offset of these is never zero, so they leave the current cell
+    //  alone.
+    bool offsetAddressed( OpCode opcode ) const {
+        return opcode == instruction_set.ADD_OFFSET || opcode == instruction_set.SET_AT || opcode == instruction_set.PUT_AT;
+    }
+
+public:
+    void cache( std::vector<Instruction> & program ) const {
+        bool cached = false;
+        for ( size_t i = 0; i < program.size(); ) {
+            const OpCode opcode = program[ i ].opcode;
+            const auto & [ when_uncached, when_cached ] = variants.at( opcode );
+            program[ i ].opcode = cached ? when_cached : when_uncached;
+            if ( opcode == instruction_set.MOVE || opcode == instruction_set.LEFT || opcode == instruction_set.RIGHT ) {
+                cached = false;
+            } else if ( not offsetAddressed( opcode ) ) {
+                cached = true;
+            }
+            i += 1;
+            if ( instruction_set.hasOperand( opcode ) || instruction_set.hasDyad( opcode ) ) {
+                i += 1;
+            } else if ( instruction_set.hasOffsetJump( opcode ) ) {
+                i += 2;
+            } else if ( instruction_set.hasTable( opcode ) ) {
+                i += 1 + static_cast<size_t>( program[ i ].operand );
+            }
+        }
+    }
+};
+
+//  This class is responsible for translating the wide instruction stream 
+//  planted by the CodePlanter into the compact, fixed-width encoding. The
+//  jump targets of OPEN and CLOSE cannot be stored as pointers in 32 bits
+//  so they become displacements from the following record. OPEN_AT and
+//  CLOSE_AT need a second record for their offset.
+class CodeCompactor {
+    const InstructionSet & instruction_set;
+    const char * base;                  //  The label that opcodes are relative to.
+
+public:
+    CodeCompactor( const InstructionSet & instruction_set, OpCode base ) :
+        instruction_set( instruction_set ),
+        base( static_cast<const char *>( base ) )
+    {}
+
+private:
+    int32_t offset( OpCode opcode ) {
+        return static_cast<int32_t>( static_cast<const char *>( opcode ) - base );
+    }
+
+    static int16_t narrow( int32_t n ) {
+        if ( n < INT16_MIN || n > INT16_MAX ) {
+            throw std::runtime_error( "Operand too large for the compact encoding: " + std::to_string( n ) );
+        }
+        return static_cast<int16_t>( n );
+    }
+
+    //  The number of wide slots taken by the instruction at i.
+    size_t width( const std::vector<Instruction> & program, size_t i ) {
+        OpCode opcode = program[ i ].opcode;
+        if ( instruction_set.hasTable( opcode ) ) {
+            return 2 + program[ i + 1 ].operand;
+        } else if ( instruction_set.hasOffsetJump( opcode ) ) {
+            return 3;
+        } else if ( instruction_set.hasOperand( opcode ) || instruction_set.hasDyad( opcode ) ) {
+            return 2;
+        } else {
+            return 1;
+        }
+    }
+
+    //  The number of compact records taken by the instruction at i. A table
+    //  needs one record per entry after the record holding the count.
+    size_t records( const std::vector<Instruction> & program, size_t i ) {
+        OpCode opcode = program[ i ].opcode;
+        if ( instruction_set.hasTable( opcode ) ) {
+            return 1 + program[ i + 1 ].operand;
+        } else if ( instruction_set.hasOffsetJump( opcode ) ) {
+            return 2;
+        } else {
+            return 1;
+        }
+    }
+
+public:
+    std::vector<CompactInstruction> compact( const std::vector<Instruction> & program ) {
+        //  Work out where each wide instruction lands in the compact stream.
+        std::vector<int32_t> renumber( program.size() + 1 );
+        int32_t n = 0;
+        for ( size_t i = 0; i < program.size(); i += width( program, i ) ) {
+            renumber[ i ] = n;
+            n += records( program, i );
+        }
+        renumber[ program.size() ] = n;
+
+        std::vector<CompactInstruction> code;
+        code.reserve( n );
+        for ( size_t i = 0; i < program.size(); i += width( program, i ) ) {
+            OpCode opcode = program[ i ].opcode;
+            CompactInstruction c = { offset( opcode ), { 0 } };
+            if ( opcode == instruction_set.OPEN || opcode == instruction_set.CLOSE ) {
+                size_t target = program[ i + 1 ].target - program.data();
+                c.operand = renumber[ target ] - static_cast<int32_t>( code.size() + 1 );
+            } else if ( instruction_set.hasOffsetJump( opcode ) ) {
+                size_t target = program[ i + 1 ].target - program.data();
+                c.operand = renumber[ target ] - static_cast<int32_t>( code.size() + 1 );
+                code.push_back( c );
+                CompactInstruction trailer = { 0, { program[ i + 2 ].operand } };
+                code.push_back( trailer );
+                continue;
+            } else if ( instruction_set.hasOperand( opcode ) ) {
+                c.operand = program[ i + 1 ].operand;
+            } else if ( instruction_set.hasDyad( opcode ) ) {
+                Dyad d = program[ i + 1 ].dyad;
+                c.dyad = { narrow( d.operand1 ), narrow( d.operand2 ) };
+            } else if ( instruction_set.hasTable( opcode ) ) {
+                c.operand = program[ i + 1 ].operand;
+                code.push_back( c );
+                for ( int k = 0; k < c.operand; k++ ) {
+                    Dyad d = program[ i + 2 + k ].dyad;
+                    CompactInstruction entry = { 0, { 0 } };
+                    entry.dyad = { narrow( d.operand1 ), narrow( d.operand2 ) };
+                    code.push_back( entry );
+                }
+                continue;
+            }
+            code.push_back( c );
+        }
+        return code;
+    }
+};
+
+//  The wide encoding is the one planted by the CodePlanter - the opcode and 
+//  each operand occupy their own slot, so operands are fetched by advancing
+//  the program counter.
+struct WideEncoding {
+    typedef Instruction Code;
+
+    //  Moving the vector keeps its storage, so the resolved jump targets
+    //  remain valid.
+    static std::vector<Code> encode( std::vector<Instruction> && program, const InstructionSet &, OpCode ) {
+        return std::move( program );
+    }
+
+    static OpCode fetch( const Code * & pc, char * ) {
+        return pc++->opcode;
+    }
+
+    static int operand( const Code * & pc ) {
+        return pc++->operand;
+    }
+
+    static Dyad dyad( const Code * & pc ) {
+        return pc++->dyad;
+    }
+
+    static const Code * target( const Code * & pc ) {
+        return pc++->target;
+    }
+
+    static Dyad entry( const Code * & pc ) {
+        return pc++->dyad;
+    }
+
+    //  The offset that follows the jump of OPEN_AT and CLOSE_AT.
+    static int trailing( const Code * & pc ) {
+        return pc++->operand;
+    }
+};
+
+//  In the compact encoding the operands live in the same record as the
+//  opcode, which the program counter has already stepped past. 
+struct CompactEncoding {
+    typedef CompactInstruction Code;
+
+    static std::vector<Code> encode( std::vector<Instruction> && program, const InstructionSet & instruction_set, OpCode base ) {
+        return CodeCompactor( instruction_set, base ).compact( program );
+    }
+
+    static OpCode fetch( const Code * & pc, char * base ) {
+        return base + pc++->opcode;
+    }
+
+    static int operand( const Code * & pc ) {
+        return pc[ -1 ].operand;
+    }
+
+    static Dyad dyad( const Code * & pc ) {
+        CompactDyad d = pc[ -1 ].dyad;
+        return { d.operand1, d.operand2 };
+    }
+
+    static const Code * target( const Code * & pc ) {
+        return pc + pc[ -1 ].operand;
+    }
+
+    //  The entries of a table follow the record holding the count, so 
+    //  these are consumed by advancing the program counter.
+    static Dyad entry( const Code * & pc ) {
+        CompactDyad d = pc++->dyad;
+        return { d.operand1, d.operand2 };
+    }
+
+    //  The offset of OPEN_AT and CLOSE_AT is in a record of its own, after
+    //  the one holding the jump.
+    static int trailing( const Code * & pc ) {
+        return pc++->operand;
     }
 };
 
 typedef unsigned char num;
 
-class Engine {
-    std::map<char, OpCode> opcode_map;
-    std::map<std::string, OpCode> extra_opcodes_map;
-    std::vector<Instruction> program;
-    std::vector<num> memory;
+//  The multiple of a cell that a transfer adds, wrapped to the width of the
+//  cell. It is worked out unsigned, as a 16-bit cell would otherwise be
+//  promoted to int and the product could overflow.
+template <typename Cell>
+inline Cell multiple( Cell n, int32_t by ) {
+    typedef std::conditional_t<( sizeof( Cell ) < sizeof( unsigned ) ), unsigned, Cell> Wide;
+    return static_cast<Cell>( static_cast<Wide>( n ) * static_cast<Wide>( by ) );
+}
+
+//  The state that the native code handlers need, beyond the location.
+template <typename OutStream, typename InStream>
+struct NativeContext {
+    OutStream & out;
+    InStream & in;
+    Tape & memory;
+};
+
+//  The instructions that the NativeCodeGenerator does not inline. Each is
+//  passed the operand slots that follow its opcode.
+template <typename OutStream, typename InStream>
+struct NativeHandlers {
+    typedef NativeContext<OutStream, InStream> Context;
+
+    static num * PUT( num * loc, void * context, const void * ) {
+        static_cast<Context *>( context )->out << *loc;
+        return loc;
+    }
+
+    static num * PUT_AT( num * loc, void * context, const void * operands ) {
+        int offset = static_cast<const Instruction *>( operands )->operand;
+        static_cast<Context *>( context )->out << *( loc + offset );
+        return loc;
+    }
+
+    static num * GET( num * loc, void * context, const void * ) {
+        InStream & in = static_cast<Context *>( context )->in;
+        char ch;
+        in.get( ch );
+        if (in.good()) {
+            *loc = ch;
+        }
+        return loc;
+    }
+
+    static num * GET_BYTES( num * loc, void * context, const void * operands ) {
+        InStream & in = static_cast<Context *>( context )->in;
+        int n = static_cast<const Instruction *>( operands )->operand;
+        for ( int k = 0; k < n; k++ ) {
+            char ch;
+            in.get( ch );
+            if ( in.good() ) {
+                loc[ k ] = ch;
+            }
+        }
+        return loc;
+    }
+
+    static num * XFR_MULTIPLE( num * loc, void *, const void * operands ) {
+        const Dyad d = static_cast<const Instruction *>( operands )->dyad;
+        *( loc + d.operand1 ) += *loc * d.operand2;
+        *loc = 0;
+        return loc;
+    }
+
+    static num * XFR_MULTI_N( num * loc, void *, const void * operands ) {
+        const Instruction * table = static_cast<const Instruction *>( operands );
+        int count = table[ 0 ].operand;
+        int n = *loc;
+        for ( int k = 1; k <= count; k++ ) {
+            *( loc + table[ k ].dyad.operand1 ) += n * table[ k ].dyad.operand2;
+        }
+        *loc = 0;
+        return loc;
+    }
+
+    static num * SEEK_LEFT( num * loc, void * context, const void * ) {
+        return seek::left( loc, static_cast<Context *>( context )->memory.data() );
+    }
+
+    static num * SEEK_RIGHT( num * loc, void * context, const void * ) {
+        Tape & memory = static_cast<Context *>( context )->memory;
+        return seek::right( loc, memory.data() + memory.size() );
+    }
+
+    static num * SEEK_LEFT_N( num * loc, void * context, const void * operands ) {
+        int stride = static_cast<const Instruction *>( operands )->operand;
+        return seek::left( loc, static_cast<Context *>( context )->memory.data(), stride );
+    }
+
+    static num * SEEK_RIGHT_N( num * loc, void * context, const void * operands ) {
+        Tape & memory = static_cast<Context *>( context )->memory;
+        int stride = static_cast<const Instruction *>( operands )->operand;
+        return seek::right( loc, memory.data() + memory.size(), stride );
+    }
+
+    static std::map<OpCode, native_code::Handler> of( const InstructionSet & instruction_set ) {
+        return {
+            { instruction_set.PUT, &PUT },
+            { instruction_set.PUT_AT, &PUT_AT },
+            { instruction_set.GET, &GET },
+            { instruction_set.GET_BYTES, &GET_BYTES },
+            { instruction_set.XFR_MULTIPLE, &XFR_MULTIPLE },
+            { instruction_set.XFR_MULTI_N, &XFR_MULTI_N },
+            { instruction_set.SEEK_LEFT, &SEEK_LEFT },
+            { instruction_set.SEEK_RIGHT, &SEEK_RIGHT },
+            { instruction_set.SEEK_LEFT_N, &SEEK_LEFT_N },
+            { instruction_set.SEEK_RIGHT_N, &SEEK_RIGHT_N }
+        };
+    }
+};
+
+//  This class is responsible for translating the planted program into
+//  native code (see native_code.hpp). The arithmetic and the moves are
+//  inlined, OPEN and CLOSE become conditional branches and everything else
+//  calls its handler. The handlers are passed pointers into the planted
+//  program, which must therefore outlive the native code.
+class NativeCodeGenerator {
+    const InstructionSet & instruction_set;
+    const std::map<OpCode, native_code::Handler> & handlers;
+
+public:
+    NativeCodeGenerator( const InstructionSet & instruction_set, const std::map<OpCode, native_code::Handler> & handlers ) :
+        instruction_set( instruction_set ),
+        handlers( handlers )
+    {}
+
+private:
+    //  The number of operand slots following an opcode.
+    size_t operands( OpCode opcode, const Instruction * next ) const {
+        if ( instruction_set.hasOperand( opcode ) || instruction_set.hasDyad( opcode ) ) {
+            return 1;
+        } else if ( instruction_set.hasTable( opcode ) ) {
+            return 1 + next->operand;
+        } else {
+            return 0;
+        }
+    }
+
+public:
+    native_code::Assembler generate( const std::vector<Instruction> & program ) const {
+        static constexpr size_t NONE = ~size_t( 0 );
+        const Instruction * program_data = program.data();
+        native_code::Assembler code;
+        std::vector<size_t> starts( program.size(), NONE );        //  Where each planted instruction begins.
+        std::vector<std::pair<size_t, size_t>> branches;            //  To be patched with the start of the target.
+        code.prologue();
+        for ( size_t i = 0; i < program.size(); ) {
+            starts[ i ] = code.size();
+            const OpCode opcode = program[ i++ ].opcode;
+            if ( opcode == instruction_set.INCR ) {
+                code.addCell( 1 );
+            } else if ( opcode == instruction_set.DECR ) {
+                code.addCell( -1 );
+            } else if ( opcode == instruction_set.ADD ) {
+                code.addCell( program[ i++ ].operand );
+            } else if ( opcode == instruction_set.ADD_OFFSET ) {
+                Dyad d = program[ i++ ].dyad;
+                code.addCellAt( d.operand1, d.operand2 );
+            } else if ( opcode == instruction_set.SET_ZERO ) {
+                code.zeroCell();
+            } else if ( opcode == instruction_set.SET_AT ) {
+                code.zeroCellAt( program[ i++ ].operand );
+            } else if ( opcode == instruction_set.RIGHT ) {
+                code.moveLoc( 1 );
+            } else if ( opcode == instruction_set.LEFT ) {
+                code.moveLoc( -1 );
+            } else if ( opcode == instruction_set.MOVE ) {
+                code.moveLoc( program[ i++ ].operand );
+            } else if ( opcode == instruction_set.OPEN ) {
+                branches.push_back( { code.branchIfZero(), program[ i++ ].target - program_data } );
+            } else if ( opcode == instruction_set.CLOSE ) {
+                branches.push_back( { code.branchUnlessZero(), program[ i++ ].target - program_data } );
+            } else if ( opcode == instruction_set.OPEN_AT || opcode == instruction_set.CLOSE_AT ) {
+                const size_t target = program[ i++ ].target - program_data;
+                code.moveLoc( program[ i++ ].operand );
+                branches.push_back( { opcode == instruction_set.OPEN_AT ? code.branchIfZero() : code.branchUnlessZero(), target } );
+            } else if ( opcode == instruction_set.HALT ) {
+                code.epilogue();
+            } else {
+                code.call( handlers.at( opcode ), &program_data[ i ] );
+                i += operands( opcode, &program_data[ i ] );
+            }
+        }
+        for ( auto [ branch, target ] : branches ) {
+            if ( starts.at( target ) == NONE ) {
+                throw std::runtime_error( "Jump into the middle of an instruction" );
+            }
+            code.patch( branch, starts[ target ] );
+        }
+        return code;
+    }
+};
+
+//  A planted program, which never changes once it has been planted and is
+//  shared, by reference count, between any number of engines on any number
+//  of threads. Its opcodes are the labels of the Engine::dispatch for the
+//  same encoding, streams, profiling, cell and snapshotting, so only that
+//  can run it. Its jumps point into itself, so it is never copied.
+template <typename Encoding, typename OutStream, typename InStream, bool PROFILE = false, typename Cell = uint8_t, bool SNAPSHOT = false>
+class CompiledProgram {
+public:
+    typedef typename Encoding::Code Code;
+
+private:
+    const std::vector<Code> program;
+
+public:
+    explicit CompiledProgram( std::vector<Code> && program ) :
+        program( std::move( program ) )
+    {}
+
+    CompiledProgram( const CompiledProgram & ) = delete;
+    CompiledProgram & operator=( const CompiledProgram & ) = delete;
+
 public:
-    Engine() : 
-        memory( 30000 )
+    const std::vector<Code> & code() const {
+        return program;
+    }
+};
+
+//  Dispatches to the next instruction. The profiling instantiation of the
+//  engine counts the instruction first; otherwise this compiles away.
+#define NEXT { if ( PROFILE ) counters->count( pc - start ); goto *Encoding::fetch( pc, base ); }
+
+//  The state of a single run: the tape, and the cache the programs are
+//  planted through. The programs themselves live in CompiledPrograms. If
+//  cache_cell is set, the wide programs this engine plants keep the current
+//  cell in a register (see CellCacher).
+//
+//  The cells are of 8, 16 or 32 bits. Planting does not depend on the cell,
+//  only the dispatch, which is instantiated for each. Narrow cells keep
+//  more of the tape in the cache and wide ones let programs count further.
+//
+//  A run of a file can be checkpointed, warm started and resumed (see
+//  snapshot.hpp). The safe points are the jumps back of CLOSE and CLOSE_AT,
+//  PUT, PUT_AT, GET, GET_BYTES and HALT, and the first of the input and
+//  output instructions for a warm start. These are
+//  only in the snapshotting instantiation of dispatch, so that other runs
+//  pay nothing for them, and it has only the usual handlers: a snapshotted
+//  run is neither native nor cached-cell.
+template <typename Cell>
+class BasicEngine {
+    Tape memory;
+    compile_cache::Cache cache;
+    profile::ProfileOptions profiling;
+    bool cache_cell;
+    snapshot::SnapshotOptions snapshots;
+    uint64_t fingerprint = 0;           //  Of the program being run.
+    snapshot::State resumed;            //  The slot and cell it starts from.
+    uint64_t input_read = 0;            //  The bytes of input it has read.
+    bool warm_start_pending = false;
+    bool stopped_at_checkpoint = false;
+public:
+    BasicEngine(
+        const TapeOptions & tape = TapeOptions(),
+        const compile_cache::Cache & cache = compile_cache::Cache::disabled(),
+        const profile::ProfileOptions & profiling = profile::ProfileOptions(),
+        bool cache_cell = false,
+        const snapshot::SnapshotOptions & snapshots = snapshot::SnapshotOptions()
+    ) : 
+        memory( tape.size, tape.max_size, sizeof( Cell ) ),
+        cache( cache ),
+        profiling( profiling ),
+        cache_cell( cache_cell ),
+        snapshots( snapshots )
     {}
 
+    //  True if the last run stopped at a checkpoint rather than halting.
+    bool stopped() const {
+        return stopped_at_checkpoint;
+    }
+
 public:
-    void runFile( std::string_view filename, bool header_needed ) {
+    //  The streams may be the standard iostreams or the BufferedOutput and
+    //  BufferedInput of buffered_io.hpp. A profiled run always uses the
+    //  wide encoding, in which every slot is an instruction or an operand.
+    template <typename OutStream = std::ostream, typename InStream = std::istream>
+    void runFile( std::string_view filename, bool header_needed, bool compact, OutStream & out = std::cout, InStream & in = std::cin ) {
+        if ( header_needed ) {
+            std::cerr << "# Executing: " << filename << std::endl;
+        }
+        if ( profiling.enabled() ) {
+            runProgram<WideEncoding, true>( filename, out, in );
+        } else if ( compact ) {
+            runProgram<CompactEncoding>( filename, out, in );
+        } else {
+            runProgram<WideEncoding>( filename, out, in );
+        }
+    }
+
+    //  Runs the program as native code, or interprets it if native code
+    //  cannot be generated on this host or a profile is wanted.
+    template <typename OutStream = std::ostream, typename InStream = std::istream>
+    void runNativeFile( std::string_view filename, bool header_needed, OutStream & out = std::cout, InStream & in = std::cin ) {
         if ( header_needed ) {
             std::cerr << "# Executing: " << filename << std::endl;
         }
+        if ( profiling.enabled() ) {
+            runProgram<WideEncoding, true>( filename, out, in );
+        } else {
+            runProgram<WideEncoding>( filename, out, in, native_code::SUPPORTED );
+        }
+    }
+
+private:
+    //  Returns null if the host cannot run the native code.
+    template <typename OutStream, typename InStream>
+    std::unique_ptr<native_code::Executable> generateNative( const std::vector<Instruction> & program, const InstructionSet & instruction_set ) {
+        const std::map<OpCode, native_code::Handler> handlers = NativeHandlers<OutStream, InStream>::of( instruction_set );
+        const native_code::Assembler code = NativeCodeGenerator( instruction_set, handlers ).generate( program );
+        try {
+            return std::make_unique<native_code::Executable>( code );
+        } catch ( const std::runtime_error & e ) {
+            std::cerr << "# " << e.what() << ", interpreting instead" << std::endl;
+            return nullptr;
+        }
+    }
+
+public:
+    //  Plants a program for the given encoding and streams, to be run by
+    //  this or any other engine.
+    template <typename Encoding, typename OutStream, typename InStream, bool PROFILE = false>
+    std::shared_ptr<const CompiledProgram<Encoding, OutStream, InStream, PROFILE, Cell>> compile( std::string_view filename ) {
+        return compile<Encoding, OutStream, InStream, PROFILE>( filename, cache_cell );
+    }
 
-        InstructionSet instruction_set;
-        instruction_set.INCR = &&INCR;
-        instruction_set.DECR = &&DECR;
-        instruction_set.LEFT = &&LEFT;
-        instruction_set.RIGHT = &&RIGHT;
-        instruction_set.OPEN = &&OPEN;
-        instruction_set.CLOSE = &&CLOSE;
-        instruction_set.PUT = &&PUT;
-        instruction_set.GET = &&GET;
-        instruction_set.ADD = &&ADD;
-        instruction_set.MOVE = &&MOVE;
-        instruction_set.SET_ZERO = &&SET_ZERO;
-        instruction_set.ADD_OFFSET = &&ADD_OFFSET;
-        instruction_set.XFR_MULTIPLE = &&XFR_MULTIPLE;
-        instruction_set.SEEK_LEFT = &&SEEK_LEFT;
-        instruction_set.SEEK_RIGHT = &&SEEK_RIGHT;
-        instruction_set.HALT = &&HALT;
-        
-        CodePlanter planter( filename, instruction_set, program );
+private:
+    //  The cell is only ever cached in the wide encoding, and not when
+    //  profiling, so that the counts are of the usual handlers.
+    template <typename Encoding, typename OutStream, typename InStream, bool PROFILE = false, bool SNAPSHOT = false>
+    std::shared_ptr<const CompiledProgram<Encoding, OutStream, InStream, PROFILE, Cell, SNAPSHOT>> compile( std::string_view filename, bool cache_cell ) {
+        const InstructionSet & instruction_set = labels<Encoding, OutStream, InStream, PROFILE, SNAPSHOT>();
+        std::vector<Instruction> planted;
+        CachingCodePlanter planter( filename, instruction_set, planted, cache );
         planter.plantProgram();
+        if constexpr ( std::is_same_v<Encoding, WideEncoding> && not PROFILE ) {
+            if ( cache_cell ) {
+                const InstructionSet * variants = cellVariants<Encoding, OutStream, InStream>();
+                CellCacher( instruction_set, variants[ 0 ], variants[ 1 ] ).cache( planted );
+            }
+        }
+        //  All opcodes are relocated relative to this label in the compact
+        //  encoding.
+        return std::make_shared<const CompiledProgram<Encoding, OutStream, InStream, PROFILE, Cell, SNAPSHOT>>(
+            Encoding::encode( std::move( planted ), instruction_set, instruction_set.INCR )
+        );
+    }
+
+public:
+    //  Runs a compiled program, starting from a clear tape.
+    template <typename Encoding, typename OutStream, typename InStream>
+    void run( const CompiledProgram<Encoding, OutStream, InStream, false, Cell> & program, OutStream & out, InStream & in ) {
+        memory.clear();
+        dispatch<Encoding, OutStream, InStream>( program.code().data(), &out, &in, nullptr, nullptr );
+    }
+
+private:
+    //  The labels are only in scope in dispatch, so we ask it for them.
+    template <typename Encoding, typename OutStream, typename InStream, bool PROFILE = false, bool SNAPSHOT = false>
+    const InstructionSet & labels() {
+        const InstructionSet * instruction_set = nullptr;
+        dispatch<Encoding, OutStream, InStream, PROFILE, SNAPSHOT>( nullptr, nullptr, nullptr, &instruction_set, nullptr );
+        return *instruction_set;
+    }
+
+    //  The uncached and cached variants of the opcodes, in that order.
+    template <typename Encoding, typename OutStream, typename InStream>
+    const InstructionSet * cellVariants() {
+        return &labels<Encoding, OutStream, InStream>() + 1;
+    }
+
+    //  The name of the opcode in each slot of a wide program, and an empty
+    //  name for each of its operands.
+    static std::vector<std::string> listingOf( const std::vector<Instruction> & program, const InstructionSet & instruction_set ) {
+        std::map<OpCode, std::string> names;
+        for ( auto & [ name, opcode ] : instruction_set.byName() ) {
+            names[ opcode ] = name;
+        }
+        std::vector<std::string> listing;
+        for ( size_t i = 0; i < program.size(); ) {
+            const OpCode opcode = program[ i++ ].opcode;
+            listing.push_back( names.at( opcode ) );
+            size_t operands = 0;
+            if ( instruction_set.hasOperand( opcode ) || instruction_set.hasDyad( opcode ) ) {
+                operands = 1;
+            } else if ( instruction_set.hasOffsetJump( opcode ) ) {
+                operands = 2;
+            } else if ( instruction_set.hasTable( opcode ) ) {
+                operands = 1 + static_cast<size_t>( program[ i ].operand );
+            }
+            listing.resize( listing.size() + operands );
+            i += operands;
+        }
+        return listing;
+    }
+
+    //  The snapshot of the bytes of the tape stops at the last cell that is
+    //  not zero. The input is the number of bytes read so far.
+    void save( const std::string & file, size_t pc, const Cell * loc, uint64_t input ) const {
+        const char * bytes = reinterpret_cast<const char *>( memory.data<Cell>() );
+        size_t used = memory.size() * sizeof( Cell );
+        while ( used > 0 && bytes[ used - 1 ] == 0 ) {
+            used -= 1;
+        }
+        snapshot::State state;
+        state.program = fingerprint;
+        state.cell_bits = 8 * sizeof( Cell );
+        state.pc = pc;
+        state.loc = static_cast<uint64_t>( loc - memory.data<Cell>() );
+        state.input = input;
+        state.tape = std::string_view( bytes, ( used + sizeof( Cell ) - 1 ) / sizeof( Cell ) * sizeof( Cell ) );
+        snapshot::write( file, state );
+    }
+
+    //  Puts back the tape and input of a snapshot, returning it so that the
+    //  dispatch can carry on from it.
+    template <typename InStream>
+    snapshot::State restore( const std::string & file, InStream & in ) {
+        const snapshot::Mapped mapped( file );
+        mapped.check( fingerprint, 8 * sizeof( Cell ), file );
+        snapshot::State state = mapped.state();
+        std::memcpy( memory.data(), state.tape.data(), state.tape.size() );
+        snapshot::skip( in, state.input );
+        state.tape = state.data_stack = state.call_stack = std::string_view();
+        return state;
+    }
+
+    template <typename Encoding, bool PROFILE = false, typename OutStream, typename InStream>
+    void runProgram( std::string_view filename, OutStream & out, InStream & in, bool native = false ) {
+        if ( snapshots.enabled() && not PROFILE ) {
+            if ( native ) {
+                std::cerr << "# Native code cannot be snapshotted, interpreting instead" << std::endl;
+            }
+            std::noskipws( std::cin );
+            runSnapshotted<Encoding>( filename, out, in );
+            return;
+        }
+
+        //  The native code generator only knows the usual handlers.
+        const auto program = compile<Encoding, OutStream, InStream, PROFILE>( filename, cache_cell && not native );
 
         std::noskipws( std::cin );
 
-        auto program_data = program.data();
-        Instruction * pc = &program_data[0];
-        num * loc = &memory.data()[0];
-        goto *(pc++->opcode);
+        if constexpr ( PROFILE ) {
+            profile::Counters counters( program->code().size(), profiling.cycles );
+            dispatch<Encoding, OutStream, InStream, PROFILE>( program->code().data(), &out, &in, nullptr, &counters );
+            const std::vector<std::string> listing = listingOf( program->code(), labels<Encoding, OutStream, InStream, PROFILE>() );
+            profile::write( profiling.file, counters, profile::sitesOf( listing ) );
+            return;
+        } else if constexpr ( std::is_same_v<Encoding, WideEncoding> && sizeof( Cell ) == 1 ) {
+            if ( native ) {
+                if ( auto executable = generateNative<OutStream, InStream>( program->code(), labels<Encoding, OutStream, InStream>() ) ) {
+                    NativeContext<OutStream, InStream> context{ out, in, memory };
+                    executable->entry()( memory.data(), &context );
+                    out.flush();
+                    return;
+                }
+            }
+        } else if ( native ) {
+            std::cerr << "# Native code needs 8-bit cells, interpreting instead" << std::endl;
+        }
+
+        dispatch<Encoding, OutStream, InStream>( program->code().data(), &out, &in, nullptr, nullptr );
+    }
+
+    //  Resumes the run from a snapshot, if there is one to resume, and
+    //  otherwise runs it from the start.
+    template <typename Encoding, typename OutStream, typename InStream>
+    void runSnapshotted( std::string_view filename, OutStream & out, InStream & in ) {
+        const snapshot::Listening listening;
+        const auto program = compile<Encoding, OutStream, InStream, false, true>( filename, false );
+        fingerprint = snapshot::fingerprintOf( std::string( filename ), std::is_same_v<Encoding, CompactEncoding> ? "compact" : "wide" );
+        std::string resume = snapshots.resume;
+        if ( resume.empty() && not snapshots.warm_start.empty() && snapshot::isSnapshotOf( snapshots.warm_start, fingerprint ) ) {
+            resume = snapshots.warm_start;
+        }
+        warm_start_pending = resume.empty() && not snapshots.warm_start.empty();
+        stopped_at_checkpoint = false;
+        resumed = resume.empty() ? snapshot::State() : restore( resume, in );
+        input_read = resumed.input;
+        dispatch<Encoding, OutStream, InStream, false, true>( program->code().data(), &out, &in, nullptr, nullptr );
+    }
+
+    //  Runs the program from its first instruction, or, if labels is not
+    //  null, just points it at the instruction set and returns. Only the
+    //  profiling instantiation is passed counters, and only the snapshotting
+    //  one has safe points and starts where it was resumed.
+    template <typename Encoding, typename OutStream, typename InStream, bool PROFILE = false, bool SNAPSHOT = false>
+    void dispatch( const typename Encoding::Code * pc, OutStream * out, InStream * in, const InstructionSet * * labels, profile::Counters * counters ) {
+        typedef typename Encoding::Code Code;
+
+        //  In the order of the fields of InstructionSet: the usual handlers,
+        //  then the variants of the cached-cell mode for when the cell is
+        //  not cached and for when it is (see CellCacher). The offset-addressed
+        //  instructions other than OPEN_AT and CLOSE_AT never touch the
+        //  current cell, so they need no variants, and nor do the moves when
+        //  the cell is not cached.
+        static const InstructionSet LABELS[] = {
+            {
+                &&SET_ZERO, &&INCR, &&DECR, &&ADD, &&ADD_OFFSET, &&XFR_MULTIPLE, &&XFR_MULTI_N,
+                &&LEFT, &&RIGHT, &&SEEK_LEFT, &&SEEK_RIGHT, &&SEEK_LEFT_N, &&SEEK_RIGHT_N,
+                &&MOVE, &&OPEN, &&CLOSE, &&GET, &&PUT,
+                &&SET_AT, &&PUT_AT, &&OPEN_AT, &&CLOSE_AT, &&GET_BYTES, &&HALT
+            },
+            {
+                &&SET_ZERO_C, &&INCR_U, &&DECR_U, &&ADD_U, &&ADD_OFFSET, &&XFR_MULTIPLE_U, &&XFR_MULTI_N_U,
+                &&LEFT, &&RIGHT, &&SEEK_LEFT_U, &&SEEK_RIGHT_U, &&SEEK_LEFT_N_U, &&SEEK_RIGHT_N_U,
+                &&MOVE, &&OPEN_U, &&CLOSE_U, &&GET_U, &&PUT_U,
+                &&SET_AT, &&PUT_AT, &&OPEN_AT_U, &&CLOSE_AT_U, &&GET_BYTES_U, &&HALT
+            },
+            {
+                &&SET_ZERO_C, &&INCR_C, &&DECR_C, &&ADD_C, &&ADD_OFFSET, &&XFR_MULTIPLE_C, &&XFR_MULTI_N_C,
+                &&LEFT_C, &&RIGHT_C, &&SEEK_LEFT_C, &&SEEK_RIGHT_C, &&SEEK_LEFT_N_C, &&SEEK_RIGHT_N_C,
+                &&MOVE_C, &&OPEN_C, &&CLOSE_C, &&GET_C, &&PUT_C,
+                &&SET_AT, &&PUT_AT, &&OPEN_AT_C, &&CLOSE_AT_C, &&GET_BYTES_C, &&HALT_C
+            }
+        };
+        if ( labels != nullptr ) {
+            *labels = LABELS;
+            return;
+        }
+
+        char * base = static_cast<char *>( &&INCR );
+        Cell * loc = memory.data<Cell>();
+        Cell cell = 0;                  //  The current cell, when it is cached.
+        const Code * start = pc;
+        if constexpr ( SNAPSHOT ) {
+            loc += resumed.loc;
+            pc += resumed.pc;
+        }
+        NEXT;
 
         ////////////////////////////////////////////////////////////////////////
         //  Control flow does not reach this position! 
@@ -474,124 +1443,663 @@ public:
     INCR:
         if ( DEBUG ) std::cout << "INCR" << std::endl;
         *loc += 1;
-        goto *(pc++->opcode);
+        NEXT;
     DECR:
         if ( DEBUG ) std::cout << "DECR" << std::endl;
         *loc -= 1;
-        goto *(pc++->opcode);
+        NEXT;
     ADD:
         if ( DEBUG ) std::cout << "ADD" << std::endl;
         {
-            int n = pc++->operand;
+            int n = Encoding::operand( pc );
             *loc += n;
         }
-        goto *(pc++->opcode);
+        NEXT;
     ADD_OFFSET:
         if ( DEBUG ) std::cout << "ADD_OFFSET" << std::endl;
         {
-            struct Dyad d = pc++->dyad;
+            struct Dyad d = Encoding::dyad( pc );
             int32_t offset = d.operand1;
             int32_t by = d.operand2;
             *( loc + offset ) += by;
         }
-        goto *(pc++->opcode);
+        NEXT;
     RIGHT:
         if ( DEBUG ) std::cout << "RIGHT" << std::endl;
         loc += 1;
-        goto *(pc++->opcode);
+        NEXT;
     LEFT:
         if ( DEBUG ) std::cout << "LEFT" << std::endl;
         loc -= 1;
-        goto *(pc++->opcode);
+        NEXT;
     MOVE:
         if ( DEBUG ) std::cout << "MOVE" << std::endl;
         {
-            int n = pc++->operand;
+            int n = Encoding::operand( pc );
             loc += n;
         }
-        goto *(pc++->opcode);
+        NEXT;
     PUT:
         if ( DEBUG ) std::cout << "PUT" << std::endl;
+        if ( SNAPSHOT && warm_start_pending ) goto WARM_START;
+        if ( SNAPSHOT && snapshot::pending() ) goto CHECKPOINT_BEFORE;
         {
-            num i = *loc;
-            std::cout << i;
+            unsigned char i = static_cast<unsigned char>( *loc );
+            *out << i;
         }
-        goto *(pc++->opcode);
+        NEXT;
     GET:
         if ( DEBUG ) std::cout << "GET" << std::endl;
+        if ( SNAPSHOT && warm_start_pending ) goto WARM_START;
+        if ( SNAPSHOT && snapshot::pending() ) goto CHECKPOINT_BEFORE;
         {
-            char ch;
-            std::cin.get( ch );
-            if (std::cin.good()) {
-                *loc = ch;
+            char ch = 0;
+            in->get( ch );
+            if ( in->good() ) {
+                *loc = static_cast<unsigned char>( ch );
+                if ( SNAPSHOT ) input_read += 1;
+            } else if ( SNAPSHOT && snapshot::stopping() ) {
+                goto CHECKPOINT_BEFORE;
+            }
+        }
+        NEXT;
+    GET_BYTES:
+        if ( DEBUG ) std::cout << "GET_BYTES" << std::endl;
+        if ( SNAPSHOT && warm_start_pending ) goto WARM_START;
+        if ( SNAPSHOT && snapshot::pending() ) goto CHECKPOINT_BEFORE;
+        {
+            const Code * operands = pc;
+            int n = Encoding::operand( pc );
+            for ( int k = 0; k < n; k++ ) {
+                char ch = 0;
+                in->get( ch );
+                if ( in->good() ) {
+                    loc[ k ] = static_cast<unsigned char>( ch );
+                    if ( SNAPSHOT ) input_read += 1;
+                } else if ( SNAPSHOT && snapshot::stopping() ) {
+                    //  All of the bytes are read again when resumed.
+                    input_read -= static_cast<uint64_t>( k );
+                    pc = operands;
+                    goto CHECKPOINT_BEFORE;
+                }
             }
         }
-        goto *(pc++->opcode);
+        NEXT;
     OPEN:
         if ( DEBUG ) std::cout << "OPEN" << std::endl;
         {
-            int n = pc++->operand;
+            const Code * target = Encoding::target( pc );
             if ( *loc == 0 ) {
-                pc = &program_data[n];
+                pc = target;
             }
-            goto *(pc++->opcode);
+            NEXT;
         }
     CLOSE:
         if ( DEBUG ) std::cout << "CLOSE" << std::endl;
         {
-            int n = pc++->operand;
+            const Code * target = Encoding::target( pc );
             if ( *loc != 0 ) {
-                pc = &program_data[n];
+                pc = target;
+                if ( SNAPSHOT && snapshot::pending() ) goto CHECKPOINT;
             }
-            goto *(pc++->opcode);
+            NEXT;
         }
     SET_ZERO:
         if ( DEBUG ) std::cout << "SET_ZERO" << std::endl;
         *loc = 0;
-        goto *(pc++->opcode);
+        NEXT;
     XFR_MULTIPLE:
         if ( DEBUG ) std::cout << "XFR_MULTIPLE" << std::endl;
         {
-            struct Dyad d = pc++->dyad;
+            struct Dyad d = Encoding::dyad( pc );
             int offset = d.operand1;
             int by = d.operand2;
-            int n = *loc;
-            if ( DEBUG ) std::cout << "XFR_MULTIPLE offset=" << offset << " n=" << n << " by=" << by << std::endl;
-            *( loc + offset ) += n * by;
+            Cell n = *loc;
+            if ( DEBUG ) std::cout << "XFR_MULTIPLE offset=" << offset << " n=" << +n << " by=" << by << std::endl;
+            *( loc + offset ) += multiple( n, by );
             *loc = 0;
         }
-        goto *(pc++->opcode);
-    SEEK_LEFT:
-        if ( DEBUG ) std::cout << "SEEK_LEFT" << std::endl;
+        NEXT;
+    XFR_MULTI_N:
+        if ( DEBUG ) std::cout << "XFR_MULTI_N" << std::endl;
         {
-            while ( *loc ) {
-                loc -= 1;
+            int count = Encoding::operand( pc );
+            Cell n = *loc;
+            for ( int k = 0; k < count; k++ ) {
+                struct Dyad d = Encoding::entry( pc );
+                *( loc + d.operand1 ) += multiple( n, d.operand2 );
             }
+            *loc = 0;
         }
-        goto *(pc++->opcode);
+        NEXT;
+    SEEK_LEFT:
+        if ( DEBUG ) std::cout << "SEEK_LEFT" << std::endl;
+        loc = seek::left( loc, memory.data<Cell>() );
+        NEXT;
     SEEK_RIGHT:
         if ( DEBUG ) std::cout << "SEEK_RIGHT" << std::endl;
+        loc = seek::right( loc, memory.data<Cell>() + memory.size() );
+        NEXT;
+    SEEK_LEFT_N:
+        if ( DEBUG ) std::cout << "SEEK_LEFT_N" << std::endl;
+        {
+            int stride = Encoding::operand( pc );
+            loc = seek::left( loc, memory.data<Cell>(), stride );
+        }
+        NEXT;
+    SEEK_RIGHT_N:
+        if ( DEBUG ) std::cout << "SEEK_RIGHT_N" << std::endl;
+        {
+            int stride = Encoding::operand( pc );
+            loc = seek::right( loc, memory.data<Cell>() + memory.size(), stride );
+        }
+        NEXT;
+    SET_AT:
+        if ( DEBUG ) std::cout << "SET_AT" << std::endl;
+        {
+            int offset = Encoding::operand( pc );
+            *( loc + offset ) = 0;
+        }
+        NEXT;
+    PUT_AT:
+        if ( DEBUG ) std::cout << "PUT_AT" << std::endl;
+        if ( SNAPSHOT && warm_start_pending ) goto WARM_START;
+        if ( SNAPSHOT && snapshot::pending() ) goto CHECKPOINT_BEFORE;
+        {
+            int offset = Encoding::operand( pc );
+            *out << static_cast<unsigned char>( *( loc + offset ) );
+        }
+        NEXT;
+    OPEN_AT:
+        if ( DEBUG ) std::cout << "OPEN_AT" << std::endl;
         {
-            while ( *loc ) {
-                loc += 1;
+            const Code * target = Encoding::target( pc );
+            loc += Encoding::trailing( pc );
+            if ( *loc == 0 ) {
+                pc = target;
+            }
+            NEXT;
+        }
+    CLOSE_AT:
+        if ( DEBUG ) std::cout << "CLOSE_AT" << std::endl;
+        {
+            const Code * target = Encoding::target( pc );
+            loc += Encoding::trailing( pc );
+            if ( *loc != 0 ) {
+                pc = target;
+                if ( SNAPSHOT && snapshot::pending() ) goto CHECKPOINT;
+            }
+            NEXT;
+        }
+    CHECKPOINT_BEFORE:
+        //  The instruction dispatched is run again, once the checkpoint is
+        //  taken or when the run is resumed.
+        if constexpr ( SNAPSHOT ) {
+            pc -= 1;
+        }
+    CHECKPOINT:
+        //  Between dispatches, with pc at the start of the loop or at the
+        //  instruction to run again.
+        if constexpr ( SNAPSHOT ) {
+            const snapshot::Request request = snapshot::take();
+            if ( not snapshots.checkpoint.empty() ) {
+                out->flush();
+                save( snapshots.checkpoint, pc - start, loc, input_read );
+                if ( request == snapshot::STOP ) {
+                    stopped_at_checkpoint = true;
+                    return;
+                }
             }
         }
-        goto *(pc++->opcode);
+        NEXT;
+    WARM_START:
+        //  The first input or output, which is run again from the snapshot,
+        //  before anything has been read.
+        if constexpr ( SNAPSHOT ) {
+            warm_start_pending = false;
+            pc -= 1;
+            save( snapshots.warm_start, pc - start, loc, 0 );
+        }
+        NEXT;
     HALT:
         if ( DEBUG ) std::cout << "DONE!" << std::endl;
+        if ( SNAPSHOT && snapshot::pending() ) goto CHECKPOINT_BEFORE;
+        if ( PROFILE ) counters->stop();
+        out->flush();
         return;
+
+        ////////////////////////////////////////////////////////////////////////
+        //  The cached-cell mode. Each uncached variant loads the cell and
+        //  carries on as the cached one, which works on cell rather than
+        //  *loc and writes it back before moving.
+        ////////////////////////////////////////////////////////////////////////
+
+    INCR_U:
+        cell = *loc;
+        goto INCR_C;
+    DECR_U:
+        cell = *loc;
+        goto DECR_C;
+    ADD_U:
+        cell = *loc;
+        goto ADD_C;
+    PUT_U:
+        cell = *loc;
+        goto PUT_C;
+    GET_U:
+        cell = *loc;
+        goto GET_C;
+    GET_BYTES_U:
+        cell = *loc;
+        goto GET_BYTES_C;
+    OPEN_U:
+        cell = *loc;
+        goto OPEN_C;
+    CLOSE_U:
+        cell = *loc;
+        goto CLOSE_C;
+    XFR_MULTIPLE_U:
+        cell = *loc;
+        goto XFR_MULTIPLE_C;
+    XFR_MULTI_N_U:
+        cell = *loc;
+        goto XFR_MULTI_N_C;
+    SEEK_LEFT_U:
+        cell = *loc;
+        goto SEEK_LEFT_C;
+    SEEK_RIGHT_U:
+        cell = *loc;
+        goto SEEK_RIGHT_C;
+    SEEK_LEFT_N_U:
+        cell = *loc;
+        goto SEEK_LEFT_N_C;
+    SEEK_RIGHT_N_U:
+        cell = *loc;
+        goto SEEK_RIGHT_N_C;
+
+    INCR_C:
+        if ( DEBUG ) std::cout << "INCR_C" << std::endl;
+        cell += 1;
+        NEXT;
+    DECR_C:
+        if ( DEBUG ) std::cout << "DECR_C" << std::endl;
+        cell -= 1;
+        NEXT;
+    ADD_C:
+        if ( DEBUG ) std::cout << "ADD_C" << std::endl;
+        cell += Encoding::operand( pc );
+        NEXT;
+    SET_ZERO_C:
+        if ( DEBUG ) std::cout << "SET_ZERO_C" << std::endl;
+        cell = 0;
+        NEXT;
+    RIGHT_C:
+        if ( DEBUG ) std::cout << "RIGHT_C" << std::endl;
+        *loc = cell;
+        loc += 1;
+        NEXT;
+    LEFT_C:
+        if ( DEBUG ) std::cout << "LEFT_C" << std::endl;
+        *loc = cell;
+        loc -= 1;
+        NEXT;
+    MOVE_C:
+        if ( DEBUG ) std::cout << "MOVE_C" << std::endl;
+        {
+            int n = Encoding::operand( pc );
+            *loc = cell;
+            loc += n;
+        }
+        NEXT;
+    PUT_C:
+        if ( DEBUG ) std::cout << "PUT_C" << std::endl;
+        *out << static_cast<unsigned char>( cell );
+        NEXT;
+    GET_C:
+        if ( DEBUG ) std::cout << "GET_C" << std::endl;
+        {
+            char ch = 0;
+            in->get( ch );
+            if ( in->good() ) {
+                cell = static_cast<unsigned char>( ch );
+            }
+        }
+        NEXT;
+    //  The first of the cells is the cached one.
+    GET_BYTES_C:
+        if ( DEBUG ) std::cout << "GET_BYTES_C" << std::endl;
+        {
+            int n = Encoding::operand( pc );
+            for ( int k = 0; k < n; k++ ) {
+                char ch = 0;
+                in->get( ch );
+                if ( in->good() ) {
+                    ( k == 0 ? cell : loc[ k ] ) = static_cast<unsigned char>( ch );
+                }
+            }
+        }
+        NEXT;
+    //  Each outcome has a dispatch of its own. Otherwise the compiler picks
+    //  the next pc with a conditional move, and every dispatch that follows
+    //  has to wait for the cell to be loaded.
+    OPEN_C:
+        if ( DEBUG ) std::cout << "OPEN_C" << std::endl;
+        {
+            const Code * target = Encoding::target( pc );
+            if ( cell == 0 ) {
+                pc = target;
+                NEXT;
+            }
+            NEXT;
+        }
+    CLOSE_C:
+        if ( DEBUG ) std::cout << "CLOSE_C" << std::endl;
+        {
+            const Code * target = Encoding::target( pc );
+            if ( cell != 0 ) {
+                pc = target;
+                NEXT;
+            }
+            NEXT;
+        }
+    //  The cell is zero after a transfer, and after a seek, so either way
+    //  it is left cached without being loaded.
+    XFR_MULTIPLE_C:
+        if ( DEBUG ) std::cout << "XFR_MULTIPLE_C" << std::endl;
+        {
+            struct Dyad d = Encoding::dyad( pc );
+            *( loc + d.operand1 ) += multiple( cell, d.operand2 );
+            cell = 0;
+        }
+        NEXT;
+    XFR_MULTI_N_C:
+        if ( DEBUG ) std::cout << "XFR_MULTI_N_C" << std::endl;
+        {
+            int count = Encoding::operand( pc );
+            for ( int k = 0; k < count; k++ ) {
+                struct Dyad d = Encoding::entry( pc );
+                *( loc + d.operand1 ) += multiple( cell, d.operand2 );
+            }
+            cell = 0;
+        }
+        NEXT;
+    SEEK_LEFT_C:
+        if ( DEBUG ) std::cout << "SEEK_LEFT_C" << std::endl;
+        *loc = cell;
+        loc = seek::left( loc, memory.data<Cell>() );
+        cell = 0;
+        NEXT;
+    SEEK_RIGHT_C:
+        if ( DEBUG ) std::cout << "SEEK_RIGHT_C" << std::endl;
+        *loc = cell;
+        loc = seek::right( loc, memory.data<Cell>() + memory.size() );
+        cell = 0;
+        NEXT;
+    SEEK_LEFT_N_C:
+        if ( DEBUG ) std::cout << "SEEK_LEFT_N_C" << std::endl;
+        {
+            int stride = Encoding::operand( pc );
+            *loc = cell;
+            loc = seek::left( loc, memory.data<Cell>(), stride );
+            cell = 0;
+        }
+        NEXT;
+    SEEK_RIGHT_N_C:
+        if ( DEBUG ) std::cout << "SEEK_RIGHT_N_C" << std::endl;
+        {
+            int stride = Encoding::operand( pc );
+            *loc = cell;
+            loc = seek::right( loc, memory.data<Cell>() + memory.size(), stride );
+            cell = 0;
+        }
+        NEXT;
+    //  These move, so the cell is written back first and then loaded from
+    //  its new place.
+    OPEN_AT_C:
+        *loc = cell;
+        goto OPEN_AT_U;
+    CLOSE_AT_C:
+        *loc = cell;
+        goto CLOSE_AT_U;
+    OPEN_AT_U:
+        if ( DEBUG ) std::cout << "OPEN_AT_U" << std::endl;
+        {
+            const Code * target = Encoding::target( pc );
+            loc += Encoding::trailing( pc );
+            cell = *loc;
+            if ( cell == 0 ) {
+                pc = target;
+                NEXT;
+            }
+            NEXT;
+        }
+    CLOSE_AT_U:
+        if ( DEBUG ) std::cout << "CLOSE_AT_U" << std::endl;
+        {
+            const Code * target = Encoding::target( pc );
+            loc += Encoding::trailing( pc );
+            cell = *loc;
+            if ( cell != 0 ) {
+                pc = target;
+                NEXT;
+            }
+            NEXT;
+        }
+    HALT_C:
+        *loc = cell;
+        goto HALT;
     }
 };
 
+typedef BasicEngine<uint8_t> Engine;
+
+//  Runs every job of a batch across the pool. Each distinct program is
+//  planted once and shared by all the workers, and each worker has an
+//  engine, and so a tape, of its own. The output of every job is captured
+//  and written out in the order of the manifest once all have finished,
+//  followed on the error stream by the reason for any failure. Returns the
+//  number of jobs that failed.
+template <typename Encoding, typename Cell = uint8_t>
+size_t runBatch(
+    const std::vector<batch::Job> & jobs,
+    const batch::Pool & pool,
+    const TapeOptions & tape,
+    const compile_cache::Cache & cache,
+    std::ostream & out = std::cout,
+    std::ostream & err = std::cerr
+) {
+    typedef BasicEngine<Cell> Engine;
+    typedef std::shared_ptr<const CompiledProgram<Encoding, CapturedOutput, StringInput, false, Cell>> Program;
+
+    std::map<std::string, size_t> program_numbers;
+    std::vector<std::string> programs;
+    for ( auto & job : jobs ) {
+        if ( program_numbers.emplace( job.program, programs.size() ).second ) {
+            programs.push_back( job.program );
+        }
+    }
+
+    std::vector<std::unique_ptr<Engine>> engines( pool.size() );
+    auto engineOf = [&]( size_t worker ) -> Engine & {
+        if ( not engines[ worker ] ) {
+            engines[ worker ] = std::make_unique<Engine>( tape, cache );
+        }
+        return *engines[ worker ];
+    };
+
+    //  Failures are reported against the job, so they are caught here
+    //  rather than abandoning the batch.
+    std::vector<Program> compiled( programs.size() );
+    std::vector<std::string> plant_errors( programs.size() );
+    pool.run( programs.size(), [&]( size_t worker, size_t p ) {
+        try {
+            if ( not std::ifstream( programs[ p ] ) ) {
+                throw std::runtime_error( "Cannot open " + programs[ p ] );
+            }
+            Engine & engine = engineOf( worker );
+            compiled[ p ] = engine.template compile<Encoding, CapturedOutput, StringInput>( programs[ p ] );
+        } catch ( const std::exception & e ) {
+            plant_errors[ p ] = e.what();
+        }
+    } );
+
+    std::vector<std::string> outputs( jobs.size() );
+    std::vector<std::string> errors( jobs.size() );
+    pool.run( jobs.size(), [&]( size_t worker, size_t j ) {
+        const size_t p = program_numbers.at( jobs[ j ].program );
+        try {
+            if ( not plant_errors[ p ].empty() ) {
+                throw std::runtime_error( plant_errors[ p ] );
+            }
+            std::string input;
+            if ( not jobs[ j ].input.empty() ) {
+                std::ifstream file( jobs[ j ].input, std::ios::binary );
+                if ( not file ) {
+                    throw std::runtime_error( "Cannot open " + jobs[ j ].input );
+                }
+                input.assign( std::istreambuf_iterator<char>( file ), std::istreambuf_iterator<char>() );
+            }
+            CapturedOutput captured;
+            StringInput in( std::move( input ) );
+            Engine & engine = engineOf( worker );
+            engine.run( *compiled[ p ], captured, in );
+            outputs[ j ] = captured.str();
+        } catch ( const std::exception & e ) {
+            errors[ j ] = e.what();
+        }
+    } );
+
+    size_t failures = 0;
+    for ( size_t j = 0; j < jobs.size(); j++ ) {
+        if ( jobs.size() > 1 ) {
+            err << "# Executing: " << jobs[ j ].program << std::endl;
+        }
+        out << outputs[ j ] << std::flush;
+        if ( not errors[ j ].empty() ) {
+            err << "# Failed: " << errors[ j ] << std::endl;
+            failures += 1;
+        }
+    }
+    return failures;
+}
+
+//  The benchmarking harness compiles this file into its own executable and
+//  supplies its own main.
+#ifndef CISC_THREADING_DEMO_NO_MAIN
+
 /*
 Each argument is the name of a Brainf*ck source file to be compiled into
-threaded coded and executed.
+threaded coded and executed. The option --compact selects the compact
+instruction encoding and --native compiles the program to native code,
+where the host supports it. The tape starts with --tape-size=N cells and grows
+on demand up to --max-tape-size=N cells. PUT and GET are buffered unless
+--unbuffered is given, in which case they use iostreams. Planted programs
+are kept in the compile cache (see compile_cache.hpp) unless --no-cache is
+given. With --profile=FILE the programs are run in the profiling
+instantiation of the engine, with --profile-cycles to time each handler,
+and the counts are written to FILE (see profile.hpp). With --cache-cell the
+wide encoding keeps the current cell in a register (see CellCacher), unless
+the program is profiled or run as native code. The cells are of 8 bits
+unless --cell-bits=16 or --cell-bits=32 is given; native code needs 8-bit
+cells, so wider ones are always interpreted.
+
+With --checkpoint=FILE a snapshot of the run is written to FILE on SIGUSR1,
+and on SIGTERM too before stopping with a failing exit status; --resume=FILE
+carries on from one. With --warm-start=FILE the run starts from FILE if it
+holds a snapshot of the program, and otherwise writes one there at the
+first input or output (see snapshot.hpp).
+
+With --batch=MANIFEST the jobs listed in the manifest (see batch.hpp) are
+run instead, across --jobs=N threads, by default one per core. Batch jobs
+are always interpreted, without --cache-cell, and the exit status is
+non-zero if any failed.
 */
 int main( int argc, char * argv[] ) {
     const std::vector<std::string_view> args(argv + 1, argv + argc);
+    std::vector<std::string_view> filenames;
+    bool compact = false;
+    bool native = false;
+    TapeOptions tape;
+    profile::ProfileOptions profiling;
+    bool buffered = true;
+    bool cached = true;
+    bool cache_cell = false;
+    int cell_bits = 8;
+    snapshot::SnapshotOptions snapshots;
+    std::string manifest;
+    size_t workers = std::thread::hardware_concurrency();
     for (auto arg : args) {
-        Engine engine;
-        engine.runFile( arg, args.size() > 1 );
+        if ( arg.substr( 0, 8 ) == "--batch=" ) {
+            manifest = arg.substr( 8 );
+        } else if ( arg.substr( 0, 7 ) == "--jobs=" ) {
+            workers = std::stoull( std::string( arg.substr( 7 ) ) );
+        } else if ( arg == "--unbuffered" ) {
+            buffered = false;
+        } else if ( arg == "--no-cache" ) {
+            cached = false;
+        } else if ( arg == "--compact" ) {
+            compact = true;
+        } else if ( arg == "--native" ) {
+            native = true;
+        } else if ( arg == "--cache-cell" ) {
+            cache_cell = true;
+        } else if ( arg.substr( 0, 12 ) == "--cell-bits=" ) {
+            cell_bits = std::stoi( std::string( arg.substr( 12 ) ) );
+            if ( cell_bits != 8 && cell_bits != 16 && cell_bits != 32 ) {
+                std::cerr << "Cells are of 8, 16 or 32 bits" << std::endl;
+                exit( EXIT_FAILURE );
+            }
+        } else if ( not tape.tryParse( arg ) && not profiling.tryParse( arg ) && not snapshots.tryParse( arg ) ) {
+            filenames.push_back( arg );
+        }
+    }
+    if ( not snapshots.checkpoint.empty() ) {
+        snapshot::installHandlers();
+    }
+    const compile_cache::Cache cache = cached ? compile_cache::Cache() : compile_cache::Cache::disabled();
+    //  Everything from here on is instantiated for the width of the cell.
+    auto runWith = [&]( auto width ) {
+        typedef decltype( width ) Cell;
+        if ( not manifest.empty() ) {
+            std::vector<batch::Job> jobs = batch::readManifest( manifest );
+            for ( auto filename : filenames ) {
+                jobs.push_back( { std::string( filename ), "" } );
+            }
+            const batch::Pool pool( workers );
+            const size_t failures = compact ?
+                runBatch<CompactEncoding, Cell>( jobs, pool, tape, cache ) :
+                runBatch<WideEncoding, Cell>( jobs, pool, tape, cache );
+            exit( failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE );
+        }
+        for (auto filename : filenames) {
+            BasicEngine<Cell> engine( tape, cache, profiling, cache_cell, snapshots );
+            if ( buffered ) {
+                BufferedOutput out;
+                BufferedInput in( STDIN_FILENO, &out );
+                if ( native ) {
+                    engine.runNativeFile( filename, filenames.size() > 1, out, in );
+                } else {
+                    engine.runFile( filename, filenames.size() > 1, compact, out, in );
+                }
+            } else if ( native ) {
+                engine.runNativeFile( filename, filenames.size() > 1 );
+            } else {
+                engine.runFile( filename, filenames.size() > 1, compact );
+            }
+            if ( engine.stopped() ) {
+                std::cerr << "# Stopped at a checkpoint: " << snapshots.checkpoint << std::endl;
+                exit( EXIT_FAILURE );
+            }
+        }
+        exit( EXIT_SUCCESS );
+    };
+    if ( cell_bits == 16 ) {
+        runWith( uint16_t() );
+    } else if ( cell_bits == 32 ) {
+        runWith( uint32_t() );
+    } else {
+        runWith( uint8_t() );
     }
-    exit( EXIT_SUCCESS );
 }
+
+#endif
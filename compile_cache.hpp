@@ -0,0 +1,170 @@
+/*
+An on-disk cache of planted programs, shared by the engines that compile
+their own source. The same handful of programs are run over and over, so
+rather than tokenise and plant them every time we keep the planted program
+as a binary image (see image.hpp) named after a hash of everything that
+determines it:
+
+    The engine, so engines with different instruction sets never collide
+    The compile flags that affect planting
+    The source itself
+    The build of the engine, so a rebuilt planter never sees stale images
+
+The cache lives in $THREADED_CODE_CACHE if that is set, otherwise in
+$XDG_CACHE_HOME/threaded_code_demo or ~/.cache/threaded_code_demo. Any
+failure to read or write the cache just means we plant as usual.
+*/
+
+#ifndef COMPILE_CACHE_HPP
+#define COMPILE_CACHE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include <unistd.h>
+
+#include "image.hpp"
+
+namespace compile_cache {
+
+//  A 64-bit FNV-1a hash, built up from several pieces. Each piece is
+//  followed by a separator so that ("ab", "c") and ("a", "bc") differ.
+class Key {
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+public:
+    Key & add( std::string_view bytes ) {
+        for ( unsigned char ch : bytes ) {
+            h = ( h ^ ch ) * 0x100000001b3ULL;
+        }
+        h = ( h ^ 0xff ) * 0x100000001b3ULL;
+        return *this;
+    }
+
+    std::string hex() const {
+        static const char digits[] = "0123456789abcdef";
+        std::string s( 16, '0' );
+        for ( int i = 0; i < 16; i++ ) {
+            s[ 15 - i ] = digits[ ( h >> ( 4 * i ) ) & 0xf ];
+        }
+        return s;
+    }
+};
+
+inline std::string readFile( const std::string & filename ) {
+    std::ifstream input( filename, std::ios::binary );
+    if ( not input ) {
+        throw std::runtime_error( "Cannot open file: " + filename );
+    }
+    std::stringstream contents;
+    contents << input.rdbuf();
+    return contents.str();
+}
+
+class Cache {
+    std::filesystem::path directory;    //  Empty when the cache is disabled.
+
+public:
+    //  The default cache directory, or an empty path if there is nowhere
+    //  sensible to put it.
+    static std::filesystem::path defaultDirectory() {
+        if ( const char * dir = std::getenv( "THREADED_CODE_CACHE" ) ) {
+            return dir;
+        } else if ( const char * xdg = std::getenv( "XDG_CACHE_HOME" ) ) {
+            return std::filesystem::path( xdg ) / "threaded_code_demo";
+        } else if ( const char * home = std::getenv( "HOME" ) ) {
+            return std::filesystem::path( home ) / ".cache" / "threaded_code_demo";
+        } else {
+            return {};
+        }
+    }
+
+    //  A cache that never hits and never stores.
+    static Cache disabled() {
+        return Cache( std::filesystem::path() );
+    }
+
+    explicit Cache( std::filesystem::path directory = defaultDirectory() ) :
+        directory( std::move( directory ) )
+    {}
+
+public:
+    bool enabled() const {
+        return not directory.empty();
+    }
+
+    //  The key for a program, given the engine, its compile flags and the
+    //  source. The build stamp is that of the file including this header.
+    static Key key( std::string_view engine, std::string_view flags, std::string_view source, std::string_view build = __DATE__ " " __TIME__ ) {
+        Key k;
+        k.add( engine ).add( flags ).add( build ).add( source );
+        return k;
+    }
+
+    std::filesystem::path path( std::string_view engine, const Key & key ) const {
+        return directory / ( std::string( engine ) + "-" + key.hex() + ".img" );
+    }
+
+    //  The cached image for the key, if there is one.
+    std::optional<std::string> lookup( std::string_view engine, const Key & key ) const {
+        if ( not enabled() ) {
+            return std::nullopt;
+        }
+        const std::string file = path( engine, key ).string();
+        if ( not image::Mapped::isImage( file ) ) {
+            return std::nullopt;
+        }
+        return file;
+    }
+
+    //  Stores an image for the key. The image is written to a temporary
+    //  file and renamed into place, so concurrent runs never see a
+    //  partial image. The temporary file is named after the process and a
+    //  count of the stores it has made, as the threads of a batch may store
+    //  the same key at once.
+    void store( std::string_view engine, const Key & key, const image::Writer & writer ) const {
+        if ( not enabled() ) {
+            return;
+        }
+        std::error_code ec;
+        std::filesystem::create_directories( directory, ec );
+        if ( ec ) {
+            return;
+        }
+        const std::filesystem::path file = path( engine, key );
+        static std::atomic<uint64_t> stores{ 0 };
+        const std::filesystem::path temp = file.string() + "." + std::to_string( getpid() ) + "." + std::to_string( stores++ ) + ".tmp";
+        {
+            std::ofstream out( temp, std::ios::binary );
+            if ( not out ) {
+                return;
+            }
+            try {
+                writer.write( out );
+            } catch ( const std::exception & ) {
+                out.setstate( std::ios::failbit );
+            }
+            out.close();
+            if ( out.fail() ) {
+                std::filesystem::remove( temp, ec );
+                return;
+            }
+        }
+        std::filesystem::rename( temp, file, ec );
+        if ( ec ) {
+            std::filesystem::remove( temp, ec );
+        }
+    }
+};
+
+} // namespace compile_cache
+
+#endif
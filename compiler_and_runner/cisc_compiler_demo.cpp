@@ -11,8 +11,12 @@ code from its execution. We introduce an intermediate JSON format.
 #include <stdexcept>
 #include <deque>
 #include <cstdlib>
+#include <set>
+#include <cstring>
 
 #include "json.hpp"
+#include "../image.hpp"
+#include "../source_view.hpp"
 
 using namespace nlohmann;
 
@@ -37,94 +41,9 @@ bool startsWith( std::string_view haystack, std::string_view needle ) {
     return haystack.rfind( needle, 0 ) == 0;
 }
 
-class PeekableProgramInput {
-    std::istream& input;                //  The source code to be read in.
-    std::deque< char > buffer;
-public:
-    PeekableProgramInput( std::istream& input ) :
-        input( input )
-    {}
-private:
-    std::optional<char> nextChar() {
-        for (;;) {
-            char ch = input.get();
-            if ( input.good() ) {
-                switch ( ch ) {
-                    case '>':
-                    case '<':
-                    case '+':
-                    case '-':
-                    case '.':
-                    case ',':
-                    case '[':
-                    case ']':
-                        return std::optional<char>( ch );
-                }
-            } else {
-                return std::nullopt;
-            }
-        }
-    }
-public:
-    std::optional<char> peekN( size_t n ) {
-        while ( this->buffer.size() <= n ) {
-            auto ch = nextChar();
-            return_unless( ch )( std::nullopt );
-            this->buffer.push_back( *ch );
-        }
-        return this->buffer[ n ];
-    }    
-public:
-    std::optional<char> peek() {
-        if ( this->buffer.empty() ) {
-            auto ch = nextChar();
-            if ( ch ) {
-                this->buffer.push_back( *ch );
-            }
-            return ch;
-        } else {
-            return this->buffer.front();
-        }
-    }
-public:
-    std::optional<char> pop() {
-        if ( this->buffer.empty() ) {
-            return nextChar();
-        } else {
-            char ch = this->buffer.front();
-            this->buffer.pop_front();
-            return ch;
-        }
-    }
-private:
-    void drop() {
-        if ( this->buffer.empty() ) {
-            input.get();
-        } else {
-            this->buffer.pop_front();
-        }
-    }
-public:
-    bool tryPop( char ch ) {
-        if ( this->peek() == ch ) {
-            this->drop();
-            return true;
-        } else {
-            return false;
-        }
-    }
-public:
-    bool tryPopString( std::string str ) {
-        int n = 0;
-        for ( auto ch : str ) {
-            auto actual = this->peekN( n );
-            return_if( actual != ch )( false );
-            n += 1;
-        }
-        this->buffer.erase( this->buffer.begin(), this->buffer.begin() + n );
-        return true;
-    }
-};
+bool endsWith( std::string_view haystack, std::string_view needle ) {
+    return haystack.size() >= needle.size() && haystack.compare( haystack.size() - needle.size(), needle.size(), needle ) == 0;
+}
 
 struct MoveAddMove {
     int lhs;
@@ -140,10 +59,6 @@ public:
     bool matches( int L, int N, int R ) {
         return L == this->lhs && N == this->by && R == this->rhs;
     }
-public:
-    bool isNonZeroBalanced() {
-        return ( this->lhs != 0 ) && ( ( this->lhs + this->rhs ) == 0 );
-    }
 };
 
 typedef struct OpCode {
@@ -159,20 +74,61 @@ typedef struct InstructionSet {
     OpCode ADD = { "ADD", false, true };
     OpCode ADD_OFFSET = { "ADD_OFFSET", false, false };
     OpCode XFR_MULTIPLE = { "XFR_MULTIPLE", false, false };
+    OpCode XFR_MULTI_N = { "XFR_MULTI_N", true, false };
     OpCode LEFT = { "LEFT", false, false };
     OpCode RIGHT = { "RIGHT", false, false };
     OpCode SEEK_LEFT = { "SEEK_LEFT", true, false };
     OpCode SEEK_RIGHT = { "SEEK_RIGHT", true, false };
+    OpCode SEEK_LEFT_N = { "SEEK_LEFT_N", true, false };
+    OpCode SEEK_RIGHT_N = { "SEEK_RIGHT_N", true, false };
     OpCode MOVE = { "MOVE", false, false };
     OpCode OPEN = { "OPEN", false, false };
     OpCode CLOSE = { "CLOSE", true, false };
     OpCode GET = { "GET", false, false };
     OpCode PUT = { "PUT", false, false };
+    //  The offset-addressed instructions of --offsets. The loop tests that
+    //  move first are the superinstructions that the runner already has.
+    OpCode SET_AT = { "SET_AT", false, false };
+    OpCode PUT_AT = { "PUT_AT", false, false };
+    OpCode MOVE_OPEN = { "MOVE+OPEN", false, false };
+    OpCode MOVE_CLOSE = { "MOVE+CLOSE", true, false };
+    //  Output of a byte known at compile time, planted by --constants, and
+    //  of a run of them from the data segment.
+    OpCode PUT_CHAR = { "PUT_CHAR", false, false };
+    OpCode PUT_BYTES = { "PUT_BYTES", false, false };
+    //  Reads into consecutive cells, for ,>,>,
+    OpCode GET_BYTES = { "GET_BYTES", false, false };
+    //  Follows HALT, so it is never run. Its operand is the length of the
+    //  data segment and the slots after it hold the bytes, eight to a slot.
+    OpCode DATA = { "DATA", false, false };
     OpCode HALT = { "HALT", false, false };
+    //  The superinstructions that cisc_runner_demo has fused handlers for.
+    //  OPEN and CLOSE may only appear last.
+    std::set<std::string> superinstructions = {
+        "DECR+CLOSE",
+        "INCR+CLOSE",
+        "LEFT+CLOSE",
+        "RIGHT+CLOSE",
+        "MOVE+CLOSE",
+        "LEFT+OPEN",
+        "RIGHT+OPEN",
+        "MOVE+OPEN",
+        "MOVE+DECR+CLOSE",
+        "DECR+RIGHT+CLOSE",
+        "MOVE+ADD+MOVE+CLOSE",
+        "ADD_OFFSET+ADD_OFFSET",
+        "ADD_OFFSET+MOVE",
+        "ADD_OFFSET+ADD_OFFSET+DECR+CLOSE",
+        "RIGHT+SEEK_LEFT",
+        "SEEK_LEFT+MOVE",
+        "XFR_MULTIPLE+MOVE",
+        "MOVE+XFR_MULTIPLE"
+    };
 } InstructionSet; 
 
 //  TODO: This should be moved to a chared header file.
 const char * OPCODE = "OpCode";
+const char * OPERAND = "Operand";
 
 typedef struct CompileFlags {
     bool deadCodeRemoval = true;
@@ -180,6 +136,16 @@ typedef struct CompileFlags {
     bool locIsZero = true;
     bool xfrMultiple = true;
     bool unplantSuperfluousCode = true;
+    bool offsets = true;                //  Offset-addressed basic blocks.
+    bool constants = true;              //  Known-value analysis and folding of the constant prefix.
+    std::string superinstructions;      //  A profile written by cisc_runner_demo --profile.
+    bool binary = false;                //  Emit a binary image rather than JSON.
+    int cellBits = 8;                   //  The width of the cells the program will be run with.
+
+    //  The values a cell can hold.
+    uint32_t cellMask() const {
+        return cellBits == 32 ? UINT32_MAX : ( uint32_t( 1 ) << cellBits ) - 1;
+    }
 
     void setDeadCode( bool enabled ) {
         this->deadCodeRemoval = enabled;
@@ -201,11 +167,21 @@ typedef struct CompileFlags {
         this->xfrMultiple = enabled;
     }
 
+    void setOffsets( bool enabled ) {
+        this->offsets = enabled;
+    }
+
+    void setConstants( bool enabled ) {
+        this->constants = enabled;
+    }
+
     void setAll( bool enabled ) {
         this->setDeadCode( enabled );
         this->setSeekZero( enabled );
         this->setPruneWhenLocIsZero( enabled );
         this->setXfrMultiple( enabled );
+        this->setOffsets( enabled );
+        this->setConstants( enabled );
     }
 
     void setArg( const std::string & arg, bool enable ) {
@@ -221,8 +197,21 @@ typedef struct CompileFlags {
             setPruneWhenLocIsZero( enable );
         } else if ( arg == "--xfrmultiple" ) {
             setXfrMultiple( enable );
+        } else if ( arg == "--offsets" ) {
+            setOffsets( enable );
+        } else if ( arg == "--constants" ) {
+            setConstants( enable );
         } else if ( arg == "--superfluous" ) {
             setUnplantSuperfluousCode( enable );
+        } else if ( arg == "--binary" ) {
+            this->binary = enable;
+        } else if ( startsWith( arg, "--superinstructions=" ) ) {
+            this->superinstructions = arg.substr( arg.find( '=' ) + 1 );
+        } else if ( startsWith( arg, "--cell-bits=" ) ) {
+            this->cellBits = std::stoi( arg.substr( arg.find( '=' ) + 1 ) );
+            if ( cellBits != 8 && cellBits != 16 && cellBits != 32 ) {
+                throw std::runtime_error( "Cells are of 8, 16 or 32 bits: " + arg );
+            }
         } else {
             std::string prefix( "--no-" );
             if ( startsWith( arg, prefix ) ) {    //  is it a prefix?
@@ -241,14 +230,87 @@ typedef struct CompileFlags {
     }
 } CompileFlags;
 
+//  Runs Brainf*ck code at compile time, on a part of the tape that is known
+//  exactly, for as long as the code neither reads input nor runs for too
+//  long. The tape is numbered from the cell that was current at the start,
+//  and its cells wrap around at the mask.
+class ConstantFolder {
+    size_t budget;                      //  The commands that may still be run.
+    uint32_t mask;
+
+public:
+    std::map<int, uint32_t> tape;       //  Cells not in the map are zero.
+    int at = 0;                         //  The current cell.
+    std::string output;
+
+    ConstantFolder( size_t budget, uint32_t mask ) : budget( budget ), mask( mask ) {}
+
+    //  Runs the code, which must be balanced. Returns false if it had to
+    //  stop, leaving the folder in no particular state.
+    bool run( const std::string & code ) {
+        std::vector<size_t> jumps( code.size() );
+        std::vector<size_t> opens;
+        for ( size_t i = 0; i < code.size(); i++ ) {
+            if ( code[ i ] == '[' ) {
+                opens.push_back( i );
+            } else if ( code[ i ] == ']' ) {
+                jumps[ i ] = opens.back();
+                jumps[ opens.back() ] = i;
+                opens.pop_back();
+            }
+        }
+        for ( size_t pc = 0; pc < code.size(); pc++ ) {
+            return_if( budget == 0 )( false );
+            budget -= 1;
+            switch ( code[ pc ] ) {
+                case '>': at += 1; break;
+                case '<': at -= 1; break;
+                case '+': tape[ at ] = ( tape[ at ] + 1 ) & mask; break;
+                case '-': tape[ at ] = ( tape[ at ] - 1 ) & mask; break;
+                case '.': output += static_cast<char>( tape[ at ] ); break;
+                case '[': if ( tape[ at ] == 0 ) pc = jumps[ pc ]; break;
+                case ']': if ( tape[ at ] != 0 ) pc = jumps[ pc ]; break;
+                default: return false;      //  Input depends on the run.
+            }
+            //  Moving off the start of the tape is left to fail at run time.
+            return_if( at < 0 )( false );
+        }
+        return true;
+    }
+};
+
 //  This class is responsible for translating the stream of source code
 //  into a vector<Instruction>. It is passed a mapping from characters
 //  to the addresses-of-labels, so it can plant (aka append) the exact
 //  pointer to the implementing code. 
+//
+//  With --offsets the moves of a basic block are not planted as they are
+//  read. Instead the planter keeps track of how far the current cell is
+//  from loc and plants ADD_OFFSET, SET_AT and PUT_AT for the cells in
+//  between. The net move is only planted at the end of the block, where
+//  MOVE+OPEN and MOVE+CLOSE combine it with the test, or ahead of an
+//  instruction that needs loc to be the current cell, such as a seek.
+//
+//  With --constants the planter also keeps track of the values of the cells
+//  that are known at each point in the program. It starts by running the
+//  program at compile time until it reads input (see ConstantFolder), and
+//  plants only the output and the tape that this leaves behind. After that
+//  a loop over a cell known to be zero is dead, and a known cell is output
+//  as a PUT_CHAR. Entering a loop, or seeking, loses what is known.
 class CodePlanter {
+    //  The commands that the constant prefix may run at compile time.
+    static constexpr size_t FOLD_BUDGET = 1 << 20;
+
     CompileFlags flags;
-    PeekableProgramInput input;         //  The source code to be read in, stripped of comment characters.
+    source_view::Cursor input;          //  The source code to be read in, stripped of comment characters.
     bool loc_is_zero = true;            //  True if, at this point in the program, the current location is guaranteed to be zero.
+    int pending = 0;                    //  The moves not yet planted: the current cell is loc + pending.
+    //  The values known at run time, numbered so that loc is here. Cells
+    //  not in the map are zero if all_known, and unknown otherwise.
+    std::map<int, std::optional<uint32_t>> known;
+    bool all_known;
+    int here = 0;
+    std::string data;                   //  The bytes that PUT_BYTES outputs.
     const InstructionSet & instruction_set;
     json & program; 
     std::vector<int> indexes;           //  Responsible for managing [ ... ] loops.
@@ -261,7 +323,8 @@ public:
         json& program 
     ) :
         flags( flags ),
-        input( input_stream ),
+        input( source_view::commandsOf( source_view::Source( input_stream ).text() ) ),
+        all_known( flags.constants ),
         instruction_set( instruction_set ), 
         program( program )
     {}
@@ -303,19 +366,71 @@ private:
         program.push_back( { { "High", hi }, { "Low", lo } } );
     }
 
+    std::optional<uint32_t> knownValue( int offset ) const {
+        auto it = known.find( here + offset );
+        return_if( it != known.end() )( it->second );
+        return_if( all_known )( 0 );
+        return std::nullopt;
+    }
+
+    //  The arithmetic is unsigned so that it wraps, whatever the width.
+    void addKnown( int offset, uint32_t n ) {
+        const std::optional<uint32_t> value = knownValue( offset );
+        known[ here + offset ] = value ? std::optional<uint32_t>( ( *value + n ) & flags.cellMask() ) : std::nullopt;
+    }
+
+    //  A cell as the signed amount that sets it when added to zero.
+    int32_t signedCell( uint32_t value ) const {
+        const uint32_t mask = flags.cellMask();
+        return value > mask / 2 ? static_cast<int32_t>( value - mask - 1 ) : static_cast<int32_t>( value );
+    }
+
+    //  Forgets everything known, except that the current cell is zero.
+    void forgetAllButZero() {
+        known.clear();
+        all_known = false;
+        if ( flags.constants ) {
+            known[ here + pending ] = 0;
+        }
+    }
+
+    //  Plants the moves of the block so far, making loc the current cell.
+    void plantPending() {
+        plantMOVE( pending );
+        pending = 0;
+    }
+
+    //  The loop is entered, and left, with the offset planted, so that its
+    //  body starts from loc. The jump is the final operand either way.
     void plantOPEN() {
-        plantOpCode( instruction_set.OPEN );
-        if ( DUMP ) std::cerr << "OPEN" << std::endl;
+        if ( pending != 0 ) {
+            if ( DUMP ) std::cerr << "MOVE+OPEN " << pending << std::endl;
+            plantOpCodeAndOperand( instruction_set.MOVE_OPEN, pending );
+            pending = 0;
+        } else {
+            if ( DUMP ) std::cerr << "OPEN" << std::endl;
+            plantOpCode( instruction_set.OPEN );
+        }
         //  If we are dealing with loops, we plant the absolute index of the
         //  operation in the program we want to jump to. This can be improved
         //  fairly easily.
         indexes.push_back( program.size() );
         program.push_back( nullptr );         //  Dummy value, will be overwritten.
+        //  The body is run again on whatever the last iteration left.
+        known.clear();
+        all_known = false;
     }
 
     void plantCLOSE() {
-        if ( DUMP ) std::cerr << "CLOSE" << std::endl;
-        plantOpCode( instruction_set.CLOSE );
+        const OpCode & close = pending != 0 ? instruction_set.MOVE_CLOSE : instruction_set.CLOSE;
+        if ( pending != 0 ) {
+            if ( DUMP ) std::cerr << "MOVE+CLOSE " << pending << std::endl;
+            plantOpCodeAndOperand( close, pending );
+            pending = 0;
+        } else {
+            if ( DUMP ) std::cerr << "CLOSE" << std::endl;
+            plantOpCode( close );
+        }
         //  If we are dealing with loops, we plant the absolute index of the
         //  operation in the program we want to jump to. This can be improved
         //  fairly easily.
@@ -323,30 +438,96 @@ private:
         int start = indexes.back();
         indexes.pop_back();
         program[ start ] = {{ "Operand", end + 1 }};     //  Overwrite the dummy value.
-        plantOperand( start + 1, instruction_set.CLOSE );
+        plantOperand( start + 1, close );
+        forgetAllButZero();
+    }
+
+    bool lastIs( size_t back, const OpCode & opcode ) const {
+        return program.size() >= back && program[ program.size() - back ].contains( OPCODE ) && program[ program.size() - back ][ OPCODE ] == opcode.name;
+    }
+
+    //  Output known at compile time. Consecutive bytes are gathered into a
+    //  single PUT_BYTES of the data segment, by rewriting the instruction
+    //  that was planted last; nothing can jump into the middle of it.
+    void plantPUT_CHAR( unsigned char ch ) {
+        if ( lastIs( 2, instruction_set.PUT_CHAR ) ) {
+            const unsigned char previous = program.back()[ OPERAND ].get<int>();
+            program.erase( program.end() - 2, program.end() );
+            if ( DUMP ) std::cerr << "PUT_BYTES offset=" << data.size() << std::endl;
+            plantOpCodeAndOperand( instruction_set.PUT_BYTES, data.size() );
+            plantOperand( 2, instruction_set.PUT_BYTES );
+            data += static_cast<char>( previous );
+        } else if ( lastIs( 3, instruction_set.PUT_BYTES ) ) {
+            program.back()[ OPERAND ] = program.back()[ OPERAND ].get<int64_t>() + 1;
+        } else {
+            if ( DUMP ) std::cerr << "PUT_CHAR " << int( ch ) << std::endl;
+            plantOpCodeAndOperand( instruction_set.PUT_CHAR, ch );
+            return;
+        }
+        data += static_cast<char>( ch );
     }
 
     void plantPUT() {
-        if ( DUMP ) std::cerr << "PUT" << std::endl;
-        plantOpCode( instruction_set.PUT );
+        if ( auto value = knownValue( pending ) ) {
+            plantPUT_CHAR( static_cast<unsigned char>( *value ) );
+        } else if ( pending != 0 ) {
+            if ( DUMP ) std::cerr << "PUT_AT " << pending << std::endl;
+            plantOpCodeAndOperand( instruction_set.PUT_AT, pending );
+        } else {
+            if ( DUMP ) std::cerr << "PUT" << std::endl;
+            plantOpCode( instruction_set.PUT );
+        }
     }
 
+    //  A run of reads into consecutive cells, such as ,>,>, is a single
+    //  GET_BYTES, after which the current cell is the last of them.
     void plantGET() {
-        if ( DUMP ) std::cerr << "GET" << std::endl;
-        plantOpCode( instruction_set.GET );
+        plantPending();
+        int n = 1;
+        while ( input.tryPopString( ">," ) ) {
+            n += 1;
+        }
+        for ( int k = 0; k < n; k++ ) {
+            known[ here + k ] = std::nullopt;
+        }
+        if ( n > 1 ) {
+            if ( DUMP ) std::cerr << "GET_BYTES n=" << n << std::endl;
+            plantOpCodeAndOperand( instruction_set.GET_BYTES, n );
+            pending = n - 1;
+            if ( not flags.offsets ) {
+                plantPending();
+            }
+        } else {
+            if ( DUMP ) std::cerr << "GET" << std::endl;
+            plantOpCode( instruction_set.GET );
+        }
     }
 
     void plantSEEK_LEFT() {
+        plantPending();
         if ( DUMP ) std::cerr << "SEEK_LEFT" << std::endl;
         plantOpCode( instruction_set.SEEK_LEFT );
+        forgetAllButZero();
     }
 
     void plantSEEK_RIGHT() {
+        plantPending();
         if ( DUMP ) std::cerr << "SEEK_RIGHT" << std::endl;
         plantOpCode( instruction_set.SEEK_RIGHT );
+        forgetAllButZero();
+    }
+
+    //  A seek with a stride, such as [>>>], planted with the stride as a
+    //  positive operand.
+    void plantSEEK_N( int n ) {
+        plantPending();
+        if ( DUMP ) std::cerr << ( n > 0 ? "SEEK_RIGHT_N " : "SEEK_LEFT_N " ) << abs( n ) << std::endl;
+        plantOpCodeAndOperand( n > 0 ? instruction_set.SEEK_RIGHT_N : instruction_set.SEEK_LEFT_N, abs( n ) );
+        forgetAllButZero();
     }
 
     void plantMOVE( int n ) {
+        here += n;
         if ( n == 1 ) {
             if ( DUMP ) std::cerr << "RIGHT" << std::endl;
             plantOpCode( instruction_set.RIGHT );
@@ -360,6 +541,11 @@ private:
     }
 
     void plantADD( int n ) {
+        if ( pending != 0 ) {
+            if ( n != 0 ) plantADD_OFFSET( pending, n );
+            return;
+        }
+        addKnown( 0, n );
         if ( n == 1 ) {
             if ( DUMP ) std::cerr << "INCR" << std::endl;
             plantOpCode( instruction_set.INCR);
@@ -404,16 +590,53 @@ private:
         if ( DUMP ) std::cerr << "ADD_OFFSET offset=" << offset << " by=" << by << std::endl;
         plantOpCode( instruction_set.ADD_OFFSET );
         plantDyad( offset, by );
+        addKnown( offset, by );
     }
 
     void plantXFR_MULTIPLE( int32_t offset, int32_t by ) {
+        plantPending();
         if ( DUMP ) std::cerr << "XFR_MULTIPLE offset=" << offset << " by=" << by << std::endl;
         plantOpCode( instruction_set.XFR_MULTIPLE );
         plantDyad( offset, by );
+        transferKnown( { { offset, by } } );
+    }
+
+    //  The transfer adds the current cell times each factor to its target,
+    //  and leaves the current cell zero.
+    void transferKnown( const std::vector<std::pair<int32_t, int32_t>> & targets ) {
+        const std::optional<uint32_t> value = knownValue( 0 );
+        for ( auto & [ offset, by ] : targets ) {
+            if ( value ) {
+                addKnown( offset, *value * static_cast<uint32_t>( by ) );
+            } else {
+                known[ here + offset ] = std::nullopt;
+            }
+        }
+        known[ here ] = 0;
+    }
+
+    //  Transfers the current cell to several others, each scaled by its own
+    //  factor. The table is planted as a count followed by (offset, factor)
+    //  pairs.
+    void plantXFR_MULTI_N( const std::vector<std::pair<int32_t, int32_t>> & targets ) {
+        plantPending();
+        if ( DUMP ) std::cerr << "XFR_MULTI_N n=" << targets.size() << std::endl;
+        plantOpCodeAndOperand( instruction_set.XFR_MULTI_N, targets.size() );
+        for ( auto & [ offset, by ] : targets ) {
+            if ( DUMP ) std::cerr << "    offset=" << offset << " by=" << by << std::endl;
+            plantDyad( offset, by );
+        }
+        transferKnown( targets );
     }
 
     void plantMoveAddMove( const MoveAddMove & mim ) {
-        if ( mim.by == 0 ) {
+        if ( flags.offsets ) {
+            //  The moves only change the offset, so the add is planted at
+            //  the cell it applies to.
+            pending += mim.lhs;
+            plantADD( mim.by );
+            pending += mim.rhs;
+        } else if ( mim.by == 0 ) {
             if ( mim.rhs == 0 ) {
                 plantMOVE( mim.lhs );
             } else if ( mim.lhs == 0 ) {
@@ -448,8 +671,14 @@ private:
     }
 
     void plantSetZero() {
-        if ( DUMP ) std::cerr << "SET_ZERO" << std::endl;
-        plantOpCode( instruction_set.SET_ZERO );
+        known[ here + pending ] = 0;
+        if ( pending != 0 ) {
+            if ( DUMP ) std::cerr << "SET_AT " << pending << std::endl;
+            plantOpCodeAndOperand( instruction_set.SET_AT, pending );
+        } else {
+            if ( DUMP ) std::cerr << "SET_ZERO" << std::endl;
+            plantOpCode( instruction_set.SET_ZERO );
+        }
     }
 
     MoveAddMove scanMoveAddMove( int initial ) {
@@ -459,11 +688,64 @@ private:
         return MoveAddMove( move_lhs, n, move_rhs );
     }
 
+    //  Looks ahead, without consuming anything, for the body of a transfer
+    //  loop following a '['. That is a loop that only moves and adds, ends
+    //  where it started and decrements the control cell by exactly one - so
+    //  it runs *loc times and adds *loc * factor to each target cell. 
+    //  Returns the length of the body including the ']', or zero if this 
+    //  is not a transfer loop.
+    size_t scanTransferLoop( std::vector<std::pair<int32_t, int32_t>> & targets ) {
+        std::map<int, int> deltas;
+        int offset = 0;
+        for ( size_t n = 0; ; n++ ) {
+            const char ch = input.peekN( n );
+            switch ( ch ) {
+                case '>':
+                    offset += 1;
+                    break;
+                case '<':
+                    offset -= 1;
+                    break;
+                case '+':
+                    deltas[ offset ] += 1;
+                    break;
+                case '-':
+                    deltas[ offset ] -= 1;
+                    break;
+                case ']':
+                    return_unless( offset == 0 && deltas[ 0 ] == -1 )( 0 );
+                    for ( auto & [ at, by ] : deltas ) {
+                        if ( at != 0 && by != 0 ) {
+                            targets.push_back( { at, by } );
+                        }
+                    }
+                    return n + 1;
+                default:
+                    //  A nested loop or I/O.
+                    return 0;
+            }
+        }
+    }
+
+    bool plantTransferLoop() {
+        std::vector<std::pair<int32_t, int32_t>> targets;
+        size_t n = scanTransferLoop( targets );
+        //  [-] is better handled as SET_ZERO.
+        return_if( n == 0 || targets.empty() )( false );
+        input.dropN( n );
+        if ( targets.size() == 1 ) {
+            plantXFR_MULTIPLE( targets[ 0 ].first, targets[ 0 ].second );
+        } else {
+            plantXFR_MULTI_N( targets );
+        }
+        return true;
+    }
+
     bool plantExpr() {
-        auto ch = input.pop();
-        return_unless( ch )( false );
+        char ch = input.pop();
+        return_if( ch == '\0' )( false );
 
-        switch ( *ch ) {
+        switch ( ch ) {
             case '+':
                 plantADD( scanAdd( 1 ) );
                 break;
@@ -478,14 +760,14 @@ private:
                 }
                 break;
             case '[':
-                if ( this->loc_is_zero && flags.deadCodeRemoval ) {
+                if ( flags.deadCodeRemoval && ( ( this->loc_is_zero && pending == 0 ) || knownValue( pending ) == 0 ) ) {
                     //  Putting comments inside [ ... ] when the location is 
                     //  known to be zero is a frequent feature of Brainf*ck 
                     //  programs. This enables us to delete the comment.
                     int nesting = 1;
                     for (;;) {
                         ch = input.pop();
-                        break_unless( ch );
+                        break_if( ch == '\0' );
                         if ( ch == '[' ) {
                             nesting += 1;
                         } else if ( ch == ']' ) {
@@ -493,18 +775,20 @@ private:
                         }
                         break_if( nesting == 0 );
                     }
-                } else {
+                } else if ( not ( flags.xfrMultiple && plantTransferLoop() ) ) {
                     MoveAddMove mim = scanMoveAddMove( 0 );
                     bool bump = mim.matches( 0, 1, 0 ) || mim.matches( 0, -1, 0 );
                     if ( bump && flags.locIsZero && input.tryPop( ']' ) ) {
-                        unplantBeforeSetZero();
+                        if ( pending == 0 ) {
+                            unplantBeforeSetZero();
+                        }
                         plantSetZero();
                     } else if ( flags.seekZero && mim.matches( 1, 0, 0 ) && input.tryPop( ']') ) {
                         plantSEEK_RIGHT();
                     } else if ( flags.seekZero && mim.matches( -1, 0, 0 ) && input.tryPop( ']') ) {
                         plantSEEK_LEFT();
-                    } else if ( flags.xfrMultiple && mim.isNonZeroBalanced() && input.tryPopString( "-]" ) ) {
-                        plantXFR_MULTIPLE( mim.lhs, mim.by );
+                    } else if ( flags.seekZero && mim.lhs != 0 && mim.matches( mim.lhs, 0, 0 ) && input.tryPop( ']') ) {
+                        plantSEEK_N( mim.lhs );
                     } else {
                         plantOPEN();
                         plantMoveAddMove( mim );
@@ -524,16 +808,251 @@ private:
         return true;
     }
 
+    //  The length of the next loop, including its brackets, or zero if it is
+    //  not closed.
+    size_t scanLoop() const {
+        int nesting = 0;
+        for ( size_t n = 0; ; n++ ) {
+            const char ch = input.peekN( n );
+            return_if( ch == '\0' )( 0 );
+            if ( ch == '[' ) {
+                nesting += 1;
+            } else if ( ch == ']' ) {
+                nesting -= 1;
+            }
+            return_if( nesting == 0 )( n + 1 );
+        }
+    }
+
+    //  Runs the commands of the program, a loop at a time, at compile time
+    //  until one would read input, then plants what they output and the
+    //  tape that they leave behind for the rest of the program. The loops are run whole, which works
+    //  out how many times they go round. The tape is zero to begin with, so
+    //  each cell is set by adding to it.
+    void plantConstantPrefix() {
+        ConstantFolder folder( FOLD_BUDGET, flags.cellMask() );
+        for (;;) {
+            const char ch = input.peek();
+            if ( ch == '[' ) {
+                //  A loop may stop part way, so it is run on a copy.
+                const size_t length = scanLoop();
+                break_if( length == 0 );
+                std::string code;
+                for ( size_t n = 0; n < length; n++ ) {
+                    code += input.peekN( n );
+                }
+                ConstantFolder next = folder;
+                break_unless( next.run( code ) );
+                folder = std::move( next );
+                input.dropN( length );
+            } else {
+                break_if( ch == '\0' || ch == ']' || ch == ',' || ( ch == '<' && folder.at == 0 ) );
+                break_unless( folder.run( std::string( 1, ch ) ) );
+                input.dropN( 1 );
+            }
+        }
+        for ( char ch : folder.output ) {
+            plantPUT_CHAR( static_cast<unsigned char>( ch ) );
+        }
+        //  Nothing can observe the tape that a program ends with.
+        return_if( input.atEnd() );
+        for ( auto & [ at, value ] : folder.tape ) {
+            if ( value != 0 ) {
+                plantADD_OFFSET( at, signedCell( value ) );
+            }
+        }
+        pending = folder.at;
+        if ( not flags.offsets ) {
+            plantPending();
+        }
+    }
+
 public:
     void plantProgram() {
+        if ( flags.constants ) {
+            plantConstantPrefix();
+        }
         while ( plantExpr() ) {}
+        //  The moves after the last block are never planted, as nothing can
+        //  observe them.
         plantOpCode( instruction_set.HALT );
+        plantDATA();
+    }
+
+    //  The data segment is laid out as operands, so that it survives fusing
+    //  and goes into an image as it is.
+    void plantDATA() {
+        return_if( data.empty() );
+        plantOpCodeAndOperand( instruction_set.DATA, data.size() );
+        for ( size_t i = 0; i < data.size(); i += sizeof( int64_t ) ) {
+            int64_t slot = 0;
+            memcpy( &slot, data.data() + i, std::min( sizeof( int64_t ), data.size() - i ) );
+            plantOperand( slot, instruction_set.DATA );
+        }
     }
 };
 
+//  This class is responsible for fusing runs of instructions into the 
+//  superinstructions of the runner, such as MOVE+ADD+MOVE+CLOSE. Only the
+//  n-grams that a profiling run found to be hot are fused. A fused 
+//  instruction takes the operands of its constituents in order.
+class SuperinstructionFuser {
+    const InstructionSet & instruction_set;
+    std::set<std::string> enabled;      //  The superinstructions to fuse.
+    size_t max_length = 1;              //  The longest enabled superinstruction.
+
+    struct Tagged {
+        std::string name;
+        size_t slot;                    //  Where the opcode was in the unfused program.
+        std::vector<json> operands;
+    };
+
+public:
+    SuperinstructionFuser( const InstructionSet & instruction_set, const json & profile ) :
+        instruction_set( instruction_set )
+    {
+        for ( auto & jngram : profile[ "NGrams" ] ) {
+            std::vector<std::string> ngram = jngram[ "OpCodes" ];
+            std::string name;
+            for ( auto & n : ngram ) {
+                name += ( name.empty() ? "" : "+" ) + n;
+            }
+            if ( instruction_set.superinstructions.count( name ) ) {
+                enabled.insert( name );
+                max_length = std::max( max_length, ngram.size() );
+            } else if ( DUMP ) {
+                std::cerr << "No superinstruction for " << name << std::endl;
+            }
+        }
+    }
+
+private:
+    //  These include MOVE+OPEN and MOVE+CLOSE, which --offsets plants.
+    static bool isJump( const std::string & name ) {
+        return endsWith( name, "OPEN" ) || endsWith( name, "CLOSE" );
+    }
+
+    std::vector<Tagged> decode( const json & program ) {
+        std::vector<Tagged> code;
+        for ( size_t i = 0; i < program.size(); i++ ) {
+            const json & slot = program[ i ];
+            if ( slot.contains( OPCODE ) ) {
+                code.push_back( { slot[ OPCODE ], i, {} } );
+            } else {
+                code.back().operands.push_back( slot );
+            }
+        }
+        return code;
+    }
+
+public:
+    json fuse( const json & program ) {
+        std::vector<Tagged> code = decode( program );
+
+        //  We must not fuse across an instruction that is jumped to.
+        std::set<size_t> targets;
+        for ( auto & t : code ) {
+            if ( isJump( t.name ) ) {
+                targets.insert( t.operands.back()[ OPERAND ].get<size_t>() );
+            }
+        }
+
+        //  Greedily fuse the longest enabled run at each position.
+        std::vector<Tagged> fused;
+        for ( size_t i = 0; i < code.size(); ) {
+            Tagged best = code[ i ];
+            size_t best_length = 1;
+            std::string name = code[ i ].name;
+            for ( size_t n = 2; n <= max_length && i + n <= code.size(); n++ ) {
+                break_if( isJump( code[ i + n - 2 ].name ) );
+                break_if( targets.count( code[ i + n - 1 ].slot ) );
+                name += "+" + code[ i + n - 1 ].name;
+                if ( enabled.count( name ) ) {
+                    best.name = name;
+                    best_length = n;
+                }
+            }
+            for ( size_t k = 1; k < best_length; k++ ) {
+                auto & operands = code[ i + k ].operands;
+                best.operands.insert( best.operands.end(), operands.begin(), operands.end() );
+            }
+            fused.push_back( best );
+            i += best_length;
+        }
+
+        //  Lay the program out again, renumbering the jump targets.
+        std::map<size_t, size_t> renumber;
+        size_t slot = 0;
+        for ( auto & t : fused ) {
+            renumber[ t.slot ] = slot;
+            slot += 1 + t.operands.size();
+        }
+        json result = json::array();
+        for ( auto & t : fused ) {
+            result.push_back( {{ OPCODE, t.name }} );
+            for ( size_t k = 0; k < t.operands.size(); k++ ) {
+                json operand = t.operands[ k ];
+                if ( isJump( t.name ) && k + 1 == t.operands.size() ) {
+                    operand[ OPERAND ] = renumber.at( operand[ OPERAND ].get<size_t>() );
+                }
+                result.push_back( operand );
+            }
+        }
+        return result;
+    }
+};
+
+//  Translates the JSON array of instructions into a binary image (see 
+//  image.hpp). The final operand of OPEN, CLOSE and any superinstruction
+//  ending in one of them is a jump.
+void writeImage( const json & program, int cell_bits, std::ostream & out ) {
+    image::Writer writer;
+    writer.cellBits( cell_bits );
+    bool jump = false;
+    for ( size_t i = 0; i < program.size(); i++ ) {
+        const json & slot = program[ i ];
+        if ( slot.contains( OPCODE ) ) {
+            const std::string name = slot[ OPCODE ];
+            writer.opcode( name );
+            jump = endsWith( name, "OPEN" ) || endsWith( name, "CLOSE" );
+        } else if ( slot.contains( OPERAND ) ) {
+            const bool last = i + 1 == program.size() || program[ i + 1 ].contains( OPCODE );
+            if ( jump && last ) {
+                writer.jump( slot[ OPERAND ] );
+            } else {
+                writer.operand( slot[ OPERAND ] );
+            }
+        } else {
+            writer.dyad( slot[ "High" ], slot[ "Low" ] );
+        }
+    }
+    writer.write( out );
+}
+
+//  Writes the JSON array of instructions. Cells other than 8 bits are
+//  recorded ahead of the instructions, and the runner drops them before
+//  it numbers the slots.
+void writeJSON( json program, int cell_bits, std::ostream & out ) {
+    if ( cell_bits != 8 ) {
+        program.insert( program.begin(), json::object( {{ "CellBits", cell_bits }} ) );
+    }
+    out << program.dump(4) << std::endl;
+}
+
+//  The benchmarking harness compiles this file into its own executable and
+//  supplies its own main.
+#ifndef CISC_COMPILER_DEMO_NO_MAIN
+
 /*
 Compiles Brainf*ck code on the standard input into a JSON array of 
-CISC instructions.
+CISC instructions, or a binary image with --binary. With --superinstructions=PROFILE the hot n-grams 
+recorded by `cisc_runner_demo --profile=PROFILE` are fused. The moves within a basic
+block are folded into offset-addressed instructions unless --no-offsets is given.
+Unless --no-constants is given, the start of the program that reads no input
+is run at compile time, and the cells known at compile time are not looked
+up at run time. With --cell-bits=16 or --cell-bits=32 that arithmetic wraps
+at the wider cells, and the width is recorded for the runner: in the header
+of an image, or ahead of the JSON instructions (see writeJSON).
 */
 int main( int argc, char * argv[] ) {
     std::vector<std::string> args(argv + 1, argv + argc);
@@ -542,6 +1061,18 @@ int main( int argc, char * argv[] ) {
     const InstructionSet instruction_set;
     CodePlanter planter( flags, std::cin, instruction_set, program );
     planter.plantProgram();
-    std::cout << program.dump(4) << std::endl;
+    if ( not flags.superinstructions.empty() ) {
+        std::ifstream input( flags.superinstructions.c_str(), std::ios::in );
+        json profile;
+        input >> profile;
+        program = SuperinstructionFuser( instruction_set, profile ).fuse( program );
+    }
+    if ( flags.binary ) {
+        writeImage( program, flags.cellBits, std::cout );
+    } else {
+        writeJSON( program, flags.cellBits, std::cout );
+    }
     exit( EXIT_SUCCESS );
 }
+
+#endif
@@ -21,7 +21,13 @@ method (Engine::runFile) fit on a single screen.
 #include <stdexcept>
 #include <deque>
 #include <cstdlib>
+#include <algorithm>
 
+#include "../seek.hpp"
+#include "../tape.hpp"
+#include "../buffered_io.hpp"
+#include "../image.hpp"
+#include "../profile.hpp"
 
 #include "json.hpp"
 
@@ -34,6 +40,8 @@ using namespace nlohmann;
 //  Syntactic sugar to emphasise the 'break'.
 #define break_if( E ) if ( E ) break
 #define break_unless( E ) if (!(E)) break
+#define continue_if( E ) if ( E ) continue
+#define continue_unless( E ) if (!(E)) continue
 
 //  Syntactic sugar to emphasise the 'return'. Usage:
 //      return_if( E );
@@ -45,6 +53,16 @@ template <typename T> int sgn(T val) {
     return (T(0) < val) - (val < T(0));
 };
 
+bool endsWith( std::string_view haystack, std::string_view needle ) {
+    return haystack.size() >= needle.size() && haystack.compare( haystack.size() - needle.size(), needle.size(), needle ) == 0;
+}
+
+//  OPEN, CLOSE and the superinstructions that end with them take a jump 
+//  target as their final operand.
+bool isJump( std::string_view name ) {
+    return endsWith( name, "OPEN" ) || endsWith( name, "CLOSE" );
+}
+
 //  We use the address of a label to play the role of an operation-code.
 typedef void * OpCode;
 
@@ -56,10 +74,11 @@ typedef struct Dyad {
 //  The instruction stream is mainly OpCodes but there are some
 //  integer arguments interspersed. Strictly speaking this makes this
 //  interpreter a hybrid between direct/indirect threading.
-typedef union {
+typedef union Instruction {
     OpCode opcode;
     int64_t operand;
     Dyad dyad;
+    union Instruction * target;         //  Jump target of OPEN and CLOSE.
 } Instruction;
 
 //  Horrible hack to more-or-less switch on string-literals.
@@ -77,16 +96,44 @@ typedef struct InstructionSet {
     OpCode ADD;
     OpCode ADD_OFFSET;
     OpCode XFR_MULTIPLE;
+    OpCode XFR_MULTI_N;
     OpCode LEFT;
     OpCode RIGHT;
     OpCode SEEK_LEFT;
     OpCode SEEK_RIGHT;
+    OpCode SEEK_LEFT_N;
+    OpCode SEEK_RIGHT_N;
     OpCode MOVE;
     OpCode OPEN;
     OpCode CLOSE;
     OpCode GET;
     OpCode PUT;
+    OpCode SET_AT;
+    OpCode PUT_AT;
+    OpCode PUT_CHAR;
+    OpCode PUT_BYTES;
+    OpCode GET_BYTES;
+    OpCode DATA;                        //  Never run, as it follows HALT.
     OpCode HALT;
+    //  Superinstructions, fused by cisc_compiler_demo --superinstructions.
+    OpCode DECR_CLOSE;
+    OpCode INCR_CLOSE;
+    OpCode LEFT_CLOSE;
+    OpCode RIGHT_CLOSE;
+    OpCode MOVE_CLOSE;
+    OpCode LEFT_OPEN;
+    OpCode RIGHT_OPEN;
+    OpCode MOVE_OPEN;
+    OpCode MOVE_DECR_CLOSE;
+    OpCode DECR_RIGHT_CLOSE;
+    OpCode MOVE_ADD_MOVE_CLOSE;
+    OpCode ADD_OFFSET_ADD_OFFSET;
+    OpCode ADD_OFFSET_MOVE;
+    OpCode ADD_OFFSET_ADD_OFFSET_DECR_CLOSE;
+    OpCode RIGHT_SEEK_LEFT;
+    OpCode SEEK_LEFT_MOVE;
+    OpCode XFR_MULTIPLE_MOVE;
+    OpCode MOVE_XFR_MULTIPLE;
 public:
     OpCode byName( const std::string & name ) const {
         switch ( hash( name.c_str() ) ) {
@@ -96,16 +143,43 @@ public:
             case hash( "ADD" ): return ADD;
             case hash( "ADD_OFFSET" ): return ADD_OFFSET;
             case hash( "XFR_MULTIPLE" ): return XFR_MULTIPLE;
+            case hash( "XFR_MULTI_N" ): return XFR_MULTI_N;
             case hash( "LEFT" ): return LEFT;
             case hash( "RIGHT" ): return RIGHT;
             case hash( "SEEK_LEFT" ): return SEEK_LEFT;
             case hash( "SEEK_RIGHT" ): return SEEK_RIGHT;
+            case hash( "SEEK_LEFT_N" ): return SEEK_LEFT_N;
+            case hash( "SEEK_RIGHT_N" ): return SEEK_RIGHT_N;
             case hash( "MOVE" ): return MOVE;
             case hash( "OPEN" ): return OPEN;
             case hash( "CLOSE" ): return CLOSE;
             case hash( "GET" ): return GET;
             case hash( "PUT" ): return PUT;
+            case hash( "SET_AT" ): return SET_AT;
+            case hash( "PUT_AT" ): return PUT_AT;
+            case hash( "PUT_CHAR" ): return PUT_CHAR;
+            case hash( "PUT_BYTES" ): return PUT_BYTES;
+            case hash( "GET_BYTES" ): return GET_BYTES;
+            case hash( "DATA" ): return DATA;
             case hash( "HALT" ): return HALT;
+            case hash( "DECR+CLOSE" ): return DECR_CLOSE;
+            case hash( "INCR+CLOSE" ): return INCR_CLOSE;
+            case hash( "LEFT+CLOSE" ): return LEFT_CLOSE;
+            case hash( "RIGHT+CLOSE" ): return RIGHT_CLOSE;
+            case hash( "MOVE+CLOSE" ): return MOVE_CLOSE;
+            case hash( "LEFT+OPEN" ): return LEFT_OPEN;
+            case hash( "RIGHT+OPEN" ): return RIGHT_OPEN;
+            case hash( "MOVE+OPEN" ): return MOVE_OPEN;
+            case hash( "MOVE+DECR+CLOSE" ): return MOVE_DECR_CLOSE;
+            case hash( "DECR+RIGHT+CLOSE" ): return DECR_RIGHT_CLOSE;
+            case hash( "MOVE+ADD+MOVE+CLOSE" ): return MOVE_ADD_MOVE_CLOSE;
+            case hash( "ADD_OFFSET+ADD_OFFSET" ): return ADD_OFFSET_ADD_OFFSET;
+            case hash( "ADD_OFFSET+MOVE" ): return ADD_OFFSET_MOVE;
+            case hash( "ADD_OFFSET+ADD_OFFSET+DECR+CLOSE" ): return ADD_OFFSET_ADD_OFFSET_DECR_CLOSE;
+            case hash( "RIGHT+SEEK_LEFT" ): return RIGHT_SEEK_LEFT;
+            case hash( "SEEK_LEFT+MOVE" ): return SEEK_LEFT_MOVE;
+            case hash( "XFR_MULTIPLE+MOVE" ): return XFR_MULTIPLE_MOVE;
+            case hash( "MOVE+XFR_MULTIPLE" ): return MOVE_XFR_MULTIPLE;
         };
         throw std::runtime_error( "Unrecognised opcode: " + name );
     }
@@ -119,16 +193,22 @@ class CodePlanter {
     const std::string filename;  
     const InstructionSet & instruction_set;
     std::vector<Instruction> & program; 
+    std::vector<std::string> & listing; //  The name of the opcode in each slot, empty for operands.
+    std::vector<size_t> jumps;          //  The operand slots of every OPEN and CLOSE.
+    size_t data = 0;                    //  The first slot of the data segment, if there is one.
+    bool jump_pending = false;          //  True if the last slot planted may be a jump operand.
 
 public:
     CodePlanter( 
         const std::string filename,
         const InstructionSet & instruction_set,
-        std::vector<Instruction> & program 
+        std::vector<Instruction> & program,
+        std::vector<std::string> & listing
     ) :
         filename( filename ),
         instruction_set( instruction_set ), 
-        program( program )
+        program( program ),
+        listing( listing )
     {}
 
 private:
@@ -138,21 +218,91 @@ private:
         int32_t low = joperand[ "Low" ];
         struct Dyad d = { .operand1=high, .operand2=low };
         program.push_back( { .dyad=d } );
+        listing.push_back( "" );
     }
 
     void plantOperand( const json & joperand ) {
         int64_t n = joperand[ "Operand" ];
         program.push_back( { .operand=n } );
+        listing.push_back( "" );
+    }
+
+    //  The jump target is the final operand of an instruction, which we 
+    //  only know once the next opcode arrives.
+    void noteJump() {
+        if ( jump_pending ) {
+            jumps.push_back( program.size() - 1 );
+            jump_pending = false;
+        }
     }
 
     void plantOpCode( const json & jopcode ) {
+        noteJump();
         const std::string name = jopcode[ "OpCode" ];
         OpCode opcode( instruction_set.byName( name ) );
         program.push_back( { opcode } );
+        listing.push_back( name );
+        jump_pending = isJump( name );
+        if ( name == "DATA" ) {
+            data = program.size() + 1;      //  After the length.
+        }
     }
 
-public:
-    void plantProgram() {
+    //  The compiler plants the absolute index of the instruction to jump
+    //  to. We rewrite these into direct pointers once the program is
+    //  complete and the vector can no longer reallocate.
+    void resolveJumps() {
+        Instruction * program_data = program.data();
+        for ( size_t j : jumps ) {
+            program[ j ].target = &program_data[ program[ j ].operand ];
+        }
+    }
+
+    //  Relocates a binary image in a single pass. The opcode table is
+    //  mapped onto our labels once, and because the jumps are tagged we can
+    //  resolve them as we go - the program is sized up front so it will 
+    //  not be reallocated.
+    void plantImage() {
+        image::Mapped mapped( filename );
+        std::vector<OpCode> relocations;
+        for ( auto name : mapped.opcodeNames() ) {
+            relocations.push_back( instruction_set.byName( std::string( name ) ) );
+        }
+        const size_t n = mapped.size();
+        const image::Tag * tags = mapped.tags();
+        const image::Slot * slots = mapped.slots();
+        program.resize( n + 1 );
+        listing.resize( n + 1 );
+        Instruction * program_data = program.data();
+        for ( size_t i = 0; i < n; i++ ) {
+            const image::Slot slot = slots[ i ];
+            switch ( tags[ i ] ) {
+                case image::OPCODE:
+                    program_data[ i ].opcode = relocations.at( slot.opcode );
+                    listing[ i ] = mapped.opcodeNames()[ slot.opcode ];
+                    if ( listing[ i ] == "DATA" ) {
+                        data = i + 2;
+                    }
+                    break;
+                case image::OPERAND:
+                    program_data[ i ].operand = slot.operand;
+                    break;
+                case image::DYAD:
+                    program_data[ i ].dyad = { .operand1=slot.dyad.high, .operand2=slot.dyad.low };
+                    break;
+                case image::JUMP:
+                    program_data[ i ].target = &program_data[ slot.operand ];
+                    jumps.push_back( i );
+                    break;
+                case image::REFERENCE:
+                    throw std::runtime_error( "Unexpected reference in image: " + filename );
+            }
+        }
+        program_data[ n ].opcode = instruction_set.HALT;
+        listing[ n ] = "HALT";
+    }
+
+    void plantJSON() {
         std::ifstream input( filename.c_str(), std::ios::in );
         json jprogram;
         input >> jprogram;
@@ -164,28 +314,197 @@ public:
             } else if ( i.contains( "High" ) ) {
                 plantDyad( i );
             }
+            //  CellBits takes no slot (see cellBitsOf).
         }
+        noteJump();
         program.push_back( { instruction_set.HALT } );
+        listing.push_back( "HALT" );
+        resolveJumps();
+    }
+
+public:
+    //  The width of the cells the program was compiled for. In JSON it is
+    //  recorded ahead of the instructions, if it is not 8 bits, so only the
+    //  first element need be read.
+    static int cellBitsOf( const std::string & filename ) {
+        if ( image::Mapped::isImage( filename ) ) {
+            return static_cast<int>( image::Mapped( filename ).cellBits() );
+        }
+        std::ifstream input( filename.c_str(), std::ios::in );
+        std::string first;
+        std::getline( input, first, '}' );
+        const size_t open = first.find( '{' );
+        return_if( open == std::string::npos )( 8 );
+        return json::parse( first.substr( open ) + "}" ).value( "CellBits", 8 );
+    }
+
+    //  The program may be either a binary image or the JSON debug format.
+    void plantProgram() {
+        if ( image::Mapped::isImage( filename ) ) {
+            plantImage();
+        } else {
+            plantJSON();
+        }
+    }
+
+public:
+    //  The bytes of the data segment that PUT_BYTES outputs, which are only
+    //  in place once the program is complete.
+    const char * dataSegment() const {
+        return reinterpret_cast<const char *>( program.data() + data );
+    }
+
+    //  The slots that OPEN and CLOSE may jump to.
+    std::vector<bool> jumpTargets() const {
+        std::vector<bool> targets( program.size() );
+        for ( size_t j : jumps ) {
+            targets[ program[ j ].target - program.data() ] = true;
+        }
+        return targets;
+    }
+};
+
+//  Counts how often each instruction of the program is dispatched, and
+//  optionally its cycles (see profile.hpp). From the counts we also recover
+//  the hottest straight-line opcode n-grams, which are the candidates for
+//  fusing into superinstructions (see the --superinstructions option of
+//  cisc_compiler_demo).
+class DispatchProfile {
+    const Instruction * program_data;
+    const std::vector<std::string> & listing;
+    const std::vector<bool> targets;
+    profile::Counters counters;
+
+public:
+    DispatchProfile( 
+        const std::vector<Instruction> & program,
+        const std::vector<std::string> & listing,
+        const std::vector<bool> targets,
+        bool timed
+    ) :
+        program_data( program.data() ),
+        listing( listing ),
+        targets( targets ),
+        counters( program.size(), timed )
+    {}
+
+public:
+    void count( const Instruction * pc ) {
+        counters.count( pc - program_data );
+    }
+
+    void stop() {
+        counters.stop();
+    }
+
+private:
+    //  Control cannot fall through to the next instruction, so an n-gram 
+    //  must stop here.
+    static bool isBranch( const std::string & name ) {
+        return isJump( name ) || name == "HALT";
+    }
+
+    size_t nextOpCode( size_t i ) const {
+        do {
+            i += 1;
+        } while ( i < listing.size() && listing[ i ].empty() );
+        return i;
+    }
+
+public:
+    //  An n-gram starting at slot i executes exactly as often as slot i, 
+    //  provided no branch leaves it early and no jump enters it part way.
+    json hottest( size_t max_length, size_t limit ) const {
+        std::map< std::vector<std::string>, uint64_t > ngrams;
+        for ( size_t i = 0; i < listing.size(); i = nextOpCode( i ) ) {
+            continue_unless( counters.countOf( i ) > 0 );
+            std::vector<std::string> ngram = { listing[ i ] };
+            size_t j = i;
+            while ( ngram.size() < max_length && not isBranch( listing[ j ] ) ) {
+                j = nextOpCode( j );
+                break_if( j >= listing.size() || targets[ j ] );
+                ngram.push_back( listing[ j ] );
+                ngrams[ ngram ] += counters.countOf( i );
+            }
+        }
+        std::vector< std::pair< std::vector<std::string>, uint64_t > > sorted( ngrams.begin(), ngrams.end() );
+        std::stable_sort( 
+            sorted.begin(), sorted.end(), 
+            []( auto & a, auto & b ) { return a.second > b.second; } 
+        );
+        json jngrams = json::array();
+        for ( auto & [ ngram, n ] : sorted ) {
+            break_if( jngrams.size() >= limit );
+            jngrams.push_back( {{ "OpCodes", ngram }, { "Count", n }} );
+        }
+        return jngrams;
+    }
+
+    void write( const std::string & filename ) const {
+        profile::write( filename, counters, profile::sitesOf( listing ), "\"NGrams\": " + hottest( 4, 32 ).dump() );
     }
 };
 
 typedef unsigned char num;
 
+//  The multiple of a cell that a transfer adds, wrapped to the width of the
+//  cell. It is worked out unsigned, as a 16-bit cell would otherwise be
+//  promoted to int and the product could overflow.
+template <typename Cell>
+inline Cell multiple( Cell n, int32_t by ) {
+    typedef std::conditional_t<( sizeof( Cell ) < sizeof( unsigned ) ), unsigned, Cell> Wide;
+    return static_cast<Cell>( static_cast<Wide>( n ) * static_cast<Wide>( by ) );
+}
+
+//  Dispatches to the next instruction. The profiling instantiation of the 
+//  engine counts the instruction first; otherwise this compiles away.
+#define NEXT { if ( PROFILE ) profile->count( pc ); goto *(pc++->opcode); }
+
+//  The cells are of the width the program was compiled for (see the
+//  --cell-bits option of cisc_compiler_demo), so the tape is only made once
+//  the program says what that is.
 class Engine {
     std::map<char, OpCode> opcode_map;
     std::map<std::string, OpCode> extra_opcodes_map;
     std::vector<Instruction> program;
-    std::vector<num> memory;
+    std::vector<std::string> listing;
+    TapeOptions tape;
 public:
-    Engine() : 
-        memory( 30000 )
+    Engine( const TapeOptions & tape = TapeOptions() ) : 
+        tape( tape )
     {}
 
 public:
-    void runFile( const std::string filename, bool header_needed ) {
+    //  If a profile is wanted, the program is run in the profiling
+    //  instantiation and the counts and the hottest n-grams are written out
+    //  at HALT.
+    //  The streams may be the standard iostreams or the BufferedOutput and
+    //  BufferedInput of buffered_io.hpp.
+    template <typename OutStream = std::ostream, typename InStream = std::istream>
+    void runFile( const std::string filename, bool header_needed, const profile::ProfileOptions & profiling, OutStream & out = std::cout, InStream & in = std::cin ) {
         if ( header_needed ) {
             std::cerr << "# Executing: " << filename << std::endl;
         }
+        if ( profiling.enabled() ) {
+            runCells<true>( filename, profiling, out, in );
+        } else {
+            runCells<false>( filename, profiling, out, in );
+        }
+    }
+
+private:
+    template <bool PROFILE, typename OutStream, typename InStream>
+    void runCells( const std::string filename, const profile::ProfileOptions & profiling, OutStream & out, InStream & in ) {
+        switch ( CodePlanter::cellBitsOf( filename ) ) {
+            case 8: return runProgram<PROFILE, uint8_t>( filename, profiling, out, in );
+            case 16: return runProgram<PROFILE, uint16_t>( filename, profiling, out, in );
+            case 32: return runProgram<PROFILE, uint32_t>( filename, profiling, out, in );
+        }
+        throw std::runtime_error( "Cells are of 8, 16 or 32 bits: " + filename );
+    }
+
+    template <bool PROFILE, typename Cell, typename OutStream, typename InStream>
+    void runProgram( const std::string filename, const profile::ProfileOptions & profiling, OutStream & out, InStream & in ) {
 
         InstructionSet instruction_set;
         instruction_set.INCR = &&INCR;
@@ -196,24 +515,57 @@ public:
         instruction_set.CLOSE = &&CLOSE;
         instruction_set.PUT = &&PUT;
         instruction_set.GET = &&GET;
+        instruction_set.SET_AT = &&SET_AT;
+        instruction_set.PUT_AT = &&PUT_AT;
+        instruction_set.PUT_CHAR = &&PUT_CHAR;
+        instruction_set.PUT_BYTES = &&PUT_BYTES;
+        instruction_set.GET_BYTES = &&GET_BYTES;
+        instruction_set.DATA = &&HALT;
         instruction_set.ADD = &&ADD;
         instruction_set.MOVE = &&MOVE;
         instruction_set.SET_ZERO = &&SET_ZERO;
         instruction_set.ADD_OFFSET = &&ADD_OFFSET;
         instruction_set.XFR_MULTIPLE = &&XFR_MULTIPLE;
+        instruction_set.XFR_MULTI_N = &&XFR_MULTI_N;
         instruction_set.SEEK_LEFT = &&SEEK_LEFT;
         instruction_set.SEEK_RIGHT = &&SEEK_RIGHT;
+        instruction_set.SEEK_LEFT_N = &&SEEK_LEFT_N;
+        instruction_set.SEEK_RIGHT_N = &&SEEK_RIGHT_N;
         instruction_set.HALT = &&HALT;
+        instruction_set.DECR_CLOSE = &&DECR_CLOSE;
+        instruction_set.INCR_CLOSE = &&INCR_CLOSE;
+        instruction_set.LEFT_CLOSE = &&LEFT_CLOSE;
+        instruction_set.RIGHT_CLOSE = &&RIGHT_CLOSE;
+        instruction_set.MOVE_CLOSE = &&MOVE_CLOSE;
+        instruction_set.LEFT_OPEN = &&LEFT_OPEN;
+        instruction_set.RIGHT_OPEN = &&RIGHT_OPEN;
+        instruction_set.MOVE_OPEN = &&MOVE_OPEN;
+        instruction_set.MOVE_DECR_CLOSE = &&MOVE_DECR_CLOSE;
+        instruction_set.DECR_RIGHT_CLOSE = &&DECR_RIGHT_CLOSE;
+        instruction_set.MOVE_ADD_MOVE_CLOSE = &&MOVE_ADD_MOVE_CLOSE;
+        instruction_set.ADD_OFFSET_ADD_OFFSET = &&ADD_OFFSET_ADD_OFFSET;
+        instruction_set.ADD_OFFSET_MOVE = &&ADD_OFFSET_MOVE;
+        instruction_set.ADD_OFFSET_ADD_OFFSET_DECR_CLOSE = &&ADD_OFFSET_ADD_OFFSET_DECR_CLOSE;
+        instruction_set.RIGHT_SEEK_LEFT = &&RIGHT_SEEK_LEFT;
+        instruction_set.SEEK_LEFT_MOVE = &&SEEK_LEFT_MOVE;
+        instruction_set.XFR_MULTIPLE_MOVE = &&XFR_MULTIPLE_MOVE;
+        instruction_set.MOVE_XFR_MULTIPLE = &&MOVE_XFR_MULTIPLE;
         
-        CodePlanter planter( filename, instruction_set, program );
+        CodePlanter planter( filename, instruction_set, program, listing );
         planter.plantProgram();
 
+        std::unique_ptr<DispatchProfile> profile;
+        if ( PROFILE ) {
+            profile = std::make_unique<DispatchProfile>( program, listing, planter.jumpTargets(), profiling.cycles );
+        }
+
         std::noskipws( std::cin );
 
-        auto program_data = program.data();
-        Instruction * pc = &program_data[0];
-        num * loc = &memory.data()[0];
-        goto *(pc++->opcode);
+        Instruction * pc = program.data();
+        Tape memory( tape.size, tape.max_size, sizeof( Cell ) );
+        Cell * loc = memory.data<Cell>();
+        const char * data = planter.dataSegment();
+        NEXT;
 
         ////////////////////////////////////////////////////////////////////////
         //  Control flow does not reach this position! 
@@ -223,18 +575,18 @@ public:
     INCR:
         if ( DEBUG ) std::cout << "INCR" << std::endl;
         *loc += 1;
-        goto *(pc++->opcode);
+        NEXT;
     DECR:
         if ( DEBUG ) std::cout << "DECR" << std::endl;
         *loc -= 1;
-        goto *(pc++->opcode);
+        NEXT;
     ADD:
         if ( DEBUG ) std::cout << "ADD" << std::endl;
         {
             int n = pc++->operand;
             *loc += n;
         }
-        goto *(pc++->opcode);
+        NEXT;
     ADD_OFFSET:
         if ( DEBUG ) std::cout << "ADD_OFFSET" << std::endl;
         {
@@ -243,104 +595,379 @@ public:
             int32_t by = d.operand2;
             *( loc + offset ) += by;
         }
-        goto *(pc++->opcode);
+        NEXT;
     RIGHT:
         if ( DEBUG ) std::cout << "RIGHT" << std::endl;
         loc += 1;
-        goto *(pc++->opcode);
+        NEXT;
     LEFT:
         if ( DEBUG ) std::cout << "LEFT" << std::endl;
         loc -= 1;
-        goto *(pc++->opcode);
+        NEXT;
     MOVE:
         if ( DEBUG ) std::cout << "MOVE" << std::endl;
         {
             int n = pc++->operand;
             loc += n;
         }
-        goto *(pc++->opcode);
+        NEXT;
     PUT:
         if ( DEBUG ) std::cout << "PUT" << std::endl;
         {
-            num i = *loc;
-            std::cout << i;
+            num i = static_cast<num>( *loc );
+            out << i;
+        }
+        NEXT;
+    SET_AT:
+        if ( DEBUG ) std::cout << "SET_AT" << std::endl;
+        {
+            int offset = pc++->operand;
+            *( loc + offset ) = 0;
+        }
+        NEXT;
+    PUT_AT:
+        if ( DEBUG ) std::cout << "PUT_AT" << std::endl;
+        {
+            int offset = pc++->operand;
+            out << static_cast<num>( *( loc + offset ) );
         }
-        goto *(pc++->opcode);
+        NEXT;
+    PUT_CHAR:
+        if ( DEBUG ) std::cout << "PUT_CHAR" << std::endl;
+        {
+            num i = pc++->operand;
+            out << i;
+        }
+        NEXT;
+    PUT_BYTES:
+        if ( DEBUG ) std::cout << "PUT_BYTES" << std::endl;
+        {
+            int64_t offset = pc++->operand;
+            int64_t length = pc++->operand;
+            out.write( data + offset, length );
+        }
+        NEXT;
+    GET_BYTES:
+        if ( DEBUG ) std::cout << "GET_BYTES" << std::endl;
+        {
+            int n = pc++->operand;
+            for ( int k = 0; k < n; k++ ) {
+                char ch;
+                in.get( ch );
+                if ( in.good() ) {
+                    loc[ k ] = static_cast<num>( ch );
+                }
+            }
+        }
+        NEXT;
     GET:
         if ( DEBUG ) std::cout << "GET" << std::endl;
         {
             char ch;
-            std::cin.get( ch );
-            if (std::cin.good()) {
-                *loc = ch;
+            in.get( ch );
+            if (in.good()) {
+                *loc = static_cast<num>( ch );
             }
         }
-        goto *(pc++->opcode);
+        NEXT;
     OPEN:
         if ( DEBUG ) std::cout << "OPEN" << std::endl;
         {
-            int n = pc++->operand;
+            Instruction * target = pc++->target;
             if ( *loc == 0 ) {
-                pc = &program_data[n];
+                pc = target;
             }
-            goto *(pc++->opcode);
+            NEXT;
         }
     CLOSE:
         if ( DEBUG ) std::cout << "CLOSE" << std::endl;
         {
-            int n = pc++->operand;
+            Instruction * target = pc++->target;
             if ( *loc != 0 ) {
-                pc = &program_data[n];
+                pc = target;
             }
-            goto *(pc++->opcode);
+            NEXT;
         }
     SET_ZERO:
         if ( DEBUG ) std::cout << "SET_ZERO" << std::endl;
         *loc = 0;
-        goto *(pc++->opcode);
+        NEXT;
     XFR_MULTIPLE:
         if ( DEBUG ) std::cout << "XFR_MULTIPLE" << std::endl;
         {
             struct Dyad d = pc++->dyad;
             int offset = d.operand1;
             int by = d.operand2;
-            int n = *loc;
-            if ( DEBUG ) std::cout << "XFR_MULTIPLE offset=" << offset << " n=" << n << " by=" << by << std::endl;
-            *( loc + offset ) += n * by;
+            Cell n = *loc;
+            if ( DEBUG ) std::cout << "XFR_MULTIPLE offset=" << offset << " n=" << +n << " by=" << by << std::endl;
+            *( loc + offset ) += multiple( n, by );
             *loc = 0;
         }
-        goto *(pc++->opcode);
-    SEEK_LEFT:
-        if ( DEBUG ) std::cout << "SEEK_LEFT" << std::endl;
+        NEXT;
+    XFR_MULTI_N:
+        if ( DEBUG ) std::cout << "XFR_MULTI_N" << std::endl;
         {
-            while ( *loc ) {
-                loc -= 1;
+            int count = pc++->operand;
+            Cell n = *loc;
+            for ( int k = 0; k < count; k++ ) {
+                struct Dyad d = pc++->dyad;
+                *( loc + d.operand1 ) += multiple( n, d.operand2 );
             }
+            *loc = 0;
         }
-        goto *(pc++->opcode);
+        NEXT;
+    SEEK_LEFT:
+        if ( DEBUG ) std::cout << "SEEK_LEFT" << std::endl;
+        loc = seek::left( loc, memory.data<Cell>() );
+        NEXT;
     SEEK_RIGHT:
         if ( DEBUG ) std::cout << "SEEK_RIGHT" << std::endl;
+        loc = seek::right( loc, memory.data<Cell>() + memory.size() );
+        NEXT;
+    SEEK_LEFT_N:
+        if ( DEBUG ) std::cout << "SEEK_LEFT_N" << std::endl;
+        {
+            int stride = pc++->operand;
+            loc = seek::left( loc, memory.data<Cell>(), stride );
+        }
+        NEXT;
+    SEEK_RIGHT_N:
+        if ( DEBUG ) std::cout << "SEEK_RIGHT_N" << std::endl;
+        {
+            int stride = pc++->operand;
+            loc = seek::right( loc, memory.data<Cell>() + memory.size(), stride );
+        }
+        NEXT;
+
+        ////////////////////////////////////////////////////////////////////////
+        //  Superinstructions. Each executes its constituent instructions in 
+        //  order, taking their operands in order, with a single dispatch.
+        ////////////////////////////////////////////////////////////////////////
+
+    DECR_CLOSE:
+        if ( DEBUG ) std::cout << "DECR+CLOSE" << std::endl;
+        {
+            *loc -= 1;
+            Instruction * target = pc++->target;
+            if ( *loc != 0 ) {
+                pc = target;
+            }
+        }
+        NEXT;
+    INCR_CLOSE:
+        if ( DEBUG ) std::cout << "INCR+CLOSE" << std::endl;
+        {
+            *loc += 1;
+            Instruction * target = pc++->target;
+            if ( *loc != 0 ) {
+                pc = target;
+            }
+        }
+        NEXT;
+    LEFT_CLOSE:
+        if ( DEBUG ) std::cout << "LEFT+CLOSE" << std::endl;
+        {
+            loc -= 1;
+            Instruction * target = pc++->target;
+            if ( *loc != 0 ) {
+                pc = target;
+            }
+        }
+        NEXT;
+    RIGHT_CLOSE:
+        if ( DEBUG ) std::cout << "RIGHT+CLOSE" << std::endl;
+        {
+            loc += 1;
+            Instruction * target = pc++->target;
+            if ( *loc != 0 ) {
+                pc = target;
+            }
+        }
+        NEXT;
+    MOVE_CLOSE:
+        if ( DEBUG ) std::cout << "MOVE+CLOSE" << std::endl;
+        {
+            loc += pc++->operand;
+            Instruction * target = pc++->target;
+            if ( *loc != 0 ) {
+                pc = target;
+            }
+        }
+        NEXT;
+    LEFT_OPEN:
+        if ( DEBUG ) std::cout << "LEFT+OPEN" << std::endl;
+        {
+            loc -= 1;
+            Instruction * target = pc++->target;
+            if ( *loc == 0 ) {
+                pc = target;
+            }
+        }
+        NEXT;
+    RIGHT_OPEN:
+        if ( DEBUG ) std::cout << "RIGHT+OPEN" << std::endl;
+        {
+            loc += 1;
+            Instruction * target = pc++->target;
+            if ( *loc == 0 ) {
+                pc = target;
+            }
+        }
+        NEXT;
+    MOVE_OPEN:
+        if ( DEBUG ) std::cout << "MOVE+OPEN" << std::endl;
         {
-            while ( *loc ) {
-                loc += 1;
+            loc += pc++->operand;
+            Instruction * target = pc++->target;
+            if ( *loc == 0 ) {
+                pc = target;
+            }
+        }
+        NEXT;
+    MOVE_DECR_CLOSE:
+        if ( DEBUG ) std::cout << "MOVE+DECR+CLOSE" << std::endl;
+        {
+            loc += pc++->operand;
+            *loc -= 1;
+            Instruction * target = pc++->target;
+            if ( *loc != 0 ) {
+                pc = target;
             }
         }
-        goto *(pc++->opcode);
+        NEXT;
+    DECR_RIGHT_CLOSE:
+        if ( DEBUG ) std::cout << "DECR+RIGHT+CLOSE" << std::endl;
+        {
+            *loc -= 1;
+            loc += 1;
+            Instruction * target = pc++->target;
+            if ( *loc != 0 ) {
+                pc = target;
+            }
+        }
+        NEXT;
+    MOVE_ADD_MOVE_CLOSE:
+        if ( DEBUG ) std::cout << "MOVE+ADD+MOVE+CLOSE" << std::endl;
+        {
+            loc += pc++->operand;
+            *loc += static_cast<Cell>( pc++->operand );
+            loc += pc++->operand;
+            Instruction * target = pc++->target;
+            if ( *loc != 0 ) {
+                pc = target;
+            }
+        }
+        NEXT;
+    ADD_OFFSET_ADD_OFFSET:
+        if ( DEBUG ) std::cout << "ADD_OFFSET+ADD_OFFSET" << std::endl;
+        {
+            struct Dyad d1 = pc++->dyad;
+            struct Dyad d2 = pc++->dyad;
+            *( loc + d1.operand1 ) += static_cast<Cell>( d1.operand2 );
+            *( loc + d2.operand1 ) += static_cast<Cell>( d2.operand2 );
+        }
+        NEXT;
+    ADD_OFFSET_MOVE:
+        if ( DEBUG ) std::cout << "ADD_OFFSET+MOVE" << std::endl;
+        {
+            struct Dyad d = pc++->dyad;
+            *( loc + d.operand1 ) += static_cast<Cell>( d.operand2 );
+            loc += pc++->operand;
+        }
+        NEXT;
+    ADD_OFFSET_ADD_OFFSET_DECR_CLOSE:
+        if ( DEBUG ) std::cout << "ADD_OFFSET+ADD_OFFSET+DECR+CLOSE" << std::endl;
+        {
+            struct Dyad d1 = pc++->dyad;
+            struct Dyad d2 = pc++->dyad;
+            *( loc + d1.operand1 ) += static_cast<Cell>( d1.operand2 );
+            *( loc + d2.operand1 ) += static_cast<Cell>( d2.operand2 );
+            *loc -= 1;
+            Instruction * target = pc++->target;
+            if ( *loc != 0 ) {
+                pc = target;
+            }
+        }
+        NEXT;
+    RIGHT_SEEK_LEFT:
+        if ( DEBUG ) std::cout << "RIGHT+SEEK_LEFT" << std::endl;
+        {
+            loc += 1;
+            loc = seek::left( loc, memory.data<Cell>() );
+        }
+        NEXT;
+    SEEK_LEFT_MOVE:
+        if ( DEBUG ) std::cout << "SEEK_LEFT+MOVE" << std::endl;
+        {
+            loc = seek::left( loc, memory.data<Cell>() );
+            loc += pc++->operand;
+        }
+        NEXT;
+    XFR_MULTIPLE_MOVE:
+        if ( DEBUG ) std::cout << "XFR_MULTIPLE+MOVE" << std::endl;
+        {
+            struct Dyad d = pc++->dyad;
+            *( loc + d.operand1 ) += multiple( *loc, d.operand2 );
+            *loc = 0;
+            loc += pc++->operand;
+        }
+        NEXT;
+    MOVE_XFR_MULTIPLE:
+        if ( DEBUG ) std::cout << "MOVE+XFR_MULTIPLE" << std::endl;
+        {
+            loc += pc++->operand;
+            struct Dyad d = pc++->dyad;
+            *( loc + d.operand1 ) += multiple( *loc, d.operand2 );
+            *loc = 0;
+        }
+        NEXT;
+
     HALT:
         if ( DEBUG ) std::cout << "DONE!" << std::endl;
+        out.flush();
+        if ( PROFILE ) {
+            profile->stop();
+            profile->write( profiling.file );
+        }
         return;
     }
 };
 
+//  The benchmarking harness compiles this file into its own executable and
+//  supplies its own main.
+#ifndef CISC_RUNNER_DEMO_NO_MAIN
+
 /*
-Each argument is the name of a Brainf*ck source file to be compiled into
-threaded coded and executed.
+Each argument is the name of a binary image or JSON file of CISC 
+instructions to be executed. The option --profile=FILE runs the programs in the profiling 
+instantiation of the engine and writes the counts and the hottest opcode n-grams to FILE,
+and --profile-cycles times each handler too (see profile.hpp). Each program
+is run with cells of the width it was compiled for.
 */
 int main( int argc, char * argv[] ) {
     const std::vector<std::string> args(argv + 1, argv + argc);
+    std::vector<std::string> filenames;
+    profile::ProfileOptions profiling;
+    TapeOptions tape;
+    bool buffered = true;
     for (auto arg : args) {
-        Engine engine;
-        engine.runFile( arg, args.size() > 1 );
+        if ( arg == "--unbuffered" ) {
+            buffered = false;
+        } else if ( not tape.tryParse( arg ) && not profiling.tryParse( arg ) ) {
+            filenames.push_back( arg );
+        }
+    }
+    for (auto filename : filenames) {
+        Engine engine( tape );
+        if ( buffered ) {
+            BufferedOutput out;
+            BufferedInput in( STDIN_FILENO, &out );
+            engine.runFile( filename, filenames.size() > 1, profiling, out, in );
+        } else {
+            engine.runFile( filename, filenames.size() > 1, profiling );
+        }
     }
     exit( EXIT_SUCCESS );
 }
+
+#endif
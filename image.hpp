@@ -0,0 +1,290 @@
+/*
+A compact binary image of a planted program, the alternative to the JSON
+arrays that the compilers emit. An image is laid out as:
+
+    Header
+    The opcode names then the binding names, each followed by a NUL
+    The index of the first slot of each binding (8 bytes each)
+    One Tag per slot, padded to a multiple of 8 bytes
+    One 8-byte Slot per slot
+
+The program is the same sequence of slots as the JSON: an opcode slot
+holds an index into the opcode names, operand and dyad slots hold their
+values and jump slots hold the absolute index of the slot to jump to.
+Programs made of several named bindings, such as Brainforth's words,
+list them in the binding table and lay their slots out one after
+another; a reference slot holds the index of the binding it refers to.
+A CISC program has no bindings. The header records the width of the cells
+that the program was compiled for, which matters once the compiler has
+folded arithmetic at compile time; 0 is the usual 8 bits.
+Because every slot is tagged, a runner can relocate the opcodes into the
+addresses of its labels, and the jumps into pointers, in one linear pass
+without knowing how many operands each opcode takes.
+
+Images are mapped rather than read, so a runner only touches the pages
+it needs.
+*/
+
+#ifndef IMAGE_HPP
+#define IMAGE_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace image {
+
+constexpr char MAGIC[ 4 ] = { 'C', 'I', 'S', 'C' };
+constexpr uint32_t VERSION = 2;
+
+enum Tag : uint8_t {
+    OPCODE,
+    OPERAND,
+    DYAD,
+    JUMP,
+    REFERENCE
+};
+
+struct Header {
+    char magic[ 4 ];
+    uint32_t version;
+    uint32_t opcode_count;
+    uint32_t binding_count;
+    uint32_t names_size;                //  In bytes, including the NULs.
+    uint32_t cell_bits;                 //  0 for 8-bit cells.
+    uint64_t slot_count;
+};
+
+union Slot {
+    uint64_t opcode;                    //  An index into the opcode names.
+    int64_t operand;                    //  Also the target of a jump or a reference.
+    struct {
+        int32_t high;
+        int32_t low;
+    } dyad;
+};
+
+static_assert( sizeof( Slot ) == 8 );
+
+inline size_t padded( size_t n ) {
+    return ( n + 7 ) & ~size_t( 7 );
+}
+
+//  This class is responsible for building up an image slot by slot and
+//  then writing it out.
+class Writer {
+    std::vector<std::string> names;
+    std::map<std::string, uint64_t> indexes;
+    std::vector<std::string> binding_names;
+    std::map<std::string, uint64_t> binding_indexes;
+    std::vector<int64_t> binding_starts;
+    std::vector<std::pair<size_t, std::string>> references;    //  Resolved when written.
+    std::vector<Tag> tags;
+    std::vector<Slot> slots;
+    uint32_t cell_bits = 0;
+
+public:
+    //  The width of the cells the program must be run with.
+    void cellBits( uint32_t bits ) {
+        cell_bits = bits == 8 ? 0 : bits;
+    }
+
+    //  The slots that follow belong to the named binding.
+    void binding( const std::string & name ) {
+        if ( not binding_indexes.emplace( name, binding_names.size() ).second ) {
+            throw std::runtime_error( "Binding defined twice: " + name );
+        }
+        binding_names.push_back( name );
+        binding_starts.push_back( static_cast<int64_t>( slots.size() ) );
+    }
+
+    //  A reference to a binding, which may be defined later.
+    void reference( const std::string & name ) {
+        references.push_back( { slots.size(), name } );
+        Slot s;
+        s.operand = 0;
+        push( REFERENCE, s );
+    }
+
+    //  The index of the next slot to be written.
+    int64_t size() const {
+        return static_cast<int64_t>( slots.size() );
+    }
+
+    void opcode( const std::string & name ) {
+        auto it = indexes.find( name );
+        if ( it == indexes.end() ) {
+            it = indexes.emplace( name, names.size() ).first;
+            names.push_back( name );
+        }
+        Slot s;
+        s.opcode = it->second;
+        push( OPCODE, s );
+    }
+
+    void operand( int64_t n ) {
+        Slot s;
+        s.operand = n;
+        push( OPERAND, s );
+    }
+
+    void dyad( int32_t high, int32_t low ) {
+        Slot s;
+        s.dyad = { high, low };
+        push( DYAD, s );
+    }
+
+    void jump( int64_t target ) {
+        Slot s;
+        s.operand = target;
+        push( JUMP, s );
+    }
+
+private:
+    void push( Tag tag, Slot slot ) {
+        tags.push_back( tag );
+        slots.push_back( slot );
+    }
+
+public:
+    void write( std::ostream & out ) const {
+        std::vector<Slot> resolved( slots );
+        for ( auto & [ index, name ] : references ) {
+            auto it = binding_indexes.find( name );
+            if ( it == binding_indexes.end() ) {
+                throw std::runtime_error( "Reference to undefined binding: " + name );
+            }
+            resolved[ index ].operand = static_cast<int64_t>( it->second );
+        }
+        std::string block;
+        for ( auto & name : names ) {
+            block += name;
+            block += '\0';
+        }
+        for ( auto & name : binding_names ) {
+            block += name;
+            block += '\0';
+        }
+        Header header;
+        std::memcpy( header.magic, MAGIC, sizeof( MAGIC ) );
+        header.version = VERSION;
+        header.opcode_count = static_cast<uint32_t>( names.size() );
+        header.binding_count = static_cast<uint32_t>( binding_names.size() );
+        header.names_size = static_cast<uint32_t>( block.size() );
+        header.cell_bits = cell_bits;
+        header.slot_count = slots.size();
+        //  Pad the names so the slots are 8-byte aligned in the mapping.
+        block.resize( padded( sizeof( Header ) + block.size() ) - sizeof( Header ) );
+        const std::string padding( padded( tags.size() ) - tags.size(), '\0' );
+        out.write( reinterpret_cast<const char *>( &header ), sizeof( Header ) );
+        out.write( block.data(), block.size() );
+        out.write( reinterpret_cast<const char *>( binding_starts.data() ), binding_starts.size() * sizeof( int64_t ) );
+        out.write( reinterpret_cast<const char *>( tags.data() ), tags.size() );
+        out.write( padding.data(), padding.size() );
+        out.write( reinterpret_cast<const char *>( resolved.data() ), resolved.size() * sizeof( Slot ) );
+    }
+};
+
+//  A read-only mapping of an image file.
+class Mapped {
+    void * mapping = MAP_FAILED;
+    size_t length = 0;
+    const Header * header = nullptr;
+    std::vector<std::string_view> names;
+    std::vector<std::string_view> binding_names;
+    const int64_t * binding_data = nullptr;
+    const Tag * tag_data = nullptr;
+    const Slot * slot_data = nullptr;
+
+public:
+    explicit Mapped( const std::string & filename ) {
+        int fd = open( filename.c_str(), O_RDONLY );
+        if ( fd < 0 ) {
+            throw std::runtime_error( "Cannot open image: " + filename );
+        }
+        struct stat st;
+        if ( fstat( fd, &st ) == 0 ) {
+            length = static_cast<size_t>( st.st_size );
+            if ( length >= sizeof( Header ) ) {
+                mapping = mmap( nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0 );
+            }
+        }
+        close( fd );
+        if ( mapping == MAP_FAILED ) {
+            throw std::runtime_error( "Cannot map image: " + filename );
+        }
+        const char * base = static_cast<const char *>( mapping );
+        header = reinterpret_cast<const Header *>( base );
+        if ( std::memcmp( header->magic, MAGIC, sizeof( MAGIC ) ) != 0 || header->version != VERSION ) {
+            munmap( mapping, length );
+            throw std::runtime_error( "Not a version " + std::to_string( VERSION ) + " image: " + filename );
+        }
+        const char * name_data = base + sizeof( Header );
+        const size_t bindings_at = padded( sizeof( Header ) + header->names_size );
+        const size_t tags_at = bindings_at + header->binding_count * sizeof( int64_t );
+        const size_t slots_at = tags_at + padded( header->slot_count );
+        if ( slots_at + header->slot_count * sizeof( Slot ) > length ) {
+            munmap( mapping, length );
+            throw std::runtime_error( "Truncated image: " + filename );
+        }
+        uint32_t at = 0;
+        for ( uint32_t i = 0; i < header->opcode_count; i++ ) {
+            names.emplace_back( name_data + at );
+            at += static_cast<uint32_t>( names.back().size() + 1 );
+        }
+        for ( uint32_t i = 0; i < header->binding_count; i++ ) {
+            binding_names.emplace_back( name_data + at );
+            at += static_cast<uint32_t>( binding_names.back().size() + 1 );
+        }
+        binding_data = reinterpret_cast<const int64_t *>( base + bindings_at );
+        tag_data = reinterpret_cast<const Tag *>( base + tags_at );
+        slot_data = reinterpret_cast<const Slot *>( base + slots_at );
+    }
+
+    ~Mapped() {
+        munmap( mapping, length );
+    }
+
+    Mapped( const Mapped & ) = delete;
+    Mapped & operator=( const Mapped & ) = delete;
+
+public:
+    //  True if the file starts with the image magic number, which lets a
+    //  runner accept either an image or JSON.
+    static bool isImage( const std::string & filename ) {
+        char magic[ sizeof( MAGIC ) ] = {};
+        int fd = open( filename.c_str(), O_RDONLY );
+        if ( fd < 0 ) {
+            return false;
+        }
+        ssize_t n = read( fd, magic, sizeof( magic ) );
+        close( fd );
+        return n == sizeof( magic ) && std::memcmp( magic, MAGIC, sizeof( MAGIC ) ) == 0;
+    }
+
+    const std::vector<std::string_view> & opcodeNames() const { return names; }
+    const std::vector<std::string_view> & bindingNames() const { return binding_names; }
+
+    //  The index of the first slot of each binding. The slots of a binding
+    //  run up to the start of the next one, or the end of the image.
+    const int64_t * bindingStarts() const { return binding_data; }
+    size_t size() const { return header->slot_count; }
+    uint32_t cellBits() const { return header->cell_bits == 0 ? 8 : header->cell_bits; }
+    const Tag * tags() const { return tag_data; }
+    const Slot * slots() const { return slot_data; }
+};
+
+} // namespace image
+
+#endif
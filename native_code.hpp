@@ -0,0 +1,199 @@
+/*
+A tiny x86-64 code generator for the engines, which turns a planted
+program into native code in the style of context threading. The simplest
+instructions are inlined as one or two machine instructions, everything
+else becomes a call to a handler, and the loops become conditional
+branches of their own. So each [ and ] gets a history in the branch
+predictor rather than sharing the single indirect jump of its label.
+
+The generated code is a function taking the current location and an
+opaque context. Throughout, the location lives in rbx and the context in
+r12, both callee-saved, so they survive the calls to the handlers. A
+handler is passed the location, the context and a pointer to the operands
+that follow its opcode in the planted program, and returns the (possibly
+moved) location.
+
+Code is written into a private buffer which is only made executable once
+it is complete, so no page is ever writable and executable at once. Only
+x86-64 Linux is supported; elsewhere SUPPORTED is false and the engines
+fall back to their interpreters.
+*/
+
+#ifndef NATIVE_CODE_HPP
+#define NATIVE_CODE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <stdexcept>
+#include <vector>
+
+#include <sys/mman.h>
+
+namespace native_code {
+
+#if defined( __x86_64__ ) && defined( __linux__ )
+constexpr bool SUPPORTED = true;
+#else
+constexpr bool SUPPORTED = false;
+#endif
+
+typedef unsigned char cell;
+
+typedef void (*Entry)( cell * loc, void * context );
+typedef cell * (*Handler)( cell * loc, void * context, const void * operands );
+
+//  This class is responsible for building up the machine code of a single
+//  function, one abstract instruction at a time.
+class Assembler {
+    std::vector<uint8_t> code;
+
+public:
+    //  The offset of the next byte to be emitted, which is what branches
+    //  are patched to.
+    size_t size() const {
+        return code.size();
+    }
+
+    const std::vector<uint8_t> & bytes() const {
+        return code;
+    }
+
+public:
+    void prologue() {
+        //  push rbx; push r12; push r13 (which keeps the stack 16-byte
+        //  aligned for the calls); mov rbx, rdi; mov r12, rsi
+        emit( { 0x53, 0x41, 0x54, 0x41, 0x55 } );
+        emit( { 0x48, 0x89, 0xFB, 0x49, 0x89, 0xF4 } );
+    }
+
+    void epilogue() {
+        //  pop r13; pop r12; pop rbx; ret
+        emit( { 0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3 } );
+    }
+
+    //  *loc += by
+    void addCell( int by ) {
+        emit( { 0x80, 0x03, static_cast<uint8_t>( by ) } );
+    }
+
+    //  *( loc + offset ) += by
+    void addCellAt( int32_t offset, int by ) {
+        emit( { 0x80, 0x83 } );
+        emit32( offset );
+        emit( { static_cast<uint8_t>( by ) } );
+    }
+
+    //  *loc = 0
+    void zeroCell() {
+        emit( { 0xC6, 0x03, 0x00 } );
+    }
+
+    //  *( loc + offset ) = 0
+    void zeroCellAt( int32_t offset ) {
+        emit( { 0xC6, 0x83 } );
+        emit32( offset );
+        emit( { 0x00 } );
+    }
+
+    //  loc += by
+    void moveLoc( int32_t by ) {
+        if ( by >= -128 && by < 128 ) {
+            emit( { 0x48, 0x83, 0xC3, static_cast<uint8_t>( by ) } );
+        } else {
+            emit( { 0x48, 0x81, 0xC3 } );
+            emit32( by );
+        }
+    }
+
+    //  Branches if *loc is, or is not, zero. The target is not known yet,
+    //  so these return the position to patch.
+    size_t branchIfZero() {
+        return branch( 0x84 );
+    }
+
+    size_t branchUnlessZero() {
+        return branch( 0x85 );
+    }
+
+    void patch( size_t branch, size_t target ) {
+        const int32_t displacement = static_cast<int32_t>( target ) - static_cast<int32_t>( branch + 4 );
+        std::memcpy( &code[ branch ], &displacement, sizeof( displacement ) );
+    }
+
+    //  loc = handler( loc, context, operands )
+    void call( Handler handler, const void * operands ) {
+        emit( { 0x48, 0x89, 0xDF, 0x4C, 0x89, 0xE6 } );     //  mov rdi, rbx; mov rsi, r12
+        emit( { 0x48, 0xBA } );                             //  mov rdx, operands
+        emit64( reinterpret_cast<uint64_t>( operands ) );
+        emit( { 0x48, 0xB8 } );                             //  mov rax, handler
+        emit64( reinterpret_cast<uint64_t>( handler ) );
+        emit( { 0xFF, 0xD0, 0x48, 0x89, 0xC3 } );           //  call rax; mov rbx, rax
+    }
+
+private:
+    //  cmp byte [rbx], 0; followed by a jcc with a 32-bit displacement.
+    size_t branch( uint8_t condition ) {
+        emit( { 0x80, 0x3B, 0x00, 0x0F, condition } );
+        const size_t at = code.size();
+        emit32( 0 );
+        return at;
+    }
+
+    void emit( std::initializer_list<uint8_t> bytes ) {
+        code.insert( code.end(), bytes );
+    }
+
+    void emit32( int32_t n ) {
+        uint8_t bytes[ sizeof( n ) ];
+        std::memcpy( bytes, &n, sizeof( n ) );
+        code.insert( code.end(), bytes, bytes + sizeof( bytes ) );
+    }
+
+    void emit64( uint64_t n ) {
+        uint8_t bytes[ sizeof( n ) ];
+        std::memcpy( bytes, &n, sizeof( n ) );
+        code.insert( code.end(), bytes, bytes + sizeof( bytes ) );
+    }
+};
+
+//  The finished machine code, mapped read-only and executable.
+class Executable {
+    void * mapping = MAP_FAILED;
+    size_t length = 0;
+
+public:
+    explicit Executable( const Assembler & assembler ) :
+        length( assembler.size() )
+    {
+        if ( not SUPPORTED ) {
+            throw std::runtime_error( "Native code is not supported on this host" );
+        }
+        mapping = mmap( nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+        if ( mapping == MAP_FAILED ) {
+            throw std::runtime_error( "Cannot map native code" );
+        }
+        std::memcpy( mapping, assembler.bytes().data(), length );
+        if ( mprotect( mapping, length, PROT_READ | PROT_EXEC ) != 0 ) {
+            munmap( mapping, length );
+            throw std::runtime_error( "Cannot make native code executable" );
+        }
+    }
+
+    ~Executable() {
+        munmap( mapping, length );
+    }
+
+    Executable( const Executable & ) = delete;
+    Executable & operator=( const Executable & ) = delete;
+
+public:
+    Entry entry() const {
+        return reinterpret_cast<Entry>( mapping );
+    }
+};
+
+} // namespace native_code
+
+#endif
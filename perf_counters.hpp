@@ -0,0 +1,139 @@
+/*
+The hardware performance counters of the running thread, read with the
+perf_event_open system call of Linux.
+
+The counters say why one dispatch strategy is faster than another, which a
+time alone cannot: a strategy whose dispatches share a single indirect
+branch mispredicts far more often than one that has a branch per handler.
+These are counted:
+
+    cycles
+    instructions
+    branch-misses
+    L1-icache-load-misses
+
+Each is opened on its own, so that any the host has are counted even if it
+lacks the others. A virtual machine, or a kernel.perf_event_paranoid of 3
+or more, may provide none at all, in which case there is nothing to report
+and the runs go ahead uncounted. If the kernel has to share the hardware
+between more counters than it has, each count is scaled up from the time
+it was actually counting.
+*/
+
+#ifndef PERF_COUNTERS_HPP
+#define PERF_COUNTERS_HPP
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace perf_counters {
+
+class HardwareCounters {
+    struct Counter {
+        std::string name;
+        int fd;
+    };
+    std::vector<Counter> counters;      //  Only those that could be opened.
+
+public:
+    HardwareCounters() {
+#ifdef __linux__
+        const uint64_t L1I_READ_MISS = PERF_COUNT_HW_CACHE_L1I | ( PERF_COUNT_HW_CACHE_OP_READ << 8 ) | ( PERF_COUNT_HW_CACHE_RESULT_MISS << 16 );
+        open( "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES );
+        open( "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS );
+        open( "branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES );
+        open( "L1-icache-load-misses", PERF_TYPE_HW_CACHE, L1I_READ_MISS );
+#endif
+    }
+
+    ~HardwareCounters() {
+#ifdef __linux__
+        for ( auto & c : counters ) {
+            close( c.fd );
+        }
+#endif
+    }
+
+    HardwareCounters( const HardwareCounters & ) = delete;
+    HardwareCounters & operator=( const HardwareCounters & ) = delete;
+
+private:
+#ifdef __linux__
+    void open( const char * name, uint32_t type, uint64_t config ) {
+        struct perf_event_attr attr;
+        memset( &attr, 0, sizeof( attr ) );
+        attr.size = sizeof( attr );
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        const int fd = static_cast<int>( syscall( SYS_perf_event_open, &attr, 0, -1, -1, 0 ) );
+        if ( fd >= 0 ) {
+            counters.push_back( { name, fd } );
+        }
+    }
+#endif
+
+public:
+    //  True if there are any counters to report.
+    bool available() const {
+        return not counters.empty();
+    }
+
+    //  Starts counting from zero.
+    void start() {
+#ifdef __linux__
+        for ( auto & c : counters ) {
+            ioctl( c.fd, PERF_EVENT_IOC_RESET, 0 );
+            ioctl( c.fd, PERF_EVENT_IOC_ENABLE, 0 );
+        }
+#endif
+    }
+
+    void stop() {
+#ifdef __linux__
+        for ( auto & c : counters ) {
+            ioctl( c.fd, PERF_EVENT_IOC_DISABLE, 0 );
+        }
+#endif
+    }
+
+    //  The counts since the last start, by name.
+    std::vector<std::pair<std::string, double>> read() const {
+        std::vector<std::pair<std::string, double>> counts;
+#ifdef __linux__
+        for ( auto & c : counters ) {
+            uint64_t values[ 3 ];               //  The count, the time enabled and the time running.
+            if ( ::read( c.fd, values, sizeof( values ) ) != static_cast<ssize_t>( sizeof( values ) ) ) continue;
+            const double scale = values[ 2 ] == 0 ? 0.0 : static_cast<double>( values[ 1 ] ) / static_cast<double>( values[ 2 ] );
+            counts.emplace_back( c.name, static_cast<double>( values[ 0 ] ) * scale );
+        }
+#endif
+        return counts;
+    }
+
+    //  The counts as a JSON object, with a member for each counter.
+    std::string json() const {
+        std::string s;
+        for ( auto & [ name, count ] : read() ) {
+            s += ( s.empty() ? "" : ", " ) + ( "\"" + name + "\": " + std::to_string( static_cast<uint64_t>( count ) ) );
+        }
+        return s.empty() ? "{}" : "{ " + s + " }";
+    }
+};
+
+} // namespace perf_counters
+
+#endif
@@ -0,0 +1,228 @@
+/*
+Execution profiles for the profiling instantiations of the engines.
+
+An engine that is asked for a profile runs its program in a second
+instantiation of its dispatch loop, which counts every instruction as it
+is dispatched. The ordinary instantiation does not change at all, so it
+pays nothing for this. With --profile-cycles the timestamp counter is read
+at every dispatch as well, and the cycles since the previous dispatch are
+charged to the previous instruction. That includes the cost of the
+profiling itself, so the cycles are best compared with one another rather
+than taken as absolute.
+
+At HALT the engine writes the counts to the file given by --profile=FILE
+as JSON, by opcode and by instruction, and writes the same counts next to
+it in FILE.folded as the folded stacks that flamegraph.pl reads. The
+stacks are static: the enclosing word, if the engine has words, and the
+enclosing loops, each named after the position of its OPEN. Whatever
+hardware counters the host provides (see perf_counters.hpp) are read over
+the same run and reported as Hardware; like the cycles, they count the
+profiling as well as the program.
+*/
+
+#ifndef PROFILE_HPP
+#define PROFILE_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <x86intrin.h>
+#endif
+
+#include "perf_counters.hpp"
+
+namespace profile {
+
+//  The command-line options --profile=FILE and --profile-cycles, shared by
+//  all the engines.
+struct ProfileOptions {
+    std::string file;                   //  Empty unless profiling.
+    bool cycles = false;
+
+public:
+    bool enabled() const {
+        return not file.empty();
+    }
+
+    //  Returns true if the argument was a profile option.
+    bool tryParse( std::string_view arg ) {
+        const std::string_view option = "--profile=";
+        if ( arg.substr( 0, option.size() ) == option ) {
+            file = std::string( arg.substr( option.size() ) );
+            return true;
+        }
+        if ( arg == "--profile-cycles" ) {
+            cycles = true;
+            return true;
+        }
+        return false;
+    }
+};
+
+//  The timestamp counter where there is one, and a nanosecond clock
+//  elsewhere.
+inline uint64_t now() {
+#if defined( __x86_64__ ) || defined( __i386__ )
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>( std::chrono::steady_clock::now().time_since_epoch().count() );
+#endif
+}
+
+//  One slot of the profiled program, as the engine describes it.
+struct Site {
+    std::string opcode;                 //  Empty for a slot that holds an operand.
+    std::string frames;                 //  The enclosing word and loops, outermost first, separated by ';'.
+};
+
+//  The counts of a single run, by slot.
+class Counters {
+    std::vector<uint64_t> counts;
+    std::vector<uint64_t> cycles;
+    const bool timed;
+    size_t current = 0;                 //  The slot being timed, if started.
+    uint64_t started = 0;
+    perf_counters::HardwareCounters hardware;
+
+public:
+    Counters( size_t slots, bool timed ) :
+        counts( slots ),
+        cycles( timed ? slots : 0 ),
+        timed( timed )
+    {
+        hardware.start();
+    }
+
+public:
+    void count( size_t slot ) {
+        counts[ slot ] += 1;
+        if ( timed ) {
+            const uint64_t t = now();
+            if ( started != 0 ) {
+                cycles[ current ] += t - started;
+            }
+            current = slot;
+            started = t;
+        }
+    }
+
+    //  Charges the last instruction, at HALT.
+    void stop() {
+        hardware.stop();
+        if ( timed && started != 0 ) {
+            cycles[ current ] += now() - started;
+            started = 0;
+        }
+    }
+
+    bool isTimed() const { return timed; }
+    uint64_t countOf( size_t slot ) const { return counts[ slot ]; }
+    uint64_t cyclesOf( size_t slot ) const { return timed ? cycles[ slot ] : 0; }
+    size_t size() const { return counts.size(); }
+    const perf_counters::HardwareCounters & hardwareCounters() const { return hardware; }
+};
+
+//  The sites of a body of code given the name of the opcode in each slot,
+//  empty for an operand. Any opcode whose name ends in OPEN enters a loop
+//  and any whose name ends in CLOSE leaves one, which covers the fused
+//  instructions too.
+inline std::vector<Site> sitesOf( const std::vector<std::string> & listing, const std::string & word = "main", size_t first = 0 ) {
+    auto endsWith = []( const std::string & name, std::string_view suffix ) {
+        return name.size() >= suffix.size() && name.compare( name.size() - suffix.size(), suffix.size(), suffix ) == 0;
+    };
+    std::vector<Site> sites;
+    std::vector<std::string> frames = { word };
+    auto joined = [&]() {
+        std::string s;
+        for ( auto & f : frames ) {
+            s += s.empty() ? f : ";" + f;
+        }
+        return s;
+    };
+    for ( size_t i = 0; i < listing.size(); i++ ) {
+        const std::string & name = listing[ i ];
+        sites.push_back( { name, joined() } );
+        if ( endsWith( name, "CLOSE" ) && frames.size() > 1 ) {
+            frames.pop_back();
+        }
+        if ( endsWith( name, "OPEN" ) ) {
+            frames.push_back( "loop@" + std::to_string( first + i ) );
+        }
+    }
+    return sites;
+}
+
+//  Writes the report and the folded stacks. The extra text, if any, is
+//  added as further members of the JSON object, so it must be of the form
+//  "Name": value.
+inline void write( const std::string & filename, const Counters & counters, const std::vector<Site> & sites, const std::string & extra = "" ) {
+    //  The opcodes are identifiers and the frames are made of identifiers,
+    //  so nothing needs escaping.
+    struct Total {
+        uint64_t count = 0;
+        uint64_t cycles = 0;
+    };
+    std::map<std::string, Total> opcodes;
+    std::map<std::string, uint64_t> stacks;
+    for ( size_t i = 0; i < sites.size() && i < counters.size(); i++ ) {
+        if ( sites[ i ].opcode.empty() || counters.countOf( i ) == 0 ) continue;
+        Total & total = opcodes[ sites[ i ].opcode ];
+        total.count += counters.countOf( i );
+        total.cycles += counters.cyclesOf( i );
+        stacks[ sites[ i ].frames + ";" + sites[ i ].opcode ] += counters.isTimed() ? counters.cyclesOf( i ) : counters.countOf( i );
+    }
+
+    std::vector<std::pair<std::string, Total>> sorted( opcodes.begin(), opcodes.end() );
+    std::stable_sort( sorted.begin(), sorted.end(), [&]( auto & a, auto & b ) {
+        return counters.isTimed() ? a.second.cycles > b.second.cycles : a.second.count > b.second.count;
+    } );
+
+    std::ofstream output( filename.c_str(), std::ios::out );
+    if ( not output ) {
+        throw std::runtime_error( "Cannot write profile: " + filename );
+    }
+    auto measures = [&]( uint64_t count, uint64_t cycles ) {
+        std::string s = "\"Count\": " + std::to_string( count );
+        if ( counters.isTimed() ) {
+            s += ", \"Cycles\": " + std::to_string( cycles );
+        }
+        return s;
+    };
+    output << "{\n    \"Timed\": " << ( counters.isTimed() ? "true" : "false" ) << ",\n";
+    output << "    \"OpCodes\": [";
+    const char * separator = "\n";
+    for ( auto & [ name, total ] : sorted ) {
+        output << separator << "        { \"OpCode\": \"" << name << "\", " << measures( total.count, total.cycles ) << " }";
+        separator = ",\n";
+    }
+    output << "\n    ],\n    \"Instructions\": [";
+    separator = "\n";
+    for ( size_t i = 0; i < sites.size() && i < counters.size(); i++ ) {
+        if ( sites[ i ].opcode.empty() || counters.countOf( i ) == 0 ) continue;
+        output << separator << "        { \"PC\": " << i << ", \"OpCode\": \"" << sites[ i ].opcode << "\", \"Frames\": \"" << sites[ i ].frames << "\", " << measures( counters.countOf( i ), counters.cyclesOf( i ) ) << " }";
+        separator = ",\n";
+    }
+    output << "\n    ],\n    \"Hardware\": " << counters.hardwareCounters().json();
+    if ( not extra.empty() ) {
+        output << ",\n    " << extra;
+    }
+    output << "\n}" << std::endl;
+
+    std::ofstream folded( ( filename + ".folded" ).c_str(), std::ios::out );
+    for ( auto & [ stack, weight ] : stacks ) {
+        folded << stack << " " << weight << "\n";
+    }
+}
+
+} // namespace profile
+
+#endif
@@ -0,0 +1,184 @@
+/*
+Vectorised implementations of SEEK_LEFT and SEEK_RIGHT, shared by the
+engines. Rather than testing one cell per iteration we compare a whole
+vector of cells against zero and pick out the cells the seek visits from
+the resulting bit-mask. A stride-N seek such as [>>>] only visits every
+Nth cell, so we mask off the cells in between. The kernels work on cells
+of 8, 16 or 32 bits, comparing them at their own width.
+
+The vector loads never stray outside [start, end). Near either end of the
+tape we fall back to the original one-cell-at-a-time loop, which keeps the
+behaviour of running off the tape exactly as it was.
+*/
+
+#ifndef SEEK_HPP
+#define SEEK_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined( __AVX2__ ) || defined( __SSE2__ )
+#include <immintrin.h>
+#elif defined( __ARM_NEON ) && defined( __aarch64__ )
+#include <arm_neon.h>
+#endif
+
+namespace seek {
+
+typedef unsigned char cell;
+
+//  Bit i of a Mask corresponds to the i'th byte of a vector, so that a cell
+//  of several bytes has as many bits, which are all the same.
+typedef uint32_t Mask;
+
+#if defined( __AVX2__ )
+
+constexpr size_t WIDTH = 32;            //  In bytes.
+
+template <typename T>
+inline Mask zeros( const T * p ) {
+    __m256i v = _mm256_loadu_si256( reinterpret_cast<const __m256i *>( p ) );
+    __m256i z = _mm256_setzero_si256();
+    if constexpr ( sizeof( T ) == 1 ) {
+        return static_cast<Mask>( _mm256_movemask_epi8( _mm256_cmpeq_epi8( v, z ) ) );
+    } else if constexpr ( sizeof( T ) == 2 ) {
+        return static_cast<Mask>( _mm256_movemask_epi8( _mm256_cmpeq_epi16( v, z ) ) );
+    } else {
+        return static_cast<Mask>( _mm256_movemask_epi8( _mm256_cmpeq_epi32( v, z ) ) );
+    }
+}
+
+#elif defined( __SSE2__ )
+
+constexpr size_t WIDTH = 16;
+
+template <typename T>
+inline Mask zeros( const T * p ) {
+    __m128i v = _mm_loadu_si128( reinterpret_cast<const __m128i *>( p ) );
+    __m128i z = _mm_setzero_si128();
+    if constexpr ( sizeof( T ) == 1 ) {
+        return static_cast<Mask>( _mm_movemask_epi8( _mm_cmpeq_epi8( v, z ) ) );
+    } else if constexpr ( sizeof( T ) == 2 ) {
+        return static_cast<Mask>( _mm_movemask_epi8( _mm_cmpeq_epi16( v, z ) ) );
+    } else {
+        return static_cast<Mask>( _mm_movemask_epi8( _mm_cmpeq_epi32( v, z ) ) );
+    }
+}
+
+#elif defined( __ARM_NEON ) && defined( __aarch64__ )
+
+constexpr size_t WIDTH = 16;
+
+//  NEON has no movemask, so we weight each byte by its bit and add up
+//  each half of the vector.
+template <typename T>
+inline Mask zeros( const T * p ) {
+    static const uint8_t weights[ 16 ] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+    uint8x16_t eq;
+    if constexpr ( sizeof( T ) == 1 ) {
+        eq = vceqzq_u8( vld1q_u8( reinterpret_cast<const uint8_t *>( p ) ) );
+    } else if constexpr ( sizeof( T ) == 2 ) {
+        eq = vreinterpretq_u8_u16( vceqzq_u16( vld1q_u16( reinterpret_cast<const uint16_t *>( p ) ) ) );
+    } else {
+        eq = vreinterpretq_u8_u32( vceqzq_u32( vld1q_u32( reinterpret_cast<const uint32_t *>( p ) ) ) );
+    }
+    uint8x16_t bits = vandq_u8( eq, vld1q_u8( weights ) );
+    return static_cast<Mask>( vaddv_u8( vget_low_u8( bits ) ) ) |
+        ( static_cast<Mask>( vaddv_u8( vget_high_u8( bits ) ) ) << 8 );
+}
+
+#else
+
+//  Portable fallback, which at least keeps the stride logic in one place.
+constexpr size_t WIDTH = 8;
+
+template <typename T>
+inline Mask zeros( const T * p ) {
+    Mask m = 0;
+    for ( size_t i = 0; i < WIDTH / sizeof( T ); i++ ) {
+        if ( p[ i ] == 0 ) {
+            m |= ( ( Mask( 1 ) << sizeof( T ) ) - 1 ) << ( i * sizeof( T ) );
+        }
+    }
+    return m;
+}
+
+#endif
+
+//  The number of cells in a vector.
+template <typename T>
+constexpr size_t LANES = WIDTH / sizeof( T );
+
+//  The cells visited by a right-seek with the given stride, starting
+//  from cell 0. Each is marked by the bit of its lowest byte.
+template <typename T>
+inline Mask rightPattern( size_t stride ) {
+    Mask pattern = 0;
+    for ( size_t i = 0; i < LANES<T>; i += stride ) {
+        pattern |= Mask( 1 ) << ( i * sizeof( T ) );
+    }
+    return pattern;
+}
+
+//  The cells visited by a left-seek with the given stride, starting
+//  from cell LANES - 1. Each is marked by the bit of its highest byte.
+template <typename T>
+inline Mask leftPattern( size_t stride ) {
+    Mask pattern = 0;
+    for ( size_t i = 0; i < LANES<T>; i += stride ) {
+        pattern |= Mask( 1 ) << ( ( LANES<T> - i ) * sizeof( T ) - 1 );
+    }
+    return pattern;
+}
+
+//  How far a seek advances after a vector with no zero cell in it: the
+//  smallest multiple of the stride that is at least LANES.
+template <typename T>
+inline size_t span( size_t stride ) {
+    return ( ( LANES<T> + stride - 1 ) / stride ) * stride;
+}
+
+//  Equivalent to: while ( *loc ) loc += stride;
+template <typename T>
+inline T * right( T * loc, const T * end, size_t stride = 1 ) {
+    if ( stride <= LANES<T> ) {
+        const Mask pattern = rightPattern<T>( stride );
+        const size_t step = span<T>( stride );
+        while ( end - loc >= static_cast<ptrdiff_t>( LANES<T> ) ) {
+            Mask m = zeros( loc ) & pattern;
+            if ( m ) {
+                return loc + __builtin_ctz( m ) / sizeof( T );
+            }
+            loc += step;
+        }
+    }
+    while ( *loc ) {
+        loc += stride;
+    }
+    return loc;
+}
+
+//  Equivalent to: while ( *loc ) loc -= stride;
+template <typename T>
+inline T * left( T * loc, const T * start, size_t stride = 1 ) {
+    if ( stride <= LANES<T> ) {
+        const Mask pattern = leftPattern<T>( stride );
+        const size_t step = span<T>( stride );
+        while ( loc - start >= static_cast<ptrdiff_t>( LANES<T> - 1 ) ) {
+            T * base = loc - ( LANES<T> - 1 );
+            Mask m = zeros( base ) & pattern;
+            if ( m ) {
+                return base + ( 31 - __builtin_clz( m ) ) / sizeof( T );
+            }
+            loc -= step;
+        }
+    }
+    while ( *loc ) {
+        loc -= stride;
+    }
+    return loc;
+}
+
+} // namespace seek
+
+#endif
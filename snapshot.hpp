@@ -0,0 +1,336 @@
+/*
+A snapshot of a run, taken by an engine between two dispatches, from which
+another process that has planted the same program can carry on. It is
+laid out as:
+
+    Header
+    The tape, padded to a multiple of 8 bytes
+    The data stack, likewise
+    The call stack, likewise
+
+The positions in it are offsets rather than pointers: the program counter
+is a slot of the planted program, loc a cell of the tape and the input the
+number of bytes the program had read. An engine says what its stacks hold,
+in the same terms; the CISC engine has none. The program is identified by
+a fingerprint of the file it was planted from, and of how it was planted,
+which must match when the snapshot is resumed. Resuming maps the file and
+copies the tape and stacks back in.
+
+There are three ways to take one, each with an option of the engines:
+
+    --checkpoint=FILE   on SIGUSR1, carrying on afterwards, or on SIGTERM,
+                        stopping afterwards so that the run can be resumed
+                        elsewhere; the engine looks at its loops' jumps
+                        back, its input and output and its halt, so a
+                        request is seen within an iteration, and SIGTERM
+                        cuts short a read that is waiting for input
+    --warm-start=FILE   at the first input or output, if FILE does not
+                        already hold one for the program, so that later
+                        runs skip the work that does not depend on input
+    --resume=FILE       carries on from FILE
+
+SIGTERM outside the snapshotting instantiation of an engine, which is the
+only one with safe points, stops the process as it would without a
+handler.
+
+A snapshot is written to a temporary file that is then renamed, so that a
+checkpoint interrupted part way leaves the previous one in place.
+*/
+
+#ifndef SNAPSHOT_HPP
+#define SNAPSHOT_HPP
+
+#include <atomic>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <istream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace snapshot {
+
+constexpr char MAGIC[ 4 ] = { 'S', 'N', 'A', 'P' };
+constexpr uint32_t VERSION = 1;
+
+struct Header {
+    char magic[ 4 ];
+    uint32_t version;
+    uint64_t program;                   //  The fingerprint of the program.
+    uint32_t cell_bits;
+    uint32_t unused;
+    uint64_t pc;
+    uint64_t loc;
+    uint64_t input;
+    uint64_t tape_size;                 //  The sizes are in bytes.
+    uint64_t data_stack_size;
+    uint64_t call_stack_size;
+};
+
+inline size_t padded( size_t n ) {
+    return ( n + 7 ) & ~size_t( 7 );
+}
+
+//  FNV-1a, which is quite enough to tell programs apart.
+inline uint64_t fingerprint( std::string_view bytes, uint64_t hash = 14695981039346656037ULL ) {
+    for ( char ch : bytes ) {
+        hash = ( hash ^ static_cast<unsigned char>( ch ) ) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+//  The fingerprint of a program file, and of how it is planted.
+inline uint64_t fingerprintOf( const std::string & filename, std::string_view planting = "" ) {
+    std::ifstream file( filename, std::ios::binary );
+    if ( not file ) {
+        throw std::runtime_error( "Cannot open " + filename );
+    }
+    const std::string text( ( std::istreambuf_iterator<char>( file ) ), std::istreambuf_iterator<char>() );
+    return fingerprint( planting, fingerprint( text ) );
+}
+
+//  A run as an engine describes it. The bytes are only borrowed.
+struct State {
+    uint64_t program = 0;
+    uint32_t cell_bits = 8;
+    uint64_t pc = 0;
+    uint64_t loc = 0;
+    uint64_t input = 0;
+    std::string_view tape;
+    std::string_view data_stack;
+    std::string_view call_stack;
+};
+
+inline void write( const std::string & filename, const State & state ) {
+    Header header;
+    std::memcpy( header.magic, MAGIC, sizeof( MAGIC ) );
+    header.version = VERSION;
+    header.program = state.program;
+    header.cell_bits = state.cell_bits;
+    header.unused = 0;
+    header.pc = state.pc;
+    header.loc = state.loc;
+    header.input = state.input;
+    header.tape_size = state.tape.size();
+    header.data_stack_size = state.data_stack.size();
+    header.call_stack_size = state.call_stack.size();
+    const std::string temporary = filename + ".tmp";
+    {
+        std::ofstream out( temporary, std::ios::binary | std::ios::trunc );
+        out.write( reinterpret_cast<const char *>( &header ), sizeof( Header ) );
+        for ( auto section : { state.tape, state.data_stack, state.call_stack } ) {
+            const std::string padding( padded( section.size() ) - section.size(), '\0' );
+            out.write( section.data(), section.size() );
+            out.write( padding.data(), padding.size() );
+        }
+        if ( not out.flush() ) {
+            throw std::runtime_error( "Cannot write snapshot: " + filename );
+        }
+    }
+    if ( std::rename( temporary.c_str(), filename.c_str() ) != 0 ) {
+        throw std::runtime_error( "Cannot write snapshot: " + filename );
+    }
+}
+
+//  A read-only mapping of a snapshot file.
+class Mapped {
+    void * mapping = MAP_FAILED;
+    size_t length = 0;
+    State contents;
+
+public:
+    explicit Mapped( const std::string & filename ) {
+        int fd = open( filename.c_str(), O_RDONLY );
+        if ( fd < 0 ) {
+            throw std::runtime_error( "Cannot open snapshot: " + filename );
+        }
+        struct stat st;
+        if ( fstat( fd, &st ) == 0 ) {
+            length = static_cast<size_t>( st.st_size );
+            if ( length >= sizeof( Header ) ) {
+                mapping = mmap( nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0 );
+            }
+        }
+        close( fd );
+        if ( mapping == MAP_FAILED ) {
+            throw std::runtime_error( "Cannot map snapshot: " + filename );
+        }
+        const char * base = static_cast<const char *>( mapping );
+        const Header * header = reinterpret_cast<const Header *>( base );
+        const size_t data_stack_at = sizeof( Header ) + padded( header->tape_size );
+        const size_t call_stack_at = data_stack_at + padded( header->data_stack_size );
+        if ( std::memcmp( header->magic, MAGIC, sizeof( MAGIC ) ) != 0 || header->version != VERSION ) {
+            munmap( mapping, length );
+            throw std::runtime_error( "Not a version " + std::to_string( VERSION ) + " snapshot: " + filename );
+        }
+        if ( call_stack_at + header->call_stack_size > length ) {
+            munmap( mapping, length );
+            throw std::runtime_error( "Truncated snapshot: " + filename );
+        }
+        contents.program = header->program;
+        contents.cell_bits = header->cell_bits;
+        contents.pc = header->pc;
+        contents.loc = header->loc;
+        contents.input = header->input;
+        contents.tape = std::string_view( base + sizeof( Header ), header->tape_size );
+        contents.data_stack = std::string_view( base + data_stack_at, header->data_stack_size );
+        contents.call_stack = std::string_view( base + call_stack_at, header->call_stack_size );
+    }
+
+    ~Mapped() {
+        munmap( mapping, length );
+    }
+
+    Mapped( const Mapped & ) = delete;
+    Mapped & operator=( const Mapped & ) = delete;
+
+public:
+    const State & state() const { return contents; }
+
+    //  Throws unless the snapshot was taken of this program.
+    void check( uint64_t program, uint32_t cell_bits, const std::string & filename ) const {
+        if ( contents.program != program ) {
+            throw std::runtime_error( "Snapshot of another program: " + filename );
+        }
+        if ( contents.cell_bits != cell_bits ) {
+            throw std::runtime_error( "Snapshot of " + std::to_string( contents.cell_bits ) + "-bit cells: " + filename );
+        }
+    }
+};
+
+//  True if the file holds a snapshot of the program, which is what a warm
+//  start needs to know.
+inline bool isSnapshotOf( const std::string & filename, uint64_t program ) {
+    Header header;
+    int fd = open( filename.c_str(), O_RDONLY );
+    if ( fd < 0 ) {
+        return false;
+    }
+    const ssize_t n = read( fd, &header, sizeof( header ) );
+    close( fd );
+    return (
+        n == static_cast<ssize_t>( sizeof( header ) ) &&
+        std::memcmp( header.magic, MAGIC, sizeof( MAGIC ) ) == 0 &&
+        header.version == VERSION &&
+        header.program == program
+    );
+}
+
+//  What a signal asks of the engine at its next safe point.
+enum Request : int {
+    NONE,
+    CONTINUE,                           //  Take a checkpoint and carry on.
+    STOP                                //  Take a checkpoint and stop.
+};
+
+//  A lock-free atomic is all that a signal handler may touch.
+inline std::atomic<int> requested{ NONE };
+
+//  True while an engine that will reach a safe point is running.
+inline std::atomic<bool> listening{ false };
+
+//  The engines test this at their safe points, so it must be cheap.
+inline bool pending() {
+    return requested.load( std::memory_order_relaxed ) != NONE;
+}
+
+//  True if a read that failed may have been cut short by SIGTERM.
+inline bool stopping() {
+    return requested.load( std::memory_order_relaxed ) == STOP;
+}
+
+inline Request take() {
+    return static_cast<Request>( requested.exchange( NONE ) );
+}
+
+//  Stops the process as SIGTERM does without a handler. Only calls that
+//  are safe in a signal handler.
+inline void stopWithoutSnapshot() {
+    std::signal( SIGTERM, SIG_DFL );
+    std::raise( SIGTERM );
+}
+
+//  SIGUSR1 asks for a checkpoint and SIGTERM for a checkpoint and a stop.
+//  A read is restarted after SIGUSR1, but not after SIGTERM, so that an
+//  engine waiting for input gets to a safe point.
+inline void installHandlers() {
+    struct sigaction action;
+    std::memset( &action, 0, sizeof( action ) );
+    sigemptyset( &action.sa_mask );
+    action.sa_handler = []( int signal ) {
+        if ( signal == SIGTERM && not listening.load() ) {
+            stopWithoutSnapshot();
+        }
+        requested.store( signal == SIGTERM ? STOP : CONTINUE );
+    };
+    sigaction( SIGTERM, &action, nullptr );
+    action.sa_flags = SA_RESTART;
+    sigaction( SIGUSR1, &action, nullptr );
+}
+
+//  Alive for a snapshotted run. A stop asked for too late to be seen at a
+//  safe point, after the run halted, is carried out when it ends.
+class Listening {
+public:
+    Listening() {
+        listening.store( true );
+    }
+
+    ~Listening() {
+        listening.store( false );
+        if ( stopping() ) {
+            stopWithoutSnapshot();
+        }
+    }
+
+    Listening( const Listening & ) = delete;
+    Listening & operator=( const Listening & ) = delete;
+};
+
+//  Skips the input that the program had read when the snapshot was taken.
+template <typename InStream>
+void skip( InStream & in, uint64_t n ) {
+    if constexpr ( std::is_base_of_v<std::istream, InStream> ) {
+        in.ignore( static_cast<std::streamsize>( n ) );
+    } else {
+        in.skip( n );
+    }
+}
+
+//  The options of the engines, see above.
+struct SnapshotOptions {
+    std::string checkpoint;
+    std::string warm_start;
+    std::string resume;
+
+public:
+    bool enabled() const {
+        return not ( checkpoint.empty() && warm_start.empty() && resume.empty() );
+    }
+
+    //  Returns true if the argument was a snapshot option.
+    bool tryParse( std::string_view arg ) {
+        return tryParse( arg, "--checkpoint=", checkpoint ) || tryParse( arg, "--warm-start=", warm_start ) || tryParse( arg, "--resume=", resume );
+    }
+
+private:
+    static bool tryParse( std::string_view arg, std::string_view option, std::string & value ) {
+        if ( arg.substr( 0, option.size() ) != option ) {
+            return false;
+        }
+        value = std::string( arg.substr( option.size() ) );
+        return true;
+    }
+};
+
+} // namespace snapshot
+
+#endif
@@ -0,0 +1,168 @@
+/*
+The source of a program as a single std::string_view, for the planters.
+
+A file is mapped rather than read, so nothing is copied on the way in. The
+planters then pick the characters they care about out of the view in one
+pass, into a compact buffer of commands, and walk along it with a Cursor.
+Looking ahead is just indexing, so peeking n commands ahead is O(1), and
+nothing is allocated whilst planting. Rather than returning an optional
+on every character, the Cursor reads '\0' past the last command, which is
+never a command itself.
+*/
+
+#ifndef SOURCE_VIEW_HPP
+#define SOURCE_VIEW_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <istream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace source_view {
+
+//  The whole text of a source, mapped from a file or read from a stream.
+//  A file that cannot be opened reads as empty, as an unopened std::ifstream
+//  does.
+class Source {
+    void * mapping = MAP_FAILED;
+    size_t length = 0;
+    std::string owned;                  //  The text of a stream, which cannot be mapped.
+    std::string_view view;
+
+public:
+    explicit Source( const std::string & filename ) {
+        const int fd = open( filename.c_str(), O_RDONLY );
+        if ( fd < 0 ) {
+            return;
+        }
+        struct stat st;
+        if ( fstat( fd, &st ) == 0 && st.st_size > 0 ) {
+            length = static_cast<size_t>( st.st_size );
+            mapping = mmap( nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0 );
+        }
+        close( fd );
+        if ( mapping != MAP_FAILED ) {
+            view = std::string_view( static_cast<const char *>( mapping ), length );
+        }
+    }
+
+    explicit Source( std::istream & input ) :
+        owned( std::istreambuf_iterator<char>( input ), std::istreambuf_iterator<char>() ),
+        view( owned )
+    {}
+
+    ~Source() {
+        if ( mapping != MAP_FAILED ) {
+            munmap( mapping, length );
+        }
+    }
+
+    Source( const Source & ) = delete;
+    Source & operator=( const Source & ) = delete;
+
+public:
+    std::string_view text() const {
+        return view;
+    }
+};
+
+//  The characters of the text that are Brainf*ck commands, in order. Every
+//  character is copied and the position only advances past the commands,
+//  so the loop has no branches to mispredict on the comments.
+inline std::string commandsOf( std::string_view text ) {
+    static const std::array<bool, 256> IS_COMMAND = [] {
+        std::array<bool, 256> table{};
+        for ( unsigned char ch : std::string_view( "><+-.,[]" ) ) {
+            table[ ch ] = true;
+        }
+        return table;
+    }();
+    std::string commands( text.size(), '\0' );
+    size_t n = 0;
+    for ( char ch : text ) {
+        commands[ n ] = ch;
+        n += IS_COMMAND[ static_cast<unsigned char>( ch ) ];
+    }
+    commands.resize( n );
+    return commands;
+}
+
+//  A read position in a buffer of commands, with unlimited lookahead.
+class Cursor {
+    std::string commands;
+    size_t position = 0;
+
+public:
+    explicit Cursor( std::string commands ) :
+        commands( std::move( commands ) )
+    {}
+
+public:
+    bool atEnd() const {
+        return position >= commands.size();
+    }
+
+    //  The number of commands still to be read.
+    size_t remaining() const {
+        return commands.size() - std::min( position, commands.size() );
+    }
+
+    //  The command n ahead of the next without consuming anything, or '\0'
+    //  past the end.
+    char peekN( size_t n ) const {
+        return position + n < commands.size() ? commands[ position + n ] : '\0';
+    }
+
+    char peek() const {
+        return peekN( 0 );
+    }
+
+    char pop() {
+        const char ch = peek();
+        position += ch != '\0';
+        return ch;
+    }
+
+    bool tryPop( char ch ) {
+        const bool matched = peek() == ch;
+        position += matched;
+        return matched;
+    }
+
+    bool tryPopString( std::string_view str ) {
+        if ( std::string_view( commands ).substr( position, str.size() ) != str ) {
+            return false;
+        }
+        position += str.size();
+        return true;
+    }
+
+    //  Discards n commands that have already been examined with peekN.
+    void dropN( size_t n ) {
+        position = std::min( position + n, commands.size() );
+    }
+
+    //  Pops commands for as long as they satisfy the predicate, returning
+    //  them as a view that stays valid as long as the Cursor does.
+    template <typename Predicate>
+    std::string_view popWhile( Predicate predicate ) {
+        const size_t start = position;
+        while ( position < commands.size() && predicate( commands[ position ] ) ) {
+            position += 1;
+        }
+        return std::string_view( commands ).substr( start, position - start );
+    }
+};
+
+} // namespace source_view
+
+#endif
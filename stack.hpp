@@ -0,0 +1,49 @@
+/*
+A stack that never moves, for the engines that keep a call or data stack
+of their own.
+
+The stack is a GuardedRegion (see tape.hpp), so it grows on demand just as
+the tape does and the engines can keep the top of it in a raw pointer,
+pushing with *top++ and popping with *--top. There are no bounds checks:
+pushing beyond the capacity, or popping an empty stack, runs into a guard
+page and is reported on the standard error before crashing.
+
+A stack whose greatest depth is known in advance can be given exactly that
+capacity, in which case it is committed up front and never faults at all.
+*/
+
+#ifndef STACK_HPP
+#define STACK_HPP
+
+#include <algorithm>
+#include <cstddef>
+
+#include "tape.hpp"
+
+template <typename T>
+class GuardedStack {
+    GuardedRegion region;
+public:
+    static constexpr size_t DEFAULT_SIZE = 1024;
+    static constexpr size_t DEFAULT_MAX_SIZE = size_t( 1 ) << 20;
+
+    //  The sizes are in items. A stack of a known depth is constructed with
+    //  the same initial and maximum size.
+    GuardedStack(
+        const GuardMessages & messages,
+        size_t size = DEFAULT_SIZE,
+        size_t max_size = DEFAULT_MAX_SIZE
+    ) :
+        region( std::max<size_t>( size, 1 ) * sizeof( T ), std::max<size_t>( max_size, 1 ) * sizeof( T ), messages )
+    {}
+
+public:
+    //  The bottom of the stack, which is where the top starts.
+    T * data() const { return reinterpret_cast<T *>( region.data() ); }
+
+    //  The number of items that are currently accessible. This can grow
+    //  whilst a program is running.
+    size_t size() const { return region.size() / sizeof( T ); }
+};
+
+#endif
@@ -2,8 +2,11 @@
 #include <vector>
 #include <fstream>
 #include <map>
+#include <memory>
 #include <string>
 
+#include "tape.hpp"
+
 #define DEBUG 0
 #define break_if( E ) if ( E ) break
 #define return_if( E ) if ( E ) return
@@ -11,7 +14,7 @@
 
 class Engine;
 
-typedef void(Engine::*OpCode)( union Instruction * & pc );
+typedef void(Engine::*OpCode)( const union Instruction * & pc );
 
 typedef union Instruction {
     OpCode opcode;
@@ -68,46 +71,72 @@ public:
 
 typedef unsigned char num;
 
-class Engine {
-    std::map<char, OpCode> opcode_map;
+//  A planted program. The opcodes are pointers to members of Engine rather
+//  than to any one engine, so a program is planted once and then shared, by
+//  reference count, between any number of engines. It never changes once
+//  it has been planted.
+class CompiledProgram {
     std::vector<Instruction> program;
-    std::vector<num> memory;
-    Instruction * program_data = nullptr;
+
+public:
+    explicit CompiledProgram( std::string_view filename ) {
+        CodePlanter planter( filename, opcodeMap(), program );
+        planter.plantProgram();
+    }
+
+    CompiledProgram( const CompiledProgram & ) = delete;
+    CompiledProgram & operator=( const CompiledProgram & ) = delete;
+
+public:
+    const Instruction * data() const {
+        return program.data();
+    }
+
+private:
+    //  Built just once, however many programs are planted.
+    static const std::map<char, OpCode> & opcodeMap();
+};
+
+//  The state of a single run - the tape and the location - which is all
+//  that is not shared between engines running the same program.
+class Engine {
+    Tape memory;
+    const Instruction * program_data = nullptr;
     num * loc = nullptr;
 
 public:
-    Engine() : 
-        memory( 30000 )
+    Engine( const TapeOptions & tape = TapeOptions() ) : 
+        memory( tape.size, tape.max_size )
     {}
 
 public:
-    void INCR( Instruction * & pc ) {
+    void INCR( const Instruction * & pc ) {
         if ( DEBUG ) std::cout << "INCR" << std::endl;
         *loc += 1;
     }
 
-    void DECR( Instruction * & pc ) {
+    void DECR( const Instruction * & pc ) {
         if ( DEBUG ) std::cout << "DECR" << std::endl;
         *loc -= 1;
     }
 
-    void RIGHT( Instruction * & pc ) {
+    void RIGHT( const Instruction * & pc ) {
         if ( DEBUG ) std::cout << "RIGHT" << std::endl;
         loc += 1;
     }
 
-    void LEFT( Instruction * & pc ) {
+    void LEFT( const Instruction * & pc ) {
         if ( DEBUG ) std::cout << "LEFT" << std::endl;
         loc -= 1;
     }
 
-    void PUT( Instruction * & pc ) {
+    void PUT( const Instruction * & pc ) {
         num i = *loc;
         if ( DEBUG ) std::cout << "PUT: " << (int)i << std::endl;
         std::cout << i;
     }
 
-    void GET( Instruction * & pc ) {
+    void GET( const Instruction * & pc ) {
         if ( DEBUG ) std::cout << "GET" << std::endl;
         {
             char ch;
@@ -118,7 +147,7 @@ public:
         }
     }
 
-    void OPEN( Instruction * & pc ) {
+    void OPEN( const Instruction * & pc ) {
         if ( DEBUG ) std::cout << "OPEN" << std::endl;
         int n = pc++->operand;
         if ( *loc == 0 ) {
@@ -126,7 +155,7 @@ public:
         }
     }
 
-    void CLOSE( Instruction * & pc ) {
+    void CLOSE( const Instruction * & pc ) {
         if ( DEBUG ) std::cout << "CLOSE" << std::endl;
         int n = pc++->operand;
         if ( *loc != 0 ) {
@@ -134,49 +163,71 @@ public:
         }
     }
 
-    void HALT( Instruction * & pc ) {
+    //  Stops the dispatch loop, so the engine can go on to another run.
+    void HALT( const Instruction * & pc ) {
         if ( DEBUG ) std::cout << "DONE!";
-        exit( EXIT_SUCCESS );
+        std::cout.flush();
+        pc = nullptr;
     }
 
-    void runFile( std::string_view filename, bool header_needed ) {
-        if ( header_needed ) {
-            std::cerr << "# Executing: " << filename << std::endl;
-        }
-
-        opcode_map = {
-            { '+', &Engine::INCR },
-            { '-', &Engine::DECR },
-            { '<', &Engine::LEFT },
-            { '>', &Engine::RIGHT },
-            { '[', &Engine::OPEN },
-            { ']', &Engine::CLOSE },
-            { '.', &Engine::PUT },
-            { ',', &Engine::GET },
-            { '\0', &Engine::HALT }
-        };
-        
-        CodePlanter planter( filename, opcode_map, program );
-        planter.plantProgram();
-
+    //  Runs a program from a clear tape.
+    void run( const CompiledProgram & program ) {
+        memory.clear();
         std::noskipws( std::cin );
 
         this->program_data = program.data();
-        Instruction * pc = &program_data[0];
+        const Instruction * pc = &program_data[0];
         loc = &memory.data()[0];
         
-        for (;;) {
+        while ( pc != nullptr ) {
             OpCode s = pc++->opcode;
             (this->*s)( pc );
         }
     }
 };
 
+const std::map<char, OpCode> & CompiledProgram::opcodeMap() {
+    static const std::map<char, OpCode> opcode_map = {
+        { '+', &Engine::INCR },
+        { '-', &Engine::DECR },
+        { '<', &Engine::LEFT },
+        { '>', &Engine::RIGHT },
+        { '[', &Engine::OPEN },
+        { ']', &Engine::CLOSE },
+        { '.', &Engine::PUT },
+        { ',', &Engine::GET },
+        { '\0', &Engine::HALT }
+    };
+    return opcode_map;
+}
+
+//  The benchmarking harness includes this file and supplies its own main.
+#ifndef SUBROUTINE_THREADING_DEMO_NO_MAIN
+
 int main( int argc, char * argv[] ) {
     const std::vector<std::string_view> args(argv + 1, argv + argc);
+    std::vector<std::string_view> filenames;
+    TapeOptions tape;
     for (auto arg : args) {
-        Engine engine;
-        engine.runFile( arg, args.size() > 1 );
+        if ( not tape.tryParse( arg ) ) {
+            filenames.push_back( arg );
+        }
+    }
+    //  A file named more than once is only planted once, and one engine
+    //  runs them all in turn.
+    std::map<std::string_view, std::shared_ptr<const CompiledProgram>> compiled;
+    Engine engine( tape );
+    for (auto filename : filenames) {
+        if ( filenames.size() > 1 ) {
+            std::cerr << "# Executing: " << filename << std::endl;
+        }
+        auto & program = compiled[ filename ];
+        if ( not program ) {
+            program = std::make_shared<const CompiledProgram>( filename );
+        }
+        engine.run( *program );
     }
     exit( EXIT_SUCCESS );
 }
+
+#endif
@@ -0,0 +1,254 @@
+/*
+A variant of subroutine threading in which nothing returns until the
+program halts. Each instruction is a free function that takes the whole
+state of the machine - the program counter, the current location and the
+base of the program - as arguments, so they stay in registers, and it ends
+by tail-calling the handler of the next instruction. A tail call compiles
+to a plain jump, so dispatch costs what it does in direct threading while
+everything remains portable C++.
+
+The tail calls must be guaranteed, or a long-running program would
+overflow the stack. Clang guarantees them with [[clang::musttail]] (and
+GCC 15 with [[gnu::musttail]]). Older GCCs make no promise but do turn
+these calls into jumps when optimising with sibling-call optimisation on,
+which the Makefile forces (-Og never does it, so it builds with -O1). Where the compiler offers
+the preserve_none calling convention the handlers use it, which leaves
+more registers free for the machine state.
+*/
+
+#include <iostream>
+#include <vector>
+#include <fstream>
+#include <map>
+#include <string>
+
+#include "tape.hpp"
+
+#define DEBUG 0
+#define break_if( E ) if ( E ) break
+#define return_if( E ) if ( E ) return
+#define break_unless( E ) if (!(E)) break
+
+#if defined( __has_cpp_attribute )
+#   if __has_cpp_attribute( clang::musttail )
+#       define MUSTTAIL [[clang::musttail]]
+#   elif __has_cpp_attribute( gnu::musttail )
+#       define MUSTTAIL [[gnu::musttail]]
+#   endif
+#endif
+#ifndef MUSTTAIL
+#   define MUSTTAIL
+#endif
+
+#if defined( __has_attribute ) && defined( __clang__ )
+#   if __has_attribute( preserve_none ) && ( defined( __x86_64__ ) || defined( __aarch64__ ) )
+#       define PRESERVE_NONE __attribute__(( preserve_none ))
+#   endif
+#endif
+#ifndef PRESERVE_NONE
+#   define PRESERVE_NONE
+#endif
+
+typedef unsigned char num;
+
+union Instruction;
+
+typedef PRESERVE_NONE void (*OpCode)( const Instruction * pc, num * loc, const Instruction * base );
+
+typedef union Instruction {
+    OpCode opcode;
+    int operand;
+} Instruction;
+
+//  Dispatches to the next instruction. This must be the last thing a
+//  handler does.
+#define NEXT( pc, loc, base ) MUSTTAIL return (pc)->opcode( (pc) + 1, (loc), (base) )
+
+class CodePlanter {
+    std::ifstream input;
+    const std::map<char, OpCode> & opcode_map;
+    std::vector<Instruction> & program;
+    std::vector<int> indexes;
+
+public:
+    CodePlanter(
+        std::string_view filename,
+        const std::map<char, OpCode> & opcode_map,
+        std::vector<Instruction> & program
+    ) :
+        input( filename.data(), std::ios::in ),
+        opcode_map( opcode_map ),
+        program( program )
+    {}
+
+private:
+    void plantChar( char ch ) {
+        //  Guard
+        auto it = opcode_map.find(ch);
+        return_if( it == opcode_map.end() );
+
+        //  Body
+        program.push_back( { it->second } );
+        if ( ch == '[' ) {
+            indexes.push_back( static_cast<int>( program.size() ) );
+            program.push_back( {nullptr} );
+        } else if ( ch == ']' ) {
+            int end = static_cast<int>( program.size() );
+            int start = indexes.back();
+            indexes.pop_back();
+            program[ start ].operand = end + 1;
+            program.push_back( {nullptr} );
+            program.back().operand = start + 1;
+        }
+    }
+
+public:
+    void plantProgram() {
+        for (;;) {
+            char ch = static_cast<char>( input.get() );
+            break_unless( input.good() );
+            plantChar( ch );
+        }
+        program.push_back( { opcode_map.at('\0') } );
+    }
+};
+
+//  The handlers. A handler may not have any local whose address is taken,
+//  or the compiler cannot reuse its frame for the tail call, so the I/O is
+//  done out of line.
+namespace handlers {
+
+[[gnu::noinline]] void put( num * loc ) {
+    num i = *loc;
+    if ( DEBUG ) std::cout << "PUT: " << (int)i << std::endl;
+    std::cout << i;
+}
+
+[[gnu::noinline]] void get( num * loc ) {
+    char ch;
+    std::cin.get( ch );
+    if (std::cin.good()) {
+        *loc = ch;
+    }
+}
+
+PRESERVE_NONE void INCR( const Instruction * pc, num * loc, const Instruction * base ) {
+    if ( DEBUG ) std::cout << "INCR" << std::endl;
+    *loc += 1;
+    NEXT( pc, loc, base );
+}
+
+PRESERVE_NONE void DECR( const Instruction * pc, num * loc, const Instruction * base ) {
+    if ( DEBUG ) std::cout << "DECR" << std::endl;
+    *loc -= 1;
+    NEXT( pc, loc, base );
+}
+
+PRESERVE_NONE void RIGHT( const Instruction * pc, num * loc, const Instruction * base ) {
+    if ( DEBUG ) std::cout << "RIGHT" << std::endl;
+    loc += 1;
+    NEXT( pc, loc, base );
+}
+
+PRESERVE_NONE void LEFT( const Instruction * pc, num * loc, const Instruction * base ) {
+    if ( DEBUG ) std::cout << "LEFT" << std::endl;
+    loc -= 1;
+    NEXT( pc, loc, base );
+}
+
+PRESERVE_NONE void PUT( const Instruction * pc, num * loc, const Instruction * base ) {
+    put( loc );
+    NEXT( pc, loc, base );
+}
+
+PRESERVE_NONE void GET( const Instruction * pc, num * loc, const Instruction * base ) {
+    if ( DEBUG ) std::cout << "GET" << std::endl;
+    get( loc );
+    NEXT( pc, loc, base );
+}
+
+PRESERVE_NONE void OPEN( const Instruction * pc, num * loc, const Instruction * base ) {
+    if ( DEBUG ) std::cout << "OPEN" << std::endl;
+    int n = pc++->operand;
+    if ( *loc == 0 ) {
+        pc = &base[n];
+    }
+    NEXT( pc, loc, base );
+}
+
+PRESERVE_NONE void CLOSE( const Instruction * pc, num * loc, const Instruction * base ) {
+    if ( DEBUG ) std::cout << "CLOSE" << std::endl;
+    int n = pc++->operand;
+    if ( *loc != 0 ) {
+        pc = &base[n];
+    }
+    NEXT( pc, loc, base );
+}
+
+//  The only handler that returns, unwinding straight back to runFile.
+PRESERVE_NONE void HALT( const Instruction *, num *, const Instruction * ) {
+    if ( DEBUG ) std::cout << "DONE!";
+    std::cout.flush();
+}
+
+} // namespace handlers
+
+class Engine {
+    std::map<char, OpCode> opcode_map;
+    Tape memory;
+
+public:
+    Engine( const TapeOptions & tape = TapeOptions() ) :
+        memory( tape.size, tape.max_size )
+    {}
+
+public:
+    void runFile( std::string_view filename, bool header_needed ) {
+        if ( header_needed ) {
+            std::cerr << "# Executing: " << filename << std::endl;
+        }
+
+        opcode_map = {
+            { '+', &handlers::INCR },
+            { '-', &handlers::DECR },
+            { '<', &handlers::LEFT },
+            { '>', &handlers::RIGHT },
+            { '[', &handlers::OPEN },
+            { ']', &handlers::CLOSE },
+            { '.', &handlers::PUT },
+            { ',', &handlers::GET },
+            { '\0', &handlers::HALT }
+        };
+
+        std::vector<Instruction> program;
+        CodePlanter planter( filename, opcode_map, program );
+        planter.plantProgram();
+
+        std::noskipws( std::cin );
+
+        const Instruction * base = program.data();
+        base->opcode( base + 1, memory.data(), base );
+    }
+};
+
+//  The benchmarking harness compiles this file into its own executable and
+//  supplies its own main.
+#ifndef TAIL_CALL_THREADING_DEMO_NO_MAIN
+
+int main( int argc, char * argv[] ) {
+    const std::vector<std::string_view> args(argv + 1, argv + argc);
+    std::vector<std::string_view> filenames;
+    TapeOptions tape;
+    for (auto arg : args) {
+        if ( not tape.tryParse( arg ) ) {
+            filenames.push_back( arg );
+        }
+    }
+    for (auto filename : filenames) {
+        Engine engine( tape );
+        engine.runFile( filename, filenames.size() > 1 );
+    }
+    exit( EXIT_SUCCESS );
+}
+
+#endif
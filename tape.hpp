@@ -0,0 +1,244 @@
+/*
+A Brainf*ck tape that grows on demand, shared by the engines.
+
+We reserve the address space for the largest tape we are prepared to
+support up front but only make the start of it accessible. The rest is
+PROT_NONE, and there is a guard page at either end. When a program walks off
+the accessible part of the tape the hardware faults, and our SIGSEGV
+handler makes more of the reservation accessible and resumes the faulting
+instruction. Because the tape never moves, the engines can keep using raw
+pointers into it and in-range programs pay nothing per instruction.
+
+Falling off the front of the tape, or off the end of the reservation, is
+reported on the standard error and then crashes as before.
+*/
+
+#ifndef TAPE_HPP
+#define TAPE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+//  What the signal handler reports when a region cannot grow. These must
+//  be fixed strings, as the handler can neither allocate nor format.
+struct GuardMessages {
+    const char * underflow = "Tape underflow: moved before the first cell\n";
+    const char * overflow = "Tape overflow: moved beyond --max-tape-size\n";
+    const char * exhausted = "Tape overflow: cannot grow the tape\n";
+};
+
+//  The address range [base, base + reserved) of which the first committed
+//  bytes are accessible, with a guard page either side.
+class GuardedRegion {
+    char * mapping = nullptr;           //  Including the guard pages.
+    size_t mapped = 0;
+    size_t page = 0;
+    char * base = nullptr;
+    size_t reserved = 0;
+    std::atomic<size_t> committed{ 0 };
+    GuardMessages messages;
+
+    //  The regions the signal handler knows about. This is a fixed table
+    //  because the handler can neither allocate nor lock.
+    static constexpr size_t MAX_REGIONS = 256;
+    static inline std::atomic<GuardedRegion *> regions[ MAX_REGIONS ] = {};
+    static inline struct sigaction previous = {};
+    static inline std::atomic<bool> installed{ false };
+
+public:
+    GuardedRegion( size_t initial, size_t maximum, const GuardMessages & messages = GuardMessages() ) :
+        messages( messages )
+    {
+        page = static_cast<size_t>( sysconf( _SC_PAGESIZE ) );
+        reserved = roundUp( std::max( initial, maximum ) );
+        mapped = page + reserved + page;
+        void * m = mmap( nullptr, mapped, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0 );
+        if ( m == MAP_FAILED ) {
+            throw std::runtime_error( "Cannot reserve a tape of " + std::to_string( reserved ) + " bytes" );
+        }
+        mapping = static_cast<char *>( m );
+        base = mapping + page;
+        if ( not commit( roundUp( initial ) ) ) {
+            munmap( mapping, mapped );
+            throw std::runtime_error( "Cannot commit a tape of " + std::to_string( initial ) + " bytes" );
+        }
+        enrol();
+    }
+
+    ~GuardedRegion() {
+        for ( auto & r : regions ) {
+            GuardedRegion * self = this;
+            if ( r.compare_exchange_strong( self, nullptr ) ) {
+                break;
+            }
+        }
+        munmap( mapping, mapped );
+    }
+
+    GuardedRegion( const GuardedRegion & ) = delete;
+    GuardedRegion & operator=( const GuardedRegion & ) = delete;
+
+public:
+    char * data() const { return base; }
+    size_t size() const { return committed.load( std::memory_order_acquire ); }
+
+private:
+    size_t roundUp( size_t n ) const {
+        return ( ( n + page - 1 ) / page ) * page;
+    }
+
+    //  Makes the first n bytes accessible. Two threads may fault on the
+    //  same tape at once, so the committed size only ever increases.
+    bool commit( size_t n ) {
+        size_t now = committed.load( std::memory_order_acquire );
+        if ( n <= now ) {
+            return true;
+        }
+        if ( mprotect( base + now, n - now, PROT_READ | PROT_WRITE ) != 0 ) {
+            return false;
+        }
+        while ( now < n && not committed.compare_exchange_weak( now, n, std::memory_order_acq_rel ) ) {}
+        return true;
+    }
+
+    void enrol() {
+        for ( auto & r : regions ) {
+            GuardedRegion * empty = nullptr;
+            if ( r.compare_exchange_strong( empty, this ) ) {
+                install();
+                return;
+            }
+        }
+        munmap( mapping, mapped );
+        throw std::runtime_error( "Too many guarded regions in use" );
+    }
+
+    static void install() {
+        bool expected = false;
+        if ( installed.compare_exchange_strong( expected, true ) ) {
+            struct sigaction action = {};
+            action.sa_sigaction = onFault;
+            action.sa_flags = SA_SIGINFO;
+            sigemptyset( &action.sa_mask );
+            sigaction( SIGSEGV, &action, &previous );
+        }
+    }
+
+    static void report( const char * message ) {
+        ssize_t ignored = write( STDERR_FILENO, message, strlen( message ) );
+        (void)ignored;
+    }
+
+    enum Outcome { NOT_MINE, GROWN, FATAL };
+
+    Outcome grow( char * address ) {
+        if ( address < mapping || address >= mapping + mapped ) {
+            return NOT_MINE;
+        }
+        if ( address < base ) {
+            report( messages.underflow );
+            return FATAL;
+        }
+        if ( address >= base + reserved ) {
+            report( messages.overflow );
+            return FATAL;
+        }
+        //  Double the tape, or more if the program has leapt far ahead.
+        size_t needed = roundUp( static_cast<size_t>( address - base ) + 1 );
+        size_t n = std::min( reserved, std::max( needed, 2 * size() ) );
+        if ( not commit( n ) ) {
+            report( messages.exhausted );
+            return FATAL;
+        }
+        return GROWN;
+    }
+
+    static void onFault( int sig, siginfo_t * info, void * context ) {
+        char * address = static_cast<char *>( info->si_addr );
+        for ( auto & r : regions ) {
+            GuardedRegion * region = r.load( std::memory_order_acquire );
+            if ( region == nullptr ) {
+                continue;
+            }
+            switch ( region->grow( address ) ) {
+                case GROWN:
+                    return;
+                case FATAL:
+                    signal( SIGSEGV, SIG_DFL );
+                    return;
+                case NOT_MINE:
+                    break;
+            }
+        }
+        //  A genuine fault. Hand it on to whoever was there before us.
+        if ( previous.sa_flags & SA_SIGINFO ) {
+            previous.sa_sigaction( sig, info, context );
+        } else if ( previous.sa_handler != SIG_DFL && previous.sa_handler != SIG_IGN ) {
+            previous.sa_handler( sig );
+        } else {
+            signal( SIGSEGV, SIG_DFL );
+        }
+    }
+};
+
+//  A tape of Brainf*ck cells that grows from its initial size up to its
+//  maximum size as the program touches it. It offers the part of the
+//  std::vector interface the engines used. The sizes are in cells, which
+//  are bytes unless the tape is made for wider ones.
+class Tape {
+    GuardedRegion region;
+    size_t cell_size;
+public:
+    static constexpr size_t DEFAULT_SIZE = 30000;
+    static constexpr size_t DEFAULT_MAX_SIZE = size_t( 1 ) << 30;
+
+    Tape( size_t size = DEFAULT_SIZE, size_t max_size = DEFAULT_MAX_SIZE, size_t cell_size = 1 ) :
+        region( size * cell_size, max_size * cell_size ),
+        cell_size( cell_size )
+    {}
+
+public:
+    template <typename Cell = unsigned char>
+    Cell * data() const { return reinterpret_cast<Cell *>( region.data() ); }
+
+    //  The number of cells that are currently accessible. This can grow
+    //  whilst a program is running.
+    size_t size() const { return region.size() / cell_size; }
+
+    //  Zeroes every accessible cell, so the tape can be reused for another
+    //  run. Only the cells that were ever accessible can be dirty.
+    void clear() { std::memset( region.data(), 0, region.size() ); }
+};
+
+//  The command-line options that size the tape, --tape-size=N and
+//  --max-tape-size=N, shared by all the engines.
+struct TapeOptions {
+    size_t size = Tape::DEFAULT_SIZE;
+    size_t max_size = Tape::DEFAULT_MAX_SIZE;
+
+public:
+    //  Returns true if the argument was a tape option.
+    bool tryParse( std::string_view arg ) {
+        return tryParse( arg, "--tape-size=", size ) || tryParse( arg, "--max-tape-size=", max_size );
+    }
+
+private:
+    static bool tryParse( std::string_view arg, std::string_view option, size_t & value ) {
+        if ( arg.substr( 0, option.size() ) != option ) {
+            return false;
+        }
+        value = std::stoull( std::string( arg.substr( option.size() ) ) );
+        return true;
+    }
+};
+
+#endif